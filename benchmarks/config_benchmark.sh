@@ -61,6 +61,8 @@ interferences=("${default_interferences[@]}")
 # Statement is only printed if there is only one benchmark and one interefence application
 # Otherwise a matrix is printed (without having the prefix)
 RESULT_PREFIX="AVG_RUNTIME:"
+MEDIAN_RESULT_PREFIX="MEDIAN_RUNTIME:"
+P95_RESULT_PREFIX="P95_RUNTIME:"
 
 print_usage() {
     echo "Usage:"
@@ -189,8 +191,8 @@ parse_args() {
             shift # past argument=value
             ;;
         -n=*|--numIterations=*)
-            it="${i#*=}"
-            check_arg_is_number $it
+            n="${i#*=}"
+            check_arg_is_number $n
             if [ $? -ne 0 ]; then
                 print_usage
                 exit 1
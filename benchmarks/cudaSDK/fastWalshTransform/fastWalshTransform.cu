@@ -211,11 +211,11 @@ int main(int argc, char *argv[])
 
     if (!test_execute_just_kernel()) {
         printf("Overall Stats\n");
-        pstats_print(&stats);
+        pstats_print(&stats, "overall");
     }
 
     printf("Kernel Stats\n");
-    pstats_print(&kernel_stats);
+    pstats_print(&kernel_stats, "kernel");
 
     printf("Shutting down...\n");
     fgpu_memory_free(d_Data);
@@ -295,11 +295,11 @@ int matrixMultiply(int argc, char **argv, int block_size, dim3 &dimsA, dim3 &dim
 
     if (!test_execute_just_kernel()) {
         printf("Overall Stats\n");
-        pstats_print(&stats);
+        pstats_print(&stats, "overall");
     }
 
     printf("Kernel Stats\n");
-    pstats_print(&kernel_stats);
+    pstats_print(&kernel_stats, "kernel");
 
     if (correct)
     {
@@ -665,7 +665,7 @@ int main(int argc, char** argv)
     }
 
     printf("Kernel Stats\n");
-    pstats_print(&kernel_stats);
+    pstats_print(&kernel_stats, "kernel");
 
 	std::cout << "Saving solution..." << std::endl;
 	dump(variables, nel, nelr);
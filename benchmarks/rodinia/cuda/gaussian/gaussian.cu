@@ -169,10 +169,10 @@ int main(int argc, char **argv)
     }
 
     printf("Overall Stats\n");
-    pstats_print(&stats);
+    pstats_print(&stats, "overall");
 
     printf("Kernel Stats\n");
-    pstats_print(&kernel_stats);
+    pstats_print(&kernel_stats, "kernel");
 
     fgpu_memory_free(g_m_cuda);
 	fgpu_memory_free(g_a_cuda);
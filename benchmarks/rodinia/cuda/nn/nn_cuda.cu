@@ -205,10 +205,10 @@ int main(int argc, char* argv[])
     }
 
     printf("Overall Stats\n");
-    pstats_print(&stats);
+    pstats_print(&stats, "overall");
 
     printf("Kernel Stats\n");
-    pstats_print(&kernel_stats);
+    pstats_print(&kernel_stats, "kernel");
 
     //Free memory
     free(distances);
@@ -42,6 +42,8 @@ done
 bench_proc_range=$((proc - app_proc))'-'$((proc-1))
 
 AVG="0"
+MEDIAN="0"
+P95="0"
 
 # Kill all known processes that this script might have ran
 kill_all_processes () {
@@ -73,7 +75,7 @@ trap 'do_for_sigint' SIGINT
 # Function to run a benchmark with an interfering application
 # First Arg - Application to run
 # Second Arg - Interference Application (can be empty string)
-# For return value, it modifies AVG variable
+# For return value, it modifies AVG, MEDIAN and P95 variables
 run_benchmark () { 
 
     bench_app="$1"
@@ -280,9 +282,13 @@ run_benchmark () {
 
     # Extract the averge runtime
     avg=`echo $stats |  grep -Po 'Avg:([a-z0-9.]+)' | sed -n "s/Avg://p"`
+    median=`echo $stats |  grep -Po 'Median:([a-z0-9.]+)' | sed -n "s/Median://p"`
+    p95=`echo $stats |  grep -Po '95 percentile:([a-z0-9.]+)' | sed -n "s/95 percentile://p"`
 
-    echo "Avg Runtime: $avg"
+    echo "Avg Runtime: $avg, Median Runtime: $median, 95 percentile Runtime: $p95"
     AVG=$avg
+    MEDIAN=$median
+    P95=$p95
 
     # Kill all processes
     if ! [[ $int_name = $NO_INTERFERENCE_DUMMY_APP ]]; then
@@ -327,6 +333,8 @@ done
 # If one benchmark and one inteference application, print the result statement also
 if [ ${#AVG_RUNTIMES[@]} = "1" ]; then
     echo "$RESULT_PREFIX ${AVG_RUNTIMES[0]} us"
+    echo "$MEDIAN_RESULT_PREFIX $MEDIAN us"
+    echo "$P95_RESULT_PREFIX $P95 us"
 else
     cat $TEMP_TIME_FILE
 fi
@@ -60,6 +60,10 @@ typedef unsigned long long UvmStream;
 
 #define UVM_MAX_MEM_COLORS      NV_MAX_MEM_COLORS
 
+// Max number of XOR masks making up the memory color function. Each mask gives
+// one bit of the color.
+#define UVM_MAX_COLOR_XOR_MASKS (4)
+
 // Max memory reserved upfront per gpu for coloring in percentage
 #define UVM_MAX_COLOR_MEM_RESV_PERCENTAGE  (80)
 
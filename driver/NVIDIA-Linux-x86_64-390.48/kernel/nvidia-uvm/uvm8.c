@@ -774,7 +774,11 @@ static long uvm_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned lon
         UVM_ROUTE_CMD_STACK(UVM_GET_PROCESS_COLOR_INFO,         uvm_api_get_process_color_info);
         UVM_ROUTE_CMD_STACK(UVM_SET_PROCESS_COLOR_INFO,         uvm_api_set_process_color_info);
         UVM_ROUTE_CMD_STACK(UVM_MEMCPY_COLORED,                 uvm_api_memcpy_colored);
+        UVM_ROUTE_CMD_STACK(UVM_MEMCPY_COLORED_BATCH,           uvm_api_memcpy_colored_batch);
         UVM_ROUTE_CMD_STACK(UVM_MEMSET_COLORED,                 uvm_api_memset_colored);
+        UVM_ROUTE_CMD_STACK(UVM_WAIT_COLORED_FENCE,             uvm_api_wait_colored_fence);
+        UVM_ROUTE_CMD_STACK(UVM_HOST_REGISTER,                  uvm_api_host_register);
+        UVM_ROUTE_CMD_STACK(UVM_HOST_UNREGISTER,                uvm_api_host_unregister);
     }
 
     // Try the test ioctls if none of the above matched
@@ -150,5 +150,9 @@ NV_STATUS uvm_api_get_device_color_info(UVM_GET_DEVICE_COLOR_INFO_PARAMS *params
 NV_STATUS uvm_api_get_process_color_info(UVM_GET_PROCESS_COLOR_INFO_PARAMS *params, struct file *filp);
 NV_STATUS uvm_api_set_process_color_info(UVM_SET_PROCESS_COLOR_INFO_PARAMS *params, struct file *filp);
 NV_STATUS uvm_api_memcpy_colored(UVM_MEMCPY_COLORED_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_memcpy_colored_batch(UVM_MEMCPY_COLORED_BATCH_PARAMS *params, struct file *filp);
 NV_STATUS uvm_api_memset_colored(UVM_MEMSET_COLORED_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_wait_colored_fence(UVM_WAIT_COLORED_FENCE_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_host_register(UVM_HOST_REGISTER_PARAMS *params, struct file *filp);
+NV_STATUS uvm_api_host_unregister(UVM_HOST_UNREGISTER_PARAMS *params, struct file *filp);
 #endif // __UVM8_API_H__
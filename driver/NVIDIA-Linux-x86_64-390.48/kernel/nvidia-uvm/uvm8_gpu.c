@@ -44,11 +44,75 @@ module_param(uvm8_ats_mode, int, S_IRUGO);
 MODULE_PARM_DESC(uvm8_ats_mode, "Enable ATS (Address Translation Services) "
                                 "UVM mode by setting this to 1");
 
+static unsigned long uvm_color_xor_masks[UVM_MAX_COLOR_XOR_MASKS];
+static int uvm_num_color_xor_masks;
+module_param_array(uvm_color_xor_masks, ulong, &uvm_num_color_xor_masks, S_IRUGO);
+MODULE_PARM_DESC(uvm_color_xor_masks, "Comma separated physical address XOR masks, one per "
+                                      "color bit, overriding the built-in memory color "
+                                      "function of all GPUs");
+
 static void remove_gpu(uvm_gpu_t *gpu);
 static void disable_peer_access(uvm_gpu_t *gpu_1, uvm_gpu_t *gpu_2);
 static NV_STATUS discover_nvlink_peers(uvm_gpu_t *gpu);
 static void destroy_nvlink_peers(uvm_gpu_t *gpu);
 
+// Colored copies and transfer color indexes assume that every naturally
+// aligned group of num_colors transfer chunks holds exactly one chunk of each
+// color, i.e. the masks are linearly independent on the low chunk index bits.
+static bool color_xor_masks_interleaved(uvm_gpu_t *gpu)
+{
+    NvU32 num_colors = 1U << gpu->num_color_xor_masks;
+    NvU32 seen = 0;
+    NvU32 i;
+
+    for (i = 0; i < num_colors; i++)
+        seen |= 1U << uvm_gpu_phys_addr_to_color(gpu, (NvU64)i * gpu->colored_transfer_chunk_size);
+
+    return seen == (NvU32)((1ULL << num_colors) - 1);
+}
+
+// Replace the architecture's color function with the one given through the
+// uvm_color_xor_masks module parameter, if any. The number of colors follows
+// the number of masks.
+static NV_STATUS init_color_xor_masks(uvm_gpu_t *gpu)
+{
+    NvU32 num_colors;
+    int i;
+
+    if (!uvm_gpu_supports_coloring(gpu) || uvm_num_color_xor_masks == 0)
+        return NV_OK;
+
+    for (i = 0; i < uvm_num_color_xor_masks; i++) {
+        // Colors are assigned at the granularity of transfer chunks, so
+        // address bits below it can't take part in the color function.
+        if (uvm_color_xor_masks[i] == 0 ||
+            (uvm_color_xor_masks[i] & (gpu->colored_transfer_chunk_size - 1)) != 0) {
+            UVM_ERR_PRINT("Invalid color XOR mask 0x%lx, GPU %s\n", uvm_color_xor_masks[i], gpu->name);
+            return NV_ERR_INVALID_ARGUMENT;
+        }
+
+        gpu->color_xor_masks[i] = uvm_color_xor_masks[i];
+    }
+
+    gpu->num_color_xor_masks = uvm_num_color_xor_masks;
+    num_colors = 1U << gpu->num_color_xor_masks;
+
+    if (!color_xor_masks_interleaved(gpu)) {
+        UVM_ERR_PRINT("Color XOR masks don't interleave colors across transfer chunks, GPU %s\n", gpu->name);
+        return NV_ERR_INVALID_ARGUMENT;
+    }
+
+#if !defined(UVM_TEST_MEM_COLORING)
+    gpu->num_transfer_mem_colors = num_colors;
+
+    // Userspace coloring allocates uncolored memory
+    if (gpu->num_allocation_mem_colors > 1)
+        gpu->num_allocation_mem_colors = num_colors;
+#endif
+
+    return NV_OK;
+}
+
 static NV_STATUS get_gpu_info(uvm_gpu_t *gpu)
 {
     NV_STATUS status;
@@ -630,6 +694,10 @@ static NV_STATUS add_gpu(const NvProcessorUuid *gpu_uuid, uvm_gpu_t **gpu_out)
     gpu->arch_hal->init_properties(gpu);
     uvm_mmu_init_gpu_peer_addresses(gpu);
 
+    status = init_color_xor_masks(gpu);
+    if (status != NV_OK)
+        goto error;
+
     status = uvm_rm_locked_call(nvUvmInterfaceAddressSpaceCreate(g_uvm_global.rm_session_handle,
                                                                  &gpu->uuid,
                                                                  gpu->rm_va_base,
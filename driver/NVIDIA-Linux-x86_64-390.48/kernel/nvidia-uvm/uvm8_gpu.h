@@ -821,6 +821,13 @@ struct uvm_gpu_struct
     NvU64 colored_allocation_chunk_size;
     NvU64 colored_transfer_chunk_size;
 
+    // Memory color function. Bit i of the color of a physical address is the
+    // parity of the address bits set in color_xor_masks[i]. Defaults come from
+    // the architecture and can be overridden with the uvm_color_xor_masks
+    // module parameter.
+    NvU64 color_xor_masks[UVM_MAX_COLOR_XOR_MASKS];
+    NvU32 num_color_xor_masks;
+
     uvm_gpu_link_type_t sysmem_link;
 };
 
@@ -1037,6 +1044,19 @@ static bool uvm_gpu_supports_coloring(uvm_gpu_t *gpu)
     return true;
 }
 
+// Returns the memory color of a physical address as given by the GPU's color
+// XOR masks
+static NvU32 uvm_gpu_phys_addr_to_color(uvm_gpu_t *gpu, NvU64 phys_addr)
+{
+    NvU32 color = 0;
+    NvU32 i;
+
+    for (i = 0; i < gpu->num_color_xor_masks; i++)
+        color |= (hweight64(phys_addr & gpu->color_xor_masks[i]) & 0x1) << i;
+
+    return color;
+}
+
 static bool uvm_gpu_supports_eviction(uvm_gpu_t *gpu)
 {
     // XXX: Restricting eviction for now as it is not working correctly.
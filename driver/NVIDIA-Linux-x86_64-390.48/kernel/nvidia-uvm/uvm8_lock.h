@@ -305,6 +305,22 @@
 //      events come from perf events, both VA_SPACE_EVENTS and VA_SPACE_TOOLS
 //      must be taken to register/report some tools events.
 //
+// - Colored fences lock (va_space->colored.lock)
+//      Order: UVM_LOCK_ORDER_COLORED_FENCES
+//      Exclusive lock (mutex) per uvm_va_space_t
+//
+//      Protects the trackers of asynchronous colored memcpy/memset
+//      operations. Like the semaphore pool tracker lock, it can be held while
+//      waiting on the trackers.
+//
+// - Host registration lock (va_space->host_registered.lock)
+//      Order: UVM_LOCK_ORDER_HOST_REGISTERED
+//      Exclusive lock (mutex) per uvm_va_space_t
+//
+//      Protects the registry of host ranges pinned by UVM_HOST_REGISTER. It
+//      is taken with a VA block lock held when a colored copy looks up pinned
+//      pages. Pinning itself (get_user_pages) is done without holding it.
+//
 // - Leaf locks
 //      Order: UVM_LOCK_ORDER_LEAF
 //
@@ -337,6 +353,8 @@ typedef enum
     UVM_LOCK_ORDER_VA_SPACE_EVENTS,
     UVM_LOCK_ORDER_VA_SPACE_TOOLS,
     UVM_LOCK_ORDER_SEMA_POOL_TRACKER,
+    UVM_LOCK_ORDER_COLORED_FENCES,
+    UVM_LOCK_ORDER_HOST_REGISTERED,
     UVM_LOCK_ORDER_LEAF,
     UVM_LOCK_ORDER_COUNT,
 } uvm_lock_order_t;
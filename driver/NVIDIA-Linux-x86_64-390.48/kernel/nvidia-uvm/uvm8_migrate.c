@@ -37,6 +37,17 @@
 #include "uvm8_hal.h"
 #include "uvm8_tools.h"
 
+// Maximum amount of host memory pinned by UVM_HOST_REGISTER per VA space
+static unsigned uvm_host_register_max_mb = 1024;
+
+module_param(uvm_host_register_max_mb, uint, S_IRUGO);
+
+// Use the per-block cached colored page masks for colored copies. Writable at
+// runtime so that colored copies can be compared with and without the cache.
+static unsigned uvm_colored_page_mask_cache = 1;
+
+module_param(uvm_colored_page_mask_cache, uint, S_IRUGO | S_IWUSR);
+
 static NV_STATUS block_migrate_map_mapped_pages(uvm_va_block_t *va_block,
                                                 uvm_va_block_retry_t *va_block_retry,
                                                 uvm_va_block_context_t *va_block_context,
@@ -256,50 +267,89 @@ static NV_STATUS uvm_va_range_migrate(uvm_va_range_t *va_range,
     return NV_OK;
 }
 
-static void uvm_block_iter_deinitialization(uvm_block_iter_t *iter)
+// Releases pins collected by uvm_block_iter_next_block(). The DMA to or from
+// the pages must have completed.
+static void uvm_colored_pins_release(struct list_head *pins)
 {
-    struct page *page;
+    uvm_colored_pins_t *cpu_pins, *next;
     NvU32 i;
 
-    if (iter->cpu_block) {
-        
-        if (iter->cpu_block->cpu.pages) {
-
-            // Release all pinned pages if any
-            for (i = 0; i < PAGES_PER_UVM_VA_BLOCK; i++) {
-                page = iter->cpu_block->cpu.pages[i];
-                if (page) {
-                    put_page(page);
-                    iter->cpu_block->cpu.pages[i]= NULL;
-                }
-            }
-
-            kfree(iter->cpu_block->cpu.pages);
-            iter->cpu_block->cpu.pages = NULL;
+    list_for_each_entry_safe(cpu_pins, next, pins, list_node) {
+        for (i = 0; i < PAGES_PER_UVM_VA_BLOCK; i++) {
+            if (cpu_pins->pages[i])
+                put_page(cpu_pins->pages[i]);
         }
 
-        kfree(iter->cpu_block);
-        iter->cpu_block = NULL;
+        list_del(&cpu_pins->list_node);
+        kfree(cpu_pins);
+    }
+}
+
+// Moves the pins of the current pseudo-block to the pins list. Pushed copies
+// might still be using the pages, so they can't be released here.
+static void uvm_block_iter_collect_pins(uvm_block_iter_t *iter)
+{
+    NvU32 i;
+
+    for (i = 0; i < PAGES_PER_UVM_VA_BLOCK; i++) {
+        if (iter->cpu_pins->pages[i])
+            break;
+    }
+
+    if (i == PAGES_PER_UVM_VA_BLOCK) {
+        kfree(iter->cpu_pins);
+    }
+    else {
+        UVM_ASSERT(iter->pins);
+        list_add_tail(&iter->cpu_pins->list_node, iter->pins);
     }
+
+    iter->cpu_pins = NULL;
+    iter->cpu_block->cpu.pages = NULL;
+}
+
+static void uvm_block_iter_deinitialization(uvm_block_iter_t *iter)
+{
+    if (iter->cpu_pins)
+        uvm_block_iter_collect_pins(iter);
+
+    // The pseudo-block is never locked nor tracked, so it needs no deinit
+    kfree(iter->cpu_block);
+    iter->cpu_block = NULL;
+}
+
+static NV_STATUS uvm_block_iter_alloc_pins(uvm_block_iter_t *iter)
+{
+    iter->cpu_pins = kzalloc(sizeof(*iter->cpu_pins), GFP_KERNEL);
+    if (!iter->cpu_pins)
+        return NV_ERR_NO_MEMORY;
+
+    iter->cpu_block->cpu.pages = iter->cpu_pins->pages;
+
+    return NV_OK;
 }
 
 // Iterate over all managed contiguous va_blocks till "length" is covered
 // Length is in terms of color mem size
+// Linux pages pinned while iterating over CPU memory are added to pins once
+// done with (see uvm_colored_pins_release()).
 static NV_STATUS uvm_block_iter_initialization(uvm_va_space_t *va_space,
                                                 NvU64 start,
                                                 uvm_processor_id_t id,
+                                                struct list_head *pins,
                                                 uvm_block_iter_t *iter)
 {
     NV_STATUS status = NV_OK;
     uvm_va_range_t *first_va_range;
     size_t block_index, range_end_block_index;
-    struct page **page_array;
 
     uvm_assert_rwsem_locked(&va_space->lock);
 
     iter->start = start;
     iter->va_range = NULL;
     iter->cpu_block = NULL;
+    iter->cpu_pins = NULL;
+    iter->pins = pins;
 
     first_va_range = uvm_va_space_iter_first(va_space, start, start);
 
@@ -309,7 +359,10 @@ static NV_STATUS uvm_block_iter_initialization(uvm_va_space_t *va_space,
     // the subsequent blocks might be. We need to handle this behaviour
     if (!first_va_range & (id == UVM_CPU_ID)) {
 
-        iter->cpu_block = kmalloc(sizeof(uvm_va_block_t), GFP_KERNEL);
+        // Only copies pin pages
+        UVM_ASSERT(pins);
+
+        iter->cpu_block = kzalloc(sizeof(uvm_va_block_t), GFP_KERNEL);
         if (!iter->cpu_block) {
             status = NV_ERR_NO_MEMORY;
             goto err;
@@ -317,14 +370,6 @@ static NV_STATUS uvm_block_iter_initialization(uvm_va_space_t *va_space,
 
         iter->cpu_block->is_linux_backed = true;
 
-        page_array = kzalloc(sizeof(struct page *) * PAGES_PER_UVM_VA_BLOCK, GFP_KERNEL);
-        if (!page_array) {
-            status = NV_ERR_NO_MEMORY;
-            goto err;
-        }
-
-        iter->cpu_block->cpu.pages = page_array;
-
         iter->next_block_index = start / UVM_VA_BLOCK_SIZE;
         iter->range_end_block_index = (size_t)-1;
         return NV_OK;
@@ -355,6 +400,14 @@ static NV_STATUS uvm_block_iter_next_block(uvm_block_iter_t *iter,
     NV_STATUS status = NV_OK;
 
     if (iter->cpu_block) {
+        // Pages of the previous block stay pinned till the copy completes
+        if (iter->cpu_pins)
+            uvm_block_iter_collect_pins(iter);
+
+        status = uvm_block_iter_alloc_pins(iter);
+        if (status != NV_OK)
+            return status;
+
         iter->cpu_block->start = iter->next_block_index * UVM_VA_BLOCK_SIZE;
         iter->cpu_block->end = iter->cpu_block->start + UVM_VA_BLOCK_SIZE - 1;
 
@@ -406,7 +459,8 @@ void uvm_va_colored_block_region_init(NvU64 start, NvU64 length, NvU32 color,
 // Update a block color range for a va block
 // Since this function depends on physical address, block should be locked
 // before calling this function.
-NV_STATUS uvm_update_va_colored_block_region(uvm_va_block_t *va_block,
+NV_STATUS uvm_update_va_colored_block_region(uvm_va_space_t *va_space,
+                                               uvm_va_block_t *va_block,
                                                uvm_processor_id_t id,
                                                uvm_va_block_colored_region_t *region)
 {
@@ -415,6 +469,7 @@ NV_STATUS uvm_update_va_colored_block_region(uvm_va_block_t *va_block,
     uvm_page_index_t first, outer, last;
     uvm_gpu_phys_address_t phy_addr;
     uvm_gpu_t *gpu;
+    const uvm_page_mask_t *color_mask;
     NvU64 page_start, page_end, page_size, page_offset;
     NvU32 page_color;
 
@@ -428,8 +483,7 @@ NV_STATUS uvm_update_va_colored_block_region(uvm_va_block_t *va_block,
 
     // No coloring on CPU side
     if (id == UVM_CPU_ID) {
-        int ret, i;
-        struct page *page;
+        int ret;
 
         start = max(va_block->start, region->start) + page_offset;
         end = min(va_block->end, start + region->length - 1);
@@ -439,23 +493,20 @@ NV_STATUS uvm_update_va_colored_block_region(uvm_va_block_t *va_block,
 
         uvm_page_mask_fill(&region->page_mask, first, outer);
 
-        // Only linux backed pages need to be locked
+        // Only linux backed pages need to be locked. The pseudo-block comes
+        // with no pages pinned (see uvm_block_iter_next_block()).
         if (va_block->is_linux_backed) {
-            // Release all previously pinned pages
-            for (i = 0; i < PAGES_PER_UVM_VA_BLOCK; i++) {
-                page = va_block->cpu.pages[i];
-                if (page) {
-                    put_page(page);
-                    va_block->cpu.pages[i]= NULL;
+            // Pages of registered host ranges are pinned already
+            if (!uvm_host_registered_get_pages(va_space, va_block->start + first * PAGE_SIZE,
+                                               outer - first, &va_block->cpu.pages[first])) {
+
+                // Try pinning pages
+                ret = NV_GET_USER_PAGES(va_block->start + first * PAGE_SIZE,
+                        outer - first, true, false, &va_block->cpu.pages[first], NULL);
+                if (ret < 0) {
+                    return NV_ERR_INVALID_ADDRESS;
                 }
             }
-
-            // Try pinning pages
-            ret = NV_GET_USER_PAGES(va_block->start + first * PAGE_SIZE,
-                    outer - first, true, false, &va_block->cpu.pages[first], NULL);
-            if (ret < 0) {
-                return NV_ERR_INVALID_ADDRESS;
-            }
         }
         goto done;
     }
@@ -470,9 +521,29 @@ NV_STATUS uvm_update_va_colored_block_region(uvm_va_block_t *va_block,
 
     gpu = uvm_gpu_get(id);
 
-    // If physically contiguous, get the start phy address and then increment
-    // Else find physical address for all the pages seperately
-    if (uvm_block_is_phys_contig(va_block, id)) {
+    // Use the block's cached colored page mask when available
+    color_mask = NULL;
+    if (uvm_colored_page_mask_cache)
+        color_mask = uvm_va_block_gpu_colored_page_mask(va_block, gpu, region->color);
+    if (color_mask) {
+
+        uvm_page_index_t i;
+
+        for_each_va_block_page_in_region_mask(i, color_mask, uvm_va_block_region(first, outer)) {
+
+            if (left == 0)
+                break;
+
+            last = i;
+
+            uvm_page_mask_set(&region->page_mask, i);
+            page_start = max(start, va_block->start + PAGE_SIZE * i) + page_offset;
+            page_end = va_block->start + PAGE_SIZE * (i + 1) - 1;
+            page_size = min(left, page_end - page_start + 1);
+            left -= page_size;
+            page_offset = 0;
+        }
+    } else if (uvm_block_is_phys_contig(va_block, id)) {
         
         uvm_page_index_t i;
 
@@ -530,7 +601,8 @@ done:
     return NV_OK;
 }
 
-static NV_STATUS uvm_va_block_memcpy_colored_locked(uvm_va_block_t *src_va_block,
+static NV_STATUS uvm_va_block_memcpy_colored_locked(uvm_va_space_t *va_space,
+                                                    uvm_va_block_t *src_va_block,
                                                     uvm_va_block_t *dest_va_block,
                                                     uvm_processor_id_t src_id,
                                                     uvm_processor_id_t dest_id,
@@ -543,11 +615,11 @@ static NV_STATUS uvm_va_block_memcpy_colored_locked(uvm_va_block_t *src_va_block
     uvm_tracker_t local_tracker = UVM_TRACKER_INIT();
     NV_STATUS tracker_status;
 
-    status = uvm_update_va_colored_block_region(src_va_block, src_id, src_region);
+    status = uvm_update_va_colored_block_region(va_space, src_va_block, src_id, src_region);
     if (status != NV_OK)
         goto out;
 
-    status =uvm_update_va_colored_block_region(dest_va_block, dest_id, dest_region);
+    status =uvm_update_va_colored_block_region(va_space, dest_va_block, dest_id, dest_region);
     if (status != NV_OK)
         goto out;
 
@@ -561,19 +633,24 @@ static NV_STATUS uvm_va_block_memcpy_colored_locked(uvm_va_block_t *src_va_block
                                                 &local_tracker);
 
 out:
-    if (out_tracker) {
-        tracker_status = uvm_tracker_add_tracker_safe(out_tracker, &local_tracker);
-        uvm_tracker_deinit(&local_tracker);
-    } else {
-        // Add everything from the local tracker to the block's tracker.
+    // Add everything from the local tracker to the blocks' trackers. The
+    // caller might not wait for the copy (asynchronous copy), so later work
+    // on these blocks has to be ordered after it. Linux backed pseudo-blocks
+    // have no tracker, their pages are kept pinned by the caller instead.
+    tracker_status = NV_OK;
+    if (!dest_va_block->is_linux_backed)
         tracker_status = uvm_tracker_add_tracker_safe(&dest_va_block->tracker, &local_tracker);
-        uvm_tracker_deinit(&local_tracker);
-    }
+    if (tracker_status == NV_OK && src_va_block != dest_va_block && !src_va_block->is_linux_backed)
+        tracker_status = uvm_tracker_add_tracker_safe(&src_va_block->tracker, &local_tracker);
+    if (tracker_status == NV_OK && out_tracker)
+        tracker_status = uvm_tracker_add_tracker_safe(out_tracker, &local_tracker);
+    uvm_tracker_deinit(&local_tracker);
 
     return status == NV_OK ? tracker_status : status;
 }
 
-static NV_STATUS uvm_va_block_memset_colored_locked(uvm_va_block_t *va_block,
+static NV_STATUS uvm_va_block_memset_colored_locked(uvm_va_space_t *va_space,
+                                                    uvm_va_block_t *va_block,
                                                     uvm_processor_id_t id,
                                                     uvm_va_block_colored_region_t *region,
                                                     NvU8 value,
@@ -584,7 +661,7 @@ static NV_STATUS uvm_va_block_memset_colored_locked(uvm_va_block_t *va_block,
     uvm_tracker_t local_tracker = UVM_TRACKER_INIT();
     NV_STATUS tracker_status;
 
-    status = uvm_update_va_colored_block_region(va_block, id, region);
+    status = uvm_update_va_colored_block_region(va_space, va_block, id, region);
     if (status != NV_OK)
         goto out;
 
@@ -596,14 +673,12 @@ static NV_STATUS uvm_va_block_memset_colored_locked(uvm_va_block_t *va_block,
                                         &local_tracker);
 
 out:
-    if (out_tracker) {
+    // Add everything from the local tracker to the block's tracker (see
+    // uvm_va_block_memcpy_colored_locked()).
+    tracker_status = uvm_tracker_add_tracker_safe(&va_block->tracker, &local_tracker);
+    if (tracker_status == NV_OK && out_tracker)
         tracker_status = uvm_tracker_add_tracker_safe(out_tracker, &local_tracker);
-        uvm_tracker_deinit(&local_tracker);
-    } else {
-        // Add everything from the local tracker to the block's tracker.
-        tracker_status = uvm_tracker_add_tracker_safe(&va_block->tracker, &local_tracker);
-        uvm_tracker_deinit(&local_tracker);
-    }
+    uvm_tracker_deinit(&local_tracker);
 
     return status == NV_OK ? tracker_status : status;
 }
@@ -615,7 +690,8 @@ static NV_STATUS uvm_memcpy_colored_blocks(uvm_va_space_t *va_space,
                                            NvU32 color,
                                            uvm_processor_id_t src_id,
                                            uvm_processor_id_t dest_id,
-                                           uvm_tracker_t *out_tracker)
+                                           uvm_tracker_t *out_tracker,
+                                           struct list_head *out_pins)
 {
     NV_STATUS status = NV_OK;
     uvm_block_iter_t src_block_iter, dest_block_iter;
@@ -624,11 +700,11 @@ static NV_STATUS uvm_memcpy_colored_blocks(uvm_va_space_t *va_space,
     NvU64 copied;
     uvm_va_block_colored_region_t src_region, dest_region;
 
-    status = uvm_block_iter_initialization(va_space, srcBase, src_id, &src_block_iter);
+    status = uvm_block_iter_initialization(va_space, srcBase, src_id, out_pins, &src_block_iter);
     if (status != NV_OK)
         return status;
 
-    status = uvm_block_iter_initialization(va_space, destBase, dest_id, &dest_block_iter);
+    status = uvm_block_iter_initialization(va_space, destBase, dest_id, out_pins, &dest_block_iter);
     if (status != NV_OK) {
         uvm_block_iter_deinitialization(&src_block_iter);
         return status;
@@ -655,7 +731,8 @@ static NV_STATUS uvm_memcpy_colored_blocks(uvm_va_space_t *va_space,
 
         status = UVM_VA_GENERIC_MULTI_BLOCK_LOCK_RETRY(src_va_block, dest_va_block,
                 NULL, NULL,
-                uvm_va_block_memcpy_colored_locked(src_va_block,
+                uvm_va_block_memcpy_colored_locked(va_space,
+                    src_va_block,
                     dest_va_block,
                     src_id,
                     dest_id,
@@ -692,7 +769,7 @@ static NV_STATUS uvm_memset_colored_blocks(uvm_va_space_t *va_space,
     NvU64 covered;
     uvm_va_block_colored_region_t region;
 
-    status = uvm_block_iter_initialization(va_space, base, id, &block_iter);
+    status = uvm_block_iter_initialization(va_space, base, id, NULL, &block_iter);
     if (status != NV_OK)
         goto out;
 
@@ -708,7 +785,8 @@ static NV_STATUS uvm_memset_colored_blocks(uvm_va_space_t *va_space,
         }
 
         status = UVM_VA_BLOCK_LOCK_RETRY(va_block, NULL,
-                uvm_va_block_memset_colored_locked(va_block,
+                uvm_va_block_memset_colored_locked(va_space,
+                                                    va_block,
                                                     id,
                                                     &region,
                                                     value,
@@ -894,7 +972,8 @@ static NV_STATUS uvm_memcpy_colored(uvm_va_space_t *va_space,
                                     NvU32 color,
                                     uvm_processor_id_t src_id,
                                     uvm_processor_id_t dest_id,
-                                    uvm_tracker_t *out_tracker)
+                                    uvm_tracker_t *out_tracker,
+                                    struct list_head *out_pins)
 {
     NV_STATUS status = NV_OK;
 
@@ -909,7 +988,8 @@ static NV_STATUS uvm_memcpy_colored(uvm_va_space_t *va_space,
                                         color,
                                         src_id,
                                         dest_id,
-                                        out_tracker);
+                                        out_tracker,
+                                        out_pins);
 
     if (status != NV_OK)
         return status;
@@ -1184,73 +1264,327 @@ done:
     return status == NV_OK ? tracker_status : status;
 }
 
-NV_STATUS uvm_api_memcpy_colored(UVM_MEMCPY_COLORED_PARAMS *params, struct file *filp)
+// Hands over the work in tracker and the host pages pinned for it to the next
+// colored fence of the VA space and returns the fence's handle. Fence slots
+// are reused round robin, so if the slot is still occupied by an older fence,
+// that fence is waited upon first. This limits the number of operations in
+// flight. On success, pins is left empty.
+//
+// LOCKING: The caller must hold the VA space lock in read mode.
+static NV_STATUS uvm_colored_fence_add(uvm_va_space_t *va_space,
+                                       uvm_tracker_t *tracker,
+                                       struct list_head *pins,
+                                       NvU64 *handle)
 {
-    uvm_va_space_t *va_space = uvm_va_space_get(filp);
-    uvm_tracker_t tracker = UVM_TRACKER_INIT();
-    // NULL = CPU
-    uvm_gpu_t *src_gpu = NULL;
-    uvm_gpu_t *dest_gpu = NULL;
-    NvU32 color = 0;
+    uvm_colored_fence_t *fence;
     NV_STATUS status;
-    NV_STATUS tracker_status = NV_OK;
+    NvU64 new_handle;
 
-    // mmap_sem will be needed if we have to create CPU mappings
+    uvm_assert_rwsem_locked(&va_space->lock);
+
+    uvm_mutex_lock(&va_space->colored.lock);
+
+    new_handle = va_space->colored.last_fence + 1;
+    fence = &va_space->colored.fences[new_handle % UVM_MAX_COLORED_FENCES];
+
+    status = uvm_tracker_wait(&fence->tracker);
+    if (status == NV_OK) {
+        uvm_colored_pins_release(&fence->pins);
+        status = uvm_tracker_overwrite_safe(&fence->tracker, tracker);
+    }
+
+    if (status == NV_OK) {
+        list_splice_init(pins, &fence->pins);
+        fence->handle = new_handle;
+        va_space->colored.last_fence = new_handle;
+        *handle = new_handle;
+    }
+
+    uvm_mutex_unlock(&va_space->colored.lock);
+
+    return status;
+}
+
+void uvm_colored_fences_init(uvm_va_space_t *va_space)
+{
+    NvU32 i;
+
+    uvm_mutex_init(&va_space->colored.lock, UVM_LOCK_ORDER_COLORED_FENCES);
+
+    for (i = 0; i < UVM_MAX_COLORED_FENCES; i++) {
+        uvm_tracker_init(&va_space->colored.fences[i].tracker);
+        INIT_LIST_HEAD(&va_space->colored.fences[i].pins);
+    }
+}
+
+void uvm_colored_fences_deinit(uvm_va_space_t *va_space)
+{
+    NvU32 i;
+
+    uvm_assert_rwsem_locked_write(&va_space->lock);
+
+    uvm_mutex_lock(&va_space->colored.lock);
+
+    // Outstanding work has to finish before the GPUs can be unregistered and
+    // before the pages it uses can be released
+    for (i = 0; i < UVM_MAX_COLORED_FENCES; i++) {
+        (void)uvm_tracker_wait_deinit(&va_space->colored.fences[i].tracker);
+        uvm_colored_pins_release(&va_space->colored.fences[i].pins);
+    }
+
+    uvm_mutex_unlock(&va_space->colored.lock);
+}
+
+void uvm_host_registered_init(uvm_va_space_t *va_space)
+{
+    uvm_mutex_init(&va_space->host_registered.lock, UVM_LOCK_ORDER_HOST_REGISTERED);
+    uvm_range_tree_init(&va_space->host_registered.tree);
+    INIT_LIST_HEAD(&va_space->host_registered.lru);
+    va_space->host_registered.num_pages = 0;
+}
+
+static size_t host_registered_range_num_pages(uvm_host_registered_range_t *range)
+{
+    return (range->node.end - range->node.start + 1) / PAGE_SIZE;
+}
+
+static void host_registered_range_free(uvm_host_registered_range_t *range, size_t num_pinned)
+{
+    size_t i;
+
+    for (i = 0; i < num_pinned; i++)
+        put_page(range->pages[i]);
+
+    uvm_kvfree(range->pages);
+    uvm_kvfree(range);
+}
+
+// Removes the range from the registry and unpins its pages
+static void host_registered_range_destroy(uvm_va_space_t *va_space, uvm_host_registered_range_t *range)
+{
+    uvm_assert_mutex_locked(&va_space->host_registered.lock);
+
+    uvm_range_tree_remove(&va_space->host_registered.tree, &range->node);
+    list_del(&range->lru_node);
+    va_space->host_registered.num_pages -= host_registered_range_num_pages(range);
+
+    host_registered_range_free(range, host_registered_range_num_pages(range));
+}
+
+void uvm_host_registered_deinit(uvm_va_space_t *va_space)
+{
+    uvm_host_registered_range_t *range, *next;
+
+    uvm_mutex_lock(&va_space->host_registered.lock);
+
+    list_for_each_entry_safe(range, next, &va_space->host_registered.lru, lru_node)
+        host_registered_range_destroy(va_space, range);
+
+    uvm_mutex_unlock(&va_space->host_registered.lock);
+}
+
+bool uvm_host_registered_get_pages(uvm_va_space_t *va_space,
+                                   NvU64 start,
+                                   size_t num_pages,
+                                   struct page **pages)
+{
+    uvm_range_tree_node_t *node;
+    uvm_host_registered_range_t *range;
+    size_t i, offset;
+    bool found = false;
+
+    uvm_mutex_lock(&va_space->host_registered.lock);
+
+    node = uvm_range_tree_find(&va_space->host_registered.tree, start);
+    if (!node)
+        goto out;
+
+    range = container_of(node, uvm_host_registered_range_t, node);
+    if (range->mm != current->mm || start + num_pages * PAGE_SIZE - 1 > range->node.end)
+        goto out;
+
+    offset = (start - range->node.start) / PAGE_SIZE;
+    for (i = 0; i < num_pages; i++) {
+        pages[i] = range->pages[offset + i];
+        get_page(pages[i]);
+    }
+
+    list_move_tail(&range->lru_node, &va_space->host_registered.lru);
+    found = true;
+
+out:
+    uvm_mutex_unlock(&va_space->host_registered.lock);
+
+    return found;
+}
+
+NV_STATUS uvm_api_host_register(UVM_HOST_REGISTER_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    uvm_host_registered_range_t *range, *lru_range;
+    NvU64 max_pages = ((NvU64)uvm_host_register_max_mb * 1024 * 1024) / PAGE_SIZE;
+    size_t num_pages, num_pinned = 0;
+    NV_STATUS status = NV_OK;
+    long ret;
+
+    if (params->length == 0 || params->base + params->length < params->base)
+        return NV_ERR_INVALID_ADDRESS;
+
+    range = uvm_kvmalloc_zero(sizeof(*range));
+    if (!range)
+        return NV_ERR_NO_MEMORY;
+
+    range->node.start = UVM_PAGE_ALIGN_DOWN(params->base);
+    range->node.end = UVM_PAGE_ALIGN_UP(params->base + params->length) - 1;
+    range->mm = current->mm;
+
+    num_pages = host_registered_range_num_pages(range);
+    if (num_pages > max_pages) {
+        uvm_kvfree(range);
+        return NV_ERR_NO_MEMORY;
+    }
+
+    range->pages = uvm_kvmalloc(num_pages * sizeof(range->pages[0]));
+    if (!range->pages) {
+        uvm_kvfree(range);
+        return NV_ERR_NO_MEMORY;
+    }
+
+    // Pinning faults in the pages, so it's done without holding the registry
+    // lock. See uvm8_lock.h.
     uvm_down_read_mmap_sem(&current->mm->mmap_sem);
-    uvm_va_space_down_read(va_space);
 
-    if (uvm_uuid_is_cpu(&params->srcUuid)) {
-        src_gpu = NULL;
+    while (num_pinned < num_pages) {
+        ret = NV_GET_USER_PAGES(range->node.start + num_pinned * PAGE_SIZE,
+                                num_pages - num_pinned, true, false, &range->pages[num_pinned], NULL);
+        if (ret <= 0) {
+            status = NV_ERR_INVALID_ADDRESS;
+            break;
+        }
+
+        num_pinned += ret;
     }
-    else {
-        src_gpu = uvm_va_space_get_gpu_by_uuid_with_gpu_va_space(va_space, &params->srcUuid);
 
-        if (!src_gpu) {
-            status = NV_ERR_INVALID_DEVICE;
-            goto done;
+    uvm_up_read_mmap_sem(&current->mm->mmap_sem);
+
+    if (status != NV_OK)
+        goto error;
+
+    uvm_mutex_lock(&va_space->host_registered.lock);
+
+    status = uvm_range_tree_add(&va_space->host_registered.tree, &range->node);
+    if (status == NV_OK) {
+        list_add_tail(&range->lru_node, &va_space->host_registered.lru);
+        va_space->host_registered.num_pages += num_pages;
+
+        // Unpin the least recently used ranges to stay within the limit. Their
+        // copies fall back to pinning on demand.
+        while (va_space->host_registered.num_pages > max_pages) {
+            lru_range = list_first_entry(&va_space->host_registered.lru, uvm_host_registered_range_t, lru_node);
+            UVM_ASSERT(lru_range != range);
+            host_registered_range_destroy(va_space, lru_range);
         }
     }
 
-    if (uvm_uuid_is_cpu(&params->destUuid)) {
-        dest_gpu = NULL;
+    uvm_mutex_unlock(&va_space->host_registered.lock);
+
+    if (status != NV_OK)
+        goto error;
+
+    return NV_OK;
+
+error:
+    host_registered_range_free(range, num_pinned);
+    return status;
+}
+
+// Unregistering a range that was already unpinned to stay within
+// uvm_host_register_max_mb is not an error.
+NV_STATUS uvm_api_host_unregister(UVM_HOST_UNREGISTER_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    uvm_range_tree_node_t *node;
+    uvm_host_registered_range_t *range;
+    NvU64 start = UVM_PAGE_ALIGN_DOWN(params->base);
+
+    uvm_mutex_lock(&va_space->host_registered.lock);
+
+    node = uvm_range_tree_find(&va_space->host_registered.tree, start);
+    if (node && node->start == start) {
+        range = container_of(node, uvm_host_registered_range_t, node);
+        if (range->mm == current->mm)
+            host_registered_range_destroy(va_space, range);
     }
-    else {
-        dest_gpu = uvm_va_space_get_gpu_by_uuid_with_gpu_va_space(va_space, &params->destUuid);
 
-        if (!dest_gpu) {
-            status = NV_ERR_INVALID_DEVICE;
-            goto done;
-        }
+    uvm_mutex_unlock(&va_space->host_registered.lock);
+
+    return NV_OK;
+}
+
+// Looks up the processors taking part in a colored copy and the color of the
+// current process on the GPU
+static NV_STATUS uvm_colored_copy_get_processors(uvm_va_space_t *va_space,
+                                                 NvProcessorUuid *srcUuid,
+                                                 NvProcessorUuid *destUuid,
+                                                 uvm_processor_id_t *src_id,
+                                                 uvm_processor_id_t *dest_id,
+                                                 NvU32 *color)
+{
+    // NULL = CPU
+    uvm_gpu_t *src_gpu = NULL;
+    uvm_gpu_t *dest_gpu = NULL;
+
+    if (!uvm_uuid_is_cpu(srcUuid)) {
+        src_gpu = uvm_va_space_get_gpu_by_uuid_with_gpu_va_space(va_space, srcUuid);
+        if (!src_gpu)
+            return NV_ERR_INVALID_DEVICE;
+    }
+
+    if (!uvm_uuid_is_cpu(destUuid)) {
+        dest_gpu = uvm_va_space_get_gpu_by_uuid_with_gpu_va_space(va_space, destUuid);
+        if (!dest_gpu)
+            return NV_ERR_INVALID_DEVICE;
     }
 
     // Either atmost one src/dest lie on CPU or both lie on same GPU
     // Invalid configuration: Both lie on CPU or different GPUs
-    if ((!src_gpu && !dest_gpu) || (src_gpu && dest_gpu && src_gpu->id != dest_gpu->id)) {
-    	status = NV_ERR_INVALID_DEVICE;
-        goto done;
-    }
+    if ((!src_gpu && !dest_gpu) || (src_gpu && dest_gpu && src_gpu->id != dest_gpu->id))
+        return NV_ERR_INVALID_DEVICE;
+
+    *src_id = src_gpu ? src_gpu->id : UVM_CPU_ID;
+    *dest_id = dest_gpu ? dest_gpu->id : UVM_CPU_ID;
 
     // Atleast one is a GPU. Get it's color. If both on same GPU, then also only a single color exists.
-    if (src_gpu) {
-        status = uvm_pmm_get_current_process_color(&src_gpu->pmm, &color);
-        if (status != NV_OK)
-            goto done;
-    } else {
-        status = uvm_pmm_get_current_process_color(&dest_gpu->pmm, &color);
-        if (status != NV_OK)
-            goto done;
-    }
+    return uvm_pmm_get_current_process_color(src_gpu ? &src_gpu->pmm : &dest_gpu->pmm, color);
+}
+
+NV_STATUS uvm_api_memcpy_colored(UVM_MEMCPY_COLORED_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    uvm_tracker_t tracker = UVM_TRACKER_INIT();
+    LIST_HEAD(pins);
+    uvm_processor_id_t src_id, dest_id;
+    NvU32 color = 0;
+    NV_STATUS status;
+    NV_STATUS tracker_status = NV_OK;
+
+    // mmap_sem will be needed if we have to create CPU mappings
+    uvm_down_read_mmap_sem(&current->mm->mmap_sem);
+    uvm_va_space_down_read(va_space);
+
+    status = uvm_colored_copy_get_processors(va_space, &params->srcUuid, &params->destUuid,
+                                             &src_id, &dest_id, &color);
+    if (status != NV_OK)
+        goto done;
 
     if (params->length == 0) {
         status = NV_OK;
         goto done;
     }
 
-    // This is synchronous call, so using a tracker.
+    // Pushed work is collected in the tracker. Caller decides whether to wait.
     status = uvm_memcpy_colored(va_space, params->srcBase, params->destBase, 
-                                params->length, color, (src_gpu ? src_gpu->id : UVM_CPU_ID),
-                                (dest_gpu ? dest_gpu->id : UVM_CPU_ID),
-                                &tracker);
+                                params->length, color, src_id, dest_id, &tracker, &pins);
 
 done:
     // We only need to hold mmap_sem to create new CPU mappings, so drop it if
@@ -1262,11 +1596,23 @@ done:
     //       mappings synchronously).
     uvm_up_read_mmap_sem_out_of_order(&current->mm->mmap_sem);
 
-    // There was an error or we are sync. Even if there was an error, we
-    // need to wait for work already dispatched to complete. Waiting on
-    // a tracker requires the VA space lock to prevent GPUs being unregistered
-    // during the wait.
-    tracker_status = uvm_tracker_wait_deinit(&tracker);
+    // Asynchronous request: Hand the pending work and the pinned host pages
+    // over to a fence that userspace can wait on (UVM_WAIT_COLORED_FENCE)
+    // instead of waiting here. If no fence could be set up, fall back to
+    // being synchronous.
+    params->fence = 0;
+    if (status == NV_OK && (params->flags & UVM_COLORED_FLAGS_ASYNC) &&
+            uvm_colored_fence_add(va_space, &tracker, &pins, &params->fence) == NV_OK) {
+        uvm_tracker_deinit(&tracker);
+    }
+    else {
+        // There was an error or we are sync. Even if there was an error, we
+        // need to wait for work already dispatched to complete. Waiting on
+        // a tracker requires the VA space lock to prevent GPUs being unregistered
+        // during the wait.
+        tracker_status = uvm_tracker_wait_deinit(&tracker);
+        uvm_colored_pins_release(&pins);
+    }
 
     uvm_va_space_up_read(va_space);
 
@@ -1279,10 +1625,80 @@ done:
     return status == NV_OK ? tracker_status : status;
 }
 
+NV_STATUS uvm_api_memcpy_colored_batch(UVM_MEMCPY_COLORED_BATCH_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    uvm_tracker_t tracker = UVM_TRACKER_INIT();
+    LIST_HEAD(pins);
+    UvmMemcpyColoredDesc *descs;
+    uvm_processor_id_t src_id, dest_id;
+    NvU32 color = 0;
+    NvU32 i;
+    NV_STATUS status;
+    NV_STATUS tracker_status = NV_OK;
+
+    params->fence = 0;
+
+    if (params->numDescs == 0)
+        return NV_OK;
+
+    if (params->numDescs > UVM_MEMCPY_COLORED_BATCH_MAX_DESCS)
+        return NV_ERR_INVALID_ARGUMENT;
+
+    // Descriptors are copied in before taking mmap_sem, copying from
+    // userspace can fault.
+    descs = uvm_kvmalloc(params->numDescs * sizeof(*descs));
+    if (!descs)
+        return NV_ERR_NO_MEMORY;
+
+    if (nv_copy_from_user(descs, (void __user *)params->descs, params->numDescs * sizeof(*descs))) {
+        uvm_kvfree(descs);
+        return NV_ERR_INVALID_ADDRESS;
+    }
+
+    // All copies are done with a single lock acquisition and their work is
+    // collected in a single tracker.
+    uvm_down_read_mmap_sem(&current->mm->mmap_sem);
+    uvm_va_space_down_read(va_space);
+
+    status = uvm_colored_copy_get_processors(va_space, &params->srcUuid, &params->destUuid,
+                                             &src_id, &dest_id, &color);
+
+    for (i = 0; i < params->numDescs && status == NV_OK; i++) {
+        if (descs[i].length == 0)
+            continue;
+
+        status = uvm_memcpy_colored(va_space, descs[i].srcBase, descs[i].destBase,
+                                    descs[i].length, color, src_id, dest_id, &tracker, &pins);
+    }
+
+    uvm_up_read_mmap_sem_out_of_order(&current->mm->mmap_sem);
+
+    // See uvm_api_memcpy_colored()
+    if (status == NV_OK && (params->flags & UVM_COLORED_FLAGS_ASYNC) &&
+            uvm_colored_fence_add(va_space, &tracker, &pins, &params->fence) == NV_OK) {
+        uvm_tracker_deinit(&tracker);
+    }
+    else {
+        tracker_status = uvm_tracker_wait_deinit(&tracker);
+        uvm_colored_pins_release(&pins);
+    }
+
+    uvm_va_space_up_read(va_space);
+
+    uvm_tools_flush_events();
+
+    uvm_kvfree(descs);
+
+    // Only clobber status if we didn't hit an earlier error
+    return status == NV_OK ? tracker_status : status;
+}
+
 NV_STATUS uvm_api_memset_colored(UVM_MEMSET_COLORED_PARAMS *params, struct file *filp)
 {
     uvm_va_space_t *va_space = uvm_va_space_get(filp);
     uvm_tracker_t tracker = UVM_TRACKER_INIT();
+    LIST_HEAD(pins);    // Stays empty, only GPU memory is memset
     uvm_gpu_t *gpu = NULL;
     NvU32 color = 0;
     NV_STATUS status;
@@ -1313,7 +1729,7 @@ NV_STATUS uvm_api_memset_colored(UVM_MEMSET_COLORED_PARAMS *params, struct file
         goto done;
     }
 
-    // This is synchronous call, so using a tracker.
+    // Pushed work is collected in the tracker. Caller decides whether to wait.
     status = uvm_memset_colored(va_space, params->base, params->length, params->value,
                                 color, gpu->id, &tracker);
 
@@ -1327,11 +1743,21 @@ done:
     //       mappings synchronously).
     uvm_up_read_mmap_sem_out_of_order(&current->mm->mmap_sem);
 
-    // There was an error or we are sync. Even if there was an error, we
-    // need to wait for work already dispatched to complete. Waiting on
-    // a tracker requires the VA space lock to prevent GPUs being unregistered
-    // during the wait.
-    tracker_status = uvm_tracker_wait_deinit(&tracker);
+    // Asynchronous request: Hand the pending work over to a fence that
+    // userspace can wait on (UVM_WAIT_COLORED_FENCE) instead of waiting here.
+    // If no fence could be set up, fall back to being synchronous.
+    params->fence = 0;
+    if (status == NV_OK && (params->flags & UVM_COLORED_FLAGS_ASYNC) &&
+            uvm_colored_fence_add(va_space, &tracker, &pins, &params->fence) == NV_OK) {
+        uvm_tracker_deinit(&tracker);
+    }
+    else {
+        // There was an error or we are sync. Even if there was an error, we
+        // need to wait for work already dispatched to complete. Waiting on
+        // a tracker requires the VA space lock to prevent GPUs being unregistered
+        // during the wait.
+        tracker_status = uvm_tracker_wait_deinit(&tracker);
+    }
 
     uvm_va_space_up_read(va_space);
 
@@ -1416,3 +1842,79 @@ done:
 
     return status == NV_OK? tracker_status : status;
 }
+
+NV_STATUS uvm_api_wait_colored_fence(UVM_WAIT_COLORED_FENCE_PARAMS *params, struct file *filp)
+{
+    uvm_va_space_t *va_space = uvm_va_space_get(filp);
+    uvm_tracker_t tracker = UVM_TRACKER_INIT();
+    uvm_colored_fence_t *fence;
+    NV_STATUS status = NV_OK;
+    NvU32 i;
+
+    params->completed = NV_TRUE;
+
+    // Fence 0 is returned for synchronous requests. Nothing to wait for.
+    if (params->fence == 0)
+        return NV_OK;
+
+    uvm_va_space_down_read(va_space);
+
+    uvm_mutex_lock(&va_space->colored.lock);
+
+    if (params->fence > va_space->colored.last_fence) {
+        status = NV_ERR_INVALID_ARGUMENT;
+    }
+    else {
+        // Fences issued after this one are not waited upon. Fences whose
+        // slot has been reused have already completed.
+        for (i = 0; i < UVM_MAX_COLORED_FENCES && status == NV_OK; i++) {
+            fence = &va_space->colored.fences[i];
+
+            if (fence->handle == 0 || fence->handle > params->fence)
+                continue;
+
+            uvm_tracker_remove_completed(&fence->tracker);
+            status = uvm_tracker_add_tracker_safe(&tracker, &fence->tracker);
+        }
+    }
+
+    uvm_mutex_unlock(&va_space->colored.lock);
+
+    if (status == NV_OK) {
+        if (params->flags & UVM_COLORED_FLAGS_QUERY) {
+            status = uvm_tracker_query(&tracker);
+            if (status == NV_WARN_MORE_PROCESSING_REQUIRED) {
+                params->completed = NV_FALSE;
+                status = NV_OK;
+            }
+        }
+        else {
+            status = uvm_tracker_wait(&tracker);
+        }
+    }
+
+    uvm_tracker_deinit(&tracker);
+
+    // Host pages of completed fences aren't needed anymore
+    if (status == NV_OK && params->completed) {
+        uvm_mutex_lock(&va_space->colored.lock);
+
+        for (i = 0; i < UVM_MAX_COLORED_FENCES; i++) {
+            fence = &va_space->colored.fences[i];
+
+            if (fence->handle == 0 || fence->handle > params->fence)
+                continue;
+
+            if (uvm_tracker_is_completed(&fence->tracker))
+                uvm_colored_pins_release(&fence->pins);
+        }
+
+        uvm_mutex_unlock(&va_space->colored.lock);
+    }
+
+    // Waiting on a tracker requires the VA space lock to prevent GPUs being
+    // unregistered during the wait.
+    uvm_va_space_up_read(va_space);
+
+    return status;
+}
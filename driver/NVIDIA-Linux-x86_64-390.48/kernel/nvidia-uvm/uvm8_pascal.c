@@ -94,6 +94,15 @@ void uvm_hal_pascal_arch_init_properties(uvm_gpu_t *gpu)
    // But during transfer memory, we need to be color aware.
    // For kernel coloring, everythng is transparent to userspace application and hence
    // it needs to be color aware.
+
+    // Cache Vertically Split
+    // color = ((phys_addr >> 12) ^ (phys_addr >> 13) ^ (phys_addr >> 18) ^
+    //          (phys_addr >> 19) ^ (phys_addr >> 22) ^ (phys_addr >> 25) ^
+    //          (phys_addr >> 26) ^ (phys_addr >> 27) ^ (phys_addr >> 30) ^
+    //          (phys_addr >> 31)) & 0x1;
+    gpu->color_xor_masks[0] = 0xce4c3ULL << 12;
+    gpu->num_color_xor_masks = 1;
+
 #if defined(UVM_TEST_MEM_COLORING)
 
     gpu->num_allocation_mem_colors = 1;
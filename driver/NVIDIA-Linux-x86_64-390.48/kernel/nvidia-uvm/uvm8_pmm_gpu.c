@@ -3455,6 +3455,11 @@ NV_STATUS uvm_api_get_device_color_info(UVM_GET_DEVICE_COLOR_INFO_PARAMS *params
 
         status = get_device_color_info(&gpu->pmm, NULL, &params->numColors,
                 &params->maxLength);
+        if (status != NV_OK)
+            goto done;
+
+        params->numColorMasks = gpu->num_color_xor_masks;
+        memcpy(params->colorMasks, gpu->color_xor_masks, sizeof(params->colorMasks));
     }
 
 done:
@@ -81,6 +81,16 @@ typedef struct uvm_range_group_range_iter_struct
     uvm_range_group_range_t *node;
 } uvm_range_group_range_iter_t;
 
+// Linux pages of a pseudo-block pinned for a colored copy. The pins are kept
+// until the copy completes, which for asynchronous copies is after the ioctl
+// returns (see uvm_colored_fence_t).
+typedef struct
+{
+    struct list_head list_node;
+
+    struct page *pages[PAGES_PER_UVM_VA_BLOCK];
+} uvm_colored_pins_t;
+
 // Context for iterating over blocks
 typedef struct uvm_block_iter_struct
 {
@@ -96,6 +106,11 @@ typedef struct uvm_block_iter_struct
     // with linux backed pages
     uvm_va_block_t *cpu_block;
 
+    // Pages pinned for the current pseudo-block. Pins of blocks already
+    // iterated over are moved to the pins list.
+    uvm_colored_pins_t *cpu_pins;
+    struct list_head *pins;
+
 } uvm_block_iter_t;
 
 static inline bool uvm_range_group_migratable(uvm_range_group_t *range_group)
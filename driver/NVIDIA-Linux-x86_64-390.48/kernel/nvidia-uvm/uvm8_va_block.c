@@ -1687,6 +1687,7 @@ static NV_STATUS block_populate_gpu_chunk(uvm_va_block_t *block,
     // operation.
     block_retry_add_used_chunk(retry, gpu, chunk);
     gpu_state->chunks[chunk_index] = chunk;
+    gpu_state->colored.valid = false;
 
     return NV_OK;
 
@@ -2174,6 +2175,49 @@ bool uvm_block_is_phys_contig(uvm_va_block_t *block, uvm_processor_id_t id)
            (uvm_va_block_size(block) == block_gpu_chunk_size(block, uvm_gpu_get(id), 0));
 }
 
+const uvm_page_mask_t *uvm_va_block_gpu_colored_page_mask(uvm_va_block_t *block, uvm_gpu_t *gpu, NvU32 color)
+{
+    uvm_va_block_gpu_state_t *gpu_state = block_gpu_state_get(block, gpu->id);
+    uvm_gpu_phys_address_t phys_addr;
+    uvm_page_index_t page_index;
+    bool phys_contig;
+
+    uvm_assert_mutex_locked(&block->lock);
+
+    if (!gpu_state)
+        return NULL;
+
+    if (gpu_state->colored.valid && gpu_state->colored.color == color)
+        return &gpu_state->colored.page_mask;
+
+    for_each_va_block_page(page_index, block) {
+        if (!block_processor_page_is_populated(block, gpu->id, page_index))
+            return NULL;
+    }
+
+    uvm_page_mask_zero(&gpu_state->colored.page_mask);
+
+    // If physically contiguous, get the start phy address and then increment
+    // Else find physical address for all the pages seperately
+    phys_contig = uvm_block_is_phys_contig(block, gpu->id);
+    phys_addr = uvm_va_block_gpu_phys_page_address(block, 0, gpu);
+
+    for_each_va_block_page(page_index, block) {
+        if (!phys_contig)
+            phys_addr = uvm_va_block_gpu_phys_page_address(block, page_index, gpu);
+
+        if (gpu->arch_hal->phys_addr_to_transfer_color(gpu, phys_addr.address) == color)
+            uvm_page_mask_set(&gpu_state->colored.page_mask, page_index);
+
+        phys_addr.address += PAGE_SIZE;
+    }
+
+    gpu_state->colored.color = color;
+    gpu_state->colored.valid = true;
+
+    return &gpu_state->colored.page_mask;
+}
+
 
 static uvm_va_block_region_t block_phys_contig_region(uvm_va_block_t *block,
                                                       uvm_page_index_t page_index,
@@ -2553,10 +2597,12 @@ NV_STATUS block_copy_colored_pages_between(uvm_va_block_t *src_block,
                 break;
             }
 
-            // Currently we are not populating blocks so this is not needed
-            // No pending work in the blocks
-            //uvm_push_acquire_tracker(&push, &src_block->tracker);
-            //uvm_push_acquire_tracker(&push, &dest_block->tracker);
+            // Asynchronous colored copies/memsets leave pending work in the
+            // blocks' trackers. Linux backed pseudo-blocks have no tracker.
+            if (!src_block->is_linux_backed)
+                uvm_push_acquire_tracker(&push, &src_block->tracker);
+            if (!dest_block->is_linux_backed)
+                uvm_push_acquire_tracker(&push, &dest_block->tracker);
 
             copying_gpu = uvm_push_get_gpu(&push);
     
@@ -2738,8 +2784,9 @@ NV_STATUS block_memset_colored_pages(uvm_va_block_t *block,
 
             push_acquired = true;
 
-            // Uncomment this when pages start being populated in memset code path
-            //uvm_push_acquire_tracker(&push, &block->tracker);
+            // Asynchronous colored copies/memsets leave pending work in the
+            // block's tracker
+            uvm_push_acquire_tracker(&push, &block->tracker);
 
             if (is_phys_contig)
                 contig_address = block_phys_page_copy_address(block, block_phys_page(id, 0), gpu);
@@ -8506,6 +8553,11 @@ static void block_split_gpu(uvm_va_block_t *existing, uvm_va_block_t *new, uvm_g
 
     new_gpu_state->force_4k_ptes = existing_gpu_state->force_4k_ptes;
 
+    // Page indices of both blocks change, so their colored page masks are
+    // stale.
+    existing_gpu_state->colored.valid = false;
+    new_gpu_state->colored.valid = false;
+
     UVM_ASSERT(PAGE_ALIGNED(new->start));
     UVM_ASSERT(PAGE_ALIGNED(existing->start));
     existing_pages = (new->start - existing->start) / PAGE_SIZE;
@@ -10239,6 +10291,7 @@ NV_STATUS uvm_va_block_evict_chunks(uvm_va_block_t *va_block,
 
         uvm_pmm_gpu_mark_chunk_evicted(&gpu->pmm, gpu_state->chunks[i]);
         gpu_state->chunks[i] = NULL;
+        gpu_state->colored.valid = false;
     }
 
 out:
@@ -240,6 +240,19 @@ typedef struct
     // isn't involved, for example false sharing among peer GPUs.
     uvm_page_mask_t pte_bits[UVM_PTE_BITS_GPU_MAX];
 
+    // Cached set of pages whose physical address has transfer color
+    // colored.color, so that repeated colored copies into the same block
+    // don't recompute the color of every page. Only computed when all the
+    // pages of the block are populated on this GPU. Physical addresses only
+    // change when chunks are populated, evicted or the block is split, all
+    // of which clear colored.valid.
+    struct
+    {
+        bool valid;
+        NvU32 color;
+        uvm_page_mask_t page_mask;
+    } colored;
+
 } uvm_va_block_gpu_state_t;
 
 // TODO: Bug 1766180: Worst-case we could have one of these per system page.
@@ -457,6 +470,12 @@ void uvm_va_block_exit(void);
 // Check if a single physical chunk covers the whole block
 bool uvm_block_is_phys_contig(uvm_va_block_t *block, uvm_processor_id_t id);
 
+// Returns the mask of pages of the block whose physical address on the GPU
+// has the given transfer color. Returns NULL if not all pages of the block are
+// populated on the GPU. The mask is cached in the block's GPU state until its
+// physical pages change. The block lock must be held.
+const uvm_page_mask_t *uvm_va_block_gpu_colored_page_mask(uvm_va_block_t *block, uvm_gpu_t *gpu, NvU32 color);
+
 // Copies colored data between two blocks based on masked region provided
 NV_STATUS block_copy_colored_pages_between(uvm_va_block_t *src_block,
                                             uvm_va_block_t *dest_block,
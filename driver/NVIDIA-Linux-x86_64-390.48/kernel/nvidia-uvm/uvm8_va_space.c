@@ -185,6 +185,9 @@ NV_STATUS uvm_va_space_create(struct inode *inode, struct file *filp)
 
     va_space->test_page_prefetch_enabled = true;
 
+    uvm_colored_fences_init(va_space);
+    uvm_host_registered_init(va_space);
+
     init_tools_data(va_space);
 
     uvm_va_space_down_write(va_space);
@@ -342,6 +345,9 @@ void uvm_va_space_destroy(struct file *filp)
 
     uvm_hmm_mirror_unregister(va_space);
 
+    uvm_colored_fences_deinit(va_space);
+    uvm_host_registered_deinit(va_space);
+
     uvm_processor_mask_copy(&retained_gpus, &va_space->registered_gpus);
     bitmap_copy(va_space->enabled_peers_teardown, va_space->enabled_peers, UVM_MAX_UNIQUE_GPU_PAIRS);
 
@@ -131,6 +131,40 @@ struct uvm_gpu_va_space_struct
     bool ats_enabled;
 };
 
+// Maximum number of asynchronous colored memcpy/memset operations in flight
+// per VA space. See UVM_MEMCPY_COLORED.
+#define UVM_MAX_COLORED_FENCES 64
+
+typedef struct
+{
+    // Handle returned to userspace. 0 if the slot was never used.
+    NvU64 handle;
+
+    // Pending work of the operation
+    uvm_tracker_t tracker;
+
+    // Host pages the operation DMAs from or to (uvm_colored_pins_t). They
+    // stay pinned until the tracker completes.
+    struct list_head pins;
+} uvm_colored_fence_t;
+
+// Host virtual address range pinned by UVM_HOST_REGISTER. Colored copies from
+// and to the range reuse its pages instead of pinning them on every copy.
+typedef struct
+{
+    // [start, end] of the range, page aligned
+    uvm_range_tree_node_t node;
+
+    // Address space the range was registered in
+    struct mm_struct *mm;
+
+    // One pinned page per PAGE_SIZE of the range
+    struct page **pages;
+
+    // Entry in host_registered.lru
+    struct list_head lru_node;
+} uvm_host_registered_range_t;
+
 struct uvm_va_space_struct
 {
     // Mask of gpus registered with the va space
@@ -274,6 +308,25 @@ struct uvm_va_space_struct
 
     bool test_page_prefetch_enabled;
 
+    // Asynchronous colored memcpy/memset operations. Handles increase
+    // monotonically and handle n is tracked in fences[n % UVM_MAX_COLORED_FENCES].
+    // Protected by colored.lock.
+    struct {
+        uvm_mutex_t lock;
+        NvU64 last_fence;
+        uvm_colored_fence_t fences[UVM_MAX_COLORED_FENCES];
+    } colored;
+
+    // Host ranges pinned by UVM_HOST_REGISTER, in least recently used order.
+    // Once more than uvm_host_register_max_mb are pinned, the least recently
+    // used ranges are unpinned again. Protected by host_registered.lock.
+    struct {
+        uvm_mutex_t lock;
+        uvm_range_tree_t tree;
+        struct list_head lru;
+        NvU64 num_pages;
+    } host_registered;
+
 #if defined(NV_PNV_NPU2_INIT_CONTEXT_PRESENT)
     // TODO: Bug 1896767: This is an unsafe temporary ATS bringup hack to
     //       unblock testing while we get the proper fix in place.
@@ -302,6 +355,26 @@ struct uvm_va_space_struct
 NV_STATUS uvm_va_space_create(struct inode *inode, struct file *filp);
 void uvm_va_space_destroy(struct file *filp);
 
+// Initialize/Tear down tracking of asynchronous colored memcpy/memset.
+// Deinit waits for all outstanding operations and must be called with the VA
+// space lock held in write mode before the GPUs are unregistered.
+void uvm_colored_fences_init(uvm_va_space_t *va_space);
+void uvm_colored_fences_deinit(uvm_va_space_t *va_space);
+
+// Initialize/Tear down the registry of host ranges pinned by UVM_HOST_REGISTER.
+// Deinit unpins all the ranges.
+void uvm_host_registered_init(uvm_va_space_t *va_space);
+void uvm_host_registered_deinit(uvm_va_space_t *va_space);
+
+// Looks up num_pages pages of the current process starting at start in the
+// host registry. If they are all covered by a single registered range, a
+// reference is taken on each of them, they are stored in pages and true is
+// returned. Otherwise false is returned and the caller has to pin the pages.
+bool uvm_host_registered_get_pages(uvm_va_space_t *va_space,
+                                   NvU64 start,
+                                   size_t num_pages,
+                                   struct page **pages);
+
 // All VA space locking should be done with these wrappers. They're macros so
 // lock assertions are attributed to line numbers correctly.
 
@@ -86,6 +86,15 @@ void uvm_hal_volta_arch_init_properties(uvm_gpu_t *gpu)
    // But during transfer memory, we need to be color aware.
    // For kernel coloring, everythng is transparent to userspace application and hence
    // it needs to be color aware.
+
+    // Cache Vertically Split
+    // color = ((phys_addr >> 12) ^ (phys_addr >> 15) ^ (phys_addr >> 16) ^
+    //          (phys_addr >> 18) ^ (phys_addr >> 20) ^ (phys_addr >> 21) ^
+    //          (phys_addr >> 23) ^ (phys_addr >> 26) ^ (phys_addr >> 28) ^
+    //          (phys_addr >> 29) ^ (phys_addr >> 30)) & 0x1;
+    gpu->color_xor_masks[0] = 0x74b59ULL << 12;
+    gpu->num_color_xor_masks = 1;
+
 #if defined(UVM_TEST_MEM_COLORING)
 
     gpu->num_allocation_mem_colors = 1;
@@ -140,18 +140,10 @@ uvm_mmu_mode_hal_t *uvm_hal_mmu_mode_volta(NvU32 big_page_size)
 static NvU32 uvm_hal_volta_mmu_phys_addr_to_true_color(uvm_gpu_t *gpu, NvU64 phys_addr)
 {
     NvU32 color;
-    bool bit0;
 
     UVM_ASSERT(uvm_gpu_supports_coloring(gpu));
 
-    //Cache Vertically Split
-    //bit0 = ((phys_addr >> 12) ^ (phys_addr >> 15) ^ (phys_addr >> 16) ^ 
-    //        (phys_addr >> 18) ^ (phys_addr >> 20) ^ (phys_addr >> 21) ^ 
-    //        (phys_addr >> 23) ^ (phys_addr >> 26) ^ (phys_addr >> 28) ^ 
-    //        (phys_addr >> 29) ^ (phys_addr & 30) & 0x1;
-
-    bit0 = hweight_long((NvU32)(phys_addr >> 12) & 0x74b59) & 0x1;
-    color = bit0;
+    color = uvm_gpu_phys_addr_to_color(gpu, phys_addr);
 
     // Transfer color represent the true number of total colors
     UVM_ASSERT(color < gpu->num_transfer_mem_colors);
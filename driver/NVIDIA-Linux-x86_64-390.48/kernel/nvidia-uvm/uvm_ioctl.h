@@ -969,7 +969,9 @@ typedef struct
 // TODO: Add support for application selecting multiple colors at once.
 
 //
-// Returns the number of colors present on the gpu
+// Returns the number of colors present on the gpu and the physical address
+// XOR masks of its color function (bit i of a color is the parity of
+// address & colorMasks[i])
 //
 
 //
@@ -981,6 +983,8 @@ typedef struct
     NvProcessorUuid destinationUuid;                            // IN
     NvU32           numColors;                                  // OUT
     NvU64           maxLength            NV_ALIGN_BYTES(8);     // OUT
+    NvU32           numColorMasks;                              // OUT
+    NvU64           colorMasks[UVM_MAX_COLOR_XOR_MASKS] NV_ALIGN_BYTES(8); // OUT
     NV_STATUS       rmStatus;                                   // OUT
 } UVM_GET_DEVICE_COLOR_INFO_PARAMS;
 
@@ -1033,6 +1037,16 @@ typedef struct
 // UvmMemcpyColored
 //
 
+// With UVM_COLORED_FLAGS_ASYNC set, UVM_MEMCPY_COLORED and UVM_MEMSET_COLORED
+// return as soon as the work has been pushed to the copy engine. The returned
+// fence must be waited upon (UVM_WAIT_COLORED_FENCE) before the source is
+// modified or the destination is read by the CPU. Pageable host memory being
+// copied stays pinned till then. Otherwise fence is 0.
+#define UVM_COLORED_FLAGS_ASYNC                                     0x1
+
+// UVM_WAIT_COLORED_FENCE only checks for completion, doesn't block
+#define UVM_COLORED_FLAGS_QUERY                                     0x1
+
 #define UVM_MEMCPY_COLORED                                          UVM_IOCTL_BASE(2045)
 typedef struct
 {
@@ -1041,6 +1055,8 @@ typedef struct
     NvU64           destBase          NV_ALIGN_BYTES(8); // IN
     NvProcessorUuid destUuid;                            // IN
     NvU64           length            NV_ALIGN_BYTES(8); // IN
+    NvU32           flags;                               // IN
+    NvU64           fence             NV_ALIGN_BYTES(8); // OUT
     NV_STATUS       rmStatus;                            // OUT
 } UVM_MEMCPY_COLORED_PARAMS;
 
@@ -1063,9 +1079,93 @@ typedef struct
     NvProcessorUuid uuid;                                // IN
     NvU64           length            NV_ALIGN_BYTES(8); // IN
     NvU8            value;                               // IN
+    NvU32           flags;                               // IN
+    NvU64           fence             NV_ALIGN_BYTES(8); // OUT
     NV_STATUS       rmStatus;                            // OUT
 } UVM_MEMSET_COLORED_PARAMS;
 
+//
+// Waits for (or with UVM_COLORED_FLAGS_QUERY, checks) completion of
+// asynchronous colored memcpy/memset. All operations issued up to and
+// including the one that returned the fence are covered.
+//
+
+//
+// UvmWaitColoredFence
+//
+
+#define UVM_WAIT_COLORED_FENCE                                      UVM_IOCTL_BASE(2041)
+typedef struct
+{
+    NvU64           fence             NV_ALIGN_BYTES(8); // IN
+    NvU32           flags;                               // IN
+    NvBool          completed;                           // OUT
+    NV_STATUS       rmStatus;                            // OUT
+} UVM_WAIT_COLORED_FENCE_PARAMS;
+
+//
+// Same as UVM_MEMCPY_COLORED but for a list of (src, dest, length) ranges
+// that all are copied in the same direction. All ranges are processed under
+// a single lock acquisition and a single fence covers all of them.
+//
+
+//
+// UvmMemcpyColoredBatch
+//
+
+#define UVM_MEMCPY_COLORED_BATCH_MAX_DESCS                          4096
+
+typedef struct
+{
+    NvU64           srcBase           NV_ALIGN_BYTES(8);
+    NvU64           destBase          NV_ALIGN_BYTES(8);
+    NvU64           length            NV_ALIGN_BYTES(8);
+} UvmMemcpyColoredDesc;
+
+#define UVM_MEMCPY_COLORED_BATCH                                    UVM_IOCTL_BASE(2040)
+typedef struct
+{
+    NvU64           descs             NV_ALIGN_BYTES(8); // IN (UvmMemcpyColoredDesc *)
+    NvU32           numDescs;                            // IN
+    NvProcessorUuid srcUuid;                             // IN
+    NvProcessorUuid destUuid;                            // IN
+    NvU32           flags;                               // IN
+    NvU64           fence             NV_ALIGN_BYTES(8); // OUT
+    NV_STATUS       rmStatus;                            // OUT
+} UVM_MEMCPY_COLORED_BATCH_PARAMS;
+
+//
+// Pins the pages of a host virtual address range until it is unregistered.
+// Colored copies from and to the range then skip pinning its pages on every
+// copy. The range must stay mapped until it is unregistered. Registered ranges
+// are unpinned in least recently used order if more than the
+// uvm_host_register_max_mb module parameter would be pinned, in which case
+// copies pin the pages on demand again.
+//
+
+//
+// UvmHostRegister
+//
+
+#define UVM_HOST_REGISTER                                           UVM_IOCTL_BASE(2039)
+typedef struct
+{
+    NvU64           base              NV_ALIGN_BYTES(8); // IN
+    NvU64           length            NV_ALIGN_BYTES(8); // IN
+    NV_STATUS       rmStatus;                            // OUT
+} UVM_HOST_REGISTER_PARAMS;
+
+//
+// UvmHostUnregister
+//
+
+#define UVM_HOST_UNREGISTER                                         UVM_IOCTL_BASE(2038)
+typedef struct
+{
+    NvU64           base              NV_ALIGN_BYTES(8); // IN
+    NV_STATUS       rmStatus;                            // OUT
+} UVM_HOST_UNREGISTER_PARAMS;
+
 //
 // Temporary ioctls which should be removed before UVM 8 release
 // Number backwards from 2047 - highest custom ioctl function number
@@ -305,13 +305,16 @@ __global__ FGPU_DEFINE_KERNEL(im2col_gpu_kernel, const int n, const Dtype* data_
       data_col_ptr += (c_col * height_col + h_col) * width_col + w_col;
       const Dtype* data_im_ptr = data_im;
       data_im_ptr += (c_im * height + h_offset) * width + w_offset;
+      // Kernel window rows are short, so mostly within one device page
+      fgpu_color_page_cache_t im_cache = FGPU_COLOR_PAGE_CACHE_INIT;
       for (int i = 0; i < kernel_h; ++i) {
         for (int j = 0; j < kernel_w; ++j) {
           int h_im = h_offset + i * dilation_h;
           int w_im = w_offset + j * dilation_w;
           FGPU_COLOR_STORE(ctx, data_col_ptr,
               (h_im >= 0 && w_im >= 0 && h_im < height && w_im < width) ?
-              FGPU_COLOR_LOAD(ctx, &data_im_ptr[i * dilation_h * width + j * dilation_w]) : 0);
+              FGPU_COLOR_LOAD_CACHED(ctx, &im_cache,
+                  &data_im_ptr[i * dilation_h * width + j * dilation_w]) : 0);
           data_col_ptr += height_col * width_col;
         }
       }
@@ -532,6 +532,11 @@ __global__ FGPU_DEFINE_KERNEL(gemm_kernel, const CBLAS_TRANSPOSE TransA,
     // that is computed by the thread
     Dtype Csub = 0;
 
+    // Consecutive tiles lie in the same device page only when walking along
+    // a row (A untransposed/B transposed). Otherwise each load is a new page.
+    fgpu_color_page_cache_t a_cache = FGPU_COLOR_PAGE_CACHE_INIT;
+    fgpu_color_page_cache_t b_cache = FGPU_COLOR_PAGE_CACHE_INIT;
+
     // Loop over all the sub-matrices of A and B    
     // required to compute the block sub-matrix
     for (int aCol = aColBegin, bRow = bRowBegin, istep=0;
@@ -558,12 +563,16 @@ __global__ FGPU_DEFINE_KERNEL(gemm_kernel, const CBLAS_TRANSPOSE TransA,
         // to shared memory; each thread loads
         // one element of each matrix
         if ((aRow + ty < hA) && (aCol + tx < wA))
-          As[ty][tx] = FGPU_COLOR_LOAD(ctx, &A[aIndex]);
+          As[ty][tx] = (TransA == CblasNoTrans) ?
+            FGPU_COLOR_LOAD_CACHED(ctx, &a_cache, &A[aIndex]) :
+            FGPU_COLOR_LOAD(ctx, &A[aIndex]);
         else
           As[ty][tx] = 0;
 
         if ((bRow + ty < hB) && (bCol + tx < wB))
-          Bs[ty][tx] = FGPU_COLOR_LOAD(ctx, &B[bIndex]);
+          Bs[ty][tx] = (TransB == CblasNoTrans) ?
+            FGPU_COLOR_LOAD(ctx, &B[bIndex]) :
+            FGPU_COLOR_LOAD_CACHED(ctx, &b_cache, &B[bIndex]);
         else
           Bs[ty][tx] = 0;
 
@@ -640,11 +649,14 @@ __global__ FGPU_DEFINE_KERNEL(gemv_kernel, const CBLAS_TRANSPOSE TransA,
     Dtype sum = 0;
     int row = _blockIdx.x;
     Dtype *y_addr = FGPU_COLOR_TRANSLATE_ADDR(ctx, &y[row]);
+    // Transposed A is walked along a column, a new page on each load
+    fgpu_color_page_cache_t x_cache = FGPU_COLOR_PAGE_CACHE_INIT;
+    fgpu_color_page_cache_t a_cache = FGPU_COLOR_PAGE_CACHE_INIT;
 
     for (int col = threadIdx.x; col < wA; col += blockDim.x) {
-      Dtype x_val = FGPU_COLOR_LOAD(ctx, &x[col]);
+      Dtype x_val = FGPU_COLOR_LOAD_CACHED(ctx, &x_cache, &x[col]);
       if (TransA == CblasNoTrans)
-        sum += FGPU_COLOR_LOAD(ctx, &A[wA * row + col]) * x_val;
+        sum += FGPU_COLOR_LOAD_CACHED(ctx, &a_cache, &A[wA * row + col]) * x_val;
       else
         sum += FGPU_COLOR_LOAD(ctx, &A[hA * col + row]) * x_val;
     }
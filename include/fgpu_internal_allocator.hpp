@@ -413,6 +413,7 @@ typedef struct allocator allocator_t;
 allocator_t *allocator_init(void *buf, size_t size, size_t alignment);
 void *allocator_alloc(allocator_t *ctx, size_t size);
 void allocator_free(allocator_t *ctx, void *address);
+size_t allocator_get_used(allocator_t *ctx);
 void allocator_deinit(allocator_t *ctx);
 
 #endif /* __FGPU_INTERNAL_ALLOCATOR_HPP__ */
@@ -14,12 +14,33 @@
 /* Maximum number of colors supported */
 #define FGPU_MAX_NUM_COLORS             8
 
+/* Maximum number of hash function masks (DRAM/L2 cache) in a device profile */
+#define FGPU_PROFILE_MAX_MASKS          32
+
+/* Maximum length of device name in a device profile (Same as cudaDeviceProp) */
+#define FGPU_PROFILE_DEVICE_NAME_LEN    256
+
 /* Maximum number of persistent blocks */
 #define FGPU_MAX_NUM_PBLOCKS            6400
 
 /* Maximum number of pending CUDA tasks */
 #define FGPU_MAX_PENDING_TASKS          100
 
+/* Maximum number of processes that can wait to launch on a color */
+#define FGPU_MAX_LAUNCH_WAITERS         64
+
+/* Interval (usec) at which launch waiters check for waiters that have died */
+#define FGPU_LAUNCH_REAP_INTERVAL       100000
+
+/* Maximum number of processes that can reserve GPU time (all colors) */
+#define FGPU_MAX_NUM_CLIENTS            64
+
+/* Number of records in device trace ring (Must be power of 2) */
+#define FGPU_TRACE_NUM_RECORDS          (1 << 16)
+
+/* Copies per colored memcpy batch ioctl (Upto UVM_MEMCPY_COLORED_BATCH_MAX_DESCS) */
+#define FGPU_MEMCPY_BATCH_SIZE          256
+
 /* Can be set to -1 if no preference. Preference is like a hint */
 #define FGPU_PREFERRED_NUM_COLORS	2
 
@@ -0,0 +1,98 @@
+/*
+ * Host emulation of the persistent threads model. Kernels defined with
+ * FGPU_DEFINE_KERNEL() are compiled as host functions (FGPU_EMULATION) and
+ * executed by host threads (emulated pblocks) following the same block
+ * dispatch protocol as the device code. Launches go through the same
+ * scheduling code as the runtime, so that it can be exercised without a GPU.
+ */
+#ifndef __FGPU_INTERNAL_EMULATOR_HPP__
+#define __FGPU_INTERNAL_EMULATOR_HPP__
+
+#include <pthread.h>
+
+#include <functional>
+#include <utility>
+
+#include <fractional_gpu.hpp>
+#include <fgpu_internal_scheduler.hpp>
+#include <fgpu_internal_telemetry.hpp>
+
+/* Entry of a kernel. Called once by each emulated pblock */
+typedef std::function<void(fgpu_dev_ctx_t dev_fctx)> fgpu_emu_kernel_t;
+
+/* Emulated device along with the per color state kept by runtime */
+typedef struct fgpu_emu_device {
+    int num_sm;
+    int num_colors;
+    int max_num_threads_per_sm;
+    int num_pblocks_per_sm;         /* In place of occupancy reported by CUDA */
+    std::pair<uint32_t, uint32_t> color_to_sms[FGPU_MAX_NUM_COLORS];
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+    /* In place of host indicators */
+    struct fgpu_preempt_indicator preempt[FGPU_MAX_NUM_COLORS];
+#endif
+
+    /* Same arbitration as host ctx */
+    fgpu_color_streams_t streams;
+
+    /* Each client takes a slot */
+    fgpu_telemetry_t telemetry;
+    int num_clients;
+} fgpu_emu_device_t;
+
+/* An emulated process */
+typedef struct fgpu_emu_client {
+    fgpu_emu_device_t *dev;
+    fgpu_launch_client_t launch;
+
+    /* In place of device memory */
+    fgpu_bindex_t bindex;
+    int cur_index;
+
+    uint64_t execution;             /* usec, of last launch */
+} fgpu_emu_client_t;
+
+/* Pblock being emulated by a thread */
+typedef struct fgpu_emu_pblock {
+    int pblock;
+    int smid;
+} fgpu_emu_pblock_t;
+
+int fgpu_emu_device_init(fgpu_emu_device_t *dev, int num_sm, int num_colors,
+        int max_num_threads_per_sm, int num_pblocks_per_sm);
+void fgpu_emu_device_deinit(fgpu_emu_device_t *dev);
+int fgpu_emu_client_init(fgpu_emu_client_t *client, fgpu_emu_device_t *dev,
+        int color, int priority, uint64_t deadline);
+void fgpu_emu_client_set_budget(fgpu_emu_client_t *client, uint64_t budget,
+        uint64_t period);
+const fgpu_emu_pblock_t *fgpu_emu_get_pblock(void);
+int fgpu_emu_launch_kernel(fgpu_emu_client_t *client, dim3 _gridDim,
+        dim3 _blockDim, const fgpu_emu_kernel_t &func);
+#if defined(FGPU_PREEMPTION_ENABLED)
+int fgpu_emu_launch_resumable_kernel(fgpu_emu_client_t *client,
+        fgpu_kernel_state_t *state, dim3 _gridDim, dim3 _blockDim,
+        const fgpu_emu_kernel_t &func);
+int fgpu_emu_preempt_color(fgpu_emu_device_t *dev, int color);
+int fgpu_emu_resume_color(fgpu_emu_device_t *dev, int color);
+#endif
+
+/*
+ * Same as FGPU_LAUNCH_KERNEL() but on the emulated device. Launch is
+ * synchronous. Arguments are copied by each pblock as on the device.
+ */
+#define FGPU_EMU_LAUNCH_KERNEL(client, func, _gridDim, _blockDim, ...)      \
+    fgpu_emu_launch_kernel(client, _gridDim, _blockDim,                     \
+            [&](fgpu_dev_ctx_t dev_fctx) { func(dev_fctx, __VA_ARGS__); })
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+
+/* Same as FGPU_LAUNCH_RESUMABLE_KERNEL() but on the emulated device */
+#define FGPU_EMU_LAUNCH_RESUMABLE_KERNEL(state, client, func, _gridDim,     \
+        _blockDim, ...)                                                     \
+    fgpu_emu_launch_resumable_kernel(client, state, _gridDim, _blockDim,    \
+            [&](fgpu_dev_ctx_t dev_fctx) { func(dev_fctx, __VA_ARGS__); })
+
+#endif /* FGPU_PREEMPTION_ENABLED */
+
+#endif /* __FGPU_INTERNAL_EMULATOR_HPP__ */
@@ -10,10 +10,12 @@
 
 int fgpu_memory_set_colors_info(int device, int color, size_t length, cudaStream_t stream);
 void fgpu_memory_deinit(void);
+int fgpu_memory_get_device_color_masks(int *num_color_masks, uint64_t *color_masks);
 
 #if defined(FGPU_USER_MEM_COLORING_ENABLED)
 
-int fgpu_get_memory_info(uintptr_t *start_virt_addr, uintptr_t *start_idx);
+int fgpu_get_memory_info(uintptr_t *start_virt_addr, uintptr_t *start_idx,
+                         fgpu_color_func_t *color_func);
 
 #endif /* FGPU_USER_MEM_COLORING_ENABLED */
 
@@ -23,5 +25,10 @@ int fgpu_memory_copy_async_internal(void *dst, const void *src, size_t count,
                                     enum fgpu_memory_copy_type type,
                                     cudaStream_t stream);
 int fgpu_memory_memset_async_internal(void *address, int value, size_t count, cudaStream_t stream);
+int fgpu_memory_copy_batch_internal(const fgpu_memory_copy_desc_t *descs, int num_descs,
+                                    enum fgpu_memory_copy_type type,
+                                    cudaStream_t stream);
+uint64_t fgpu_memory_get_last_fence_internal(void);
+int fgpu_memory_wait_fence_internal(uint64_t fence, bool block);
 
 #endif /* __FGPU_INTERNAL_MEMORY_HPP__ */
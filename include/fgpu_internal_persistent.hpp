@@ -2,6 +2,9 @@
 #ifndef __FGPU_INTERNAL_PERSISTENT_HPP__
 #define __FGPU_INTERNAL_PERSISTENT_HPP__
 
+#include <errno.h>
+#include <stdio.h>
+
 #include <fgpu_internal_common.hpp>
 
 typedef struct __align__(FGPU_DEVICE_CACHELINE_SIZE) fgpu_bindex {
@@ -22,14 +25,100 @@ struct __align__(FGPU_DEVICE_CACHELINE_SIZE) fgpu_indicator {
     int started;
 };
 
+/* Set by host to ask pblocks of a color to stop picking up new blocks */
+struct __align__(FGPU_DEVICE_CACHELINE_SIZE) fgpu_preempt_indicator {
+    int requested;
+};
+
 /* Memory where persistent kernel indicates to host that it successfully launched */
 typedef struct fgpu_indicators {
     struct fgpu_indicator indicators[FGPU_MAX_NUM_PBLOCKS];
+    struct fgpu_preempt_indicator preempt[FGPU_MAX_NUM_COLORS];
 } fgpu_indicators_t;
 
 /* Forward declaration */
 typedef struct fgpu_dev_ctx fgpu_dev_ctx_t;
 
+/* Shape of a persistent launch. Shared by runtime and emulator */
+typedef struct fgpu_launch_geometry {
+    uint32_t num_blocks;            /* Logical blocks (user provided grid) */
+    uint32_t num_threads;           /* Threads per block */
+    uint32_t num_pblocks;           /* Persistent blocks launched on all SMs */
+    uint32_t num_active_pblocks;    /* Persistent blocks on SMs of the color */
+} fgpu_launch_geometry_t;
+
+/* Validates user provided dimensions */
+inline int fgpu_check_launch_dims(dim3 gridDim, dim3 blockDim,
+        int max_num_threads_per_sm, fgpu_launch_geometry_t *geo)
+{
+    geo->num_blocks = gridDim.x * gridDim.y * gridDim.z;
+    if (geo->num_blocks == 0) {
+        fprintf(stderr, "FGPU:Invalid number of blocks\n");
+        return -EINVAL;
+    }
+
+    geo->num_threads = blockDim.x * blockDim.y * blockDim.z;
+    if (geo->num_threads == 0 || geo->num_threads > (uint32_t)max_num_threads_per_sm) {
+        fprintf(stderr, "Invalid number of threads in a block\n");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Number of pblocks to launch given the occupancy of kernel */
+inline int fgpu_set_launch_geometry(int num_pblocks_per_sm, int num_sm,
+        uint32_t start_sm, uint32_t end_sm, fgpu_launch_geometry_t *geo)
+{
+    if (num_pblocks_per_sm == 0) {
+        fprintf(stderr, "FGPU:Invalid grid/block/thread configuration\n");
+        return -EINVAL;
+    }
+
+    geo->num_pblocks = num_pblocks_per_sm * num_sm;
+
+    if (geo->num_pblocks > FGPU_MAX_NUM_PBLOCKS) {
+        fprintf(stderr, "FGPU:FGPU_MAX_NUM_PBLOCKS is set too low\n");
+        return -EINVAL;
+    }
+
+    geo->num_active_pblocks = num_pblocks_per_sm * (end_sm - start_sm + 1);
+
+    return 0;
+}
+
+/*
+ * SMs assigned to a color. Due to integer division, last color gets the
+ * leftover SMs.
+ */
+inline void fgpu_get_color_sms(int color, int num_colors, int num_sm,
+        uint32_t *start_sm, uint32_t *end_sm)
+{
+    int sm_per_color = num_sm / num_colors;
+
+    *start_sm = color * sm_per_color;
+    *end_sm = (color + 1) * sm_per_color - 1;
+    if (color == num_colors - 1)
+        *end_sm = num_sm - 1;
+}
+
+/* Converts linear logical block index to 3D index */
+__host__ __device__ __forceinline__
+uint3 fgpu_get_blockIdx3D(dim3 gridDim, int _blockIdx1D)
+{
+    uint blocks_left;
+    uint num2Dblocks;
+    uint3 _blockIdx3D;
+
+    num2Dblocks = gridDim.x * gridDim.y;
+    _blockIdx3D.z = _blockIdx1D / (num2Dblocks);
+    blocks_left = _blockIdx1D - (_blockIdx3D.z * num2Dblocks);
+    _blockIdx3D.y = blocks_left / gridDim.x;
+    _blockIdx3D.x = blocks_left - _blockIdx3D.y * gridDim.x;
+
+    return _blockIdx3D;
+}
+
 void fgpu_set_ctx_dims(fgpu_dev_ctx_t *ctx, int _gridDim, int _blockDim);
 void fgpu_set_ctx_dims(fgpu_dev_ctx_t *ctx, dim3 _gridDim, dim3 _blockDim);
 void fgpu_set_ctx_dims(fgpu_dev_ctx_t *ctx, uint3 _gridDim, uint3 _blockDim);
@@ -0,0 +1,54 @@
+/* Device profile, as exported by the reverse engineering code */
+#ifndef __FGPU_INTERNAL_PROFILE_HPP__
+#define __FGPU_INTERNAL_PROFILE_HPP__
+
+#include <inttypes.h>
+
+#include <fgpu_internal_config.hpp>
+
+/*
+ * Profile file is a text file of "key = value" lines ('#' starts a comment).
+ * Masks are comma separated physical address XOR masks (same format as the
+ * uvm_color_xor_masks module parameter). Keys not known are ignored so that
+ * older runtimes can read newer profiles of the same major version.
+ */
+#define FGPU_PROFILE_VERSION            1
+
+/* Color masks must not have bits in the lowest 4KB (Same as FGPU_DEVICE_COLOR_SHIFT) */
+#define FGPU_PROFILE_COLOR_SHIFT        12
+
+/* Maximum number of color masks (Same as FGPU_MAX_MEM_COLOR_BITS) */
+#define FGPU_PROFILE_MAX_COLOR_MASKS    4
+
+typedef struct fgpu_device_profile {
+    uint32_t version;
+    char device[FGPU_PROFILE_DEVICE_NAME_LEN];      /* Name as reported by CUDA */
+    int min_bit;                                    /* Physical address bits examined */
+    int max_bit;
+    int num_dram_masks;                             /* DRAM bank function */
+    uint64_t dram_masks[FGPU_PROFILE_MAX_MASKS];
+    int num_cache_masks;                            /* L2 cache set function */
+    uint64_t cache_masks[FGPU_PROFILE_MAX_MASKS];
+    int num_color_masks;                            /* Usable for coloring (Any prefix) */
+    uint64_t color_masks[FGPU_PROFILE_MAX_COLOR_MASKS];
+    uint32_t l2_cache_line_size;                    /* Bytes */
+    uint32_t l2_cache_word_size;                    /* Bytes */
+    uint32_t l2_cache_line_words;                   /* Measured (0 if not known) */
+    double dram_fast_latency;                       /* Cycles (NAN if not known) */
+    double dram_slow_latency;                       /* Row buffer conflict */
+    double dram_threshold;
+    double cache_hit_latency;
+    double cache_threshold;
+} fgpu_device_profile_t;
+
+/* Host only (no CUDA needed) */
+void fgpu_profile_init(fgpu_device_profile_t *profile);
+int fgpu_profile_write(const char *path, const fgpu_device_profile_t *profile);
+int fgpu_profile_load(const char *path, fgpu_device_profile_t *profile);
+int fgpu_profile_format_masks(char *buf, size_t len, const uint64_t *masks, int num_masks);
+int fgpu_profile_derive_color_masks(fgpu_device_profile_t *profile,
+                                    const uint64_t *common_masks, int num_common_masks);
+bool fgpu_profile_check_color_masks(const fgpu_device_profile_t *profile,
+                                    const uint64_t *masks, int num_masks);
+
+#endif /* __FGPU_INTERNAL_PROFILE_HPP__ */
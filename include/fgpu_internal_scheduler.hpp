@@ -0,0 +1,129 @@
+/*
+ * Data structures used for arbitrating launches within a color. Backend
+ * agnostic: used by both the runtime and the emulator.
+ */
+#ifndef __FGPU_INTERNAL_SCHEDULER_HPP__
+#define __FGPU_INTERNAL_SCHEDULER_HPP__
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <fgpu_internal_config.hpp>
+#include <fgpu_internal_telemetry.hpp>
+
+/* Deadline value indicating that launch has no deadline */
+#define FGPU_NO_DEADLINE        0
+
+/*
+ * A process waiting to launch on a color stream.
+ * Queue lives in shared memory, so entries are slots rather than linked nodes
+ * (pointers are not valid across processes).
+ */
+typedef struct fgpu_launch_waiter {
+    bool valid;
+    pid_t pid;                      /* Removed if process dies while waiting */
+    int priority;                   /* Higher value is served first */
+    uint64_t deadline;              /* Absolute (usec, CLOCK_MONOTONIC) */
+    uint64_t seq;                   /* Arrival order. Used for tie breaking */
+} fgpu_launch_waiter_t;
+
+typedef struct fgpu_launch_queue {
+    uint64_t next_seq;
+    int size;
+    fgpu_launch_waiter_t waiters[FGPU_MAX_LAUNCH_WAITERS];
+} fgpu_launch_queue_t;
+
+/*
+ * Token bucket limiting GPU time used by a process. Tokens (usec of GPU time)
+ * worth budget are added every period and capped at budget. Bucket can go
+ * negative as kernel durations are only known after completion.
+ */
+typedef struct fgpu_budget {
+    uint64_t budget;                /* usec per period */
+    uint64_t period;                /* usec */
+    int64_t tokens;
+    uint64_t last_refill;
+} fgpu_budget_t;
+
+/*
+ * Only one outstanding operation in each color stream. When stream is busy,
+ * launches wait in the launch queue of the color and the stream is handed to
+ * the top of the queue.
+ */
+typedef struct fgpu_color_streams {
+    pthread_mutex_t lock;
+    pthread_cond_t cond[FGPU_MAX_NUM_COLORS];
+    bool is_free[FGPU_MAX_NUM_COLORS];
+    fgpu_launch_queue_t queues[FGPU_MAX_NUM_COLORS];
+} fgpu_color_streams_t;
+
+/* Launch state of a process (or of an emulated client) */
+typedef struct fgpu_launch_client {
+    int color;
+    int priority;
+    uint64_t rel_deadline;          /* usec, FGPU_NO_DEADLINE if none */
+
+    /* GPU time budget. Only enforced if set */
+    bool is_budget_set;
+    fgpu_budget_t budget;
+
+    uint64_t launch_start;          /* Time stream was acquired by last launch */
+    uint64_t queue_wait;            /* usec last launch waited for stream */
+
+    /* Counters of color and of client (NULL if not tracked) */
+    fgpu_telemetry_counters_t *color_counters;
+    fgpu_telemetry_counters_t *counters;
+} fgpu_launch_client_t;
+
+/* Utilization is represented in parts per million */
+#define FGPU_UTILIZATION_FULL   1000000
+
+/* A process that has reserved utilization of a color (admission control) */
+typedef struct fgpu_client {
+    bool valid;
+    pid_t pid;
+    int color;
+    uint32_t utilization;
+} fgpu_client_t;
+
+/* Function declarations (caller holds the lock protecting the queue) */
+void launch_queue_init(fgpu_launch_queue_t *queue);
+int launch_queue_insert(fgpu_launch_queue_t *queue, int priority,
+        uint64_t deadline);
+int launch_queue_top(fgpu_launch_queue_t *queue);
+void launch_queue_remove(fgpu_launch_queue_t *queue, int slot);
+void launch_queue_wait(pthread_cond_t *cond, pthread_mutex_t *lock);
+uint64_t launch_queue_now_usec(void);
+
+void budget_init(fgpu_budget_t *b, uint64_t budget, uint64_t period,
+        uint64_t now);
+void budget_consume(fgpu_budget_t *b, uint64_t usage, uint64_t now);
+uint64_t budget_get_delay(fgpu_budget_t *b, uint64_t now);
+
+int color_streams_init(fgpu_color_streams_t *streams, int num_colors,
+        bool pshared);
+void color_streams_deinit(fgpu_color_streams_t *streams, int num_colors);
+
+/* Phases of a launch, in order of calling */
+void launch_client_init(fgpu_launch_client_t *client, int color, int priority,
+        uint64_t rel_deadline);
+void launch_client_set_budget(fgpu_launch_client_t *client, uint64_t budget,
+        uint64_t period);
+void launch_wait_for_budget(fgpu_launch_client_t *client);
+int launch_acquire_stream(fgpu_color_streams_t *streams,
+        fgpu_launch_client_t *client);
+void launch_start(fgpu_launch_client_t *client, int num_pblocks,
+        int num_active_pblocks);
+void launch_complete(fgpu_color_streams_t *streams,
+        fgpu_launch_client_t *client);
+bool launch_get_resume_point(int start_block, int num_claimed, int num_blocks,
+        int *next_block);
+
+/* Caller holds the lock protecting clients table */
+int admission_reserve(fgpu_client_t *clients, int color, uint32_t utilization,
+        uint32_t threshold);
+void admission_release(fgpu_client_t *clients, int slot);
+uint32_t admission_get_utilization(const fgpu_client_t *clients, int color);
+
+#endif /* __FGPU_INTERNAL_SCHEDULER_HPP__ */
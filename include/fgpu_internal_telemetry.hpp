@@ -0,0 +1,46 @@
+/* Telemetry shared with monitoring tools (e.g. fgpu_top) */
+#ifndef __FGPU_INTERNAL_TELEMETRY_HPP__
+#define __FGPU_INTERNAL_TELEMETRY_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <fgpu_internal_config.hpp>
+
+/*
+ * Counters only increase (except heap_used) and are updated with atomic
+ * operations without taking any lock. Monitors compute rates by sampling.
+ */
+typedef struct fgpu_telemetry_counters {
+    uint64_t kernels_launched;
+    uint64_t busy_time;             /* usec from launch till completion */
+    uint64_t queue_wait_time;       /* usec waiting for color stream */
+    uint64_t wasted_pblocks;        /* pblocks launched on SMs of other colors */
+    uint64_t bytes_copied;          /* Via fgpu_memory_copy_async() */
+    uint64_t heap_used;             /* Bytes allocated in colored heap */
+} fgpu_telemetry_counters_t;
+
+/* Per process counters. Slot is free if pid is 0 */
+typedef struct fgpu_telemetry_client {
+    pid_t pid;
+    int color;
+    fgpu_telemetry_counters_t counters;
+} fgpu_telemetry_client_t;
+
+/* Lives in shared memory right after the host context */
+typedef struct fgpu_telemetry {
+    int num_colors;
+    fgpu_telemetry_counters_t colors[FGPU_MAX_NUM_COLORS];
+    fgpu_telemetry_client_t clients[FGPU_MAX_NUM_CLIENTS];
+} fgpu_telemetry_t;
+
+/* For monitors - Maps telemetry read-only. Doesn't need fgpu_init() */
+const volatile fgpu_telemetry_t *fgpu_telemetry_attach(void);
+void fgpu_telemetry_detach(const volatile fgpu_telemetry_t *telemetry);
+
+/* Updates by library internals */
+void fgpu_telemetry_add_bytes_copied(size_t count);
+void fgpu_telemetry_set_heap_used(size_t used);
+
+#endif /* __FGPU_INTERNAL_TELEMETRY_HPP__ */
@@ -0,0 +1,45 @@
+/* Data structures used for tracing persistent blocks (host and device) */
+#ifndef __FGPU_INTERNAL_TRACE_HPP__
+#define __FGPU_INTERNAL_TRACE_HPP__
+
+#include <inttypes.h>
+
+#include <fgpu_internal_config.hpp>
+
+/* Block range used for pblocks that exited as they were on other color's SM */
+#define FGPU_TRACE_INACTIVE_BLOCK   -1
+
+/* One execution of a (range of) logical block(s) by a pblock */
+typedef struct fgpu_trace_record {
+    uint64_t start;                 /* %globaltimer (nsec) */
+    uint64_t end;
+    uint32_t smid;
+    uint32_t pblock;
+    uint32_t launch;                /* Launch sequence number within process */
+    int32_t first_block;            /* Logical block range (inclusive) */
+    int32_t last_block;
+    uint32_t valid;                 /* Written last so partial records can be skipped */
+} fgpu_trace_record_t;
+
+/* Ring of records in colored device memory. Oldest records are overwritten */
+typedef struct fgpu_trace_buffer {
+    unsigned long long head;        /* Total records ever written */
+    fgpu_trace_record_t records[FGPU_TRACE_NUM_RECORDS];
+} fgpu_trace_buffer_t;
+
+/* Header of trace dump file. Followed by 'num_records' records (oldest first) */
+#define FGPU_TRACE_FILE_MAGIC       0x46475054  /* "FGPT" */
+#define FGPU_TRACE_FILE_VERSION     1
+
+typedef struct fgpu_trace_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_records;
+    uint64_t num_dropped;           /* Overwritten because ring was full */
+} fgpu_trace_file_header_t;
+
+/* Host only (no CUDA needed) */
+int fgpu_trace_write_file(const char *path, const fgpu_trace_buffer_t *buffer);
+int fgpu_trace_convert_to_json(const char *trace_path, const char *json_path);
+
+#endif /* __FGPU_INTERNAL_TRACE_HPP__ */
@@ -5,12 +5,23 @@
 #include <inttypes.h>
 
 #include <fgpu_internal_persistent.hpp>
+#include <fgpu_internal_trace.hpp>
 
 #include <fgpu_internal_common.hpp>
 
 /* Currently only the very first device is used */
 #define FGPU_DEVICE_NUMBER  0
 
+/* Maximum number of memory color bits (Upto UVM_MAX_COLOR_XOR_MASKS) */
+#define FGPU_MAX_MEM_COLOR_BITS     4
+
+/* Device memory color function, in terms of device page frame numbers */
+typedef struct fgpu_color_func {
+    int num_bits;                                   /* Color is num_bits wide */
+    uint64_t patterns[FGPU_MAX_MEM_COLOR_BITS];     /* Color bit i is parity of pfn & patterns[i] */
+    uint32_t offsets[FGPU_MAX_MEM_COLOR_BITS];      /* Page in a group of 2^num_bits flipping bit i */
+} fgpu_color_func_t;
+
 /* This structure is context that is handed over to kernel by host */
 typedef struct fgpu_dev_ctx {
     volatile fgpu_indicators_t *d_host_indicators;  /* Used to indicate launch completion to host */
@@ -28,13 +39,66 @@ typedef struct fgpu_dev_ctx {
     int num_active_pblocks;	    /* Number of pblocks which will do computation */
     int _blockIdx;
 
+#if defined(FGPU_PREEMPTION_ENABLED)
+    volatile struct fgpu_preempt_indicator *d_preempt; /* Preemption request (NULL if not resumable) */
+    int start_block;                /* First logical block of this launch */
+#endif
+
 #if defined(FGPU_USER_MEM_COLORING_ENABLED)
     uint64_t start_virt_addr;
     uint64_t start_idx;
+    fgpu_color_func_t color_func;
+#endif
+
+#if defined(FGPU_TRACE_ENABLED)
+    fgpu_trace_buffer_t *d_trace;   /* Ring in colored memory */
+    uint32_t launch;                /* Launch sequence number */
+    /* Block being executed by pblock. Only maintained by thread 0 */
+    uint64_t trace_start;
+    int trace_first_block;
+    int trace_last_block;
 #endif
 
 } fgpu_dev_ctx_t;
 
+#if defined(FGPU_PREEMPTION_ENABLED)
+
+/* Returned by resumable launches when kernel was preempted before completion */
+#define FGPU_KERNEL_PREEMPTED   1
+
+/* Progress of a resumable kernel. Must be zero initialized before first launch */
+typedef struct fgpu_kernel_state {
+    int next_block;                 /* First logical block not yet executed */
+} fgpu_kernel_state_t;
+
+#endif /* FGPU_PREEMPTION_ENABLED */
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+
+/* Time (nsec) spent by launches of this process in each phase of launch */
+typedef struct fgpu_launch_profile {
+    uint64_t num_launches;
+    uint64_t occupancy;             /* Launch geometry (occupancy query) */
+    uint64_t budget;                /* Waiting for GPU time budget */
+    uint64_t fence;                 /* Waiting for colored memcpy/memset */
+    uint64_t queue;                 /* Waiting for color stream (launch queue) */
+    uint64_t launchpad;             /* Serialized launch (If enabled) */
+    uint64_t setup;                 /* Filling the device context */
+    uint64_t launch;                /* Kernel launch call */
+    uint64_t sync;                  /* Waiting for kernel to complete */
+    uint64_t release;               /* Releasing color stream, accounting */
+} fgpu_launch_profile_t;
+
+#endif /* FGPU_LAUNCH_PROFILE_ENABLED */
+
+/*
+ * Launch priority of a process within its color. Higher value is served first.
+ * Any integer can be used, these are just the common classes.
+ */
+#define FGPU_PRIORITY_BATCH         0
+#define FGPU_PRIORITY_REALTIME      10
+#define FGPU_DEFAULT_PRIORITY       FGPU_PRIORITY_BATCH
+
 enum fgpu_memory_copy_type {
     FGPU_COPY_CPU_TO_GPU,
     FGPU_COPY_GPU_TO_CPU,
@@ -43,19 +107,52 @@ enum fgpu_memory_copy_type {
     FGPU_COPY_DEFAULT,      /* Direction is automatically detected */
 };
 
+/* One copy of fgpu_memory_copy_batch() */
+typedef struct fgpu_memory_copy_desc {
+    void *dst;
+    const void *src;
+    size_t count;
+} fgpu_memory_copy_desc_t;
+
+/* Marks completion of memcpy/memset issued before it was recorded */
+typedef struct fgpu_memory_event {
+    uint64_t fence;         /* Colored memcpy/memset done by driver */
+    cudaStream_t stream;    /* Rest of the work */
+} fgpu_memory_event_t;
+
 int fgpu_server_init(void);
 void fgpu_server_deinit(void);
 int fgpu_init(void);
 void fgpu_deinit(void);
 int fgpu_get_env_color(void);
 size_t fgpu_get_env_color_mem_size(void);
+int fgpu_get_env_priority(void);
+uint64_t fgpu_get_env_deadline(void);
 bool fgpu_is_init_complete(void);
-int fgpu_set_color_prop(int color, size_t mem_size);
+int fgpu_set_color_prop(int color, size_t mem_size,
+                        int priority = FGPU_DEFAULT_PRIORITY,
+                        uint64_t deadline = 0);
 bool fgpu_is_color_prop_set(void);
+int fgpu_set_budget(uint64_t budget, uint64_t period);
 int fgpu_prepare_launch_kernel(fgpu_dev_ctx_t *ctx, const void *func, 
         size_t shared_mem, dim3 *_gridDim, cudaStream_t **stream);
 int fgpu_complete_launch_kernel(fgpu_dev_ctx_t *ctx);
 int fgpu_color_stream_synchronize(void);
+#if defined(FGPU_PREEMPTION_ENABLED)
+int fgpu_prepare_resumable_kernel(fgpu_dev_ctx_t *ctx, fgpu_kernel_state_t *state,
+        const void *func, size_t shared_mem, dim3 *_gridDim, cudaStream_t **stream);
+int fgpu_complete_resumable_kernel(fgpu_dev_ctx_t *ctx, fgpu_kernel_state_t *state);
+int fgpu_preempt_color(int color);
+int fgpu_resume_color(int color);
+bool fgpu_is_color_preempted(int color);
+#endif
+#if defined(FGPU_TRACE_ENABLED)
+int fgpu_trace_dump(const char *path);
+#endif
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+void fgpu_get_launch_profile(fgpu_launch_profile_t *profile);
+void fgpu_reset_launch_profile(void);
+#endif
 int fpgpu_num_sm(int color, int *num_sm);
 int fgpu_num_colors(void);
 
@@ -66,11 +163,27 @@ int fgpu_memory_free(void *p);
 
 void *fgpu_memory_get_phy_address(void *addr);
 
+/* 
+ * As with cudaMemcpyAsync(), a copy from/to pageable host memory is done by
+ * the time it returns. Host memory registered with fgpu_host_register() is
+ * copied asynchronously and must not be reused till the copy completes (See
+ * fgpu_memory_event_record()).
+ */
 int fgpu_memory_copy_async(void *dst, const void *src, size_t count,
                            enum fgpu_memory_copy_type type,
                            cudaStream_t stream = NULL);
 int fgpu_memory_memset_async(void *address, int value, size_t count,
                             cudaStream_t stream = NULL);
+int fgpu_memory_copy_batch(const fgpu_memory_copy_desc_t *descs, int num_descs,
+                           enum fgpu_memory_copy_type type,
+                           cudaStream_t stream = NULL);
+int fgpu_memory_event_record(fgpu_memory_event_t *event,
+                             cudaStream_t stream = NULL);
+int fgpu_memory_event_query(fgpu_memory_event_t *event);
+int fgpu_memory_event_synchronize(fgpu_memory_event_t *event);
+
+int fgpu_host_register(void *ptr, size_t size);
+int fgpu_host_unregister(void *ptr);
 
 #ifdef FGPU_COMP_COLORING_ENABLE
 
@@ -112,6 +225,36 @@ int fgpu_memory_memset_async(void *address, int value, size_t count,
     ret;                                                                    \
 })
 
+#if defined(FGPU_PREEMPTION_ENABLED)
+
+/*
+ * Macro to launch kernel that can be preempted at logical block boundaries.
+ * Launch starts from state->next_block. Returns FGPU_KERNEL_PREEMPTED if the
+ * kernel was preempted (state is updated and same call resumes the kernel),
+ * 0 if kernel completed and negative if error.
+ * Kernels launched with FGPU_LAUNCH_KERNEL() are never preempted.
+ */
+#define FGPU_LAUNCH_RESUMABLE_KERNEL(state, func, _gridDim, _blockDim, sharedMem, ...) \
+({                                                                          \
+    fgpu_dev_ctx_t dev_fctx;                                                \
+    int ret;                                                                \
+    dim3 _lgridDim;                                                         \
+    cudaStream_t *stream;                                                   \
+    fgpu_set_ctx_dims(&dev_fctx, _gridDim, _blockDim);                      \
+    dev_fctx._blockIdx =  -1;                                               \
+    ret = fgpu_prepare_resumable_kernel(&dev_fctx, state, (const void *)func, \
+            sharedMem, &_lgridDim, &stream);                                \
+    if (ret >= 0) {                                                         \
+        func<<<_lgridDim, _blockDim, sharedMem, *stream>>>(dev_fctx,        \
+                __VA_ARGS__);                                               \
+        ret = fgpu_complete_resumable_kernel(&dev_fctx, state);             \
+    }                                                                       \
+                                                                            \
+    ret;                                                                    \
+})
+
+#endif /* FGPU_PREEMPTION_ENABLED */
+
 #else /* FGPU_COMP_COLORING_ENABLE */
 
 /* Macro to launch kernel - Returns a tag - Negative if error */
@@ -2,11 +2,97 @@
 #ifndef __FRACTIONAL_GPU_CUH__
 #define __FRACTIONAL_GPU_CUH__
 
+#include <errno.h>
+
 #include <fgpu_internal_common.hpp>
 #include <fractional_gpu.hpp>
 
 /******************************************************************************/
-#ifdef FGPU_COMP_COLORING_ENABLE
+#if defined(FGPU_COMP_COLORING_ENABLE) || defined(FGPU_EMULATION)
+
+/*
+ * Claims next 'count' logical blocks of the launch. Returns first block
+ * claimed (num_blocks or more if none is left). On preemption, stops claiming
+ * blocks so that block index reflects the progress. Used by both the device
+ * and the emulated pblocks.
+ */
+__host__ __device__ __forceinline__
+int fgpu_claim_blocks(const fgpu_dev_ctx_t *dev_ctx, int count)
+{
+    int lblockIdx;
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+    if (dev_ctx->d_preempt && dev_ctx->d_preempt->requested)
+        return dev_ctx->num_blocks;
+#endif
+
+#if defined(__CUDA_ARCH__)
+    lblockIdx = atomicAdd(&dev_ctx->d_bindex->index[dev_ctx->index], count);
+#else
+    lblockIdx = __sync_fetch_and_add(&dev_ctx->d_bindex->index[dev_ctx->index], count);
+#endif
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+    lblockIdx += dev_ctx->start_block;
+#endif
+
+    return lblockIdx;
+}
+
+#endif
+
+#if defined(FGPU_EMULATION)
+
+#include <fgpu_internal_emulator.hpp>
+
+/* Kernels are host functions, run by each emulated pblock (a host thread) */
+#define FGPU_DEFINE_VOID_KERNEL(func)                                       \
+    void func(fgpu_dev_ctx_t dev_fctx)
+
+#define FGPU_DEFINE_KERNEL(func, ...)                                       \
+    void func(fgpu_dev_ctx_t dev_fctx, __VA_ARGS__)
+
+/* Emulated pblocks have a single thread, so there is nothing to synchronize */
+inline int fgpu_device_init(const fgpu_dev_ctx_t *dev_ctx)
+{
+    const fgpu_emu_pblock_t *pblock = fgpu_emu_get_pblock();
+
+    /* Prepare for the next function */
+    if (pblock->pblock == 0)
+        dev_ctx->d_bindex->index[dev_ctx->index ^ 1] = 0;
+
+    if (pblock->smid < dev_ctx->start_sm || pblock->smid > dev_ctx->end_sm)
+        return -1;
+
+    return 0;
+}
+
+inline int fgpu_device_get_blockIdx(fgpu_dev_ctx_t *dev_ctx, dim3 *_blockIdx)
+{
+    int lblockIdx = fgpu_claim_blocks(dev_ctx, 1);
+
+    if (lblockIdx >= dev_ctx->num_blocks)
+        return -1;
+
+    *_blockIdx = fgpu_get_blockIdx3D(dev_ctx->gridDim, lblockIdx);
+
+    return 0;
+}
+
+inline int fgpu_device_get_multi_blockIdx(fgpu_dev_ctx_t *dev_ctx, int *_blockIdx1D, int count)
+{
+    int lblockIdx1D = fgpu_claim_blocks(dev_ctx, count);
+    int got = dev_ctx->num_blocks - lblockIdx1D;
+
+    if (got <= 0)
+        return -1;
+
+    *_blockIdx1D = lblockIdx1D;
+
+    return count < got ? count : got;
+}
+
+#elif defined(FGPU_COMP_COLORING_ENABLE)
 
 /* Macro to define (modified) kernels (with no args) */
 #define FGPU_DEFINE_VOID_KERNEL(func)                                       \
@@ -20,6 +106,63 @@
  * Have to keep these functions as inlines because seperate compilation in CUDA
  * has high performance impact
  */
+
+#if defined(FGPU_TRACE_ENABLED)
+
+__device__ __forceinline__
+uint64_t fgpu_device_globaltimer(void)
+{
+    uint64_t time;
+    asm volatile("mov.u64 %0, %%globaltimer;" : "=l"(time));
+    return time;
+}
+
+/* Appends a record to the trace ring. Called only by thread 0 of a pblock */
+__device__ __forceinline__
+void fgpu_device_trace(const fgpu_dev_ctx_t *dev_ctx, uint sm, int first_block,
+        int last_block, uint64_t start, uint64_t end)
+{
+    fgpu_trace_record_t *record;
+    unsigned long long slot;
+
+    slot = atomicAdd(&dev_ctx->d_trace->head, 1ULL);
+    record = &dev_ctx->d_trace->records[slot & (FGPU_TRACE_NUM_RECORDS - 1)];
+
+    /* Ring might wrap around, so invalidate record while it is being filled */
+    record->valid = 0;
+    __threadfence();
+    record->start = start;
+    record->end = end;
+    record->smid = sm;
+    record->pblock = blockIdx.x;
+    record->launch = dev_ctx->launch;
+    record->first_block = first_block;
+    record->last_block = last_block;
+    __threadfence();
+    record->valid = 1;
+}
+
+/* Closes record of block(s) previously executed by pblock and starts next */
+__device__ __forceinline__
+void fgpu_device_trace_next(fgpu_dev_ctx_t *dev_ctx, int first_block,
+        int last_block)
+{
+    uint64_t now = fgpu_device_globaltimer();
+    uint sm;
+
+    if (dev_ctx->trace_first_block >= 0) {
+        asm("mov.u32 %0, %smid;" : "=r"(sm));
+        fgpu_device_trace(dev_ctx, sm, dev_ctx->trace_first_block,
+                dev_ctx->trace_last_block, dev_ctx->trace_start, now);
+    }
+
+    dev_ctx->trace_start = now;
+    dev_ctx->trace_first_block = first_block;
+    dev_ctx->trace_last_block = last_block;
+}
+
+#endif /* FGPU_TRACE_ENABLED */
+
 __device__ __forceinline__
 int fgpu_device_init(const fgpu_dev_ctx_t *dev_ctx)
 {
@@ -64,6 +207,13 @@ int fgpu_device_init(const fgpu_dev_ctx_t *dev_ctx)
     }
 
     if (sm < dev_ctx->start_sm || sm > dev_ctx->end_sm) {
+#if defined(FGPU_TRACE_ENABLED)
+        if (threadIdx.x == 0 && threadIdx.y == 0 && threadIdx.z == 0) {
+            uint64_t now = fgpu_device_globaltimer();
+            fgpu_device_trace(dev_ctx, sm, FGPU_TRACE_INACTIVE_BLOCK,
+                    FGPU_TRACE_INACTIVE_BLOCK, now, now);
+        }
+#endif
         __syncthreads();
         return -1;
     }
@@ -78,20 +228,16 @@ int fgpu_device_get_blockIdx(fgpu_dev_ctx_t *dev_ctx, dim3 *_blockIdx)
     __shared__ uint3 lblockIdx3D;
 
     if (threadIdx.x == 0 && threadIdx.y == 0 && threadIdx.z == 0) {
-        uint blocks_left;
-        uint num2Dblocks;
-        uint x, y, z;
-
-        lblockIdx = atomicAdd(&dev_ctx->d_bindex->index[dev_ctx->index], 1);
-
-        num2Dblocks = dev_ctx->gridDim.x * dev_ctx->gridDim.y;
-        z = lblockIdx / (num2Dblocks);
-        blocks_left = lblockIdx - (z * num2Dblocks);
-        y = blocks_left / dev_ctx->gridDim.x;
-        x = blocks_left - y * dev_ctx->gridDim.x;
-        lblockIdx3D.x = x;
-        lblockIdx3D.y = y;
-        lblockIdx3D.z = z;
+        lblockIdx = fgpu_claim_blocks(dev_ctx, 1);
+
+#if defined(FGPU_TRACE_ENABLED)
+        if (lblockIdx < dev_ctx->num_blocks)
+            fgpu_device_trace_next(dev_ctx, lblockIdx, lblockIdx);
+        else
+            fgpu_device_trace_next(dev_ctx, -1, -1);
+#endif
+
+        lblockIdx3D = fgpu_get_blockIdx3D(dev_ctx->gridDim, lblockIdx);
     }
     __syncthreads();
 
@@ -111,7 +257,15 @@ int fgpu_device_get_multi_blockIdx(fgpu_dev_ctx_t *dev_ctx, int *_blockIdx1D, in
     int got;
 
     if (threadIdx.x == 0 && threadIdx.y == 0 && threadIdx.z == 0) {
-        lblockIdx1D = atomicAdd(&dev_ctx->d_bindex->index[dev_ctx->index], count);
+        lblockIdx1D = fgpu_claim_blocks(dev_ctx, count);
+
+#if defined(FGPU_TRACE_ENABLED)
+        if (lblockIdx1D < dev_ctx->num_blocks)
+            fgpu_device_trace_next(dev_ctx, lblockIdx1D,
+                    min(lblockIdx1D + count, dev_ctx->num_blocks) - 1);
+        else
+            fgpu_device_trace_next(dev_ctx, -1, -1);
+#endif
     }
     __syncthreads();
 
@@ -124,23 +278,14 @@ int fgpu_device_get_multi_blockIdx(fgpu_dev_ctx_t *dev_ctx, int *_blockIdx1D, in
     return count < got ? count : got;
 }
 
-__device__ __forceinline__
+#endif /* FGPU_EMULATION */
+
+#if defined(FGPU_COMP_COLORING_ENABLE) || defined(FGPU_EMULATION)
+
+__host__ __device__ __forceinline__
 dim3 fgpu_device_get_blockIdx3D(fgpu_dev_ctx_t *dev_ctx, int _blockIdx1D)
 {
-    uint blocks_left;
-    uint num2Dblocks;
-    uint x, y, z;
-    dim3 _blockIdx3D;
-
-    num2Dblocks = dev_ctx->gridDim.x * dev_ctx->gridDim.y;
-    z = _blockIdx1D / (num2Dblocks);
-    blocks_left = _blockIdx1D - (z * num2Dblocks);
-    y = blocks_left / dev_ctx->gridDim.x;
-    x = blocks_left - y * dev_ctx->gridDim.x;
-    _blockIdx3D.x = x;
-    _blockIdx3D.y = y;
-    _blockIdx3D.z = z;
-    return _blockIdx3D;
+    return dim3(fgpu_get_blockIdx3D(dev_ctx->gridDim, _blockIdx1D));
 }
 
 #define FGPU_DEVICE_INIT()                                                  \
@@ -165,7 +310,7 @@ dim3 fgpu_device_get_blockIdx3D(fgpu_dev_ctx_t *dev_ctx, int _blockIdx1D)
 
 #define FGPU_FOR_EACH_MULTI_END     }}
 
-#else /* FGPU_COMP_COLORING_ENABLE */
+#else /* FGPU_COMP_COLORING_ENABLE || FGPU_EMULATION */
 
 #define FGPU_DEFINE_VOID_KERNEL(func)                                       \
     __global__ void func(void)
@@ -189,17 +334,91 @@ dim3 fgpu_device_get_blockIdx3D(fgpu_dev_ctx_t *dev_ctx, int _blockIdx1D)
 
 #define FGPU_FOR_EACH_MULTI_END     FGPU_FOR_EACH_END
 
-#endif /* FGPU_COMP_COLORING_ENABLE */
+#endif /* FGPU_COMP_COLORING_ENABLE || FGPU_EMULATION */
 
 /*****************************************************************************/
 
-#if defined(FGPU_USER_MEM_COLORING_ENABLED)
-
 // TODO: This should be per GPU based
 #define FGPU_DEVICE_COLOR_SHIFT	            12
 #define FGPU_DEVICE_PAGE_SIZE               (1 << FGPU_DEVICE_COLOR_SHIFT)
 #define FGPU_DEVICE_PAGE_MASK               (~(FGPU_DEVICE_PAGE_SIZE - 1))
-#define FGPU_DEVICE_COLOR_PATTERN           0xce4c3		// Split cache vertically
+
+/* Returns the color of a device page frame (Color functions are also used on host) */
+__host__ __device__ __forceinline__
+uint32_t fgpu_color_of_page(const fgpu_color_func_t *func, uint64_t pfn)
+{
+    uint32_t color = 0;
+
+    for (int i = 0; i < func->num_bits; i++) {
+#if defined(__CUDA_ARCH__)
+        color |= (__popcll(pfn & func->patterns[i]) & 0x1) << i;
+#else
+        color |= (__builtin_popcountll(pfn & func->patterns[i]) & 0x1) << i;
+#endif
+    }
+
+    return color;
+}
+
+/*
+ * Page idx of colored memory maps to the page of required color in the group of
+ * 2^num_bits pages starting at (idx << num_bits). Start of memory is aligned
+ * to a group, so the color of a page in the group is linear in its offset.
+ */
+__host__ __device__ __forceinline__
+uint64_t fgpu_color_true_page(const fgpu_color_func_t *func, uint64_t start_idx,
+                              int color, uint64_t idx)
+{
+    uint32_t diff;
+
+    idx <<= func->num_bits;
+    diff = fgpu_color_of_page(func, idx + start_idx) ^ color;
+
+    for (int i = 0; i < func->num_bits; i++) {
+        if (diff & (1 << i))
+            idx ^= func->offsets[i];
+    }
+
+    return idx;
+}
+
+/*
+ * Converts the driver's color XOR masks to page frame patterns and finds, for
+ * each color bit, the page within an aligned group of 2^k pages that flips
+ * only that bit. These exist only if every group holds all the colors.
+ */
+inline int fgpu_color_func_init(const uint64_t *color_masks, int num_color_masks,
+                                fgpu_color_func_t *color_func)
+{
+    uint32_t found = 0;
+    uint32_t page, c;
+    int i;
+
+    if (num_color_masks < 1 || num_color_masks > FGPU_MAX_MEM_COLOR_BITS)
+        return -EINVAL;
+
+    color_func->num_bits = num_color_masks;
+    for (i = 0; i < num_color_masks; i++) {
+        if (color_masks[i] & (FGPU_DEVICE_PAGE_SIZE - 1))
+            return -EINVAL;
+        color_func->patterns[i] = color_masks[i] >> FGPU_DEVICE_COLOR_SHIFT;
+    }
+
+    for (page = 0; page < (1U << num_color_masks); page++) {
+        c = fgpu_color_of_page(color_func, page);
+        if (c && (c & (c - 1)) == 0) {
+            color_func->offsets[__builtin_ctz(c)] = page;
+            found |= c;
+        }
+    }
+
+    if (found != (1U << num_color_masks) - 1)
+        return -EINVAL;
+
+    return 0;
+}
+
+#if defined(FGPU_USER_MEM_COLORING_ENABLED)
 
 #define FGPU_COLOR_LOAD(ctx, addr)              \
 ({                                              \
@@ -224,28 +443,99 @@ void *fgpu_color_load(const fgpu_dev_ctx_t *ctx, const void *virt_offset)
 {
     uint64_t true_virt_addr;
 	uint64_t c_virt_offset = (uint64_t)virt_offset - ctx->start_virt_addr;
-	uint64_t idx = ((c_virt_offset >> FGPU_DEVICE_COLOR_SHIFT) << 1);
-	uint32_t pattern = (idx + ctx->start_idx) & FGPU_DEVICE_COLOR_PATTERN;
-	uint8_t parity = __popc(pattern) & 0x1;
-	idx += (parity != ctx->color);
+	uint64_t idx = fgpu_color_true_page(&ctx->color_func, ctx->start_idx, ctx->color,
+	                                    c_virt_offset >> FGPU_DEVICE_COLOR_SHIFT);
 	true_virt_addr = ctx->start_virt_addr + (idx << FGPU_DEVICE_COLOR_SHIFT) + (c_virt_offset & 0xFFF);
 	return  (void *)true_virt_addr;
 
 }
 
+/*
+ * Translation only changes at device page boundaries, so accesses walking
+ * through memory can translate once per page and reuse it for the rest of the
+ * page. Each thread keeps its own cache (usually one per array accessed).
+ */
+typedef struct fgpu_color_page_cache {
+    uint64_t virt_page;             /* Colored virtual page cached */
+    uint64_t true_page;             /* Its true virtual page */
+} fgpu_color_page_cache_t;
+
+#define FGPU_COLOR_PAGE_CACHE_INIT      {(uint64_t)-1, 0}
+
+__device__ __forceinline__
+void *fgpu_color_load_cached(const fgpu_dev_ctx_t *ctx, fgpu_color_page_cache_t *cache,
+                             const void *virt_offset)
+{
+    uint64_t addr = (uint64_t)virt_offset;
+    uint64_t page = addr & FGPU_DEVICE_PAGE_MASK;
+
+    if (page != cache->virt_page) {
+        cache->virt_page = page;
+        cache->true_page = (uint64_t)fgpu_color_load(ctx, (const void *)page);
+    }
+
+    return (void *)(cache->true_page + (addr & ~FGPU_DEVICE_PAGE_MASK));
+}
+
+#define FGPU_COLOR_LOAD_CACHED(ctx, cache, addr)            \
+({                                                          \
+    void *ptr = fgpu_color_load_cached(ctx, cache, addr);   \
+    *(typeof(addr))ptr;                                     \
+})
+
+#define FGPU_COLOR_STORE_CACHED(ctx, cache, addr, value)    \
+({                                                          \
+    void *ptr = fgpu_color_load_cached(ctx, cache, addr);   \
+    *(typeof(addr))ptr = value;                             \
+})
+
+#define FGPU_COLOR_TRANSLATE_ADDR_CACHED(ctx, cache, addr)  \
+({                                                          \
+    void *ptr = fgpu_color_load_cached(ctx, cache, addr);   \
+    (typeof(addr))ptr;                                      \
+})
+
+/*
+ * Vector loads/stores (e.g. float2/float4). An aligned vector never crosses a
+ * device page, so a single translation covers all of its elements.
+ */
+#define FGPU_COLOR_LOAD_VEC(ctx, addr, vtype)               \
+({                                                          \
+    void *ptr = fgpu_color_load(ctx, addr);                 \
+    *(vtype *)ptr;                                          \
+})
+
+#define FGPU_COLOR_STORE_VEC(ctx, addr, vtype, value)       \
+({                                                          \
+    void *ptr = fgpu_color_load(ctx, addr);                 \
+    *(vtype *)ptr = value;                                  \
+})
+
+/*
+ * Translates the start of a span (e.g. a row of a tile being staged in shared
+ * memory). The returned pointer is valid for fgpu_color_span_bytes(addr) bytes,
+ * i.e. upto the end of the device page.
+ */
+#define FGPU_COLOR_TRANSLATE_SPAN(ctx, addr)    FGPU_COLOR_TRANSLATE_ADDR(ctx, addr)
+
+__host__ __device__ __forceinline__
+size_t fgpu_color_span_bytes(const void *addr)
+{
+    return FGPU_DEVICE_PAGE_SIZE - ((uint64_t)addr & ~FGPU_DEVICE_PAGE_MASK);
+}
+
 /* For host side */
 inline void *fgpu_color_device_true_virt_addr(const uint64_t start_virt_addr, 
                                               uint64_t start_phy_addr,
+                                              const fgpu_color_func_t *color_func,
                                               int color,
                                               const void *virt_addr)
 {
     uint64_t true_virt_addr;
     uint64_t start_idx = start_phy_addr >> FGPU_DEVICE_COLOR_SHIFT;
 	uint64_t c_virt_offset = (uint64_t)virt_addr - start_virt_addr;
-	uint64_t idx = ((c_virt_offset >> FGPU_DEVICE_COLOR_SHIFT) << 1);
-	uint32_t pattern = (idx + start_idx) & FGPU_DEVICE_COLOR_PATTERN;
-	uint8_t parity = __builtin_popcount(pattern) & 0x1;
-	idx += (parity != color);
+	uint64_t idx = fgpu_color_true_page(color_func, start_idx, color,
+	                                    c_virt_offset >> FGPU_DEVICE_COLOR_SHIFT);
 	true_virt_addr = start_virt_addr + (idx << FGPU_DEVICE_COLOR_SHIFT) + (c_virt_offset & 0xFFF);
 	return  (void *)true_virt_addr;
 }
@@ -269,6 +559,50 @@ inline void *fgpu_color_device_true_virt_addr(const uint64_t start_virt_addr,
     addr;                                       \
 })
 
+typedef struct fgpu_color_page_cache {
+} fgpu_color_page_cache_t;
+
+#define FGPU_COLOR_PAGE_CACHE_INIT      {}
+
+/* Cache is still referenced, else nvcc warns it is declared but unused */
+#define FGPU_COLOR_LOAD_CACHED(ctx, cache, addr)            \
+({                                                          \
+    (void)(cache);                                          \
+    *addr;                                                  \
+})
+
+#define FGPU_COLOR_STORE_CACHED(ctx, cache, addr, value)    \
+({                                                          \
+    (void)(cache);                                          \
+    *addr = value;                                          \
+})
+
+#define FGPU_COLOR_TRANSLATE_ADDR_CACHED(ctx, cache, addr)  \
+({                                                          \
+    (void)(cache);                                          \
+    addr;                                                   \
+})
+
+#define FGPU_COLOR_LOAD_VEC(ctx, addr, vtype)               \
+({                                                          \
+    *(vtype *)(addr);                                       \
+})
+
+#define FGPU_COLOR_STORE_VEC(ctx, addr, vtype, value)       \
+({                                                          \
+    *(vtype *)(addr) = value;                               \
+})
+
+#define FGPU_COLOR_TRANSLATE_SPAN(ctx, addr)    FGPU_COLOR_TRANSLATE_ADDR(ctx, addr)
+
+/* Memory is contiguous */
+__host__ __device__ __forceinline__
+size_t fgpu_color_span_bytes(const void *addr)
+{
+    (void)addr;
+    return (size_t)-1;
+}
+
 #endif /* FGPU_USER_MEM_COLORING_ENABLED */
 
 
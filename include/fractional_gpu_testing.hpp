@@ -2,9 +2,14 @@
 #ifndef __FRACTIONAL_GPU_TESTING_HPP__
 #define __FRACTIONAL_GPU_TESTING_HPP__
 
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -19,58 +24,257 @@
 #endif
 
 #define USECPSEC 1000000ULL
-inline double dtime_usec(unsigned long long start)
+#define NSECPUSEC 1000ULL
+
+/* Time in usec (with nsec resolution) from a monotonic clock since start */
+inline double dtime_usec(double start)
 {
-  timeval tv;
-  gettimeofday(&tv, 0);
-  return (double)(((tv.tv_sec*USECPSEC)+tv.tv_usec)-start);
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * USECPSEC + (double)ts.tv_nsec / NSECPUSEC - start;
 }
 
-/* For benchmarking applications */
+/*
+ * For benchmarking applications. Observations (in usec) are recorded in a
+ * log-linear histogram of nsec values: values below 2^PSTATS_SUB_BUCKET_BITS
+ * nsec are exact, larger values are split into 2^PSTATS_SUB_BUCKET_BITS linear
+ * buckets per power of two (relative error < 1%). Memory used is constant
+ * irrespective of number of observations. Min/Max/Avg are exact.
+ */
+#define PSTATS_SUB_BUCKET_BITS  7
+#define PSTATS_SUB_BUCKETS      (1ULL << PSTATS_SUB_BUCKET_BITS)
+#define PSTATS_MAX_VALUE_BITS   48      /* Larger values (> 3 days) are clamped */
+#define PSTATS_NUM_BUCKETS      ((PSTATS_MAX_VALUE_BITS - PSTATS_SUB_BUCKET_BITS + 1) * \
+                                 PSTATS_SUB_BUCKETS)
+
+/* Default percentiles printed/saved (Can be changed by -q option) */
+#define PSTATS_DEFAULT_PERCENTILES  "50,99,99.9,100"
+#define PSTATS_MAX_PERCENTILES      16
+
 typedef struct pstats {
     double sum;
+    double min;
+    double max;
     size_t count;
-    std::vector<double> vals;
+    uint64_t buckets[PSTATS_NUM_BUCKETS];
 } pstats_t;
 
 inline void pstats_init(pstats_t *stats)
 {
     stats->count = stats->sum = 0;
-    stats->vals.clear();
+    stats->min = stats->max = 0;
+    memset(stats->buckets, 0, sizeof(stats->buckets));
+}
+
+inline size_t pstats_bucket_index(uint64_t val)
+{
+    int msb;
+
+    if (val < PSTATS_SUB_BUCKETS)
+        return val;
+
+    if (val >= (1ULL << PSTATS_MAX_VALUE_BITS))
+        return PSTATS_NUM_BUCKETS - 1;
+
+    msb = 63 - __builtin_clzll(val);
+    return (msb - PSTATS_SUB_BUCKET_BITS + 1) * PSTATS_SUB_BUCKETS +
+        (val >> (msb - PSTATS_SUB_BUCKET_BITS)) - PSTATS_SUB_BUCKETS;
+}
+
+/* Midpoint (in usec) of the values of a bucket */
+inline double pstats_bucket_value(size_t index)
+{
+    size_t range = index >> PSTATS_SUB_BUCKET_BITS;
+    uint64_t sub = index & (PSTATS_SUB_BUCKETS - 1);
+    uint64_t low, width;
+
+    if (range == 0)
+        return (double)index / NSECPUSEC;
+
+    low = (PSTATS_SUB_BUCKETS + sub) << (range - 1);
+    width = 1ULL << (range - 1);
+    return (low + (width - 1) / 2.0) / NSECPUSEC;
 }
 
 inline void pstats_add_observation(pstats_t *stats, double time)
 {
+    uint64_t val = time > 0 ? (uint64_t)(time * NSECPUSEC + 0.5) : 0;
+
+    if (stats->count == 0 || time < stats->min)
+        stats->min = time;
+    if (stats->count == 0 || time > stats->max)
+        stats->max = time;
+
     stats->count++;
     stats->sum += time;
-    stats->vals.push_back(time);
+    stats->buckets[pstats_bucket_index(val)]++;
 }
 
-inline void pstats_print(pstats_t *stats)
+/* Adds observations of src into dst (e.g. to combine per-thread stats) */
+inline void pstats_merge(pstats_t *dst, const pstats_t *src)
 {
-    double median;
-    size_t count = stats->count;
-    size_t count_95p = ((double)(count) * 95.0) / 100.0;
-    size_t count_5p = ((double)(count) * 5.0) / 100.0;
-
-    if (count == 0) {
-        printf("STATS:No values\n");
+    if (src->count == 0)
         return;
+
+    if (dst->count == 0 || src->min < dst->min)
+        dst->min = src->min;
+    if (dst->count == 0 || src->max > dst->max)
+        dst->max = src->max;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (size_t i = 0; i < PSTATS_NUM_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+/* Value at percentile (0-100). Exact for 0 (Min) and 100 (Max). */
+inline double pstats_percentile(const pstats_t *stats, double percentile)
+{
+    uint64_t rank, seen = 0;
+
+    if (stats->count == 0)
+        return 0;
+
+    if (percentile <= 0)
+        return stats->min;
+
+    if (percentile >= 100)
+        return stats->max;
+
+    rank = (uint64_t)ceil(percentile * stats->count / 100.0);
+    if (rank == 0)
+        rank = 1;
+
+    for (size_t i = 0; i < PSTATS_NUM_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen >= rank)
+            return std::min(std::max(pstats_bucket_value(i), stats->min), stats->max);
     }
 
-    std::sort(stats->vals.begin(), stats->vals.begin() + stats->vals.size());
+    return stats->max;
+}
+
+/* Percentiles printed and saved to stats file */
+static double pstats_percentiles[PSTATS_MAX_PERCENTILES];
+static int pstats_num_percentiles = -1;
+
+/* Stats file (JSON lines if name ends in .json, else CSV) */
+static const char *pstats_file_path = NULL;
+static FILE *pstats_file = NULL;
+
+/* Sets the percentiles from a comma separated list. Returns < 0 if invalid. */
+inline int pstats_set_percentiles(const char *list)
+{
+    const char *p = list;
+    char *end;
+    int num = 0;
+
+    while (*p) {
+        double val = strtod(p, &end);
+
+        if (end == p || val < 0 || val > 100 || num == PSTATS_MAX_PERCENTILES)
+            return -EINVAL;
+
+        pstats_percentiles[num++] = val;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -EINVAL;
+
+        p = end;
+    }
+
+    if (num == 0)
+        return -EINVAL;
+
+    pstats_num_percentiles = num;
+    return 0;
+}
+
+/* Saves stats to the stats file (if configured) */
+inline void pstats_save(const pstats_t *stats, const char *name)
+{
+    const char *ext;
+    bool json;
+
+    if (!pstats_file_path)
+        return;
+
+    ext = strrchr(pstats_file_path, '.');
+    json = ext && strcmp(ext, ".json") == 0;
+
+    if (!pstats_file) {
+        pstats_file = fopen(pstats_file_path, "w");
+        if (!pstats_file) {
+            fprintf(stderr, "Unable to open stats file %s\n", pstats_file_path);
+            pstats_file_path = NULL;
+            return;
+        }
+
+        if (!json) {
+            fprintf(pstats_file, "name,count,avg_usec,min_usec,max_usec");
+            for (int i = 0; i < pstats_num_percentiles; i++)
+                fprintf(pstats_file, ",p%g_usec", pstats_percentiles[i]);
+            fprintf(pstats_file, "\n");
+        }
+    }
 
-    /* Count odd or even? */
-    if (count & 0x1) {
-        median = stats->vals[count / 2];
+    if (json) {
+        fprintf(pstats_file, "{\"name\":\"%s\",\"count\":%zu,\"avg_usec\":%f,"
+                "\"min_usec\":%f,\"max_usec\":%f,\"percentiles_usec\":{",
+                name, stats->count, stats->count ? stats->sum / stats->count : 0,
+                stats->min, stats->max);
+        for (int i = 0; i < pstats_num_percentiles; i++)
+            fprintf(pstats_file, "%s\"%g\":%f", i ? "," : "", pstats_percentiles[i],
+                    pstats_percentile(stats, pstats_percentiles[i]));
+        fprintf(pstats_file, "}}\n");
     } else {
-        median = (stats->vals[count / 2 - 1] + stats->vals[count / 2]) / 2;
+        fprintf(pstats_file, "%s,%zu,%f,%f,%f", name, stats->count,
+                stats->count ? stats->sum / stats->count : 0, stats->min, stats->max);
+        for (int i = 0; i < pstats_num_percentiles; i++)
+            fprintf(pstats_file, ",%f", pstats_percentile(stats, pstats_percentiles[i]));
+        fprintf(pstats_file, "\n");
+    }
+
+    fflush(pstats_file);
+}
+
+inline void pstats_close(void)
+{
+    if (pstats_file) {
+        fclose(pstats_file);
+        pstats_file = NULL;
+    }
+}
+
+/*
+ * Prints stats (First line format is parsed by benchmark scripts) and saves
+ * them in stats file with the given name.
+ */
+inline void pstats_print(const pstats_t *stats, const char *name = "stats")
+{
+    if (pstats_num_percentiles < 0)
+        pstats_set_percentiles(PSTATS_DEFAULT_PERCENTILES);
+
+    if (stats->count == 0) {
+        printf("STATS:No values\n");
+        pstats_save(stats, name);
+        return;
     }
 
     printf("STATS: Avg:%f, Median:%f, Min:%f, Max:%f, 5 percentile:%f, 95 percentile:%f, Count:%zu\n",
-            stats->sum / stats->count, median,
-            stats->vals[0], stats->vals[count - 1], stats->vals[count_5p], stats->vals[count_95p],
-            stats->count);
+            stats->sum / stats->count, pstats_percentile(stats, 50),
+            stats->min, stats->max, pstats_percentile(stats, 5),
+            pstats_percentile(stats, 95), stats->count);
+
+    printf("PERCENTILES:");
+    for (int i = 0; i < pstats_num_percentiles; i++)
+        printf("%s p%g:%f", i ? "," : "", pstats_percentiles[i],
+                pstats_percentile(stats, pstats_percentiles[i]));
+    printf("\n");
+
+    pstats_save(stats, name);
 }
 
 /* 
@@ -92,7 +296,13 @@ bool test_execute_just_kernel(void)
 void print_usage(char **argv)
 {
     fprintf(stderr, "Usage: %s -c <color> -m <memory size> -i <number of iterations> [OPTIONS]\n"
-            "-k Execute only kernel (Default: Memcpy and kernels both executed)\n",
+            "-k Execute only kernel (Default: Memcpy and kernels both executed)\n"
+            "-p <priority> Launch priority within color (Higher is served first)\n"
+            "-d <deadline> Relative launch deadline in usec (Default: None)\n"
+            "-b <budget> GPU time budget in usec per period (Default: None)\n"
+            "-P <period> Budget period in usec (Default: 1 sec)\n"
+            "-o <file> Save stats to file (JSON lines if file ends in .json, else CSV)\n"
+            "-q <percentiles> Comma separated percentiles to report (Default: " PSTATS_DEFAULT_PERCENTILES ")\n",
             argv[0]);
     fprintf(stderr, "Exiting\n");
     exit(-1);
@@ -103,15 +313,21 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
         bool do_init = true)
 {
     int opt, ret;
-    int color, num_iterations;
+    int color, num_iterations, priority;
     size_t mem_size;
+    uint64_t deadline, budget, period;
+    bool is_period_set = false;
 
     /* Set default values */
     color = fgpu_get_env_color();
     mem_size = fgpu_get_env_color_mem_size();
+    priority = fgpu_get_env_priority();
+    deadline = fgpu_get_env_deadline();
+    budget = 0;
+    period = 1000000;
     num_iterations = DEFAULT_NUM_ITERATION;
 
-    while ((opt = getopt(argc, argv, "c:i:m:k")) != -1) {
+    while ((opt = getopt(argc, argv, "c:i:m:kp:d:b:P:o:q:")) != -1) {
         
         switch (opt) {
         
@@ -131,6 +347,34 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
             execute_just_kernel = true;
             break;
 
+        case 'p':
+            priority = atoi(optarg);
+            break;
+
+        case 'd':
+            deadline = atoll(optarg);
+            break;
+
+        case 'b':
+            budget = atoll(optarg);
+            break;
+
+        case 'P':
+            period = atoll(optarg);
+            is_period_set = true;
+            break;
+
+        case 'o':
+            pstats_file_path = optarg;
+            break;
+
+        case 'q':
+            if (pstats_set_percentiles(optarg) < 0) {
+                fprintf(stderr, "Invalid percentiles\n");
+                print_usage(argv);
+            }
+            break;
+
         default: /* '?' */
             fprintf(stderr, "Invalid arguments found\n");
             print_usage(argv);
@@ -139,6 +383,12 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
         }
     }
 
+    /* Budget is set along with color, which caller does itself if delayed */
+    if (!do_init && (budget > 0 || is_period_set)) {
+        fprintf(stderr, "Budget can't be set when color initialization is delayed\n");
+        print_usage(argv);
+    }
+
     printf("Configuration:\n");
 
     printf("Computational Coloring:\t");
@@ -177,15 +427,26 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
             exit(EXIT_FAILURE);
         }
 
-        ret = fgpu_set_color_prop(color, mem_size);
+        ret = fgpu_set_color_prop(color, mem_size, priority, deadline);
         if (ret < 0) {
             fprintf(stderr, "Exiting as unable to set color property\n");
             exit(EXIT_FAILURE);
         }
+
+        if (budget > 0) {
+            ret = fgpu_set_budget(budget, period);
+            if (ret < 0) {
+                fprintf(stderr, "Exiting as budget not admitted\n");
+                exit(EXIT_FAILURE);
+            }
+        }
     }
 
     printf("Color:\t%d\n", color);
     printf("Memory:\t%zd\n", mem_size);
+    printf("Priority:\t%d\n", priority);
+    printf("Deadline:\t%" PRIu64 "\n", deadline);
+    printf("Budget:\t%" PRIu64 "/%" PRIu64 "\n", budget, period);
     printf("Iterations:\t%d\n", num_iterations);
     printf("Color Initialized Delayed:%s\n", do_init ? "FALSE" : "TRUE");
 
@@ -194,6 +455,14 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
 
 static inline void test_deinitialize()
 {
+#if defined(FGPU_TRACE_ENABLED)
+    const char *trace_path = getenv("FGPU_TRACE_FILE");
+    if (trace_path && fgpu_trace_dump(trace_path) < 0)
+        fprintf(stderr, "Unable to dump trace\n");
+#endif
+
+    pstats_close();
+
     fgpu_deinit();
 }
 
@@ -202,7 +471,9 @@ static inline void test_deinitialize()
 void print_usage(char **argv)
 {
     fprintf(stderr, "Usage: %s -i <number of iterations> [OPTIONS]\n"
-            "-k Execute only kernel (Default: Memcpy and kernels both executed)\n",
+            "-k Execute only kernel (Default: Memcpy and kernels both executed)\n"
+            "-o <file> Save stats to file (JSON lines if file ends in .json, else CSV)\n"
+            "-q <percentiles> Comma separated percentiles to report (Default: " PSTATS_DEFAULT_PERCENTILES ")\n",
             argv[0]);
     fprintf(stderr, "Exiting\n");
     exit(-1);
@@ -217,7 +488,7 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
     
     num_iterations = DEFAULT_NUM_ITERATION;
 
-    while ((opt = getopt(argc, argv, "i:k")) != -1) {
+    while ((opt = getopt(argc, argv, "i:ko:q:")) != -1) {
         
         switch (opt) {
         
@@ -227,6 +498,18 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
 
         case 'k':
             execute_just_kernel = true;
+            break;
+
+        case 'o':
+            pstats_file_path = optarg;
+            break;
+
+        case 'q':
+            if (pstats_set_percentiles(optarg) < 0) {
+                fprintf(stderr, "Invalid percentiles\n");
+                print_usage(argv);
+            }
+            break;
 
         default: /* '?' */
             fprintf(stderr, "Invalid arguments found\n");
@@ -245,6 +528,7 @@ static inline void test_initialize(int argc, char **argv, int *out_num_iteration
 
 static inline void test_deinitialize()
 {
+    pstats_close();
 }
 
 #endif /* USE_FGPU */
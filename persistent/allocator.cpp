@@ -30,6 +30,7 @@ typedef struct allocator {
     void *start_address;
     size_t size;
     size_t alignment;                                   /* Alignment requirement for all addresses */
+    size_t used;                                        /* Bytes currently allocated */
     std::map<void *, node_t *> nodes_map;               /* Nodes are both mainted in map and list */
 } allocator_t;
 
@@ -304,6 +305,7 @@ allocator_t *allocator_init(void *buf, size_t size, size_t alignment)
     ctx->size = size;
     ctx->start_address = buf;
     ctx->alignment = alignment;
+    ctx->used = 0;
 
     /* Insert the whole buffer as a free node */
     node = new_free_node(ctx, (void *)round_address, node_size);
@@ -322,6 +324,8 @@ void *allocator_alloc(allocator_t *ctx, size_t size)
     if (!node)
         return NULL;
 
+    ctx->used += node->size;
+
     return node->address;
 }
 
@@ -336,9 +340,17 @@ void allocator_free(allocator_t *ctx, void *address)
 
     node = it->second;
 
+    ctx->used -= node->size;
+
     mark_node_free(ctx, node);
 }
 
+/* Returns number of bytes currently allocated (including alignment padding) */
+size_t allocator_get_used(allocator_t *ctx)
+{
+    return ctx->used;
+}
+
 /* Frees up the allocator */
 void allocator_deinit(allocator_t *ctx)
 {
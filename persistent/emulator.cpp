@@ -0,0 +1,293 @@
+/*
+ * Emulation of persistent kernels on host threads. Each pblock is a host
+ * thread with an emulated SM id (pblocks are distributed round robin on SMs)
+ * running the kernel function. The kernel's block dispatch (fgpu_device_init()
+ * and friends in FGPU_EMULATION mode) follows the device protocol.
+ * Launches go through the same scheduling phases as fgpu_prepare_launch_kernel()
+ * and fgpu_complete_launch_kernel(): budget, launch queue and telemetry.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <fgpu_internal_emulator.hpp>
+#include <fgpu_internal_persistent.hpp>
+
+/* An emulated pblock */
+typedef struct emu_pblock_thread {
+    pthread_t thread;
+    fgpu_emu_pblock_t pblock;
+    const fgpu_dev_ctx_t *ctx;
+    const fgpu_emu_kernel_t *func;
+} emu_pblock_thread_t;
+
+/* Pblock emulated by the calling thread */
+static thread_local const fgpu_emu_pblock_t *emu_pblock;
+
+int fgpu_emu_device_init(fgpu_emu_device_t *dev, int num_sm, int num_colors,
+        int max_num_threads_per_sm, int num_pblocks_per_sm)
+{
+    int ret;
+
+    if (num_colors <= 0 || num_colors > FGPU_MAX_NUM_COLORS ||
+            num_sm < num_colors) {
+        fprintf(stderr, "FGPU:Too few SMs/Too many colors\n");
+        return -EINVAL;
+    }
+
+    dev->num_sm = num_sm;
+    dev->num_colors = num_colors;
+    dev->max_num_threads_per_sm = max_num_threads_per_sm;
+    dev->num_pblocks_per_sm = num_pblocks_per_sm;
+
+    for (int i = 0; i < num_colors; i++) {
+        uint32_t start_sm, end_sm;
+
+        fgpu_get_color_sms(i, num_colors, num_sm, &start_sm, &end_sm);
+        dev->color_to_sms[i] = std::make_pair(start_sm, end_sm);
+#if defined(FGPU_PREEMPTION_ENABLED)
+        dev->preempt[i].requested = 0;
+#endif
+    }
+
+    ret = color_streams_init(&dev->streams, num_colors, false);
+    if (ret < 0)
+        return ret;
+
+    memset(&dev->telemetry, 0, sizeof(dev->telemetry));
+    dev->telemetry.num_colors = num_colors;
+    dev->num_clients = 0;
+
+    return 0;
+}
+
+void fgpu_emu_device_deinit(fgpu_emu_device_t *dev)
+{
+    color_streams_deinit(&dev->streams, dev->num_colors);
+}
+
+/* Same as fgpu_set_color_prop() but for an emulated process */
+int fgpu_emu_client_init(fgpu_emu_client_t *client, fgpu_emu_device_t *dev,
+        int color, int priority, uint64_t deadline)
+{
+    int slot;
+
+    if (color < 0 || color >= dev->num_colors) {
+        fprintf(stderr, "FGPU:Invalid color\n");
+        return -EINVAL;
+    }
+
+    client->dev = dev;
+    client->execution = 0;
+    memset(&client->bindex, 0, sizeof(client->bindex));
+    client->cur_index = 0;
+    launch_client_init(&client->launch, color, priority, deadline);
+
+    /* Telemetry is best effort */
+    slot = __sync_fetch_and_add(&dev->num_clients, 1);
+    if (slot >= FGPU_MAX_NUM_CLIENTS) {
+        fprintf(stderr, "FGPU:No free telemetry slot\n");
+        return 0;
+    }
+
+    dev->telemetry.clients[slot].pid = getpid();
+    dev->telemetry.clients[slot].color = color;
+    client->launch.color_counters = &dev->telemetry.colors[color];
+    client->launch.counters = &dev->telemetry.clients[slot].counters;
+
+    return 0;
+}
+
+/* Admission control is not emulated */
+void fgpu_emu_client_set_budget(fgpu_emu_client_t *client, uint64_t budget,
+        uint64_t period)
+{
+    launch_client_set_budget(&client->launch, budget, period);
+}
+
+const fgpu_emu_pblock_t *fgpu_emu_get_pblock(void)
+{
+    return emu_pblock;
+}
+
+static void *emu_pblock_run(void *data)
+{
+    emu_pblock_thread_t *t = (emu_pblock_thread_t *)data;
+
+    emu_pblock = &t->pblock;
+
+    /* Each pblock gets its own copy of ctx, as on the device */
+    (*t->func)(*t->ctx);
+
+    return NULL;
+}
+
+/* Same as fgpu_prepare_launch_kernel() but on the emulated device */
+static int emu_prepare_launch(fgpu_emu_client_t *client, fgpu_dev_ctx_t *ctx,
+        fgpu_launch_geometry_t *geo)
+{
+    fgpu_emu_device_t *dev = client->dev;
+    int color = client->launch.color;
+    int ret;
+
+    ret = fgpu_check_launch_dims(ctx->gridDim, ctx->blockDim,
+            dev->max_num_threads_per_sm, geo);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_set_launch_geometry(dev->num_pblocks_per_sm, dev->num_sm,
+            dev->color_to_sms[color].first, dev->color_to_sms[color].second,
+            geo);
+    if (ret < 0)
+        return ret;
+
+    /* Stream is not held while waiting for budget */
+    launch_wait_for_budget(&client->launch);
+
+    ret = launch_acquire_stream(&dev->streams, &client->launch);
+    if (ret < 0)
+        return ret;
+
+    launch_start(&client->launch, geo->num_pblocks, geo->num_active_pblocks);
+
+    ctx->color = color;
+    ctx->num_pblock = geo->num_pblocks;
+    ctx->num_blocks = geo->num_blocks;
+    ctx->index = client->cur_index;
+    client->cur_index ^= 1; /* Toggle the index */
+    ctx->d_bindex = &client->bindex;
+    ctx->start_sm = dev->color_to_sms[color].first;
+    ctx->end_sm = dev->color_to_sms[color].second;
+    ctx->num_active_pblocks = geo->num_active_pblocks;
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+    /* Only resumable launches can report partial progress */
+    ctx->d_preempt = NULL;
+    ctx->start_block = 0;
+#endif
+
+    return 0;
+}
+
+/* Runs the pblocks and waits for them (in place of launch and stream sync) */
+static int emu_run_pblocks(fgpu_emu_client_t *client, const fgpu_dev_ctx_t *ctx,
+        const fgpu_emu_kernel_t &func)
+{
+    std::vector<emu_pblock_thread_t> pblocks(ctx->num_pblock);
+    int ret;
+
+    for (int i = 0; i < ctx->num_pblock; i++) {
+        pblocks[i].pblock.pblock = i;
+        pblocks[i].pblock.smid = i % client->dev->num_sm;
+        pblocks[i].ctx = ctx;
+        pblocks[i].func = &func;
+
+        ret = pthread_create(&pblocks[i].thread, NULL, emu_pblock_run, &pblocks[i]);
+        if (ret != 0) {
+            fprintf(stderr, "FGPU:Can't create emulated pblock\n");
+            /* Pblocks already created still need to be waited for */
+            for (int j = 0; j < i; j++)
+                pthread_join(pblocks[j].thread, NULL);
+            return -ret;
+        }
+    }
+
+    for (int i = 0; i < ctx->num_pblock; i++)
+        pthread_join(pblocks[i].thread, NULL);
+
+    client->execution = launch_queue_now_usec() - client->launch.launch_start;
+
+    return 0;
+}
+
+/* Launches a kernel on client's color and waits for it to complete */
+int fgpu_emu_launch_kernel(fgpu_emu_client_t *client, dim3 _gridDim,
+        dim3 _blockDim, const fgpu_emu_kernel_t &func)
+{
+    fgpu_launch_geometry_t geo;
+    fgpu_dev_ctx_t ctx = fgpu_dev_ctx_t();
+    int ret;
+
+    ctx.gridDim = _gridDim;
+    ctx.blockDim = _blockDim;
+    ctx._blockIdx = -1;
+
+    ret = emu_prepare_launch(client, &ctx, &geo);
+    if (ret < 0)
+        return ret;
+
+    ret = emu_run_pblocks(client, &ctx, func);
+
+    launch_complete(&client->dev->streams, &client->launch);
+
+    return ret;
+}
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+
+/* Same as FGPU_LAUNCH_RESUMABLE_KERNEL() but on the emulated device */
+int fgpu_emu_launch_resumable_kernel(fgpu_emu_client_t *client,
+        fgpu_kernel_state_t *state, dim3 _gridDim, dim3 _blockDim,
+        const fgpu_emu_kernel_t &func)
+{
+    fgpu_launch_geometry_t geo;
+    fgpu_dev_ctx_t ctx = fgpu_dev_ctx_t();
+    bool is_preempted;
+    int ret;
+
+    ctx.gridDim = _gridDim;
+    ctx.blockDim = _blockDim;
+    ctx._blockIdx = -1;
+
+    ret = emu_prepare_launch(client, &ctx, &geo);
+    if (ret < 0)
+        return ret;
+
+    ctx.d_preempt = &client->dev->preempt[ctx.color];
+    ctx.start_block = state->next_block;
+
+    ret = emu_run_pblocks(client, &ctx, func);
+
+    launch_complete(&client->dev->streams, &client->launch);
+
+    if (ret < 0)
+        return ret;
+
+    is_preempted = launch_get_resume_point(ctx.start_block,
+            client->bindex.index[ctx.index], ctx.num_blocks, &state->next_block);
+
+    return is_preempted ? FGPU_KERNEL_PREEMPTED : 0;
+}
+
+int fgpu_emu_preempt_color(fgpu_emu_device_t *dev, int color)
+{
+    if (color < 0 || color >= dev->num_colors) {
+        fprintf(stderr, "FGPU:Invalid color\n");
+        return -EINVAL;
+    }
+
+    dev->preempt[color].requested = 1;
+    __sync_synchronize();
+
+    return 0;
+}
+
+int fgpu_emu_resume_color(fgpu_emu_device_t *dev, int color)
+{
+    if (color < 0 || color >= dev->num_colors) {
+        fprintf(stderr, "FGPU:Invalid color\n");
+        return -EINVAL;
+    }
+
+    dev->preempt[color].requested = 0;
+    __sync_synchronize();
+
+    return 0;
+}
+
+#endif /* FGPU_PREEMPTION_ENABLED */
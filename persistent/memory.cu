@@ -7,7 +7,16 @@
  */
 
 /* TODO: Use better error codes */
-/* TODO: Half of colored memory is being wasted. Need to resolve this issue */
+/* 
+ * NOTE: With userspace coloring, only pages of process's color are used out of
+ * the reservation (req_length * num_colors). This can't be recovered here:
+ * Reservation is backed by 2MB chunks mapped as a whole into the process
+ * (that's the point of userspace coloring) and UVM only allows a chunk to be
+ * owned by a single va_block, so a process with another color can't map it.
+ * Mapping only same colored pages would need 4KB chunks, which is what kernel
+ * coloring does (without the waste). Userspace coloring is deprecated in
+ * favour of it, so this is not going to be fixed.
+ */
 /* 
  * TODO: Make PTEs on GPU consistent (on memprefetch to CPU they are invidated
  * for uvm to work). But make sure data migrates when data changes (When user 
@@ -34,6 +43,8 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <map>
+
 /* CUDA/NVML */
 #include <cuda.h>
 #include <cuda_runtime_api.h>
@@ -49,6 +60,7 @@
 
 #include <fgpu_internal_allocator.hpp>
 #include <fgpu_internal_memory.hpp>
+#include <fgpu_internal_telemetry.hpp>
 
 #ifdef FGPU_MEM_COLORING_ENABLED
 
@@ -56,12 +68,19 @@
 /* TODO: This path can be changed via environment variable */
 #define NVIDIA_MPS_CONTROL_PATH "/tmp/nvidia-mps/control"
 
+/* Set to 0 to not cache colored memcpy/memset ioctl params */
+#define FGPU_IOCTL_PARAMS_CACHE_ENV_NAME    "FGPU_IOCTL_PARAMS_CACHE_ENV"
+
 /* Ioctl codes */
 #define IOCTL_GET_DEVICE_COLOR_INFO     _IOC(0, 0, UVM_GET_DEVICE_COLOR_INFO, 0)
 #define IOCTL_GET_PROCESS_COLOR_INFO    _IOC(0, 0, UVM_GET_PROCESS_COLOR_INFO, 0)
 #define IOCTL_SET_PROCESS_COLOR_INFO    _IOC(0, 0, UVM_SET_PROCESS_COLOR_INFO, 0)
 #define IOCTL_MEMCPY_COLORED            _IOC(0, 0, UVM_MEMCPY_COLORED, 0)
 #define IOCTL_MEMSET_COLORED            _IOC(0, 0, UVM_MEMSET_COLORED, 0)
+#define IOCTL_WAIT_COLORED_FENCE        _IOC(0, 0, UVM_WAIT_COLORED_FENCE, 0)
+#define IOCTL_MEMCPY_COLORED_BATCH      _IOC(0, 0, UVM_MEMCPY_COLORED_BATCH, 0)
+#define IOCTL_HOST_REGISTER             _IOC(0, 0, UVM_HOST_REGISTER, 0)
+#define IOCTL_HOST_UNREGISTER           _IOC(0, 0, UVM_HOST_UNREGISTER, 0)
 
 /* UVM device fd */
 static int g_uvm_fd = -1;
@@ -92,8 +111,16 @@ struct {
 
     int color;
 
+#if defined(FGPU_USER_MEM_COLORING_ENABLED)
+    fgpu_color_func_t color_func;
+#endif
+
     allocator_t *allocator;
 
+    /* Fence of last colored memcpy/memset issued and of last one completed */
+    volatile uint64_t last_fence;
+    volatile uint64_t completed_fence;
+
 } g_memory_ctx;
 
 /* Does the most neccesary initialization */
@@ -271,7 +298,8 @@ int connect(int sockfd, const struct sockaddr *addr,
 
 } /* extern "C" */
 
-static int get_device_color_info(int device, int *num_colors, size_t *max_len)
+static int get_device_color_info(int device, int *num_colors, size_t *max_len,
+                                 int *num_color_masks, uint64_t *color_masks)
 {
     UVM_GET_DEVICE_COLOR_INFO_PARAMS params;
     int ret;
@@ -295,6 +323,12 @@ static int get_device_color_info(int device, int *num_colors, size_t *max_len)
     if (max_len)
         *max_len = params.maxLength;
 
+    if (num_color_masks)
+        *num_color_masks = params.numColorMasks;
+
+    if (color_masks)
+        memcpy(color_masks, params.colorMasks, sizeof(params.colorMasks));
+
     return 0;
 
 }
@@ -313,10 +347,42 @@ int fgpu_memory_get_device_info(int *num_colors, size_t *max_len)
         return -EBADF;
     }
 
-    return get_device_color_info(FGPU_DEVICE_NUMBER, num_colors, max_len);
+    return get_device_color_info(FGPU_DEVICE_NUMBER, num_colors, max_len,
+                                 NULL, NULL);
 
 }
 
+/* Get the color XOR masks used by the driver (Upto FGPU_MAX_MEM_COLOR_BITS) */
+int fgpu_memory_get_device_color_masks(int *num_color_masks, uint64_t *color_masks)
+{
+    uint64_t masks[UVM_MAX_COLOR_XOR_MASKS];
+    int num_masks;
+    int ret;
+
+    ret = init(true);
+    if (ret < 0)
+        return ret;
+
+    if (g_uvm_fd < 0) {
+        fprintf(stderr, "FGPU:Initialization not done\n");
+        return -EBADF;
+    }
+
+    ret = get_device_color_info(FGPU_DEVICE_NUMBER, NULL, NULL, &num_masks, masks);
+    if (ret < 0)
+        return ret;
+
+    if (num_masks > FGPU_MAX_MEM_COLOR_BITS) {
+        fprintf(stderr, "FGPU:Too many color masks in driver\n");
+        return -EINVAL;
+    }
+
+    *num_color_masks = num_masks;
+    memcpy(color_masks, masks, num_masks * sizeof(uint64_t));
+
+    return 0;
+}
+
 static int get_process_color_info(int device, int *color, size_t *length)
 {
     UVM_GET_PROCESS_COLOR_INFO_PARAMS params;
@@ -362,12 +428,85 @@ int fgpu_process_get_colors_info(int device, int *color, size_t *length)
     return get_process_color_info(device, color, length);
 }
 
+static int get_copy_uuid(int device, bool on_gpu, NvProcessorUuid *uuid)
+{
+    if (!on_gpu) {
+        memcpy(uuid, &NV_PROCESSOR_UUID_CPU_DEFAULT, sizeof(NvProcessorUuid));
+        return 0;
+    }
+
+    return get_device_UUID(device, uuid);
+}
+
+/* 
+ * Ioctl params with all but address/length/value/flags filled in. Memcpy
+ * params are indexed by [source on gpu][destination on gpu]. These are built
+ * once along with the process color, as looking up the device UUID is costly
+ * compared to a small copy. With FGPU_IOCTL_PARAMS_CACHE_ENV set to 0, these
+ * are built again for every copy instead (For comparison).
+ */
+typedef struct ioctl_params {
+    UVM_MEMCPY_COLORED_PARAMS memcpy_params[2][2];
+    UVM_MEMSET_COLORED_PARAMS memset_params;
+} ioctl_params_t;
+
+static ioctl_params_t g_ioctl_params;
+static bool g_ioctl_params_cached;
+
+static int init_ioctl_params(int device, ioctl_params_t *ioctl_params)
+{
+    int ret;
+
+    memset(ioctl_params, 0, sizeof(*ioctl_params));
+
+    for (int src_on_gpu = 0; src_on_gpu < 2; src_on_gpu++) {
+        for (int dst_on_gpu = 0; dst_on_gpu < 2; dst_on_gpu++) {
+            UVM_MEMCPY_COLORED_PARAMS *params = 
+                &ioctl_params->memcpy_params[src_on_gpu][dst_on_gpu];
+
+            ret = get_copy_uuid(device, src_on_gpu, &params->srcUuid);
+            if (ret < 0)
+                return ret;
+
+            ret = get_copy_uuid(device, dst_on_gpu, &params->destUuid);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    ret = get_device_UUID(device, &ioctl_params->memset_params.uuid);
+    if (ret < 0)
+        return ret;
+
+    ioctl_params->memset_params.flags = UVM_COLORED_FLAGS_ASYNC;
+
+    return 0;
+}
+
+static int get_ioctl_params(ioctl_params_t **ioctl_params, ioctl_params_t *buf)
+{
+    int ret;
+
+    if (g_ioctl_params_cached) {
+        *ioctl_params = &g_ioctl_params;
+        return 0;
+    }
+
+    ret = init_ioctl_params(FGPU_DEVICE_NUMBER, buf);
+    if (ret < 0)
+        return ret;
+
+    *ioctl_params = buf;
+    return 0;
+}
+
 /* Set memory color and also reserve memory */
 static int set_process_color_info(int device, int color, size_t req_length,
         cudaStream_t stream)
 {
     UVM_SET_PROCESS_COLOR_INFO_PARAMS params;
     size_t actual_length = req_length;
+    const char *tmp;
     int ret;
 
     /* Color can only be set once */
@@ -377,11 +516,21 @@ static int set_process_color_info(int device, int color, size_t req_length,
     }
 
 #if defined(FGPU_USER_MEM_COLORING_ENABLED)
+    /* Only one color's pages are usable (See note at the top) */
     int num_colors;
-    ret = get_device_color_info(device, &num_colors, NULL);
+    int num_color_masks;
+    uint64_t color_masks[UVM_MAX_COLOR_XOR_MASKS];
+    ret = get_device_color_info(device, &num_colors, NULL,
+                                &num_color_masks, color_masks);
     if (ret < 0)
         return ret;
-    
+
+    ret = fgpu_color_func_init(color_masks, num_color_masks, &g_memory_ctx.color_func);
+    if (ret < 0) {
+        fprintf(stderr, "FGPU:Color function not supported with userspace coloring\n");
+        return ret;
+    }
+
     actual_length = req_length * num_colors;
 #endif
 
@@ -389,6 +538,13 @@ static int set_process_color_info(int device, int color, size_t req_length,
     if (ret < 0)
         return ret;
 
+    ret = init_ioctl_params(device, &g_ioctl_params);
+    if (ret < 0)
+        return ret;
+
+    tmp = getenv(FGPU_IOCTL_PARAMS_CACHE_ENV_NAME);
+    g_ioctl_params_cached = !tmp || atoi(tmp) != 0;
+
     params.color = color;
     params.length = actual_length;
 
@@ -419,6 +575,16 @@ static int set_process_color_info(int device, int color, size_t req_length,
         return ret;
     }
 
+#if defined(FGPU_USER_MEM_COLORING_ENABLED)
+    /* Translation works on aligned groups of pages, one of each color */
+    if ((params.address >> FGPU_DEVICE_COLOR_SHIFT) &
+            ((1ULL << g_memory_ctx.color_func.num_bits) - 1)) {
+        fprintf(stderr, "FGPU:Reserved memory not aligned to color groups\n");
+        cudaFree(g_memory_ctx.base_addr);
+        return -EINVAL;
+    }
+#endif
+
     g_memory_ctx.is_initialized = true;
     g_memory_ctx.base_phy_addr = (void *)params.address;
     g_memory_ctx.reserved_len = req_length;
@@ -481,6 +647,8 @@ int fgpu_memory_allocate(void **p, size_t len)
     }
 
     *p = ret_addr;
+
+    fgpu_telemetry_set_heap_used(allocator_get_used(g_memory_ctx.allocator));
     
     return 0;
 }
@@ -494,6 +662,8 @@ int fgpu_memory_free(void *p)
 
     allocator_free(g_memory_ctx.allocator, p);
 
+    fgpu_telemetry_set_heap_used(allocator_get_used(g_memory_ctx.allocator));
+
     return 0;
 }
 
@@ -550,7 +720,8 @@ void *fgpu_memory_get_phy_address(void *addr)
 
 #if defined(FGPU_USER_MEM_COLORING_ENABLED)
 
-int fgpu_get_memory_info(uintptr_t *start_virt_addr, uintptr_t *start_idx)
+int fgpu_get_memory_info(uintptr_t *start_virt_addr, uintptr_t *start_idx,
+                         fgpu_color_func_t *color_func)
 {
     if (!g_memory_ctx.is_initialized) {
         fprintf(stderr, "FGPU:Initialization not done\n");
@@ -559,6 +730,7 @@ int fgpu_get_memory_info(uintptr_t *start_virt_addr, uintptr_t *start_idx)
 
     *start_virt_addr = (uintptr_t)g_memory_ctx.base_addr;
     *start_idx = ((uintptr_t)g_memory_ctx.base_phy_addr) >> FGPU_DEVICE_COLOR_SHIFT;
+    *color_func = g_memory_ctx.color_func;
 
     return 0;
 }
@@ -581,6 +753,7 @@ int fgpu_memory_copy_async_to_device_internal(void *dst, const void *src,
                 (size_t)FGPU_DEVICE_PAGE_SIZE - (size_t)offset);
         void *true_virt_addr_dest = fgpu_color_device_true_virt_addr((uint64_t)g_memory_ctx.base_addr,
                                                                      (uint64_t)g_memory_ctx.base_phy_addr,
+                                                                     &g_memory_ctx.color_func,
                                                                      g_memory_ctx.color,
                                                                      dst);
 
@@ -607,6 +780,7 @@ int fgpu_memory_copy_async_to_host_internal(void *dst, const void *src,
                 (size_t)FGPU_DEVICE_PAGE_SIZE - (size_t)offset);
         void *true_virt_addr_src = fgpu_color_device_true_virt_addr((uint64_t)g_memory_ctx.base_addr,
                                                                     (uint64_t)g_memory_ctx.base_phy_addr,
+                                                                    &g_memory_ctx.color_func,
                                                                     g_memory_ctx.color,
                                                                     src);
 
@@ -653,12 +827,132 @@ static bool is_address_on_gpu(const void *address)
     return true;
 }
 
+/* Fences are handed out in increasing order, but ioctls can return out of order */
+static void update_fence(volatile uint64_t *fence, uint64_t value)
+{
+    uint64_t old;
+
+    while ((old = *fence) < value) {
+        if (__sync_bool_compare_and_swap(fence, old, value))
+            break;
+    }
+}
+
+uint64_t fgpu_memory_get_last_fence_internal(void)
+{
+    return g_memory_ctx.last_fence;
+}
+
+/* 
+ * Waits for all colored memcpy/memset upto fence. If not blocking, returns 0
+ * if these are still pending. Returns 1 on completion.
+ */
+int fgpu_memory_wait_fence_internal(uint64_t fence, bool block)
+{
+    UVM_WAIT_COLORED_FENCE_PARAMS params;
+    int ret;
+
+    if (fence <= g_memory_ctx.completed_fence)
+        return 1;
+
+    params.fence = fence;
+    params.flags = block ? 0 : UVM_COLORED_FLAGS_QUERY;
+
+    ret = ioctl(g_uvm_fd, IOCTL_WAIT_COLORED_FENCE, &params);
+    if (ret < 0)
+        return ret;
+
+    if (params.rmStatus != NV_OK) {
+        fprintf(stderr, "FGPU:Waiting for memcpy failed\n");
+        return -EINVAL;
+    }
+
+    if (!params.completed)
+        return 0;
+
+    update_fence(&g_memory_ctx.completed_fence, fence);
+
+    return 1;
+}
+
+static bool is_copy_src_on_gpu(enum fgpu_memory_copy_type type, const void *src)
+{
+    return type == FGPU_COPY_GPU_TO_CPU || type == FGPU_COPY_GPU_TO_GPU ||
+            (type == FGPU_COPY_DEFAULT && is_address_on_gpu(src));
+}
+
+static bool is_copy_dst_on_gpu(enum fgpu_memory_copy_type type, const void *dst)
+{
+    return type == FGPU_COPY_CPU_TO_GPU || type == FGPU_COPY_GPU_TO_GPU ||
+            (type == FGPU_COPY_DEFAULT && is_address_on_gpu(dst));
+}
+
+static NvU64 get_copy_address(bool on_gpu, const void *address)
+{
+    if (!on_gpu)
+        return (NvU64)address;
+
+    return (NvU64)fgpu_color_device_true_virt_addr((uint64_t)g_memory_ctx.base_addr,
+                                                   (uint64_t)g_memory_ctx.base_phy_addr,
+                                                   &g_memory_ctx.color_func,
+                                                   g_memory_ctx.color,
+                                                   address);
+}
+
+/* Host ranges registered with fgpu_host_register(), start -> length */
+static struct {
+    pthread_mutex_t lock;
+    std::map<uintptr_t, size_t> ranges;
+} g_host_registered = {PTHREAD_MUTEX_INITIALIZER};
+
+static bool is_host_registered(const void *address, size_t count)
+{
+    uintptr_t start = (uintptr_t)address;
+    std::map<uintptr_t, size_t>::iterator it;
+    bool ret = false;
+
+    pthread_mutex_lock(&g_host_registered.lock);
+    it = g_host_registered.ranges.upper_bound(start);
+    if (it != g_host_registered.ranges.begin()) {
+        it--;
+        ret = start + count <= it->first + it->second;
+    }
+    pthread_mutex_unlock(&g_host_registered.lock);
+
+    return ret;
+}
+
+/* 
+ * As with cudaMemcpyAsync(), copies from/to pageable host memory are done
+ * by the time they return, so that the host buffer can be reused right away.
+ * Only copies between GPU and registered host memory are left in flight.
+ */
+static NvU32 get_copy_flags(bool src_on_gpu, const void *src,
+                            bool dst_on_gpu, const void *dst, size_t count)
+{
+    if (!src_on_gpu && !is_host_registered(src, count))
+        return 0;
+
+    if (!dst_on_gpu && !is_host_registered(dst, count))
+        return 0;
+
+    return UVM_COLORED_FLAGS_ASYNC;
+}
+
+/* 
+ * Colored memcpy/memset are done by the driver on its own channel. They are
+ * ordered after the work already on the stream and don't block till completion
+ * (See get_copy_flags() for copies with host memory). Work after them is
+ * ordered by waiting on the fence (See fgpu_memory_event_t).
+ */
 int fgpu_memory_copy_async_internal(void *dst, const void *src, size_t count,
                                     enum fgpu_memory_copy_type type,
                                     cudaStream_t stream)
 {
-    /* XXX: Currently, not sure how to use stream? */
     UVM_MEMCPY_COLORED_PARAMS params;
+    ioctl_params_t buf, *ioctl_params;
+    bool src_on_gpu = is_copy_src_on_gpu(type, src);
+    bool dst_on_gpu = is_copy_dst_on_gpu(type, dst);
     int ret;
 
     if (type == FGPU_COPY_CPU_TO_CPU) {
@@ -666,42 +960,19 @@ int fgpu_memory_copy_async_internal(void *dst, const void *src, size_t count,
         return 0;
     }
 
-    /* Source is GPU? */
-    if (type == FGPU_COPY_GPU_TO_CPU || type == FGPU_COPY_GPU_TO_GPU ||
-            (type == FGPU_COPY_DEFAULT && is_address_on_gpu(src))) {
-        
-        ret = get_device_UUID(FGPU_DEVICE_NUMBER, &params.srcUuid);
-        if (ret < 0)
-            return ret;
-        
-        params.srcBase = (NvU64)fgpu_color_device_true_virt_addr((uint64_t)g_memory_ctx.base_addr,
-                                                                    (uint64_t)g_memory_ctx.base_phy_addr,
-                                                                    g_memory_ctx.color,
-                                                                    src);
-
-    } else {
-        memcpy(&params.srcUuid, &NV_PROCESSOR_UUID_CPU_DEFAULT, sizeof(NvProcessorUuid));
-        params.srcBase = (NvU64)src;
-    }
-
-    /* Destination is GPU? */
-    if (type == FGPU_COPY_CPU_TO_GPU || type == FGPU_COPY_GPU_TO_GPU ||
-            (type == FGPU_COPY_DEFAULT && is_address_on_gpu(dst))) {
-        ret = get_device_UUID(FGPU_DEVICE_NUMBER, &params.destUuid);
-        if (ret < 0)
-            return ret;
-
-        params.destBase = (NvU64)fgpu_color_device_true_virt_addr((uint64_t)g_memory_ctx.base_addr,
-                                                                    (uint64_t)g_memory_ctx.base_phy_addr,
-                                                                    g_memory_ctx.color,
-                                                                    dst);
+    ret = get_ioctl_params(&ioctl_params, &buf);
+    if (ret < 0)
+        return ret;
 
-    } else {
-        memcpy(&params.destUuid, &NV_PROCESSOR_UUID_CPU_DEFAULT, sizeof(NvProcessorUuid));
-        params.destBase = (NvU64)dst;
-    }
+    ret = gpuErrCheck(cudaStreamSynchronize(stream));
+    if (ret < 0)
+        return ret;
 
+    params = ioctl_params->memcpy_params[src_on_gpu][dst_on_gpu];
+    params.srcBase = get_copy_address(src_on_gpu, src);
+    params.destBase = get_copy_address(dst_on_gpu, dst);
     params.length = count;
+    params.flags = get_copy_flags(src_on_gpu, src, dst_on_gpu, dst, count);
 
     ret = ioctl(g_uvm_fd, IOCTL_MEMCPY_COLORED, &params);
     if (ret < 0)
@@ -712,21 +983,105 @@ int fgpu_memory_copy_async_internal(void *dst, const void *src, size_t count,
         return -EINVAL;
     }
 
+    update_fence(&g_memory_ctx.last_fence, params.fence);
+
+    return 0;
+}
+
+/* 
+ * Consecutive copies in the same direction are handed to driver together.
+ * Ordering w.r.t. stream is same as fgpu_memory_copy_async_internal(). A batch
+ * is asynchronous only if all of its copies could be.
+ */
+int fgpu_memory_copy_batch_internal(const fgpu_memory_copy_desc_t *descs, int num_descs,
+                                    enum fgpu_memory_copy_type type,
+                                    cudaStream_t stream)
+{
+    UVM_MEMCPY_COLORED_BATCH_PARAMS params;
+    UvmMemcpyColoredDesc batch[FGPU_MEMCPY_BATCH_SIZE];
+    ioctl_params_t buf, *ioctl_params;
+    bool src_on_gpu, dst_on_gpu;
+    NvU32 flags;
+    int i, n, ret;
+
+    ret = get_ioctl_params(&ioctl_params, &buf);
+    if (ret < 0)
+        return ret;
+
+    ret = gpuErrCheck(cudaStreamSynchronize(stream));
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < num_descs; i += n) {
+
+        src_on_gpu = is_copy_src_on_gpu(type, descs[i].src);
+        dst_on_gpu = is_copy_dst_on_gpu(type, descs[i].dst);
+
+        if (!src_on_gpu && !dst_on_gpu) {
+            memcpy(descs[i].dst, descs[i].src, descs[i].count);
+            n = 1;
+            continue;
+        }
+
+        flags = UVM_COLORED_FLAGS_ASYNC;
+
+        for (n = 0; i + n < num_descs && n < FGPU_MEMCPY_BATCH_SIZE; n++) {
+            const fgpu_memory_copy_desc_t *desc = &descs[i + n];
+
+            if (is_copy_src_on_gpu(type, desc->src) != src_on_gpu ||
+                    is_copy_dst_on_gpu(type, desc->dst) != dst_on_gpu)
+                break;
+
+            batch[n].srcBase = get_copy_address(src_on_gpu, desc->src);
+            batch[n].destBase = get_copy_address(dst_on_gpu, desc->dst);
+            batch[n].length = desc->count;
+
+            if (flags)
+                flags = get_copy_flags(src_on_gpu, desc->src, dst_on_gpu,
+                                       desc->dst, desc->count);
+        }
+
+        memcpy(&params.srcUuid, &ioctl_params->memcpy_params[src_on_gpu][dst_on_gpu].srcUuid,
+                sizeof(NvProcessorUuid));
+        memcpy(&params.destUuid, &ioctl_params->memcpy_params[src_on_gpu][dst_on_gpu].destUuid,
+                sizeof(NvProcessorUuid));
+        params.descs = (NvU64)batch;
+        params.numDescs = n;
+        params.flags = flags;
+
+        ret = ioctl(g_uvm_fd, IOCTL_MEMCPY_COLORED_BATCH, &params);
+        if (ret < 0)
+            return ret;
+
+        if (params.rmStatus != NV_OK) {
+            fprintf(stderr, "FGPU:Memcpy failed\n");
+            return -EINVAL;
+        }
+
+        update_fence(&g_memory_ctx.last_fence, params.fence);
+    }
+
     return 0;
 }
 
 int fgpu_memory_memset_async_internal(void *address, int value, size_t count, cudaStream_t stream)
 {
-    /* XXX: Currently, not sure how to use stream? */
     UVM_MEMSET_COLORED_PARAMS params;
+    ioctl_params_t buf, *ioctl_params;
     int ret;
 
-    ret = get_device_UUID(FGPU_DEVICE_NUMBER, &params.uuid);
+    ret = get_ioctl_params(&ioctl_params, &buf);
+    if (ret < 0)
+        return ret;
+
+    ret = gpuErrCheck(cudaStreamSynchronize(stream));
     if (ret < 0)
         return ret;
-        
+
+    params = ioctl_params->memset_params;
     params.base = (NvU64)fgpu_color_device_true_virt_addr((uint64_t)g_memory_ctx.base_addr,
                                                           (uint64_t)g_memory_ctx.base_phy_addr,
+                                                          &g_memory_ctx.color_func,
                                                           g_memory_ctx.color,
                                                           address);
     params.value = value;
@@ -741,6 +1096,60 @@ int fgpu_memory_memset_async_internal(void *address, int value, size_t count, cu
         return -EINVAL;
     } 
 
+    update_fence(&g_memory_ctx.last_fence, params.fence);
+
+    return 0;
+}
+
+/* 
+ * Pins host memory in the driver so that colored copies from/to it don't have
+ * to pin its pages on every copy. Memory must stay mapped till unregistered.
+ */
+int fgpu_host_register(void *ptr, size_t size)
+{
+    UVM_HOST_REGISTER_PARAMS params;
+    int ret;
+
+    params.base = (NvU64)ptr;
+    params.length = size;
+
+    ret = ioctl(g_uvm_fd, IOCTL_HOST_REGISTER, &params);
+    if (ret < 0)
+        return ret;
+
+    if (params.rmStatus != NV_OK) {
+        fprintf(stderr, "FGPU:Host register failed\n");
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&g_host_registered.lock);
+    g_host_registered.ranges[(uintptr_t)ptr] = size;
+    pthread_mutex_unlock(&g_host_registered.lock);
+
+    return 0;
+}
+
+int fgpu_host_unregister(void *ptr)
+{
+    UVM_HOST_UNREGISTER_PARAMS params;
+    int ret;
+
+    params.base = (NvU64)ptr;
+
+    /* Copies in flight keep their own pins */
+    pthread_mutex_lock(&g_host_registered.lock);
+    g_host_registered.ranges.erase((uintptr_t)ptr);
+    pthread_mutex_unlock(&g_host_registered.lock);
+
+    ret = ioctl(g_uvm_fd, IOCTL_HOST_UNREGISTER, &params);
+    if (ret < 0)
+        return ret;
+
+    if (params.rmStatus != NV_OK) {
+        fprintf(stderr, "FGPU:Host unregister failed\n");
+        return -EINVAL;
+    }
+
     return 0;
 }
 
@@ -770,4 +1179,41 @@ int fgpu_memory_memset_async_internal(void *address, int value, size_t count, cu
     return gpuErrCheck(cudaMemsetAsync(address, value, count, stream));
 }
 
+int fgpu_memory_copy_batch_internal(const fgpu_memory_copy_desc_t *descs, int num_descs,
+                                    enum fgpu_memory_copy_type type,
+                                    cudaStream_t stream)
+{
+    int ret;
+
+    for (int i = 0; i < num_descs; i++) {
+        ret = fgpu_memory_copy_async_internal(descs[i].dst, descs[i].src,
+                descs[i].count, type, stream);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* All copies are on CUDA streams */
+uint64_t fgpu_memory_get_last_fence_internal(void)
+{
+    return 0;
+}
+
+int fgpu_memory_wait_fence_internal(uint64_t fence, bool block)
+{
+    return 1;
+}
+
+int fgpu_host_register(void *ptr, size_t size)
+{
+    return gpuErrCheck(cudaHostRegister(ptr, size, cudaHostRegisterDefault));
+}
+
+int fgpu_host_unregister(void *ptr)
+{
+    return gpuErrCheck(cudaHostUnregister(ptr));
+}
+
 #endif /* FGPU_USER_MEM_COLORING_ENABLED */
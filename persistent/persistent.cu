@@ -6,10 +6,13 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <map>
@@ -20,6 +23,10 @@
 #include <fgpu_internal_common.hpp>
 #include <fgpu_internal_memory.hpp>
 #include <fgpu_internal_persistent.hpp>
+#include <fgpu_internal_profile.hpp>
+#include <fgpu_internal_scheduler.hpp>
+#include <fgpu_internal_telemetry.hpp>
+#include <fgpu_internal_trace.hpp>
 #include <fractional_gpu.hpp>
 
 /* TODO: Add support for multithreaded applications */
@@ -40,6 +47,15 @@
 /* Name of environment variables to check for color/size of colored mem */
 #define FGPU_COLOR_ENV_NAME             "FGPU_COLOR_ENV"
 #define FGPU_COLOR_MEM_SIZE_ENV_NAME    "FGPU_COLOR_MEM_SIZE_ENV"
+#define FGPU_PRIORITY_ENV_NAME          "FGPU_PRIORITY_ENV"
+#define FGPU_DEADLINE_ENV_NAME          "FGPU_DEADLINE_ENV"
+
+/* Name of environment variable to check for admission threshold (percent) */
+#define FGPU_ADMISSION_THRESHOLD_ENV_NAME   "FGPU_ADMISSION_THRESHOLD_ENV"
+#define FGPU_DEFAULT_ADMISSION_THRESHOLD    100
+
+/* Name of environment variable to check for device profile (Used by server) */
+#define FGPU_DEVICE_PROFILE_ENV_NAME        "FGPU_DEVICE_PROFILE_ENV"
 
 /* Default values of color/size of colored mem */
 #define FGPU_DEFAULT_COLOR              0
@@ -60,6 +76,10 @@ static volatile fgpu_indicators_t *h_indicators;
 static volatile fgpu_indicators_t *d_host_indicators;
 static volatile fgpu_bindex_t *d_dev_indicator;
 static fgpu_bindex_t *d_bindex;
+#if defined(FGPU_TRACE_ENABLED)
+static fgpu_trace_buffer_t *d_trace;
+static uint32_t g_launch_seq;
+#endif
 int cur_index;
 /*
  * This structure contains all host side information for persistent thread ctx.
@@ -82,19 +102,78 @@ typedef struct fgpu_host_ctx {
     int last_num_pblocks_launched;
     int last_num_active_pblocks;
 
-    /*
-     * Lock to allow only one outstanding operation in each color stream
-     * CUDA streams can't be shared between processes.
-     */
-    pthread_mutex_t streams_lock;
-    pthread_cond_t streams_cond[FGPU_MAX_NUM_COLORS];
-    bool is_stream_free[FGPU_MAX_NUM_COLORS];
+    /* CUDA streams can't be shared between processes, so arbitrate them */
+    fgpu_color_streams_t streams;
+
+    /* Utilization reserved by processes on each color (set by server) */
+    pthread_mutex_t clients_lock;
+    fgpu_client_t clients[FGPU_MAX_NUM_CLIENTS];
+    uint32_t admission_threshold;
 
 } fgpu_host_ctx_t;
 
 /* Host side context */
 static fgpu_host_ctx_t *g_host_ctx;
 
+/* Telemetry (placed after host ctx in same shared memory) */
+static fgpu_telemetry_t *g_telemetry;
+static fgpu_telemetry_client_t *g_telemetry_client;
+
+/* Size of shared memory containing host ctx and telemetry */
+static size_t get_shmem_size(size_t page_size)
+{
+    return ROUND_UP(sizeof(fgpu_host_ctx_t), page_size) +
+        ROUND_UP(sizeof(fgpu_telemetry_t), page_size);
+}
+
+static fgpu_telemetry_t *get_telemetry(void *shmem, size_t page_size)
+{
+    return (fgpu_telemetry_t *)((uintptr_t)shmem +
+            ROUND_UP(sizeof(fgpu_host_ctx_t), page_size));
+}
+
+/* Adds to counter of both the process and its color */
+#define TELEMETRY_ADD(field, val)                                               \
+    do {                                                                        \
+        if (g_telemetry_client) {                                               \
+            __sync_fetch_and_add(&g_telemetry->colors[g_color].field,           \
+                    (uint64_t)(val));                                           \
+            __sync_fetch_and_add(&g_telemetry_client->counters.field,           \
+                    (uint64_t)(val));                                           \
+        }                                                                       \
+    } while (0)
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+
+static fgpu_launch_profile_t g_launch_profile;
+static uint64_t g_launch_profile_mark;
+
+static inline uint64_t launch_profile_now_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Charges time since the last mark to a phase of launch */
+#define LAUNCH_PROFILE_START()                                                  \
+    g_launch_profile_mark = launch_profile_now_nsec()
+
+#define LAUNCH_PROFILE_PHASE(phase)                                             \
+    do {                                                                        \
+        uint64_t _now = launch_profile_now_nsec();                              \
+        g_launch_profile.phase += _now - g_launch_profile_mark;                 \
+        g_launch_profile_mark = _now;                                           \
+    } while (0)
+
+#else
+
+#define LAUNCH_PROFILE_START()
+#define LAUNCH_PROFILE_PHASE(phase)
+
+#endif /* FGPU_LAUNCH_PROFILE_ENABLED */
+
 /* Shared memories file descriptor */
 static int shmem_fd = -1;
 static int shmem_host_fd = -1;
@@ -102,6 +181,10 @@ static int shmem_host_fd = -1;
 /* The set color for the process */
 static int g_color = FGPU_INVALID_COLOR;
 
+/* Launch class, budget and telemetry of the process within its color */
+static fgpu_launch_client_t g_launch_client;
+static int g_client_slot = -1;
+
 /* Checks if MPS is enabled */
 static bool is_mps_enabled(void)
 {
@@ -183,6 +266,63 @@ static int init_shared_condvar(pthread_cond_t *cond)
     return 0;
 }
 
+/*
+ * Loads device profile, if any. Devices with a profile (exported by reverse
+ * engineering code) are supported even if not in the list of supported GPUs.
+ * Returns 1 if profile was loaded.
+ */
+static int load_device_profile(const cudaDeviceProp *device_prop,
+        fgpu_device_profile_t *profile)
+{
+    const char *path = getenv(FGPU_DEVICE_PROFILE_ENV_NAME);
+    int ret;
+
+    if (!path)
+        return 0;
+
+    ret = fgpu_profile_load(path, profile);
+    if (ret < 0)
+        return ret;
+
+    if (strcmp(profile->device, device_prop->name) != 0) {
+        fprintf(stderr, "FGPU:Device profile is for \"%s\", not \"%s\"\n",
+                profile->device, device_prop->name);
+        return -ENXIO;
+    }
+
+    printf("FGPU:Using device profile %s\n", path);
+
+    return 1;
+}
+
+#ifdef FGPU_MEM_COLORING_ENABLED
+/* Profile code has its own limit as it doesn't include the public headers */
+COMPILE_ASSERT(FGPU_PROFILE_MAX_COLOR_MASKS == FGPU_MAX_MEM_COLOR_BITS);
+
+/* Color function is set in the driver. Check it is the one in the profile. */
+static int check_device_profile_colors(const fgpu_device_profile_t *profile)
+{
+    uint64_t color_masks[FGPU_MAX_MEM_COLOR_BITS];
+    char buf[FGPU_MAX_MEM_COLOR_BITS * 20];
+    int num_color_masks;
+    int ret;
+
+    ret = fgpu_memory_get_device_color_masks(&num_color_masks, color_masks);
+    if (ret < 0)
+        return ret;
+
+    if (fgpu_profile_check_color_masks(profile, color_masks, num_color_masks))
+        return 0;
+
+    fgpu_profile_format_masks(buf, sizeof(buf), profile->color_masks,
+            profile->num_color_masks);
+    fprintf(stderr, "FGPU:Driver color function doesn't match device profile. "
+            "Load nvidia-uvm with uvm_color_xor_masks set to (a prefix of) %s\n", buf);
+
+    return -EINVAL;
+}
+#endif
+
 /* Sets color info per device */
 static int init_color_info(fgpu_host_ctx_t *host_ctx, int device,
         const cudaDeviceProp *device_prop)
@@ -191,6 +331,8 @@ static int init_color_info(fgpu_host_ctx_t *host_ctx, int device,
     int num_sm = device_prop->multiProcessorCount;
     int sm_per_color;
     int supported = false;
+    fgpu_device_profile_t profile;
+    int has_profile;
    
     /* Check device is supported */
     for (int i = 0; i < sizeof(supported_gpus)/sizeof(supported_gpus[0]); i++) {
@@ -200,8 +342,13 @@ static int init_color_info(fgpu_host_ctx_t *host_ctx, int device,
         }
     }
 
-    if (!supported) {
-        fprintf(stderr, "FGPU:Unknown CUDA device\n");
+    has_profile = load_device_profile(device_prop, &profile);
+    if (has_profile < 0)
+        return has_profile;
+
+    if (!supported && !has_profile) {
+        fprintf(stderr, "FGPU:Unknown CUDA device. Set %s to its device profile\n",
+                FGPU_DEVICE_PROFILE_ENV_NAME);
         return -ENXIO;
     }
 
@@ -226,6 +373,12 @@ static int init_color_info(fgpu_host_ctx_t *host_ctx, int device,
 	    return ret;
     }
 
+    if (has_profile) {
+        ret = check_device_profile_colors(&profile);
+        if (ret < 0)
+            return ret;
+    }
+
     /* 
      * When memory coloring enabled, the total number of colors available is 
      * equal to memory coloring.
@@ -260,16 +413,13 @@ static int init_color_info(fgpu_host_ctx_t *host_ctx, int device,
 
     printf("FGPU:Device: \"%s\", Number of Colors:%d\n", device_prop->name, num_colors);
     for (int i = 0; i < num_colors; i++) {
-        int start_sm;
-        int end_sm;
+        uint32_t start_sm;
+        uint32_t end_sm;
 
-        start_sm = i * sm_per_color;
-        end_sm = (i + 1) * sm_per_color - 1;
-        if (i == num_colors - 1)
-            end_sm = num_sm - 1;
+        fgpu_get_color_sms(i, num_colors, num_sm, &start_sm, &end_sm);
 
         host_ctx->color_to_sms[i] = std::make_pair(start_sm, end_sm);
-        printf("FGPU:Color:%d, SMs:(%d->%d)\n", i, start_sm, end_sm);
+        printf("FGPU:Color:%d, SMs:(%u->%u)\n", i, start_sm, end_sm);
     }
 
     return 0;
@@ -314,6 +464,115 @@ static int init_device_info(fgpu_host_ctx_t *host_ctx)
     return 0;
 }
 
+/* Claims a telemetry slot for the process. Slots of dead processes are reused */
+static void telemetry_claim_client(int color)
+{
+    pid_t pid = getpid();
+
+    for (int i = 0; i < FGPU_MAX_NUM_CLIENTS; i++) {
+        fgpu_telemetry_client_t *client = &g_telemetry->clients[i];
+        pid_t old = client->pid;
+
+        if (old != 0 && !(kill(old, 0) < 0 && errno == ESRCH))
+            continue;
+
+        if (!__sync_bool_compare_and_swap(&client->pid, old, pid))
+            continue;
+
+        /* Heap of dead process is no longer in use */
+        if (old != 0)
+            __sync_fetch_and_sub(&g_telemetry->colors[client->color].heap_used,
+                    client->counters.heap_used);
+
+        memset(&client->counters, 0, sizeof(client->counters));
+        client->color = color;
+        g_telemetry_client = client;
+        g_launch_client.color_counters = &g_telemetry->colors[color];
+        g_launch_client.counters = &client->counters;
+        return;
+    }
+
+    /* Telemetry is best effort */
+    fprintf(stderr, "FGPU:No free telemetry slot\n");
+}
+
+static void telemetry_release_client(void)
+{
+    if (!g_telemetry_client)
+        return;
+
+    fgpu_telemetry_set_heap_used(0);
+    g_launch_client.counters = NULL;
+    __sync_lock_release(&g_telemetry_client->pid);
+    g_telemetry_client = NULL;
+}
+
+void fgpu_telemetry_add_bytes_copied(size_t count)
+{
+    TELEMETRY_ADD(bytes_copied, count);
+}
+
+void fgpu_telemetry_set_heap_used(size_t used)
+{
+    uint64_t old;
+
+    if (!g_telemetry_client)
+        return;
+
+    old = g_telemetry_client->counters.heap_used;
+    g_telemetry_client->counters.heap_used = used;
+    __sync_fetch_and_add(&g_telemetry->colors[g_color].heap_used,
+            (uint64_t)used - old);
+}
+
+/* Maps telemetry read-only (without needing to initialize FGPU) */
+const volatile fgpu_telemetry_t *fgpu_telemetry_attach(void)
+{
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    void *shmem;
+    int fd;
+
+    fd = shm_open(FGPU_SHMEM_NAME, O_RDONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        fprintf(stderr, "FGPU:Couldn't open shmem. Is server running?\n");
+        return NULL;
+    }
+
+    shmem = mmap(NULL, get_shmem_size(page_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shmem == MAP_FAILED) {
+        fprintf(stderr, "FGPU:Can't map shmem\n");
+        return NULL;
+    }
+
+    return get_telemetry(shmem, page_size);
+}
+
+void fgpu_telemetry_detach(const volatile fgpu_telemetry_t *telemetry)
+{
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+
+    munmap((void *)((uintptr_t)telemetry - ROUND_UP(sizeof(fgpu_host_ctx_t), page_size)),
+            get_shmem_size(page_size));
+}
+
+/* Returns admission threshold (ppm) per color from env variable or default */
+static uint32_t get_env_admission_threshold(void)
+{
+    const char* tmp = getenv(FGPU_ADMISSION_THRESHOLD_ENV_NAME);
+    int percent = FGPU_DEFAULT_ADMISSION_THRESHOLD;
+
+    if (tmp)
+        percent = atoi(tmp);
+
+    if (percent <= 0 || percent > 100) {
+        fprintf(stderr, "FGPU:Invalid admission threshold. Using default\n");
+        percent = FGPU_DEFAULT_ADMISSION_THRESHOLD;
+    }
+
+    return (uint32_t)percent * (FGPU_UTILIZATION_FULL / 100);
+}
+
 /* Initialize (by server)
  * Currently, assumption is made that client's are launch some time after
  * server is launched, allowing server to initialize properly before clients
@@ -340,7 +599,7 @@ int fgpu_server_init(void)
 
     page_size = sysconf(_SC_PAGE_SIZE);
 
-    shmem_size = ROUND_UP(sizeof(fgpu_host_ctx_t), page_size);
+    shmem_size = get_shmem_size(page_size);
 
     ret = ftruncate(shmem_fd, shmem_size);
     if (ret < 0) {
@@ -356,6 +615,9 @@ int fgpu_server_init(void)
         goto err;
     }
 
+    g_telemetry = get_telemetry(g_host_ctx, page_size);
+    memset(g_telemetry, 0, sizeof(fgpu_telemetry_t));
+
     ret = shmem_host_fd = shm_open(FGPU_SHMEM_HOST_NAME,
             O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
     if (ret < 0) {
@@ -415,16 +677,20 @@ int fgpu_server_init(void)
     g_host_ctx->last_num_pblocks_launched = 0;
     g_host_ctx->last_color = FGPU_INVALID_COLOR;
 
-    ret = init_shared_mutex(&g_host_ctx->streams_lock);
+    ret = color_streams_init(&g_host_ctx->streams, g_host_ctx->num_colors, true);
     if (ret < 0)
         goto err;
 
-    for (int i = 0; i < g_host_ctx->num_colors; i++) {
-        ret = init_shared_condvar(&g_host_ctx->streams_cond[i]);
-        if (ret < 0)
-            goto err;
-        g_host_ctx->is_stream_free[i] = true;
-    }
+    ret = init_shared_mutex(&g_host_ctx->clients_lock);
+    if (ret < 0)
+        goto err;
+
+    for (int i = 0; i < FGPU_MAX_NUM_CLIENTS; i++)
+        g_host_ctx->clients[i].valid = false;
+
+    g_host_ctx->admission_threshold = get_env_admission_threshold();
+
+    g_telemetry->num_colors = g_host_ctx->num_colors;
      
     if (!is_mps_enabled()) {
         fprintf(stderr, "FGPU:MPS is not enabled\n");
@@ -482,7 +748,7 @@ int fgpu_init(void)
 
     page_size = sysconf(_SC_PAGE_SIZE);
 
-    shmem_size = ROUND_UP(sizeof(fgpu_host_ctx_t), page_size);
+    shmem_size = get_shmem_size(page_size);
     g_host_ctx = (fgpu_host_ctx_t *)mmap(NULL, shmem_size,
                     PROT_READ | PROT_WRITE, MAP_SHARED, shmem_fd, 0);
     if (g_host_ctx == NULL) {
@@ -491,6 +757,8 @@ int fgpu_init(void)
         goto err;
     }
 
+    g_telemetry = get_telemetry(g_host_ctx, page_size);
+
     ret = shmem_host_fd = shm_open(FGPU_SHMEM_HOST_NAME, O_RDWR, S_IRUSR | S_IWUSR);
     if (ret < 0) {
         fprintf(stderr, "FGPU:Couldn't open shmem\n");
@@ -548,6 +816,14 @@ err:
 
 void fgpu_deinit(void)
 {
+    telemetry_release_client();
+
+    if (g_client_slot >= 0) {
+        pthread_mutex_lock(&g_host_ctx->clients_lock);
+        admission_release(g_host_ctx->clients, g_client_slot);
+        pthread_mutex_unlock(&g_host_ctx->clients_lock);
+        g_client_slot = -1;
+    }
 
     if (d_bindex)
         fgpu_memory_free((void *)d_bindex);
@@ -555,6 +831,11 @@ void fgpu_deinit(void)
     if (d_dev_indicator)
         fgpu_memory_free((void *)d_dev_indicator);
 
+#if defined(FGPU_TRACE_ENABLED)
+    if (d_trace)
+        fgpu_memory_free((void *)d_trace);
+#endif
+
 #if defined(FGPU_MEM_COLORING_ENABLED)
     fgpu_memory_deinit();
 #endif
@@ -600,12 +881,37 @@ size_t fgpu_get_env_color_mem_size(void)
     return (size_t)atoll(tmp);
 }
 
+/* Returns either the launch priority set via env variable or default value */
+int fgpu_get_env_priority(void)
+{
+    const char* tmp = getenv(FGPU_PRIORITY_ENV_NAME);
+    if (!tmp)
+        return FGPU_DEFAULT_PRIORITY;
+
+    return atoi(tmp);
+}
+
+/* Returns either the relative deadline (usec) set via env variable or none */
+uint64_t fgpu_get_env_deadline(void)
+{
+    const char* tmp = getenv(FGPU_DEADLINE_ENV_NAME);
+    if (!tmp)
+        return FGPU_NO_DEADLINE;
+
+    return (uint64_t)atoll(tmp);
+}
+
 bool fgpu_is_init_complete(void)
 {
     return is_initialized();
 }
 
-int fgpu_set_color_prop(int color, size_t mem_size)
+/*
+ * Priority and relative deadline (usec, 0 for none) define the order in which
+ * processes sharing a color get to launch.
+ */
+int fgpu_set_color_prop(int color, size_t mem_size, int priority,
+        uint64_t deadline)
 {
     int ret;
 
@@ -632,6 +938,9 @@ int fgpu_set_color_prop(int color, size_t mem_size)
 #endif
 
     g_color = color;
+    launch_client_init(&g_launch_client, color, priority, deadline);
+
+    telemetry_claim_client(color);
 
     ret = fgpu_memory_allocate((void **)&d_bindex, sizeof(struct fgpu_bindex));
     if (ret < 0)
@@ -650,6 +959,15 @@ int fgpu_set_color_prop(int color, size_t mem_size)
     if (ret < 0)
         goto err;
 
+#if defined(FGPU_TRACE_ENABLED)
+    ret = fgpu_memory_allocate((void **)&d_trace, sizeof(fgpu_trace_buffer_t));
+    if (ret < 0)
+        goto err;
+
+    ret = fgpu_memory_memset_async((void *)d_trace, 0, sizeof(fgpu_trace_buffer_t));
+    if (ret < 0)
+        goto err;
+#endif
 
     ret = fgpu_color_stream_synchronize();
     if (ret < 0)
@@ -668,6 +986,14 @@ err:
         d_dev_indicator = NULL;
     }
 
+#if defined(FGPU_TRACE_ENABLED)
+    if (d_trace) {
+        fgpu_memory_free((void *)d_trace);
+        d_trace = NULL;
+    }
+#endif
+
+    telemetry_release_client();
     g_color = FGPU_INVALID_COLOR;
 
     return ret;
@@ -681,6 +1007,46 @@ bool fgpu_is_color_prop_set(void)
     return is_color_set();
 }
 
+/*
+ * Limits GPU time used by the process to 'budget' usec every 'period' usec.
+ * Utilization is reserved on the color; fails with -EBUSY if color can't
+ * admit it. Needs to be called after color is set.
+ */
+int fgpu_set_budget(uint64_t budget, uint64_t period)
+{
+    uint32_t utilization;
+    int ret;
+
+    if (!is_color_set()) {
+        fprintf(stderr, "FGPU:Colors not set\n");
+        return -EINVAL;
+    }
+
+    if (g_launch_client.is_budget_set) {
+        fprintf(stderr, "FGPU:Budget can be only set once\n");
+        return -EINVAL;
+    }
+
+    if (budget == 0 || period == 0 || budget > period) {
+        fprintf(stderr, "FGPU:Invalid budget\n");
+        return -EINVAL;
+    }
+
+    utilization = (uint32_t)(budget * FGPU_UTILIZATION_FULL / period);
+
+    pthread_mutex_lock(&g_host_ctx->clients_lock);
+    ret = admission_reserve(g_host_ctx->clients, g_color, utilization,
+            g_host_ctx->admission_threshold);
+    pthread_mutex_unlock(&g_host_ctx->clients_lock);
+    if (ret < 0)
+        return ret;
+
+    g_client_slot = ret;
+    launch_client_set_budget(&g_launch_client, budget, period);
+
+    return 0;
+}
+
 /* Wait for last launched kernel to be completely started */
 static void wait_for_last_start(void)
 {
@@ -728,18 +1094,6 @@ static void wait_for_last_start(void)
 #endif
 }
 
-/* 
- * Called when cuda stream operation completes. 
- * Unforntunately, currently Nvidia does't provide with stream callbacks with MPS
- */
-static void stream_callback(int color)
-{
-    pthread_mutex_lock(&g_host_ctx->streams_lock);
-    g_host_ctx->is_stream_free[color] = true;
-    pthread_cond_signal(&g_host_ctx->streams_cond[color]);
-    pthread_mutex_unlock(&g_host_ctx->streams_lock);
-}
-
 /* Overloaded function to get blockDim and gridDim */
 void fgpu_set_ctx_dims(fgpu_dev_ctx_t *ctx, int _gridDim, int _blockDim)
 {
@@ -764,6 +1118,8 @@ int fgpu_complete_launch_kernel(fgpu_dev_ctx_t *ctx)
 {
     int ret;
 
+    LAUNCH_PROFILE_PHASE(launch);
+
     if (!is_color_set()) {
         fprintf(stderr, "FGPU:Colors not set\n");
         return -EINVAL;
@@ -778,80 +1134,89 @@ int fgpu_complete_launch_kernel(fgpu_dev_ctx_t *ctx)
     g_host_ctx->is_lauchpad_free = true;
     pthread_cond_signal(&g_host_ctx->launch_cond);
     pthread_mutex_unlock(&g_host_ctx->launch_lock);
+
+    LAUNCH_PROFILE_PHASE(launchpad);
 #endif
 
     ret = gpuErrCheck(cudaStreamSynchronize(color_stream));
 
-    stream_callback(ctx->color);
+    LAUNCH_PROFILE_PHASE(sync);
 
-    return ret;
-}
+    /*
+     * Releases the stream once kernel completes. Unforntunately, currently
+     * Nvidia does't provide with stream callbacks with MPS.
+     */
+    launch_complete(&g_host_ctx->streams, &g_launch_client);
 
-/* Wait for last launched kernel of a specific color to be completed */
-static void wait_for_last_complete(int color)
-{
-    pthread_mutex_lock(&g_host_ctx->streams_lock);
-    while (1) {
-        if (g_host_ctx->is_stream_free[color])
-            break;
-        pthread_cond_wait(&g_host_ctx->streams_cond[color], &g_host_ctx->streams_lock);
-    }
-    g_host_ctx->is_stream_free[color] = false;
-    pthread_mutex_unlock(&g_host_ctx->streams_lock);
+    LAUNCH_PROFILE_PHASE(release);
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+    g_launch_profile.num_launches++;
+#endif
+
+    return ret;
 }
 
 /* Prepare ctx before launch */
 int fgpu_prepare_launch_kernel(fgpu_dev_ctx_t *ctx, const void *func,
         size_t shared_mem, dim3 *_gridDim, cudaStream_t **stream)
 {
-    uint32_t num_blocks;
-    uint32_t num_threads;
-    uint32_t num_pblocks;
+    fgpu_launch_geometry_t geo;
     int num_pblocks_per_sm;
     int ret;
 
+    LAUNCH_PROFILE_START();
+
     if (!is_color_set()) {
         fprintf(stderr, "FGPU:Colors not set\n");
         return -1;
     }
 
-    num_blocks = ctx->gridDim.x * ctx->gridDim.y * ctx->gridDim.z;
-    if (num_blocks == 0) {
-        fprintf(stderr, "FGPU:Invalid number of blocks\n");
-        return -EINVAL;
-    }
-
-    num_threads = ctx->blockDim.x * ctx->blockDim.y * ctx->blockDim.z;
-    if (num_threads == 0 || num_threads > g_host_ctx->max_num_threads_per_sm) {
-        fprintf(stderr, "Invalid number of threads in a block\n");
-        return -EINVAL;
-    }
+    ret = fgpu_check_launch_dims(ctx->gridDim, ctx->blockDim,
+            g_host_ctx->max_num_threads_per_sm, &geo);
+    if (ret < 0)
+        return ret;
 
     ret = 
         gpuErrCheck(cudaOccupancyMaxActiveBlocksPerMultiprocessorWithFlags(&num_pblocks_per_sm,
-                    func, num_threads, shared_mem, cudaOccupancyDisableCachingOverride));
+                    func, geo.num_threads, shared_mem, cudaOccupancyDisableCachingOverride));
     if (ret < 0)
         return ret;
 
-    if (num_pblocks_per_sm == 0) {
-        fprintf(stderr, "FGPU:Invalid grid/block/thread configuration\n");
-        return -EINVAL;
-    }
+    ret = fgpu_set_launch_geometry(num_pblocks_per_sm, g_host_ctx->num_sm,
+            g_host_ctx->color_to_sms[g_color].first,
+            g_host_ctx->color_to_sms[g_color].second, &geo);
+    if (ret < 0)
+        return ret;
 
-    num_pblocks = num_pblocks_per_sm * g_host_ctx->num_sm;
+    LAUNCH_PROFILE_PHASE(occupancy);
 
-    if (num_pblocks > FGPU_MAX_NUM_PBLOCKS) {
-        fprintf(stderr, "FGPU:FGPU_MAX_NUM_PBLOCKS is set too low\n");
-        return -EINVAL;
-    }
+    /* Stream is not held while waiting for budget */
+    launch_wait_for_budget(&g_launch_client);
 
-    wait_for_last_complete(g_color);
+    LAUNCH_PROFILE_PHASE(budget);
+
+    /* Kernel is ordered after colored memcpy/memset already issued */
+    ret = fgpu_memory_wait_fence_internal(fgpu_memory_get_last_fence_internal(), true);
+    if (ret < 0)
+        return ret;
+
+    LAUNCH_PROFILE_PHASE(fence);
+
+    ret = launch_acquire_stream(&g_host_ctx->streams, &g_launch_client);
+    if (ret < 0)
+        return ret;
+
+    LAUNCH_PROFILE_PHASE(queue);
 
     wait_for_last_start();
 
+    LAUNCH_PROFILE_PHASE(launchpad);
+
+    launch_start(&g_launch_client, geo.num_pblocks, geo.num_active_pblocks);
+
     ctx->color = g_color;
-    ctx->num_pblock = num_pblocks;
-    ctx->num_blocks = num_blocks;
+    ctx->num_pblock = geo.num_pblocks;
+    ctx->num_blocks = geo.num_blocks;
     ctx->index = cur_index;
     cur_index ^= 1; /* Toggle the index */
     ctx->d_host_indicators = d_host_indicators;
@@ -859,31 +1224,210 @@ int fgpu_prepare_launch_kernel(fgpu_dev_ctx_t *ctx, const void *func,
     ctx->d_bindex = d_bindex;
     ctx->start_sm = g_host_ctx->color_to_sms[g_color].first;
     ctx->end_sm = g_host_ctx->color_to_sms[g_color].second;
-    ctx->num_active_pblocks = num_pblocks_per_sm * (ctx->end_sm - ctx->start_sm + 1);
+    ctx->num_active_pblocks = geo.num_active_pblocks;
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+    /* Only resumable launches can report partial progress */
+    ctx->d_preempt = NULL;
+    ctx->start_block = 0;
+#endif
+
+#if defined(FGPU_TRACE_ENABLED)
+    ctx->d_trace = d_trace;
+    ctx->launch = g_launch_seq++;
+    ctx->trace_first_block = -1;
+#endif
 
 
 #if defined(FGPU_USER_MEM_COLORING_ENABLED)
-    ret = fgpu_get_memory_info(&ctx->start_virt_addr, &ctx->start_idx);
+    ret = fgpu_get_memory_info(&ctx->start_virt_addr, &ctx->start_idx,
+                               &ctx->color_func);
     if (ret < 0)
         return ret;
 #endif
 
-    _gridDim->x = num_pblocks;
+    _gridDim->x = geo.num_pblocks;
     _gridDim->y = 1;
     _gridDim->z = 1;
     *stream = &color_stream;
 
+    LAUNCH_PROFILE_PHASE(setup);
+
     return 0;
 }
 
+#if defined(FGPU_PREEMPTION_ENABLED)
+
+/* Prepare ctx before launch of a resumable kernel */
+int fgpu_prepare_resumable_kernel(fgpu_dev_ctx_t *ctx, fgpu_kernel_state_t *state,
+        const void *func, size_t shared_mem, dim3 *_gridDim, cudaStream_t **stream)
+{
+    int ret;
+
+    ret = fgpu_prepare_launch_kernel(ctx, func, shared_mem, _gridDim, stream);
+    if (ret < 0)
+        return ret;
+
+    ctx->d_preempt = &d_host_indicators->preempt[g_color];
+    ctx->start_block = state->next_block;
+
+    return 0;
+}
+
+/*
+ * Called after a resumable kernel has been launched. Once kernel completes,
+ * the block index counter holds the number of logical blocks claimed (and
+ * hence executed) by the pblocks, which gives the point to resume from.
+ */
+int fgpu_complete_resumable_kernel(fgpu_dev_ctx_t *ctx, fgpu_kernel_state_t *state)
+{
+    int claimed;
+    int ret;
+
+    ret = fgpu_complete_launch_kernel(ctx);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_memory_copy_async(&claimed, (void *)&ctx->d_bindex->index[ctx->index],
+            sizeof(claimed), FGPU_COPY_GPU_TO_CPU);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_color_stream_synchronize();
+    if (ret < 0)
+        return ret;
+
+    if (launch_get_resume_point(ctx->start_block, claimed, ctx->num_blocks,
+                &state->next_block))
+        return FGPU_KERNEL_PREEMPTED;
+
+    return 0;
+}
+
+/*
+ * Requests all pblocks running on a color to exit at the next logical block
+ * boundary. Can be called by any process attached to FGPU (including server).
+ * Only resumable kernels are preempted. These return without progress if
+ * launched while preemption is requested. Other kernels run to completion.
+ */
+int fgpu_preempt_color(int color)
+{
+    if (!is_initialized() || h_indicators == NULL) {
+        fprintf(stderr, "FGPU:fgpu module not initialized\n");
+        return -EINVAL;
+    }
+
+    if (color >= g_host_ctx->num_colors || color < 0) {
+        fprintf(stderr, "FGPU:Invalid color\n");
+        return -EINVAL;
+    }
+
+    h_indicators->preempt[color].requested = 1;
+    __sync_synchronize();
+
+    return 0;
+}
+
+/* Allows kernels on a color to run again */
+int fgpu_resume_color(int color)
+{
+    if (!is_initialized() || h_indicators == NULL) {
+        fprintf(stderr, "FGPU:fgpu module not initialized\n");
+        return -EINVAL;
+    }
+
+    if (color >= g_host_ctx->num_colors || color < 0) {
+        fprintf(stderr, "FGPU:Invalid color\n");
+        return -EINVAL;
+    }
+
+    h_indicators->preempt[color].requested = 0;
+    __sync_synchronize();
+
+    return 0;
+}
+
+bool fgpu_is_color_preempted(int color)
+{
+    if (!is_initialized() || h_indicators == NULL)
+        return false;
+
+    if (color >= g_host_ctx->num_colors || color < 0)
+        return false;
+
+    return h_indicators->preempt[color].requested != 0;
+}
+
+#endif /* FGPU_PREEMPTION_ENABLED */
+
+#if defined(FGPU_TRACE_ENABLED)
+
+/*
+ * Writes trace of pblocks of all kernels launched till now into a file.
+ * Use fgpu_trace2json to convert it into Chrome trace format.
+ */
+int fgpu_trace_dump(const char *path)
+{
+    fgpu_trace_buffer_t *h_trace;
+    int ret;
+
+    if (!is_color_set()) {
+        fprintf(stderr, "FGPU:Colors not set\n");
+        return -EINVAL;
+    }
+
+    h_trace = new fgpu_trace_buffer_t;
+
+    ret = fgpu_memory_copy_async(h_trace, d_trace, sizeof(fgpu_trace_buffer_t),
+            FGPU_COPY_GPU_TO_CPU);
+    if (ret < 0)
+        goto out;
+
+    ret = fgpu_color_stream_synchronize();
+    if (ret < 0)
+        goto out;
+
+    ret = fgpu_trace_write_file(path, h_trace);
+
+out:
+    delete h_trace;
+    return ret;
+}
+
+#endif /* FGPU_TRACE_ENABLED */
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+
+/* Time spent in each phase by launches of this process since last reset */
+void fgpu_get_launch_profile(fgpu_launch_profile_t *profile)
+{
+    *profile = g_launch_profile;
+}
+
+void fgpu_reset_launch_profile(void)
+{
+    memset(&g_launch_profile, 0, sizeof(g_launch_profile));
+}
+
+#endif /* FGPU_LAUNCH_PROFILE_ENABLED */
+
 int fgpu_color_stream_synchronize(void)
 {
+    int ret;
+
 #ifdef FGPU_COMP_COLORING_ENABLE
     if (!is_color_set()) {
         fprintf(stderr, "FGPU:Colors not set\n");
         return -EINVAL;
     }
+#endif
+
+    /* Colored memcpy/memset are not part of the stream */
+    ret = fgpu_memory_wait_fence_internal(fgpu_memory_get_last_fence_internal(), true);
+    if (ret < 0)
+        return ret;
 
+#ifdef FGPU_COMP_COLORING_ENABLE
     return gpuErrCheck(cudaStreamSynchronize(color_stream));
 #else
     return gpuErrCheck(cudaDeviceSynchronize());
@@ -925,9 +1469,16 @@ int fgpu_memory_copy_async(void *dst, const void *src, size_t count,
      * Instead of using default stream (which caused device wide synchronization)
      * Use process specific stream.
      */
+    int ret;
+
     if (stream == NULL)
         stream = color_stream;
-    return fgpu_memory_copy_async_internal(dst, src, count, type, stream);
+
+    ret = fgpu_memory_copy_async_internal(dst, src, count, type, stream);
+    if (ret == 0)
+        fgpu_telemetry_add_bytes_copied(count);
+
+    return ret;
 }
 
 int fgpu_memory_memset_async(void *address, int value, size_t count,
@@ -942,3 +1493,73 @@ int fgpu_memory_memset_async(void *address, int value, size_t count,
 
     return fgpu_memory_memset_async_internal(address, value, count, stream);
 }
+
+/* Copies many (small) buffers with a single call into driver */
+int fgpu_memory_copy_batch(const fgpu_memory_copy_desc_t *descs, int num_descs,
+                           enum fgpu_memory_copy_type type,
+                           cudaStream_t stream)
+{
+    size_t count = 0;
+    int ret;
+
+    if (stream == NULL)
+        stream = color_stream;
+
+    ret = fgpu_memory_copy_batch_internal(descs, num_descs, type, stream);
+    if (ret < 0)
+        return ret;
+
+    for (int i = 0; i < num_descs; i++)
+        count += descs[i].count;
+
+    fgpu_telemetry_add_bytes_copied(count);
+
+    return 0;
+}
+
+/* 
+ * Event covers memcpy/memset issued so far. Work queued on the stream after the
+ * event was recorded also needs to finish before event is considered complete.
+ */
+int fgpu_memory_event_record(fgpu_memory_event_t *event, cudaStream_t stream)
+{
+    if (stream == NULL)
+        stream = color_stream;
+
+    event->fence = fgpu_memory_get_last_fence_internal();
+    event->stream = stream;
+
+    return 0;
+}
+
+/* Returns 1 if event has completed, 0 if not */
+int fgpu_memory_event_query(fgpu_memory_event_t *event)
+{
+    cudaError_t err;
+    int ret;
+
+    ret = fgpu_memory_wait_fence_internal(event->fence, false);
+    if (ret <= 0)
+        return ret;
+
+    err = cudaStreamQuery(event->stream);
+    if (err == cudaErrorNotReady)
+        return 0;
+
+    ret = gpuErrCheck(err);
+    if (ret < 0)
+        return ret;
+
+    return 1;
+}
+
+int fgpu_memory_event_synchronize(fgpu_memory_event_t *event)
+{
+    int ret;
+
+    ret = fgpu_memory_wait_fence_internal(event->fence, true);
+    if (ret < 0)
+        return ret;
+
+    return gpuErrCheck(cudaStreamSynchronize(event->stream));
+}
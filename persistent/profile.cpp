@@ -0,0 +1,346 @@
+/*
+ * Device profiles. The reverse engineering code exports the memory hierarchy
+ * details it finds (hash functions, cacheline size, latencies) into a profile,
+ * which the server loads to support a new GPU without code changes. This file
+ * has no CUDA dependency so that profiles can be handled on machines without
+ * GPU.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fgpu_internal_profile.hpp>
+
+#define FGPU_PROFILE_MAX_LINE           4096
+
+/* Span of common masks is searched for color masks only if it is small */
+#define FGPU_PROFILE_MAX_COMMON_MASKS   16
+
+/* Rank of masks as vectors over GF(2) */
+static int get_rank(const uint64_t *masks, int num_masks)
+{
+    uint64_t basis[64] = {0};
+    int rank = 0;
+
+    for (int i = 0; i < num_masks; i++) {
+        uint64_t m = masks[i];
+
+        for (int bit = 63; bit >= 0 && m; bit--) {
+            if (!((m >> bit) & 1))
+                continue;
+
+            if (!basis[bit]) {
+                basis[bit] = m;
+                rank++;
+                break;
+            }
+
+            m ^= basis[bit];
+        }
+    }
+
+    return rank;
+}
+
+void fgpu_profile_init(fgpu_device_profile_t *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->version = FGPU_PROFILE_VERSION;
+    profile->dram_fast_latency = NAN;
+    profile->dram_slow_latency = NAN;
+    profile->dram_threshold = NAN;
+    profile->cache_hit_latency = NAN;
+    profile->cache_threshold = NAN;
+}
+
+/* Formats masks as comma separated list. Returns < 0 if buffer is too small. */
+int fgpu_profile_format_masks(char *buf, size_t len, const uint64_t *masks, int num_masks)
+{
+    size_t pos = 0;
+    int ret;
+
+    if (len == 0)
+        return -EINVAL;
+
+    buf[0] = '\0';
+    for (int i = 0; i < num_masks; i++) {
+        ret = snprintf(buf + pos, len - pos, "%s0x%" PRIx64, i ? "," : "", masks[i]);
+        if (ret < 0 || (size_t)ret >= len - pos)
+            return -ENOSPC;
+        pos += ret;
+    }
+
+    return 0;
+}
+
+static int parse_masks(const char *value, uint64_t *masks, int max_masks)
+{
+    const char *p = value;
+    char *end;
+    int num_masks = 0;
+
+    while (*p) {
+        if (num_masks == max_masks)
+            return -ENOSPC;
+
+        errno = 0;
+        masks[num_masks++] = strtoull(p, &end, 0);
+        if (errno || end == p)
+            return -EINVAL;
+
+        while (*end == ' ' || *end == '\t')
+            end++;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -EINVAL;
+
+        p = end;
+    }
+
+    return num_masks;
+}
+
+static void write_masks(FILE *fp, const char *key, const uint64_t *masks, int num_masks)
+{
+    fprintf(fp, "%s = ", key);
+    for (int i = 0; i < num_masks; i++)
+        fprintf(fp, "%s0x%" PRIx64, i ? "," : "", masks[i]);
+    fprintf(fp, "\n");
+}
+
+static void write_latency(FILE *fp, const char *key, double latency)
+{
+    if (!isnan(latency))
+        fprintf(fp, "%s = %f\n", key, latency);
+}
+
+int fgpu_profile_write(const char *path, const fgpu_device_profile_t *profile)
+{
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "FGPU:Couldn't open device profile %s\n", path);
+        return -errno;
+    }
+
+    fprintf(fp, "# FGPU device profile\n");
+    fprintf(fp, "version = %u\n", profile->version);
+    fprintf(fp, "device = %s\n", profile->device);
+    fprintf(fp, "min_bit = %d\n", profile->min_bit);
+    fprintf(fp, "max_bit = %d\n", profile->max_bit);
+    write_masks(fp, "dram_masks", profile->dram_masks, profile->num_dram_masks);
+    write_masks(fp, "cache_masks", profile->cache_masks, profile->num_cache_masks);
+    write_masks(fp, "color_masks", profile->color_masks, profile->num_color_masks);
+    fprintf(fp, "l2_cache_line_size = %u\n", profile->l2_cache_line_size);
+    fprintf(fp, "l2_cache_word_size = %u\n", profile->l2_cache_word_size);
+    if (profile->l2_cache_line_words)
+        fprintf(fp, "l2_cache_line_words = %u\n", profile->l2_cache_line_words);
+    write_latency(fp, "dram_fast_latency", profile->dram_fast_latency);
+    write_latency(fp, "dram_slow_latency", profile->dram_slow_latency);
+    write_latency(fp, "dram_threshold", profile->dram_threshold);
+    write_latency(fp, "cache_hit_latency", profile->cache_hit_latency);
+    write_latency(fp, "cache_threshold", profile->cache_threshold);
+
+    if (ferror(fp))
+        ret = -EIO;
+
+    if (fclose(fp) != 0 || ret < 0) {
+        fprintf(stderr, "FGPU:Couldn't write device profile %s\n", path);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* Removes leading/trailing whitespace in place */
+static char *trim(char *s)
+{
+    char *end;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+
+    end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' ||
+                end[-1] == '\n' || end[-1] == '\r'))
+        end--;
+    *end = '\0';
+
+    return s;
+}
+
+static int parse_line(fgpu_device_profile_t *profile, char *key, char *value)
+{
+    int ret = 0;
+
+    if (strcmp(key, "version") == 0) {
+        profile->version = strtoul(value, NULL, 0);
+    } else if (strcmp(key, "device") == 0) {
+        if (strlen(value) >= sizeof(profile->device))
+            return -EINVAL;
+        strcpy(profile->device, value);
+    } else if (strcmp(key, "min_bit") == 0) {
+        profile->min_bit = atoi(value);
+    } else if (strcmp(key, "max_bit") == 0) {
+        profile->max_bit = atoi(value);
+    } else if (strcmp(key, "dram_masks") == 0) {
+        ret = profile->num_dram_masks = parse_masks(value, profile->dram_masks,
+                FGPU_PROFILE_MAX_MASKS);
+    } else if (strcmp(key, "cache_masks") == 0) {
+        ret = profile->num_cache_masks = parse_masks(value, profile->cache_masks,
+                FGPU_PROFILE_MAX_MASKS);
+    } else if (strcmp(key, "color_masks") == 0) {
+        ret = profile->num_color_masks = parse_masks(value, profile->color_masks,
+                FGPU_PROFILE_MAX_COLOR_MASKS);
+    } else if (strcmp(key, "l2_cache_line_size") == 0) {
+        profile->l2_cache_line_size = strtoul(value, NULL, 0);
+    } else if (strcmp(key, "l2_cache_word_size") == 0) {
+        profile->l2_cache_word_size = strtoul(value, NULL, 0);
+    } else if (strcmp(key, "l2_cache_line_words") == 0) {
+        profile->l2_cache_line_words = strtoul(value, NULL, 0);
+    } else if (strcmp(key, "dram_fast_latency") == 0) {
+        profile->dram_fast_latency = strtod(value, NULL);
+    } else if (strcmp(key, "dram_slow_latency") == 0) {
+        profile->dram_slow_latency = strtod(value, NULL);
+    } else if (strcmp(key, "dram_threshold") == 0) {
+        profile->dram_threshold = strtod(value, NULL);
+    } else if (strcmp(key, "cache_hit_latency") == 0) {
+        profile->cache_hit_latency = strtod(value, NULL);
+    } else if (strcmp(key, "cache_threshold") == 0) {
+        profile->cache_threshold = strtod(value, NULL);
+    }
+
+    /* Unknown keys are from newer profiles. Ignore them. */
+    return ret < 0 ? ret : 0;
+}
+
+int fgpu_profile_load(const char *path, fgpu_device_profile_t *profile)
+{
+    char line[FGPU_PROFILE_MAX_LINE];
+    int line_num = 0;
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "FGPU:Couldn't open device profile %s\n", path);
+        return -errno;
+    }
+
+    fgpu_profile_init(profile);
+    profile->version = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *key, *value, *sep;
+
+        line_num++;
+
+        sep = strchr(line, '#');
+        if (sep)
+            *sep = '\0';
+
+        key = trim(line);
+        if (*key == '\0')
+            continue;
+
+        sep = strchr(key, '=');
+        if (!sep) {
+            ret = -EINVAL;
+            break;
+        }
+
+        *sep = '\0';
+        key = trim(key);
+        value = trim(sep + 1);
+
+        ret = parse_line(profile, key, value);
+        if (ret < 0)
+            break;
+    }
+
+    fclose(fp);
+
+    if (ret < 0) {
+        fprintf(stderr, "FGPU:Invalid device profile %s (Line %d)\n", path, line_num);
+        return ret;
+    }
+
+    if (profile->version == 0 || profile->device[0] == '\0') {
+        fprintf(stderr, "FGPU:Invalid device profile %s\n", path);
+        return -EINVAL;
+    }
+
+    if (profile->version > FGPU_PROFILE_VERSION) {
+        fprintf(stderr, "FGPU:Unsupported device profile version %u (Expected upto %u)\n",
+                profile->version, FGPU_PROFILE_VERSION);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/*
+ * Picks color masks from the span of the masks common to DRAM banks and L2
+ * cache sets. Like the driver requires, every aligned group of 2^k pages must
+ * hold one page of each color, i.e. the k masks restricted to the lowest k
+ * page frame bits must be linearly independent. Masks are added greedily so
+ * every prefix is also a valid color function.
+ * Returns number of color masks found.
+ */
+int fgpu_profile_derive_color_masks(fgpu_device_profile_t *profile,
+                                    const uint64_t *common_masks, int num_common_masks)
+{
+    uint64_t low_bits[FGPU_PROFILE_MAX_COLOR_MASKS];
+    int k = 0;
+
+    if (num_common_masks > FGPU_PROFILE_MAX_COMMON_MASKS)
+        num_common_masks = FGPU_PROFILE_MAX_COMMON_MASKS;
+
+    for (uint32_t comb = 1; comb < (1U << num_common_masks) &&
+            k < FGPU_PROFILE_MAX_COLOR_MASKS; comb++) {
+        uint64_t mask = 0;
+
+        for (int i = 0; i < num_common_masks; i++) {
+            if (comb & (1U << i))
+                mask ^= common_masks[i];
+        }
+
+        if (mask == 0 || (mask & ((1ULL << FGPU_PROFILE_COLOR_SHIFT) - 1)))
+            continue;
+
+        for (int i = 0; i <= k; i++) {
+            uint64_t m = i < k ? profile->color_masks[i] : mask;
+            low_bits[i] = (m >> FGPU_PROFILE_COLOR_SHIFT) & ((1ULL << (k + 1)) - 1);
+        }
+
+        if (get_rank(low_bits, k + 1) == k + 1)
+            profile->color_masks[k++] = mask;
+    }
+
+    profile->num_color_masks = k;
+
+    return k;
+}
+
+/* Checks if color function of masks can be derived from profile's color masks */
+bool fgpu_profile_check_color_masks(const fgpu_device_profile_t *profile,
+                                    const uint64_t *masks, int num_masks)
+{
+    uint64_t all[2 * FGPU_PROFILE_MAX_COLOR_MASKS];
+    int n = profile->num_color_masks;
+
+    if (num_masks > FGPU_PROFILE_MAX_COLOR_MASKS)
+        return false;
+
+    memcpy(all, profile->color_masks, n * sizeof(uint64_t));
+    memcpy(all + n, masks, num_masks * sizeof(uint64_t));
+
+    return get_rank(masks, num_masks) == num_masks &&
+        get_rank(all, n + num_masks) == get_rank(profile->color_masks, n);
+}
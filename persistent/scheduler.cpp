@@ -0,0 +1,428 @@
+/*
+ * Arbitration between processes waiting to launch on the same color.
+ * Waiters are ordered by priority (highest first), then by earliest deadline
+ * (EDF, waiters with a deadline before those without) and then by arrival.
+ * Queue is small, so a linear scan is used for finding the top.
+ *
+ * Also contains GPU time budgets (token bucket), admission control and the
+ * phases of a launch built on top of them. These are shared by the runtime
+ * and the emulator, so nothing here depends on CUDA.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fgpu_internal_scheduler.hpp>
+
+void launch_queue_init(fgpu_launch_queue_t *queue)
+{
+    queue->next_seq = 0;
+    queue->size = 0;
+
+    for (int i = 0; i < FGPU_MAX_LAUNCH_WAITERS; i++)
+        queue->waiters[i].valid = false;
+}
+
+/* Returns true if waiter 'a' should be served before waiter 'b' */
+static bool is_higher_precedence(const fgpu_launch_waiter_t *a,
+        const fgpu_launch_waiter_t *b)
+{
+    if (a->priority != b->priority)
+        return a->priority > b->priority;
+
+    if (a->deadline != b->deadline) {
+        if (a->deadline == FGPU_NO_DEADLINE)
+            return false;
+        if (b->deadline == FGPU_NO_DEADLINE)
+            return true;
+        return a->deadline < b->deadline;
+    }
+
+    return a->seq < b->seq;
+}
+
+/* Adds a waiter to queue. Returns slot of waiter or negative value on error */
+int launch_queue_insert(fgpu_launch_queue_t *queue, int priority,
+        uint64_t deadline)
+{
+    for (int i = 0; i < FGPU_MAX_LAUNCH_WAITERS; i++) {
+        fgpu_launch_waiter_t *waiter = &queue->waiters[i];
+
+        if (waiter->valid)
+            continue;
+
+        waiter->valid = true;
+        waiter->pid = getpid();
+        waiter->priority = priority;
+        waiter->deadline = deadline;
+        waiter->seq = queue->next_seq++;
+        queue->size++;
+
+        return i;
+    }
+
+    fprintf(stderr, "FGPU:Too many processes waiting to launch\n");
+    return -ENOSPC;
+}
+
+/*
+ * Waiters of processes that died while waiting are removed, else they would
+ * stay at the top of the queue forever.
+ */
+static void launch_queue_reap_dead(fgpu_launch_queue_t *queue)
+{
+    for (int i = 0; i < FGPU_MAX_LAUNCH_WAITERS; i++) {
+        if (!queue->waiters[i].valid)
+            continue;
+
+        if (kill(queue->waiters[i].pid, 0) < 0 && errno == ESRCH)
+            launch_queue_remove(queue, i);
+    }
+}
+
+/* Returns slot of waiter to be served next or -1 if queue is empty */
+int launch_queue_top(fgpu_launch_queue_t *queue)
+{
+    int top = -1;
+
+    launch_queue_reap_dead(queue);
+
+    for (int i = 0; i < FGPU_MAX_LAUNCH_WAITERS; i++) {
+        if (!queue->waiters[i].valid)
+            continue;
+
+        if (top < 0 ||
+                is_higher_precedence(&queue->waiters[i], &queue->waiters[top]))
+            top = i;
+    }
+
+    return top;
+}
+
+void launch_queue_remove(fgpu_launch_queue_t *queue, int slot)
+{
+    assert(slot >= 0 && slot < FGPU_MAX_LAUNCH_WAITERS);
+    assert(queue->waiters[slot].valid);
+
+    queue->waiters[slot].valid = false;
+    queue->size--;
+}
+
+/*
+ * Waits for the queue to change. Dead processes don't signal, so waiters
+ * periodically wake up to check the top of the queue.
+ */
+void launch_queue_wait(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+    struct timespec ts;
+    uint64_t nsec;
+
+    /* Condvars use the default (realtime) clock */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    nsec = ts.tv_nsec + (uint64_t)FGPU_LAUNCH_REAP_INTERVAL * 1000;
+    ts.tv_sec += nsec / 1000000000;
+    ts.tv_nsec = nsec % 1000000000;
+
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/* Time base for deadlines. Monotonic clock is shared between processes */
+uint64_t launch_queue_now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void budget_init(fgpu_budget_t *b, uint64_t budget, uint64_t period,
+        uint64_t now)
+{
+    b->budget = budget;
+    b->period = period;
+    b->tokens = budget;
+    b->last_refill = now;
+}
+
+/*
+ * Budget is refilled at the start of each period. Refill time only advances by
+ * whole periods, so that partial periods are not lost.
+ */
+static void budget_refill(fgpu_budget_t *b, uint64_t now)
+{
+    uint64_t periods = (now - b->last_refill) / b->period;
+
+    if (periods == 0)
+        return;
+
+    b->tokens += (int64_t)(periods * b->budget);
+    if (b->tokens > (int64_t)b->budget)
+        b->tokens = b->budget;
+    b->last_refill += periods * b->period;
+}
+
+/* Charges GPU time used by a completed launch */
+void budget_consume(fgpu_budget_t *b, uint64_t usage, uint64_t now)
+{
+    budget_refill(b, now);
+    b->tokens -= usage;
+}
+
+/* Returns time (usec) to wait before budget allows next launch */
+uint64_t budget_get_delay(fgpu_budget_t *b, uint64_t now)
+{
+    uint64_t periods;
+
+    budget_refill(b, now);
+    if (b->tokens > 0)
+        return 0;
+
+    /* Periods needed to get back to a single token */
+    periods = ((uint64_t)(1 - b->tokens) + b->budget - 1) / b->budget;
+
+    return b->last_refill + periods * b->period - now;
+}
+
+/* Adds to counter of both the client and its color */
+#define LAUNCH_TELEMETRY_ADD(client, field, val)                                \
+    do {                                                                        \
+        if ((client)->counters) {                                               \
+            __sync_fetch_and_add(&(client)->color_counters->field,              \
+                    (uint64_t)(val));                                           \
+            __sync_fetch_and_add(&(client)->counters->field,                    \
+                    (uint64_t)(val));                                           \
+        }                                                                       \
+    } while (0)
+
+/* Streams are shared between processes if 'pshared' is set */
+int color_streams_init(fgpu_color_streams_t *streams, int num_colors,
+        bool pshared)
+{
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    int pshared_attr = pshared ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE;
+    int ret;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, pshared_attr);
+    ret = pthread_mutex_init(&streams->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    if (ret != 0) {
+        fprintf(stderr, "FGPU:Mutex can't be initialized\n");
+        return -ret;
+    }
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, pshared_attr);
+
+    for (int i = 0; i < num_colors; i++) {
+        ret = pthread_cond_init(&streams->cond[i], &cattr);
+        if (ret != 0) {
+            fprintf(stderr, "FGPU:Condvar can't be initialized\n");
+            for (int j = 0; j < i; j++)
+                pthread_cond_destroy(&streams->cond[j]);
+            pthread_mutex_destroy(&streams->lock);
+            pthread_condattr_destroy(&cattr);
+            return -ret;
+        }
+
+        streams->is_free[i] = true;
+        launch_queue_init(&streams->queues[i]);
+    }
+
+    pthread_condattr_destroy(&cattr);
+
+    return 0;
+}
+
+void color_streams_deinit(fgpu_color_streams_t *streams, int num_colors)
+{
+    for (int i = 0; i < num_colors; i++)
+        pthread_cond_destroy(&streams->cond[i]);
+
+    pthread_mutex_destroy(&streams->lock);
+}
+
+void launch_client_init(fgpu_launch_client_t *client, int color, int priority,
+        uint64_t rel_deadline)
+{
+    memset(client, 0, sizeof(*client));
+    client->color = color;
+    client->priority = priority;
+    client->rel_deadline = rel_deadline;
+}
+
+/* Caller has done admission control */
+void launch_client_set_budget(fgpu_launch_client_t *client, uint64_t budget,
+        uint64_t period)
+{
+    budget_init(&client->budget, budget, period, launch_queue_now_usec());
+    client->is_budget_set = true;
+}
+
+/* Delays the launch till budget has tokens left. Stream must not be held */
+void launch_wait_for_budget(fgpu_launch_client_t *client)
+{
+    uint64_t delay;
+
+    if (!client->is_budget_set)
+        return;
+
+    while ((delay = budget_get_delay(&client->budget, launch_queue_now_usec())) > 0)
+        usleep(delay);
+}
+
+/*
+ * Waits for last launch on client's color to complete and for all higher
+ * precedence waiters of the color to be served, then takes the stream.
+ */
+int launch_acquire_stream(fgpu_color_streams_t *streams,
+        fgpu_launch_client_t *client)
+{
+    fgpu_launch_queue_t *queue = &streams->queues[client->color];
+    uint64_t now = launch_queue_now_usec();
+    uint64_t deadline = FGPU_NO_DEADLINE;
+    int slot;
+
+    if (client->rel_deadline != FGPU_NO_DEADLINE)
+        deadline = now + client->rel_deadline;
+
+    pthread_mutex_lock(&streams->lock);
+
+    slot = launch_queue_insert(queue, client->priority, deadline);
+    if (slot < 0) {
+        pthread_mutex_unlock(&streams->lock);
+        return slot;
+    }
+
+    while (!(streams->is_free[client->color] && launch_queue_top(queue) == slot))
+        launch_queue_wait(&streams->cond[client->color], &streams->lock);
+
+    launch_queue_remove(queue, slot);
+    streams->is_free[client->color] = false;
+    pthread_mutex_unlock(&streams->lock);
+
+    client->queue_wait = launch_queue_now_usec() - now;
+    LAUNCH_TELEMETRY_ADD(client, queue_wait_time, client->queue_wait);
+
+    return 0;
+}
+
+/* Called right before kernel is launched (stream is held) */
+void launch_start(fgpu_launch_client_t *client, int num_pblocks,
+        int num_active_pblocks)
+{
+    client->launch_start = launch_queue_now_usec();
+
+    LAUNCH_TELEMETRY_ADD(client, kernels_launched, 1);
+    LAUNCH_TELEMETRY_ADD(client, wasted_pblocks, num_pblocks - num_active_pblocks);
+}
+
+/*
+ * Called once kernel has completed. Time since launch is charged to the
+ * budget and the stream is released.
+ */
+void launch_complete(fgpu_color_streams_t *streams,
+        fgpu_launch_client_t *client)
+{
+    uint64_t now = launch_queue_now_usec();
+
+    LAUNCH_TELEMETRY_ADD(client, busy_time, now - client->launch_start);
+
+    if (client->is_budget_set)
+        budget_consume(&client->budget, now - client->launch_start, now);
+
+    pthread_mutex_lock(&streams->lock);
+    streams->is_free[client->color] = true;
+    /* All waiters need to check if they are at top of launch queue */
+    pthread_cond_broadcast(&streams->cond[client->color]);
+    pthread_mutex_unlock(&streams->lock);
+}
+
+/*
+ * Once a resumable kernel completes, number of logical blocks claimed (and
+ * hence executed) gives the point to resume from. Returns true if blocks are
+ * left (i.e. kernel was preempted).
+ */
+bool launch_get_resume_point(int start_block, int num_claimed, int num_blocks,
+        int *next_block)
+{
+    *next_block = start_block + num_claimed;
+    if (*next_block >= num_blocks) {
+        *next_block = num_blocks;
+        return false;
+    }
+
+    return true;
+}
+
+/* Reservations of processes that died without releasing them are freed */
+static void admission_reap_dead(fgpu_client_t *clients)
+{
+    for (int i = 0; i < FGPU_MAX_NUM_CLIENTS; i++) {
+        if (!clients[i].valid)
+            continue;
+
+        if (kill(clients[i].pid, 0) < 0 && errno == ESRCH)
+            clients[i].valid = false;
+    }
+}
+
+uint32_t admission_get_utilization(const fgpu_client_t *clients, int color)
+{
+    uint32_t utilization = 0;
+
+    for (int i = 0; i < FGPU_MAX_NUM_CLIENTS; i++) {
+        if (clients[i].valid && clients[i].color == color)
+            utilization += clients[i].utilization;
+    }
+
+    return utilization;
+}
+
+/*
+ * Reserves utilization on a color for calling process. Returns slot of
+ * reservation or -EBUSY if color's committed utilization would exceed
+ * threshold.
+ */
+int admission_reserve(fgpu_client_t *clients, int color, uint32_t utilization,
+        uint32_t threshold)
+{
+    uint32_t committed;
+
+    admission_reap_dead(clients);
+
+    committed = admission_get_utilization(clients, color);
+    if ((uint64_t)committed + utilization > threshold) {
+        fprintf(stderr, "FGPU:Color %d can't admit utilization %u (committed:%u, threshold:%u)\n",
+                color, utilization, committed, threshold);
+        return -EBUSY;
+    }
+
+    for (int i = 0; i < FGPU_MAX_NUM_CLIENTS; i++) {
+        if (clients[i].valid)
+            continue;
+
+        clients[i].valid = true;
+        clients[i].pid = getpid();
+        clients[i].color = color;
+        clients[i].utilization = utilization;
+
+        return i;
+    }
+
+    fprintf(stderr, "FGPU:Too many clients\n");
+    return -ENOSPC;
+}
+
+void admission_release(fgpu_client_t *clients, int slot)
+{
+    assert(slot >= 0 && slot < FGPU_MAX_NUM_CLIENTS);
+
+    clients[slot].valid = false;
+}
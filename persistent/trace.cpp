@@ -0,0 +1,175 @@
+/*
+ * Host side handling of persistent block traces. Traces are dumped into a
+ * binary file which can later be converted into Chrome trace JSON (viewable
+ * in chrome://tracing or Perfetto). This file has no CUDA dependency so that
+ * traces can be processed on machines without GPU.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <set>
+#include <vector>
+
+#include <fgpu_internal_trace.hpp>
+
+/* Writes valid records of the ring (oldest first) into a file */
+int fgpu_trace_write_file(const char *path, const fgpu_trace_buffer_t *buffer)
+{
+    fgpu_trace_file_header_t header;
+    uint64_t head = buffer->head;
+    uint64_t start, count;
+    FILE *fp;
+    int ret = 0;
+
+    if (head > FGPU_TRACE_NUM_RECORDS) {
+        start = head % FGPU_TRACE_NUM_RECORDS;
+        count = FGPU_TRACE_NUM_RECORDS;
+    } else {
+        start = 0;
+        count = head;
+    }
+
+    header.magic = FGPU_TRACE_FILE_MAGIC;
+    header.version = FGPU_TRACE_FILE_VERSION;
+    header.num_records = 0;
+    header.num_dropped = head - count;
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (buffer->records[(start + i) % FGPU_TRACE_NUM_RECORDS].valid)
+            header.num_records++;
+    }
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "FGPU:Can't open trace file %s\n", path);
+        return -errno;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        ret = -EIO;
+
+    for (uint64_t i = 0; i < count && ret == 0; i++) {
+        const fgpu_trace_record_t *record =
+            &buffer->records[(start + i) % FGPU_TRACE_NUM_RECORDS];
+
+        if (!record->valid)
+            continue;
+
+        if (fwrite(record, sizeof(*record), 1, fp) != 1)
+            ret = -EIO;
+    }
+
+    if (ret < 0)
+        fprintf(stderr, "FGPU:Can't write trace file %s\n", path);
+
+    fclose(fp);
+    return ret;
+}
+
+static int read_trace_file(const char *path, fgpu_trace_file_header_t *header,
+        std::vector<fgpu_trace_record_t> &records)
+{
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "FGPU:Can't open trace file %s\n", path);
+        return -errno;
+    }
+
+    if (fread(header, sizeof(*header), 1, fp) != 1 ||
+            header->magic != FGPU_TRACE_FILE_MAGIC) {
+        fprintf(stderr, "FGPU:Not a trace file: %s\n", path);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (header->version != FGPU_TRACE_FILE_VERSION) {
+        fprintf(stderr, "FGPU:Unsupported trace file version %u\n", header->version);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    records.resize(header->num_records);
+    if (header->num_records != 0 &&
+            fread(records.data(), sizeof(fgpu_trace_record_t),
+                header->num_records, fp) != header->num_records) {
+        fprintf(stderr, "FGPU:Truncated trace file: %s\n", path);
+        ret = -EINVAL;
+    }
+
+out:
+    fclose(fp);
+    return ret;
+}
+
+/*
+ * Converts trace file into Chrome trace event format. Each SM is shown as a
+ * process and each pblock as a thread of it.
+ */
+int fgpu_trace_convert_to_json(const char *trace_path, const char *json_path)
+{
+    fgpu_trace_file_header_t header;
+    std::vector<fgpu_trace_record_t> records;
+    std::set<uint32_t> sms;
+    uint64_t origin = UINT64_MAX;
+    bool first = true;
+    FILE *fp;
+    int ret;
+
+    ret = read_trace_file(trace_path, &header, records);
+    if (ret < 0)
+        return ret;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].start < origin)
+            origin = records[i].start;
+        sms.insert(records[i].smid);
+    }
+
+    fp = fopen(json_path, "w");
+    if (!fp) {
+        fprintf(stderr, "FGPU:Can't open output file %s\n", json_path);
+        return -errno;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%" PRIu64 "},\n"
+            "\"traceEvents\":[\n", header.num_dropped);
+
+    for (std::set<uint32_t>::iterator it = sms.begin(); it != sms.end(); ++it) {
+        fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+                "\"args\":{\"name\":\"SM %u\"}}", first ? "" : ",\n", *it, *it);
+        first = false;
+    }
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const fgpu_trace_record_t *r = &records[i];
+        double ts = (r->start - origin) / 1000.0;
+
+        if (r->first_block == FGPU_TRACE_INACTIVE_BLOCK) {
+            fprintf(fp, "%s{\"name\":\"Inactive\",\"cat\":\"launch %u\",\"ph\":\"i\","
+                    "\"s\":\"t\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+                    first ? "" : ",\n", r->launch, ts, r->smid, r->pblock);
+        } else {
+            fprintf(fp, "%s{\"name\":\"Blocks %d-%d\",\"cat\":\"launch %u\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,"
+                    "\"args\":{\"launch\":%u,\"first_block\":%d,\"last_block\":%d}}",
+                    first ? "" : ",\n", r->first_block, r->last_block, r->launch,
+                    ts, (r->end - r->start) / 1000.0, r->smid, r->pblock,
+                    r->launch, r->first_block, r->last_block);
+        }
+        first = false;
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if (ferror(fp)) {
+        fprintf(stderr, "FGPU:Can't write output file %s\n", json_path);
+        ret = -EIO;
+    }
+
+    fclose(fp);
+    return ret;
+}
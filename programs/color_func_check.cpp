@@ -0,0 +1,102 @@
+/*
+ * Checks memory color functions (as used with userspace coloring) on host, no
+ * GPU needed. Colors are computed over synthetic physical ranges for sample
+ * color XOR masks of the driver. Prints "Result = PASS" if all checks pass.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include <fractional_gpu_cuda.cuh>
+
+/* Driver's color XOR masks the color function is checked with */
+typedef struct color_masks_case {
+    int num_masks;
+    uint64_t masks[FGPU_MAX_MEM_COLOR_BITS + 1];
+    bool valid;                     /* Usable with userspace coloring */
+} color_masks_case_t;
+
+/*
+ * Checks that each aligned group of 2^k pages of a (synthetic) physical range
+ * holds every color exactly once, and that page idx of colored memory maps to
+ * the page of its color in group idx. So each color gets an equal share of
+ * the range, with no page shared by two colored pages.
+ */
+static bool check_color_balance(const fgpu_color_func_t *func,
+        uint64_t start_idx, uint64_t num_groups)
+{
+    uint32_t num_colors = 1U << func->num_bits;
+
+    for (uint64_t g = 0; g < num_groups; g++) {
+        uint32_t seen = 0;
+
+        for (uint32_t i = 0; i < num_colors; i++) {
+            uint32_t c = fgpu_color_of_page(func, start_idx + g * num_colors + i);
+
+            if (seen & (1U << c))
+                return false;
+            seen |= 1U << c;
+        }
+
+        for (uint32_t c = 0; c < num_colors; c++) {
+            uint64_t page = fgpu_color_true_page(func, start_idx, c, g);
+
+            if (page / num_colors != g ||
+                    fgpu_color_of_page(func, start_idx + page) != c)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Runs the color function over ranges starting at different group aligned
+ * frames (as the driver's allocations). Masks that don't give every color in
+ * each group must be rejected.
+ */
+static bool check_color_func(void)
+{
+    color_masks_case_t cases[] = {
+        {1, {0xce4c3000}, true},
+        {2, {0x74b59000, 0x3a582000}, true},
+        {3, {0xce4c7000, 0x74b59000, 0x3a582000}, true},
+        {4, {0x8c41000, 0x31a2000, 0x52c4000, 0x9a58000}, true},
+        {1, {0x2000}, false},
+        {1, {0x74b59800}, false},
+        {2, {0x74b59000, 0x74b59000}, false},
+        {3, {0xce4c3000, 0x74b59000, 0x3a582000}, false},
+        {5, {0x1000, 0x2000, 0x4000, 0x8000, 0x10000}, false},
+    };
+    uint64_t start_frames[] = {0, 0x40000, 0x123450, 0xffff0};
+    bool correct = true;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        fgpu_color_func_t func;
+        int ret;
+
+        ret = fgpu_color_func_init(cases[i].masks, cases[i].num_masks, &func);
+        if ((ret == 0) != cases[i].valid) {
+            correct = false;
+            continue;
+        }
+
+        if (ret < 0)
+            continue;
+
+        for (size_t j = 0; j < sizeof(start_frames) / sizeof(start_frames[0]); j++) {
+            if (!check_color_balance(&func, start_frames[j], 4096))
+                correct = false;
+        }
+    }
+
+    return correct;
+}
+
+int main(void)
+{
+    bool correct = check_color_func();
+
+    printf("Result = %s\n", correct ? "PASS" : "FAIL");
+
+    return correct ? 0 : -1;
+}
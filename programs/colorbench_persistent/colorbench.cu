@@ -0,0 +1,175 @@
+/*
+ * Compares effective read bandwidth of colored memory for the different
+ * device side address translation helpers. Without userspace memory coloring
+ * all of them are plain loads and should perform the same.
+ */
+#include <stdio.h>
+#include <assert.h>
+
+#include <fractional_gpu.hpp>
+#include <fractional_gpu_cuda.cuh>
+
+#define USE_FGPU
+#include <fractional_gpu_testing.hpp>
+
+#define N                   (16 * 1024 * 1024)  /* Floats */
+#define BLOCK_ELEMS         (16 * 1024)         /* Floats read by a block */
+#define NUM_THREADS         256
+
+/* Never true as input is all ones. Keeps the compiler from dropping loads. */
+#define CONSUME(ctx, out, sum)                  \
+    if (sum < 0)                                \
+        FGPU_COLOR_STORE(ctx, out, sum);
+
+/* Current way: translate on every access */
+__global__
+FGPU_DEFINE_KERNEL(read_per_access, const float *x, float *out)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        const float *base = x + _blockIdx.x * BLOCK_ELEMS;
+        float sum = 0;
+
+        for (int i = threadIdx.x; i < BLOCK_ELEMS; i += blockDim.x)
+            sum += FGPU_COLOR_LOAD(ctx, &base[i]);
+
+        CONSUME(ctx, out, sum);
+    } FGPU_FOR_EACH_END;
+}
+
+/* Translate once per page per thread */
+__global__
+FGPU_DEFINE_KERNEL(read_cached, const float *x, float *out)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        const float *base = x + _blockIdx.x * BLOCK_ELEMS;
+        fgpu_color_page_cache_t cache = FGPU_COLOR_PAGE_CACHE_INIT;
+        float sum = 0;
+
+        for (int i = threadIdx.x; i < BLOCK_ELEMS; i += blockDim.x)
+            sum += FGPU_COLOR_LOAD_CACHED(ctx, &cache, &base[i]);
+
+        CONSUME(ctx, out, sum);
+    } FGPU_FOR_EACH_END;
+}
+
+/* Translate once per float4 */
+__global__
+FGPU_DEFINE_KERNEL(read_vec4, const float *x, float *out)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        const float *base = x + _blockIdx.x * BLOCK_ELEMS;
+        float sum = 0;
+
+        for (int i = threadIdx.x * 4; i < BLOCK_ELEMS; i += blockDim.x * 4) {
+            float4 v = FGPU_COLOR_LOAD_VEC(ctx, &base[i], float4);
+            sum += v.x + v.y + v.z + v.w;
+        }
+
+        CONSUME(ctx, out, sum);
+    } FGPU_FOR_EACH_END;
+}
+
+/* Translate once per page for the whole block (like tile staging loops) */
+__global__
+FGPU_DEFINE_KERNEL(read_span, const float *x, float *out)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        const float *base = x + _blockIdx.x * BLOCK_ELEMS;
+        float sum = 0;
+
+        for (size_t i = 0; i < BLOCK_ELEMS; ) {
+            const float *span = FGPU_COLOR_TRANSLATE_SPAN(ctx, &base[i]);
+            size_t n = min(BLOCK_ELEMS - i, fgpu_color_span_bytes(&base[i]) / sizeof(float));
+
+            for (size_t j = threadIdx.x; j < n; j += blockDim.x)
+                sum += span[j];
+
+            i += n;
+        }
+
+        CONSUME(ctx, out, sum);
+    } FGPU_FOR_EACH_END;
+}
+
+/* Returns from the caller (with ret set) if a launch fails */
+#define RUN(name, nIter, grid, threads, ...)                                \
+{                                                                           \
+    pstats_t stats;                                                         \
+    pstats_init(&stats);                                                    \
+                                                                            \
+    /* First launch is warmup */                                            \
+    for (int j = -1; j < nIter; j++) {                                      \
+        double start = dtime_usec(0);                                       \
+        ret = FGPU_LAUNCH_KERNEL(name, grid, threads, 0, __VA_ARGS__);      \
+        if (ret < 0)                                                        \
+            return ret;                                                     \
+        ret = fgpu_color_stream_synchronize();                              \
+        if (ret < 0)                                                        \
+            return ret;                                                     \
+        if (j >= 0)                                                         \
+            pstats_add_observation(&stats, dtime_usec(start));              \
+    }                                                                       \
+                                                                            \
+    printf(#name ": Bandwidth:%f GB/s\n",                                   \
+            bandwidth(stats.sum / stats.count));                            \
+    pstats_print(&stats, #name);                                            \
+}
+
+double bandwidth(double time)
+{
+    return ((double)N * sizeof(float)) / time / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+    float *x, *d_x, *d_out;
+    int nIter;
+    int ret;
+
+    test_initialize(argc, argv, &nIter);
+
+    dim3 grid(N / BLOCK_ELEMS, 1, 1), threads(NUM_THREADS, 1, 1);
+
+    x = (float *)malloc(N * sizeof(float));
+    assert(x);
+    for (int i = 0; i < N; i++)
+        x[i] = 1.0f;
+
+    ret = fgpu_memory_allocate((void **)&d_x, N * sizeof(float));
+    if (ret < 0)
+        return ret;
+    ret = fgpu_memory_allocate((void **)&d_out, sizeof(float));
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_memory_copy_async(d_x, x, N * sizeof(float), FGPU_COPY_CPU_TO_GPU);
+    if (ret < 0)
+        return ret;
+
+    RUN(read_per_access, nIter, grid, threads, d_x, d_out);
+    RUN(read_cached, nIter, grid, threads, d_x, d_out);
+    RUN(read_vec4, nIter, grid, threads, d_x, d_out);
+    RUN(read_span, nIter, grid, threads, d_x, d_out);
+
+    fgpu_memory_free(d_x);
+    fgpu_memory_free(d_out);
+    free(x);
+
+    test_deinitialize();
+}
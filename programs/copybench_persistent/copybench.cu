@@ -0,0 +1,184 @@
+/*
+ * Checks throughput of many small copies (like uploading all the blobs of a
+ * neural network) when done one by one v.s. as a single batch. Data copied by
+ * the batch is checked first, from both pageable and registered host memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <fractional_gpu.hpp>
+#include <fractional_gpu_cuda.cuh>
+
+#define USE_FGPU
+#include <fractional_gpu_testing.hpp>
+
+#define NUM_COPIES          512
+#define MAX_COPY_SIZE       (256 * 1024)
+
+size_t copy_sizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024};
+
+void check(int ret)
+{
+    if (ret < 0) {
+        fprintf(stderr, "Copy failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void setup_descs(fgpu_memory_copy_desc_t *descs, void *dst, void *src, size_t size)
+{
+    /* Buffers are spaced apart so that each copy is a separate range */
+    for (int i = 0; i < NUM_COPIES; i++) {
+        descs[i].dst = (void *)((uintptr_t)dst + i * MAX_COPY_SIZE);
+        descs[i].src = (void *)((uintptr_t)src + i * MAX_COPY_SIZE);
+        descs[i].count = size;
+    }
+}
+
+double copy_single(fgpu_memory_copy_desc_t *descs, enum fgpu_memory_copy_type type)
+{
+    double start = dtime_usec(0);
+
+    for (int i = 0; i < NUM_COPIES; i++)
+        check(fgpu_memory_copy_async(descs[i].dst, descs[i].src,
+                    descs[i].count, type));
+
+    check(fgpu_color_stream_synchronize());
+
+    return dtime_usec(start);
+}
+
+double copy_batch(fgpu_memory_copy_desc_t *descs, enum fgpu_memory_copy_type type)
+{
+    double start = dtime_usec(0);
+
+    check(fgpu_memory_copy_batch(descs, NUM_COPIES, type));
+    check(fgpu_color_stream_synchronize());
+
+    return dtime_usec(start);
+}
+
+/* 
+ * Round trip through GPU. Pageable source is overwritten as soon as the batch
+ * returns (it is done by then), registered source only after the batch has
+ * completed.
+ */
+void check_batch(char *d_x, size_t size, bool is_registered)
+{
+    fgpu_memory_copy_desc_t h2d[NUM_COPIES], d2h[NUM_COPIES];
+    size_t len = NUM_COPIES * size;
+    char *h_src, *h_dst;
+
+    h_src = (char *)malloc(len);
+    h_dst = (char *)malloc(len);
+    assert(h_src && h_dst);
+
+    if (is_registered) {
+        check(fgpu_host_register(h_src, len));
+        check(fgpu_host_register(h_dst, len));
+    }
+
+    for (size_t i = 0; i < len; i++)
+        h_src[i] = (char)(i * 7 + i / 4096);
+    memset(h_dst, 0, len);
+
+    for (int i = 0; i < NUM_COPIES; i++) {
+        h2d[i].dst = d_x + i * MAX_COPY_SIZE;
+        h2d[i].src = h_src + i * size;
+        h2d[i].count = size;
+        d2h[i].dst = h_dst + i * size;
+        d2h[i].src = d_x + i * MAX_COPY_SIZE;
+        d2h[i].count = size;
+    }
+
+    check(fgpu_memory_copy_batch(h2d, NUM_COPIES, FGPU_COPY_CPU_TO_GPU));
+    if (is_registered)
+        check(fgpu_color_stream_synchronize());
+    for (size_t i = 0; i < len; i++)
+        h_src[i] = ~h_src[i];
+
+    check(fgpu_memory_copy_batch(d2h, NUM_COPIES, FGPU_COPY_GPU_TO_CPU));
+    check(fgpu_color_stream_synchronize());
+
+    for (size_t i = 0; i < len; i++) {
+        if (h_dst[i] != (char)~h_src[i]) {
+            fprintf(stderr, "Batch copy (%s host memory, size %zu) mismatch at %zu\n",
+                    is_registered ? "registered" : "pageable", size, i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (is_registered) {
+        check(fgpu_host_unregister(h_src));
+        check(fgpu_host_unregister(h_dst));
+    }
+
+    free(h_src);
+    free(h_dst);
+}
+
+void print_result(const char *name, size_t size, pstats_t *stats)
+{
+    double avg = stats->sum / stats->count;
+
+    printf("%s: Size:%zu, Copies/sec:%f, Bandwidth:%f GB/s\n", name, size,
+            (double)NUM_COPIES * 1000000 / avg,
+            (double)NUM_COPIES * size / avg / 1000);
+    pstats_print(stats, name);
+}
+
+int main(int argc, char *argv[])
+{
+    fgpu_memory_copy_desc_t h2d[NUM_COPIES], d2h[NUM_COPIES];
+    pstats_t single_h2d, batch_h2d, single_d2h, batch_d2h;
+    char *h_x, *d_x;
+    int num_iterations;
+    int ret;
+
+    test_initialize(argc, argv, &num_iterations);
+
+    gpuErrAssert(cudaHostAlloc(&h_x, NUM_COPIES * MAX_COPY_SIZE, cudaHostAllocDefault));
+
+    ret = fgpu_memory_allocate((void **)&d_x, NUM_COPIES * MAX_COPY_SIZE);
+    if (ret < 0)
+        return ret;
+
+    for (int i = 0; i < sizeof(copy_sizes) / sizeof(copy_sizes[0]); i++) {
+        size_t size = copy_sizes[i];
+
+        setup_descs(h2d, d_x, h_x, size);
+        setup_descs(d2h, h_x, d_x, size);
+
+        pstats_init(&single_h2d);
+        pstats_init(&batch_h2d);
+        pstats_init(&single_d2h);
+        pstats_init(&batch_d2h);
+
+        check_batch(d_x, size, false);
+        check_batch(d_x, size, true);
+
+        /* Warmup */
+        copy_single(h2d, FGPU_COPY_CPU_TO_GPU);
+        copy_batch(h2d, FGPU_COPY_CPU_TO_GPU);
+
+        for (int j = 0; j < num_iterations; j++) {
+            pstats_add_observation(&single_h2d, copy_single(h2d, FGPU_COPY_CPU_TO_GPU));
+            pstats_add_observation(&batch_h2d, copy_batch(h2d, FGPU_COPY_CPU_TO_GPU));
+            pstats_add_observation(&single_d2h, copy_single(d2h, FGPU_COPY_GPU_TO_CPU));
+            pstats_add_observation(&batch_d2h, copy_batch(d2h, FGPU_COPY_GPU_TO_CPU));
+        }
+
+        print_result("HostToDeviceSingle", size, &single_h2d);
+        print_result("HostToDeviceBatch", size, &batch_h2d);
+        print_result("DeviceToHostSingle", size, &single_d2h);
+        print_result("DeviceToHostBatch", size, &batch_d2h);
+        printf("\n");
+    }
+
+    cudaFreeHost(h_x);
+    fgpu_memory_free(d_x);
+
+    test_deinitialize();
+}
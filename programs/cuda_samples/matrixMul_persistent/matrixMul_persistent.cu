@@ -245,7 +245,8 @@ int matrixMultiply(int num_iterations)
         return ret;
 
     total = dtime_usec(start);
-    pstats_print(&stats);
+    printf("Kernel Stats\n");
+    pstats_print(&stats, "kernel");
 
     // Compute and print the performance
     double msecPerMatrixMul = total / nIter / 1000;
@@ -195,7 +195,8 @@ int main(int argc, char **argv)
 
     total = dtime_usec(start);
 
-    pstats_print(&stats);
+    printf("Kernel Stats\n");
+    pstats_print(&stats, "kernel");
     printf("Average time: %f ms\n\n", total / numIterations / 1000);
 
     double dTimeSecs = 1.0e-6 * total / numIterations;
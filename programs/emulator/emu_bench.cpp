@@ -0,0 +1,568 @@
+/*
+ * Runs clients on the emulated device (no GPU needed) to benchmark launch
+ * arbitration and to check the runtime's scheduling and block dispatch. Each
+ * color has a number of clients continuously launching kernels. Client 0 of
+ * every color is real-time (highest priority) unless FIFO is requested. Rest
+ * of the clients can be given a GPU time budget.
+ * Every launch is checked to execute each logical block exactly once and only
+ * on the SMs of the client's color. Before the benchmark, launches queued
+ * behind a busy color are checked to be served in order of precedence (and
+ * resumable kernels to be preempted/resumed). After it, telemetry and budgets
+ * are checked against the launches done.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <fractional_gpu_cuda.cuh>
+#include <fractional_gpu_testing.hpp>
+
+#define MAX_CLIENTS_PER_COLOR   16
+
+typedef struct bench_config {
+    int num_sm;
+    int num_colors;
+    int num_clients;                /* Per color */
+    int num_iterations;
+    int num_blocks;
+    int num_pblocks_per_sm;
+    int work;                       /* usec per logical block */
+    bool fifo;
+    uint64_t budget;                /* usec per period (0 if not set) */
+    uint64_t period;                /* usec */
+} bench_config_t;
+
+typedef struct bench_client {
+    pthread_t thread;
+    const bench_config_t *config;
+    fgpu_emu_client_t client;
+    pstats_t wait_stats;
+    pstats_t latency_stats;
+    uint64_t elapsed;               /* usec from setting budget till last completion */
+    uint64_t max_execution;
+    bool correct;
+} bench_client_t;
+
+/* Launch of ordering check. Records when it got served */
+typedef struct order_waiter {
+    pthread_t thread;
+    fgpu_emu_client_t client;
+    int priority;
+    uint64_t deadline;
+    int expected;                   /* Position in which it should be served */
+    int served;
+    int ret;
+} order_waiter_t;
+
+static volatile int order_next;
+static volatile bool order_blocked;
+static volatile bool order_release;
+
+static void busy_wait(int usec)
+{
+    uint64_t end = launch_queue_now_usec() + usec;
+
+    while (launch_queue_now_usec() < end);
+}
+
+/* Counts executions of each logical block and checks the SM it ran on */
+FGPU_DEFINE_KERNEL(count_blocks, int *hits, int start_sm, int end_sm,
+        volatile bool *wrong_sm, int work)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        int smid = fgpu_emu_get_pblock()->smid;
+
+        __sync_fetch_and_add(&hits[_blockIdx.y * FGPU_GET_GRIDDIM(ctx).x + _blockIdx.x], 1);
+        if (smid < start_sm || smid > end_sm)
+            *wrong_sm = true;
+        busy_wait(work);
+    } FGPU_FOR_EACH_END;
+}
+
+FGPU_DEFINE_KERNEL(record_order, volatile int *served)
+{
+    dim3 _blockIdx;
+
+    FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        *served = __sync_fetch_and_add(&order_next, 1);
+    } FGPU_FOR_EACH_END;
+}
+
+/* Keeps the color busy till released */
+FGPU_DEFINE_KERNEL(block_color, volatile bool *release)
+{
+    dim3 _blockIdx;
+
+    FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        order_blocked = true;
+        while (!*release);
+    } FGPU_FOR_EACH_END;
+}
+
+static void *order_waiter_run(void *data)
+{
+    order_waiter_t *w = (order_waiter_t *)data;
+
+    w->ret = FGPU_EMU_LAUNCH_KERNEL(&w->client, record_order, dim3(1), dim3(1),
+            &w->served);
+
+    return NULL;
+}
+
+static void *order_blocker_run(void *data)
+{
+    order_waiter_t *w = (order_waiter_t *)data;
+
+    w->ret = FGPU_EMU_LAUNCH_KERNEL(&w->client, block_color, dim3(1), dim3(1),
+            &order_release);
+
+    return NULL;
+}
+
+static int get_num_queued(fgpu_emu_device_t *dev, int color)
+{
+    int size;
+
+    pthread_mutex_lock(&dev->streams.lock);
+    size = dev->streams.queues[color].size;
+    pthread_mutex_unlock(&dev->streams.lock);
+
+    return size;
+}
+
+/*
+ * Queues launches of different priority/deadline (arriving one by one) behind
+ * a running kernel and checks the order in which they are served. Deadlines
+ * are far apart so that the gaps between arrivals don't matter.
+ */
+static bool check_launch_order(fgpu_emu_device_t *dev)
+{
+    order_waiter_t waiters[] = {
+        {0, {}, FGPU_PRIORITY_BATCH, 2000000, 3, 0, 0},
+        {0, {}, FGPU_PRIORITY_BATCH, FGPU_NO_DEADLINE, 4, 0, 0},
+        {0, {}, FGPU_PRIORITY_REALTIME, FGPU_NO_DEADLINE, 1, 0, 0},
+        {0, {}, FGPU_PRIORITY_BATCH, FGPU_NO_DEADLINE, 5, 0, 0},
+        {0, {}, FGPU_PRIORITY_BATCH, 1000000, 2, 0, 0},
+        {0, {}, FGPU_PRIORITY_REALTIME, 1000000, 0, 0, 0},
+    };
+    int num_waiters = sizeof(waiters) / sizeof(waiters[0]);
+    order_waiter_t blocker = {0, {}, FGPU_PRIORITY_BATCH, FGPU_NO_DEADLINE, 0, 0, 0};
+    bool correct = true;
+
+    order_next = 0;
+    order_blocked = false;
+    order_release = false;
+
+    if (fgpu_emu_client_init(&blocker.client, dev, 0, blocker.priority,
+                blocker.deadline) < 0)
+        return false;
+
+    for (int i = 0; i < num_waiters; i++) {
+        if (fgpu_emu_client_init(&waiters[i].client, dev, 0, waiters[i].priority,
+                    waiters[i].deadline) < 0)
+            return false;
+    }
+
+    if (pthread_create(&blocker.thread, NULL, order_blocker_run, &blocker) != 0) {
+        fprintf(stderr, "Can't create client thread\n");
+        return false;
+    }
+
+    while (!order_blocked);
+
+    for (int i = 0; i < num_waiters; i++) {
+        if (pthread_create(&waiters[i].thread, NULL, order_waiter_run, &waiters[i]) != 0) {
+            fprintf(stderr, "Can't create client thread\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Wait for it to be queued so that arrival order is known */
+        while (get_num_queued(dev, 0) != i + 1)
+            usleep(100);
+    }
+
+    order_release = true;
+    pthread_join(blocker.thread, NULL);
+
+    for (int i = 0; i < num_waiters; i++) {
+        pthread_join(waiters[i].thread, NULL);
+
+        if (waiters[i].ret < 0 || waiters[i].served != waiters[i].expected) {
+            fprintf(stderr, "Launch (priority:%d, deadline:%" PRIu64 ") served %d, expected %d\n",
+                    waiters[i].priority, waiters[i].deadline,
+                    waiters[i].served, waiters[i].expected);
+            correct = false;
+        }
+    }
+
+    printf("Launch order: %s\n", correct ? "PASS" : "FAIL");
+
+    return correct;
+}
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+
+/* Requests preemption of its own color once a block is reached */
+FGPU_DEFINE_KERNEL(preempt_at_block, int *hits, int preempt_block,
+        fgpu_emu_device_t *dev, int color)
+{
+    dim3 _blockIdx;
+
+    FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        __sync_fetch_and_add(&hits[_blockIdx.x], 1);
+        if ((int)_blockIdx.x == preempt_block)
+            fgpu_emu_preempt_color(dev, color);
+        busy_wait(10);
+    } FGPU_FOR_EACH_END;
+}
+
+static bool check_hits(const std::vector<int> &hits, int expected)
+{
+    for (size_t i = 0; i < hits.size(); i++) {
+        if (hits[i] != expected)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Checks that a resumable kernel launched while its color is preempted makes
+ * no progress while a normal kernel runs to completion, and that a kernel
+ * preempted midway resumes from where it stopped.
+ */
+static bool check_preemption(fgpu_emu_device_t *dev, int num_blocks)
+{
+    fgpu_emu_client_t client;
+    fgpu_kernel_state_t state = {0};
+    std::vector<int> hits(num_blocks);
+    int start_sm = dev->color_to_sms[0].first;
+    int end_sm = dev->color_to_sms[0].second;
+    volatile bool wrong_sm = false;
+    bool correct = true;
+    int num_preemptions = 0;
+    int ret;
+
+    if (fgpu_emu_client_init(&client, dev, 0, FGPU_PRIORITY_BATCH,
+                FGPU_NO_DEADLINE) < 0)
+        return false;
+
+    fgpu_emu_preempt_color(dev, 0);
+
+    ret = FGPU_EMU_LAUNCH_RESUMABLE_KERNEL(&state, &client, count_blocks,
+            dim3(num_blocks), dim3(32), &hits[0], start_sm, end_sm, &wrong_sm, 0);
+    if (ret != FGPU_KERNEL_PREEMPTED || state.next_block != 0 || !check_hits(hits, 0))
+        correct = false;
+
+    ret = FGPU_EMU_LAUNCH_KERNEL(&client, count_blocks, dim3(num_blocks), dim3(32),
+            &hits[0], start_sm, end_sm, &wrong_sm, 0);
+    if (ret < 0 || !check_hits(hits, 1))
+        correct = false;
+
+    fgpu_emu_resume_color(dev, 0);
+
+    for (int i = 0; i < num_blocks; i++)
+        hits[i] = 0;
+
+    while ((ret = FGPU_EMU_LAUNCH_RESUMABLE_KERNEL(&state, &client, preempt_at_block,
+                    dim3(num_blocks), dim3(32), &hits[0], num_blocks / 2, dev, 0)) ==
+            FGPU_KERNEL_PREEMPTED) {
+        num_preemptions++;
+        fgpu_emu_resume_color(dev, 0);
+    }
+
+    if (ret < 0 || num_preemptions != 1 || state.next_block != num_blocks ||
+            !check_hits(hits, 1) || wrong_sm)
+        correct = false;
+
+    printf("Preemption: %s\n", correct ? "PASS" : "FAIL");
+
+    return correct;
+}
+
+#endif /* FGPU_PREEMPTION_ENABLED */
+
+static void *client_run(void *data)
+{
+    bench_client_t *bc = (bench_client_t *)data;
+    const bench_config_t *config = bc->config;
+    fgpu_emu_device_t *dev = bc->client.dev;
+    std::vector<int> hits(config->num_blocks);
+    int color = bc->client.launch.color;
+    int start_sm = dev->color_to_sms[color].first;
+    int end_sm = dev->color_to_sms[color].second;
+    volatile bool wrong_sm = false;
+    uint64_t start = launch_queue_now_usec();
+
+    if (config->budget > 0 && bc->client.launch.priority == FGPU_PRIORITY_BATCH)
+        fgpu_emu_client_set_budget(&bc->client, config->budget, config->period);
+
+    for (int i = 0; i < config->num_iterations; i++) {
+        int ret;
+
+        for (int j = 0; j < config->num_blocks; j++)
+            hits[j] = 0;
+
+        ret = FGPU_EMU_LAUNCH_KERNEL(&bc->client, count_blocks,
+                dim3(config->num_blocks), dim3(32), &hits[0], start_sm, end_sm,
+                &wrong_sm, config->work);
+        if (ret < 0) {
+            bc->correct = false;
+            return NULL;
+        }
+
+        for (int j = 0; j < config->num_blocks; j++) {
+            if (hits[j] != 1)
+                bc->correct = false;
+        }
+
+        if (wrong_sm)
+            bc->correct = false;
+
+        pstats_add_observation(&bc->wait_stats, bc->client.launch.queue_wait);
+        pstats_add_observation(&bc->latency_stats,
+                bc->client.launch.queue_wait + bc->client.execution);
+        if (bc->client.execution > bc->max_execution)
+            bc->max_execution = bc->client.execution;
+    }
+
+    bc->elapsed = launch_queue_now_usec() - start;
+
+    return NULL;
+}
+
+/* Counters of each color should add up to the counters of its clients */
+static bool check_telemetry(const fgpu_emu_device_t *dev,
+        const std::vector<bench_client_t> &clients, int num_iterations)
+{
+    const fgpu_telemetry_t *telemetry = &dev->telemetry;
+    bool correct = true;
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        const fgpu_telemetry_counters_t *counters = clients[i].client.launch.counters;
+
+        if (counters && counters->kernels_launched != (uint64_t)num_iterations)
+            correct = false;
+    }
+
+    for (int c = 0; c < telemetry->num_colors; c++) {
+        fgpu_telemetry_counters_t sum = {};
+
+        for (int i = 0; i < dev->num_clients && i < FGPU_MAX_NUM_CLIENTS; i++) {
+            if (telemetry->clients[i].color != c)
+                continue;
+
+            sum.kernels_launched += telemetry->clients[i].counters.kernels_launched;
+            sum.busy_time += telemetry->clients[i].counters.busy_time;
+            sum.queue_wait_time += telemetry->clients[i].counters.queue_wait_time;
+            sum.wasted_pblocks += telemetry->clients[i].counters.wasted_pblocks;
+        }
+
+        if (sum.kernels_launched != telemetry->colors[c].kernels_launched ||
+                sum.busy_time != telemetry->colors[c].busy_time ||
+                sum.queue_wait_time != telemetry->colors[c].queue_wait_time ||
+                sum.wasted_pblocks != telemetry->colors[c].wasted_pblocks)
+            correct = false;
+    }
+
+    printf("Telemetry: %s\n", correct ? "PASS" : "FAIL");
+
+    return correct;
+}
+
+/*
+ * A client can start a launch only while it has budget left, so over its run
+ * it can use at most the budget of each period started plus one launch.
+ */
+static bool check_budget(const bench_client_t *bc)
+{
+    const fgpu_launch_client_t *launch = &bc->client.launch;
+    uint64_t periods, limit;
+
+    if (!launch->is_budget_set || !launch->counters)
+        return true;
+
+    periods = bc->elapsed / launch->budget.period + 1;
+    limit = periods * launch->budget.budget + bc->max_execution;
+
+    printf("Budget: %" PRIu64 " usec used in %" PRIu64 " usec (limit:%" PRIu64 " usec)\n",
+            launch->counters->busy_time, bc->elapsed, limit);
+
+    return launch->counters->busy_time <= limit;
+}
+
+static void usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS]\n"
+            "-s <num SMs> (Default: 20)\n"
+            "-c <num colors> (Default: 2)\n"
+            "-n <clients per color> (Default: 2)\n"
+            "-i <iterations per client> (Default: 100)\n"
+            "-g <logical blocks per kernel> (Default: 200)\n"
+            "-o <pblocks per SM> (Default: 2)\n"
+            "-w <usec of work per block> (Default: 10)\n"
+            "-f Use FIFO (Same priority for all clients)\n"
+            "-b <budget usec per period> (Default: None. For batch clients)\n"
+            "-p <period usec> (Default: 10000)\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    bench_config_t config = {20, 2, 2, 100, 200, 2, 10, false, 0, 10000};
+    std::vector<bench_client_t> clients;
+    fgpu_emu_device_t dev;
+    bool correct = true;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "s:c:n:i:g:o:w:fb:p:")) != -1) {
+        switch (opt) {
+        case 's':
+            config.num_sm = atoi(optarg);
+            break;
+        case 'c':
+            config.num_colors = atoi(optarg);
+            break;
+        case 'n':
+            config.num_clients = atoi(optarg);
+            break;
+        case 'i':
+            config.num_iterations = atoi(optarg);
+            break;
+        case 'g':
+            config.num_blocks = atoi(optarg);
+            break;
+        case 'o':
+            config.num_pblocks_per_sm = atoi(optarg);
+            break;
+        case 'w':
+            config.work = atoi(optarg);
+            break;
+        case 'f':
+            config.fifo = true;
+            break;
+        case 'b':
+            config.budget = strtoull(optarg, NULL, 10);
+            break;
+        case 'p':
+            config.period = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv);
+        }
+    }
+
+    if (config.num_clients <= 0 || config.num_clients > MAX_CLIENTS_PER_COLOR)
+        usage(argv);
+
+    if (config.period == 0 || config.budget > config.period)
+        usage(argv);
+
+    ret = fgpu_emu_device_init(&dev, config.num_sm, config.num_colors, 1024,
+            config.num_pblocks_per_sm);
+    if (ret < 0)
+        return ret;
+
+    correct = check_launch_order(&dev);
+
+#if defined(FGPU_PREEMPTION_ENABLED)
+    correct = check_preemption(&dev, config.num_blocks) && correct;
+#endif
+
+    clients.resize(config.num_colors * config.num_clients);
+
+    for (int c = 0; c < config.num_colors; c++) {
+        for (int i = 0; i < config.num_clients; i++) {
+            bench_client_t *bc = &clients[c * config.num_clients + i];
+            int priority = (i == 0 && !config.fifo) ?
+                FGPU_PRIORITY_REALTIME : FGPU_PRIORITY_BATCH;
+
+            ret = fgpu_emu_client_init(&bc->client, &dev, c, priority,
+                    FGPU_NO_DEADLINE);
+            if (ret < 0)
+                return ret;
+
+            bc->config = &config;
+            bc->elapsed = 0;
+            bc->max_execution = 0;
+            bc->correct = true;
+            pstats_init(&bc->wait_stats);
+            pstats_init(&bc->latency_stats);
+        }
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        ret = pthread_create(&clients[i].thread, NULL, client_run, &clients[i]);
+        if (ret != 0) {
+            fprintf(stderr, "Can't create client thread\n");
+            return -ret;
+        }
+    }
+
+    for (size_t i = 0; i < clients.size(); i++)
+        pthread_join(clients[i].thread, NULL);
+
+    printf("Policy: %s, SMs: %d, Colors: %d, Clients per color: %d\n",
+            config.fifo ? "FIFO" : "Priority", config.num_sm,
+            config.num_colors, config.num_clients);
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        bench_client_t *bc = &clients[i];
+        int color = bc->client.launch.color;
+        char name[64];
+
+        printf("Color:%d, Client:%zu, Priority:%d\n", color,
+                i % config.num_clients, bc->client.launch.priority);
+        printf("Queue wait(usec):\n");
+        snprintf(name, sizeof(name), "color%d_client%zu_wait", color,
+                i % config.num_clients);
+        pstats_print(&bc->wait_stats, name);
+        printf("Launch latency(usec):\n");
+        snprintf(name, sizeof(name), "color%d_client%zu_latency", color,
+                i % config.num_clients);
+        pstats_print(&bc->latency_stats, name);
+
+        correct = check_budget(bc) && bc->correct && correct;
+    }
+
+    /* Per color stats combine stats of all clients of the color */
+    for (int c = 0; c < config.num_colors; c++) {
+        pstats_t latency_stats;
+        char name[64];
+
+        pstats_init(&latency_stats);
+        for (int i = 0; i < config.num_clients; i++)
+            pstats_merge(&latency_stats, &clients[c * config.num_clients + i].latency_stats);
+
+        printf("Color:%d, All clients\n", c);
+        printf("Launch latency(usec):\n");
+        snprintf(name, sizeof(name), "color%d_latency", c);
+        pstats_print(&latency_stats, name);
+    }
+
+    correct = check_telemetry(&dev, clients, config.num_iterations) && correct;
+
+    fgpu_emu_device_deinit(&dev);
+
+    printf("%s\n", correct ? "Result = PASS" : "Result = FAIL");
+
+    return correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
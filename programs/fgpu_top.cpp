@@ -0,0 +1,136 @@
+/* Live monitor of FGPU telemetry. Samples counters and prints rates */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <fgpu_internal_telemetry.hpp>
+
+#define DEFAULT_INTERVAL_MS     1000
+
+static void print_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [-i <interval in ms>] [-n <number of samples>]\n",
+            argv[0]);
+}
+
+/* Copies telemetry so that rates are computed over a consistent snapshot */
+static void take_snapshot(const volatile fgpu_telemetry_t *telemetry,
+        fgpu_telemetry_t *snapshot)
+{
+    memcpy(snapshot, (const void *)telemetry, sizeof(*snapshot));
+}
+
+static void print_counters(const char *name, double interval,
+        const fgpu_telemetry_counters_t *cur,
+        const fgpu_telemetry_counters_t *prev)
+{
+    uint64_t launches = cur->kernels_launched - prev->kernels_launched;
+    uint64_t busy = cur->busy_time - prev->busy_time;
+    uint64_t wait = cur->queue_wait_time - prev->queue_wait_time;
+
+    printf("%-14s %10.1f %7.1f %12.1f %12.1f %10.2f %10.2f\n", name,
+            launches / interval,
+            100.0 * busy / (interval * 1000000),
+            launches ? (double)wait / launches : 0.0,
+            (cur->wasted_pblocks - prev->wasted_pblocks) / interval,
+            (cur->bytes_copied - prev->bytes_copied) / interval / (1024 * 1024),
+            cur->heap_used / (1024.0 * 1024));
+}
+
+static void print_header(void)
+{
+    printf("%-14s %10s %7s %12s %12s %10s %10s\n", "",
+            "Launch/s", "Busy%", "Wait(us)/L", "Wasted/s", "Copy MB/s",
+            "Heap MB");
+}
+
+int main(int argc, char **argv)
+{
+    const volatile fgpu_telemetry_t *telemetry;
+    fgpu_telemetry_t *prev, *cur;
+    int interval_ms = DEFAULT_INTERVAL_MS;
+    int num_samples = -1;
+    bool is_tty = isatty(STDOUT_FILENO);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'n':
+            num_samples = atoi(optarg);
+            break;
+        default:
+            print_usage(argv);
+            return -EINVAL;
+        }
+    }
+
+    if (interval_ms <= 0) {
+        print_usage(argv);
+        return -EINVAL;
+    }
+
+    telemetry = fgpu_telemetry_attach();
+    if (!telemetry)
+        return -ENOENT;
+
+    prev = new fgpu_telemetry_t;
+    cur = new fgpu_telemetry_t;
+
+    take_snapshot(telemetry, prev);
+
+    for (int n = 0; num_samples < 0 || n < num_samples; n++) {
+        double interval = interval_ms / 1000.0;
+        char name[32];
+
+        usleep(interval_ms * 1000);
+        take_snapshot(telemetry, cur);
+
+        if (is_tty)
+            printf("\033[2J\033[H");
+
+        printf("FGPU Colors: %d, Interval: %d ms\n\n", cur->num_colors,
+                interval_ms);
+
+        print_header();
+        for (int i = 0; i < cur->num_colors && i < FGPU_MAX_NUM_COLORS; i++) {
+            snprintf(name, sizeof(name), "Color %d", i);
+            print_counters(name, interval, &cur->colors[i], &prev->colors[i]);
+        }
+
+        printf("\n");
+        print_header();
+        for (int i = 0; i < FGPU_MAX_NUM_CLIENTS; i++) {
+            const fgpu_telemetry_client_t *client = &cur->clients[i];
+
+            if (client->pid == 0)
+                continue;
+
+            /* Counters are reset when slot changes owner */
+            if (prev->clients[i].pid != client->pid)
+                memset(&prev->clients[i].counters, 0,
+                        sizeof(prev->clients[i].counters));
+
+            snprintf(name, sizeof(name), "PID %d(C%d)", client->pid,
+                    client->color);
+            print_counters(name, interval, &client->counters,
+                    &prev->clients[i].counters);
+        }
+
+        fflush(stdout);
+        std::swap(prev, cur);
+    }
+
+    delete prev;
+    delete cur;
+    fgpu_telemetry_detach(telemetry);
+
+    return 0;
+}
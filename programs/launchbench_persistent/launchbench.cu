@@ -0,0 +1,421 @@
+/*
+ * Measures the host overhead of kernel launches. An empty kernel is launched
+ * natively (on a CUDA stream) and via FGPU_LAUNCH_KERNEL for different block
+ * sizes, with 1..N concurrent client processes on each color. Run it in each
+ * FGPU mode (disabled, compute only, compute and memory) to compare the modes.
+ * If FGPU is built with FGPU_LAUNCH_PROFILE_ENABLED, time spent in each phase
+ * of FGPU launches is also reported.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fractional_gpu.hpp>
+#include <fractional_gpu_cuda.cuh>
+
+#define USE_FGPU
+#include <fractional_gpu_testing.hpp>
+
+#define MAX_CLIENTS             16      /* Across all colors */
+#define MAX_BLOCK_SIZES         8
+#define DEFAULT_BLOCK_SIZES     "32,128,512,1024"
+#define DEFAULT_MEM_SIZE        (32 * 1024 * 1024)
+
+enum launch_type {
+    LAUNCH_NATIVE,
+    LAUNCH_FGPU,
+    NUM_LAUNCH_TYPES,
+};
+
+static const char *launch_names[NUM_LAUNCH_TYPES] = {"native", "fgpu"};
+
+typedef struct bench_config {
+    int num_colors;
+    int max_clients;                /* Per color */
+    int num_iterations;
+    int num_blocks;
+    size_t mem_size;
+    int num_block_sizes;
+    int block_sizes[MAX_BLOCK_SIZES];
+} bench_config_t;
+
+/* Result of a client for a block size */
+typedef struct bench_result {
+    pstats_t latency[NUM_LAUNCH_TYPES];
+    double start[NUM_LAUNCH_TYPES]; /* usec */
+    double end[NUM_LAUNCH_TYPES];
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+    fgpu_launch_profile_t profile;
+#endif
+} bench_result_t;
+
+/* Shared by all client processes of a run */
+typedef struct bench_shared {
+    pthread_barrier_t barrier;
+    bool failed;
+    bench_result_t results[];       /* [client][block size] */
+} bench_shared_t;
+
+__global__ void native_empty(int)
+{
+}
+
+FGPU_DEFINE_KERNEL(fgpu_empty, int arg)
+{
+    FGPU_DEVICE_INIT();
+    dim3 _blockIdx;
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+    } FGPU_FOR_EACH_END;
+}
+
+static int launch(enum launch_type type, int num_blocks, int block_size,
+        cudaStream_t stream)
+{
+    int ret;
+
+    if (type == LAUNCH_NATIVE) {
+        native_empty<<<num_blocks, block_size, 0, stream>>>(0);
+        return cudaStreamSynchronize(stream) == cudaSuccess ? 0 : -EINVAL;
+    }
+
+    ret = FGPU_LAUNCH_KERNEL(fgpu_empty, dim3(num_blocks), dim3(block_size), 0, 0);
+    if (ret < 0)
+        return ret;
+
+    return fgpu_color_stream_synchronize();
+}
+
+/*
+ * Runs in a client process. All clients wait on the barrier before each
+ * measurement (even after a failure) so that they launch concurrently.
+ */
+static void client_run(const bench_config_t *config, bench_shared_t *shared,
+        int client, int color)
+{
+    cudaStream_t stream;
+    bool initialized, ok;
+    int ret;
+
+    ret = fgpu_init();
+    initialized = ret == 0;
+    if (ret == 0)
+        ret = fgpu_set_color_prop(color, config->mem_size);
+    if (ret == 0 && cudaStreamCreate(&stream) != cudaSuccess)
+        ret = -EINVAL;
+
+    ok = ret == 0;
+    if (!ok)
+        fprintf(stderr, "Client %d: Unable to initialize\n", client);
+
+    for (int b = 0; b < config->num_block_sizes; b++) {
+        bench_result_t *res = &shared->results[client * config->num_block_sizes + b];
+        int block_size = config->block_sizes[b];
+
+        for (int t = 0; t < NUM_LAUNCH_TYPES; t++) {
+            enum launch_type type = (enum launch_type)t;
+
+            pstats_init(&res->latency[t]);
+
+            /* Warmup */
+            if (ok && launch(type, config->num_blocks, block_size, stream) < 0) {
+                fprintf(stderr, "Client %d: Unable to launch kernel\n", client);
+                ok = false;
+            }
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+            fgpu_reset_launch_profile();
+#endif
+
+            pthread_barrier_wait(&shared->barrier);
+
+            res->start[t] = dtime_usec(0);
+            for (int i = 0; ok && i < config->num_iterations; i++) {
+                double start = dtime_usec(0);
+
+                if (launch(type, config->num_blocks, block_size, stream) < 0) {
+                    fprintf(stderr, "Client %d: Unable to launch kernel\n", client);
+                    ok = false;
+                }
+
+                pstats_add_observation(&res->latency[t], dtime_usec(start));
+            }
+            res->end[t] = dtime_usec(0);
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+            if (type == LAUNCH_FGPU)
+                fgpu_get_launch_profile(&res->profile);
+#endif
+        }
+    }
+
+    if (!ok)
+        shared->failed = true;
+
+    if (ret == 0)
+        cudaStreamDestroy(stream);
+
+    if (initialized)
+        fgpu_deinit();
+}
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+static void print_profile(const bench_config_t *config, bench_shared_t *shared,
+        int num_clients, int b)
+{
+    fgpu_launch_profile_t sum;
+    double n;
+
+    memset(&sum, 0, sizeof(sum));
+    for (int c = 0; c < num_clients; c++) {
+        const fgpu_launch_profile_t *p =
+            &shared->results[c * config->num_block_sizes + b].profile;
+
+        sum.num_launches += p->num_launches;
+        sum.occupancy += p->occupancy;
+        sum.budget += p->budget;
+        sum.fence += p->fence;
+        sum.queue += p->queue;
+        sum.launchpad += p->launchpad;
+        sum.setup += p->setup;
+        sum.launch += p->launch;
+        sum.sync += p->sync;
+        sum.release += p->release;
+    }
+
+    if (sum.num_launches == 0)
+        return;
+
+    /* Average usec per launch */
+    n = sum.num_launches * 1000.0;
+    printf("PHASES(usec): Occupancy:%f, Budget:%f, Fence:%f, Queue:%f, Launchpad:%f, "
+            "Setup:%f, Launch:%f, Sync:%f, Release:%f\n",
+            sum.occupancy / n, sum.budget / n, sum.fence / n, sum.queue / n,
+            sum.launchpad / n, sum.setup / n, sum.launch / n, sum.sync / n,
+            sum.release / n);
+}
+#endif
+
+static void print_results(const bench_config_t *config, bench_shared_t *shared,
+        int clients_per_color)
+{
+    int num_clients = clients_per_color * config->num_colors;
+
+    for (int b = 0; b < config->num_block_sizes; b++) {
+        for (int t = 0; t < NUM_LAUNCH_TYPES; t++) {
+            pstats_t stats;
+            double start = 0, end = 0;
+            char name[64];
+
+            pstats_init(&stats);
+            for (int c = 0; c < num_clients; c++) {
+                bench_result_t *res = &shared->results[c * config->num_block_sizes + b];
+
+                pstats_merge(&stats, &res->latency[t]);
+                if (c == 0 || res->start[t] < start)
+                    start = res->start[t];
+                if (c == 0 || res->end[t] > end)
+                    end = res->end[t];
+            }
+
+            printf("Clients per color:%d, Block size:%d, Launch:%s\n", clients_per_color,
+                    config->block_sizes[b], launch_names[t]);
+            printf("Throughput:%f launches/sec\n",
+                    end > start ? stats.count * (double)USECPSEC / (end - start) : 0);
+            snprintf(name, sizeof(name), "%s_t%d_n%d", launch_names[t],
+                    config->block_sizes[b], clients_per_color);
+            pstats_print(&stats, name);
+
+#if defined(FGPU_LAUNCH_PROFILE_ENABLED)
+            if (t == LAUNCH_FGPU)
+                print_profile(config, shared, num_clients, b);
+#endif
+        }
+    }
+}
+
+/* Runs clients_per_color clients on each color concurrently */
+static int run(const bench_config_t *config, int clients_per_color)
+{
+    int num_clients = clients_per_color * config->num_colors;
+    size_t size = sizeof(bench_shared_t) +
+        num_clients * config->num_block_sizes * sizeof(bench_result_t);
+    pthread_barrierattr_t attr;
+    bench_shared_t *shared;
+    pid_t pids[MAX_CLIENTS];
+    bool failed;
+
+    shared = (bench_shared_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        fprintf(stderr, "Can't allocate shared memory\n");
+        return -ENOMEM;
+    }
+
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&shared->barrier, &attr, num_clients);
+    pthread_barrierattr_destroy(&attr);
+    shared->failed = false;
+
+    fflush(stdout);
+
+    for (int c = 0; c < num_clients; c++) {
+        pids[c] = fork();
+        if (pids[c] < 0) {
+            /* Clients already started would wait forever on barrier */
+            fprintf(stderr, "Can't create client process\n");
+            for (int i = 0; i < c; i++)
+                kill(pids[i], SIGKILL);
+            num_clients = c;
+            shared->failed = true;
+            break;
+        }
+
+        if (pids[c] == 0) {
+            client_run(config, shared, c, c % config->num_colors);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    for (int c = 0; c < num_clients; c++) {
+        int status;
+
+        if (waitpid(pids[c], &status, 0) < 0 || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != EXIT_SUCCESS)
+            shared->failed = true;
+    }
+
+    failed = shared->failed;
+    if (!failed)
+        print_results(config, shared, clients_per_color);
+
+    pthread_barrier_destroy(&shared->barrier);
+    munmap(shared, size);
+
+    return failed ? -EINVAL : 0;
+}
+
+static int parse_block_sizes(bench_config_t *config, const char *list)
+{
+    const char *p = list;
+    char *end;
+
+    config->num_block_sizes = 0;
+    while (*p) {
+        long val = strtol(p, &end, 0);
+
+        if (end == p || val <= 0 || val > 1024 ||
+                config->num_block_sizes == MAX_BLOCK_SIZES)
+            return -EINVAL;
+
+        config->block_sizes[config->num_block_sizes++] = val;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -EINVAL;
+
+        p = end;
+    }
+
+    return config->num_block_sizes > 0 ? 0 : -EINVAL;
+}
+
+static void usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS]\n"
+            "-c <num colors> Clients run on colors 0..num colors-1 (Default: 1)\n"
+            "-n <clients per color> Runs with 1..n clients per color (Default: 4)\n"
+            "-i <launches per client> (Default: 1000)\n"
+            "-g <blocks per kernel> (Default: 128)\n"
+            "-t <threads per block> Comma separated list (Default: " DEFAULT_BLOCK_SIZES ")\n"
+            "-m <memory size> Per client (Default: 32MB)\n"
+            "-o <file> Save stats to file (JSON lines if file ends in .json, else CSV)\n"
+            "-q <percentiles> Comma separated percentiles to report (Default: " PSTATS_DEFAULT_PERCENTILES ")\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    bench_config_t config = {1, 4, 1000, 128, DEFAULT_MEM_SIZE};
+    int opt, ret;
+
+    parse_block_sizes(&config, DEFAULT_BLOCK_SIZES);
+
+    while ((opt = getopt(argc, argv, "c:n:i:g:t:m:o:q:")) != -1) {
+        switch (opt) {
+        case 'c':
+            config.num_colors = atoi(optarg);
+            break;
+        case 'n':
+            config.max_clients = atoi(optarg);
+            break;
+        case 'i':
+            config.num_iterations = atoi(optarg);
+            break;
+        case 'g':
+            config.num_blocks = atoi(optarg);
+            break;
+        case 't':
+            if (parse_block_sizes(&config, optarg) < 0)
+                usage(argv);
+            break;
+        case 'm':
+            config.mem_size = atoll(optarg);
+            break;
+        case 'o':
+            pstats_file_path = optarg;
+            break;
+        case 'q':
+            if (pstats_set_percentiles(optarg) < 0)
+                usage(argv);
+            break;
+        default:
+            usage(argv);
+        }
+    }
+
+    if (config.num_colors <= 0 || config.num_colors > FGPU_MAX_NUM_COLORS ||
+            config.max_clients <= 0 ||
+            config.max_clients * config.num_colors > MAX_CLIENTS ||
+            config.num_iterations <= 0 || config.num_blocks <= 0)
+        usage(argv);
+
+    printf("Computational Coloring:\t");
+#if defined(FGPU_COMP_COLORING_ENABLE)
+    printf("Enabled\n");
+#else
+    printf("Disabled\n");
+#endif
+
+    printf("Memory Coloring:\t");
+#if defined(FGPU_MEM_COLORING_ENABLED)
+    printf("Enabled\n");
+#else
+    printf("Disabled\n");
+#endif
+
+    printf("Colors: %d, Launches per client: %d, Blocks per kernel: %d\n",
+            config.num_colors, config.num_iterations, config.num_blocks);
+
+    for (int n = 1; n <= config.max_clients; n++) {
+        ret = run(&config, n);
+        if (ret < 0) {
+            fprintf(stderr, "Benchmark failed with %d clients per color\n", n);
+            pstats_close();
+            return EXIT_FAILURE;
+        }
+    }
+
+    pstats_close();
+
+    return EXIT_SUCCESS;
+}
@@ -1,7 +1,20 @@
-/* This program checks the memory bandwidth */
+/*
+ * This program checks the memory bandwidth. Besides host copies, on-device
+ * access patterns (sequential, strided, random pointer chase) are measured
+ * for different working sets (below/above color's share of L2 cache). To
+ * measure with a co-runner, run another instance on a different color with
+ * -k (loops on the selected tests). Runtime of all the access test launches
+ * is also reported as kernel stats (for benchmark scripts).
+ * Usage: membench_persistent [test options] [-- suite options [-- test options]]
+ */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <fractional_gpu.hpp>
 #include <fractional_gpu_cuda.cuh>
 
@@ -9,40 +22,167 @@
 #include <fractional_gpu_testing.hpp>
 
 #define N                   (128 * 1024 * 1024)
-#define PAGE_SIZE           (4 * 1024)
+#define PAGE_SIZE           (4 * 1024)          /* Color page size */
+#define NUM_SMALL_COPIES    1000
+
+#define LINE_SIZE           FGPU_DEVICE_CACHELINE_SIZE
+#define NUM_THREADS         256
+#define MAX_BLOCKS          4096
+#define MIN_ACCESSES        (16 * 1024 * 1024)  /* Per kernel (small working sets are repeated) */
+#define CHASE_HOPS          (1024 * 1024)
+#define MAX_LIST            16
+#define SUITE_ITERATIONS    10                  /* Default iterations of each test */
+#define DRAM_WORKING_SET    (64 * 1024 * 1024)
+
+enum pattern {
+    PATTERN_COPY,
+    PATTERN_SEQ,
+    PATTERN_STRIDE,
+    PATTERN_CHASE,
+    NUM_PATTERNS,
+};
+
+enum op {
+    OP_READ,
+    OP_WRITE,
+    OP_RMW,
+    NUM_OPS,
+};
+
+static const char *pattern_names[NUM_PATTERNS] = {"copy", "seq", "stride", "chase"};
+static const char *op_names[NUM_OPS] = {"read", "write", "rmw"};
+
+typedef struct suite_config {
+    unsigned patterns;                  /* Bitmask of enum pattern */
+    unsigned ops;                       /* Bitmask of enum op */
+    int num_working_sets;               /* Bytes (0 if default) */
+    size_t working_sets[MAX_LIST];
+    int num_strides;                    /* Bytes (0 if default) */
+    size_t strides[MAX_LIST];
+} suite_config_t;
+
+/* Every stride_words'th word of working set is accessed by consecutive threads */
+FGPU_DEFINE_KERNEL(access_kernel, uint32_t *buf, size_t num_accesses, size_t stride_words,
+        int passes, int op, uint32_t *out)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        size_t num_threads = FGPU_GET_GRIDDIM(ctx).x * blockDim.x;
+        size_t tid = _blockIdx.x * blockDim.x + threadIdx.x;
+        uint32_t sum = 0;
+
+        for (int p = 0; p < passes; p++) {
+            for (size_t i = tid; i < num_accesses; i += num_threads) {
+                uint32_t *addr = &buf[i * stride_words];
+
+                if (op == OP_READ) {
+                    sum += FGPU_COLOR_LOAD(ctx, addr);
+                } else if (op == OP_WRITE) {
+                    FGPU_COLOR_STORE(ctx, addr, (uint32_t)i);
+                } else {
+                    FGPU_COLOR_STORE(ctx, addr, FGPU_COLOR_LOAD(ctx, addr) + 1);
+                }
+            }
+        }
+
+        /* Keeps the compiler from dropping loads */
+        if (sum == 0xFFFFFFFF)
+            FGPU_COLOR_STORE(ctx, out, sum);
+    } FGPU_FOR_EACH_END;
+}
+
+/* Single thread follows the chain, so each load waits for the previous one */
+FGPU_DEFINE_KERNEL(chase_kernel, uint32_t *chain, int num_hops, uint32_t *out)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        uint32_t idx = 0;
+
+        if (_blockIdx.x == 0 && threadIdx.x == 0) {
+            for (int i = 0; i < num_hops; i++)
+                idx = FGPU_COLOR_LOAD(ctx, &chain[idx]);
+
+            if (idx == 0xFFFFFFFF)
+                FGPU_COLOR_STORE(ctx, out, idx);
+        }
+    } FGPU_FOR_EACH_END;
+}
+
+size_t small_sizes[] = {64, 512, PAGE_SIZE};
 
 void transfer_one(void *dst, void *src, size_t size, enum fgpu_memory_copy_type kind)
 {
     int ret = fgpu_memory_copy_async(dst, src, size, kind);
-    if (ret == 0)
+    if (ret < 0)
         exit(-1);
-    fgpu_color_stream_synchronize();
-     if (ret == 0)
+    ret = fgpu_color_stream_synchronize();
+    if (ret < 0)
         exit(-1);
 }
 
+/* 
+ * Host side cost dominates for small copies. Run with
+ * FGPU_IOCTL_PARAMS_CACHE_ENV=0 to compare against building the ioctl params
+ * on every copy (reported with "Uncached" suffix).
+ */
+void small_transfer_latency(void *dst, void *src, enum fgpu_memory_copy_type kind,
+        const char *prefix)
+{
+    const char *cache_env = getenv("FGPU_IOCTL_PARAMS_CACHE_ENV");
+    pstats_t stats;
+    double start;
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s%s", prefix,
+            cache_env && atoi(cache_env) == 0 ? "Uncached" : "");
+
+    for (int i = 0; i < sizeof(small_sizes) / sizeof(small_sizes[0]); i++) {
+        pstats_init(&stats);
+
+        for (int j = 0; j < NUM_SMALL_COPIES; j++) {
+            start = dtime_usec(0);
+            transfer_one(dst, src, small_sizes[i], kind);
+            pstats_add_observation(&stats, dtime_usec(start));
+        }
+
+        printf("%s: Size:%zu, Latency (usec)\n", name, small_sizes[i]);
+        pstats_print(&stats, name);
+    }
+}
+
 double bandwidth(double time)
 {
     return ((double)N) / time / 1000;
 }
 
-int main(int argc, char *argv[])
+/* Host copies (Not run with -k as these are not kernels) */
+void run_copy_tests(void)
 {
-    char *x, *h_x, *d_x;
+    char *x, *r_x, *h_x, *d_x;
     double start;
     int ret;
-    int num_iterations;
-
-    test_initialize(argc, argv, &num_iterations);
 
     x = (char *)malloc(N*sizeof(char));
     assert(x);
 
+    /* Pageable memory, but pinned once instead of on every copy */
+    r_x = (char *)malloc(N*sizeof(char));
+    assert(r_x);
+    ret = fgpu_host_register(r_x, N);
+    if (ret < 0)
+        exit(-1);
+
     gpuErrAssert(cudaHostAlloc(&h_x, N*sizeof(char), cudaHostAllocDefault));
 
     ret = fgpu_memory_allocate((void **)&d_x, N);
     if (ret < 0)
-        return ret;
+        exit(-1);
 
     // Warmup
     printf("Doing Warmup\n");
@@ -55,6 +195,10 @@ int main(int argc, char *argv[])
 
     printf("Warmup done\n");
 
+    small_transfer_latency(d_x, h_x, FGPU_COPY_CPU_TO_GPU, "SmallHostToDevicePinned");
+    small_transfer_latency(h_x, d_x, FGPU_COPY_GPU_TO_CPU, "SmallDeviceToHostPinned");
+    printf("\n\n");
+
     for (int i = 0; i < 3; i++) {
     
         /* Test one way transfer */
@@ -62,10 +206,18 @@ int main(int argc, char *argv[])
         transfer_one(d_x, x, N, FGPU_COPY_CPU_TO_GPU);
         printf("HostToDevice: Bandwidth:%f GB/s\n", bandwidth(dtime_usec(start)));
 
+        start = dtime_usec(0);
+        transfer_one(d_x, r_x, N, FGPU_COPY_CPU_TO_GPU);
+        printf("HostToDeviceRegistered: Bandwidth:%f GB/s\n", bandwidth(dtime_usec(start)));
+
         start = dtime_usec(0);
         transfer_one(x, d_x, N, FGPU_COPY_GPU_TO_CPU);
         printf("DeviceToHost: Bandwidth:%f GB/s\n", bandwidth(dtime_usec(start)));
 
+        start = dtime_usec(0);
+        transfer_one(r_x, d_x, N, FGPU_COPY_GPU_TO_CPU);
+        printf("DeviceToHostRegistered: Bandwidth:%f GB/s\n", bandwidth(dtime_usec(start)));
+
         start = dtime_usec(0);
         transfer_one(d_x, h_x, N, FGPU_COPY_CPU_TO_GPU);
         printf("HostToDevicePinned: Bandwidth:%f GB/s\n", bandwidth(dtime_usec(start)));
@@ -84,8 +236,403 @@ int main(int argc, char *argv[])
     }
 
     free(x);
+    fgpu_host_unregister(r_x);
+    free(r_x);
     cudaFreeHost(h_x);
     fgpu_memory_free(d_x);
+}
+
+/* Parses comma separated sizes (with optional K/M/G suffix) */
+static int parse_sizes(const char *list, size_t *vals, int max_vals)
+{
+    const char *p = list;
+    char *end;
+    int num = 0;
+
+    while (*p) {
+        size_t val = strtoull(p, &end, 0);
+
+        if (end == p || num == max_vals)
+            return -EINVAL;
+
+        switch (*end) {
+        case 'G':
+            val *= 1024;
+            /* fall through */
+        case 'M':
+            val *= 1024;
+            /* fall through */
+        case 'K':
+            val *= 1024;
+            end++;
+            break;
+        }
+
+        if (val == 0)
+            return -EINVAL;
+
+        vals[num++] = val;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -EINVAL;
+
+        p = end;
+    }
+
+    return num;
+}
+
+/* Parses comma separated names into bitmask of their index */
+static int parse_names(const char *list, const char **names, int num_names, unsigned *mask)
+{
+    char buf[256];
+    char *save, *tok;
+
+    if (strlen(list) >= sizeof(buf))
+        return -EINVAL;
+
+    strcpy(buf, list);
+    *mask = 0;
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int i;
+
+        for (i = 0; i < num_names; i++) {
+            if (strcmp(tok, names[i]) == 0)
+                break;
+        }
+
+        if (i == num_names)
+            return -EINVAL;
+
+        *mask |= 1U << i;
+    }
+
+    return *mask ? 0 : -EINVAL;
+}
+
+static void suite_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [test options] [-- suite options [-- test options]]\n"
+            "Suite options:\n"
+            "-p <patterns> Comma separated from copy,seq,stride,chase (Default: all)\n"
+            "-a <operations> Comma separated from read,write,rmw (Default: all)\n"
+            "-w <working sets> Comma separated sizes, K/M/G suffix allowed "
+            "(Default: 1/4, 1/2, 2, 8 times color's share of L2 cache and 64M)\n"
+            "-s <strides> Comma separated sizes (Default: Powers of two from 8 to page size)\n",
+            argv[0]);
+    fprintf(stderr, "Exiting\n");
+    exit(-1);
+}
+
+/* test_initialize() stops at "--", rest of the arguments are for the suite */
+static void parse_suite_args(int argc, char **argv, suite_config_t *config)
+{
+    int opt;
+
+    config->patterns = (1U << NUM_PATTERNS) - 1;
+    config->ops = (1U << NUM_OPS) - 1;
+    config->num_working_sets = 0;
+    config->num_strides = 0;
+
+    while ((opt = getopt(argc, argv, "p:a:w:s:")) != -1) {
+        switch (opt) {
+        case 'p':
+            if (parse_names(optarg, pattern_names, NUM_PATTERNS, &config->patterns) < 0)
+                suite_usage(argv);
+            break;
+
+        case 'a':
+            if (parse_names(optarg, op_names, NUM_OPS, &config->ops) < 0)
+                suite_usage(argv);
+            break;
+
+        case 'w':
+            config->num_working_sets = parse_sizes(optarg, config->working_sets, MAX_LIST);
+            if (config->num_working_sets < 0)
+                suite_usage(argv);
+            break;
+
+        case 's':
+            config->num_strides = parse_sizes(optarg, config->strides, MAX_LIST);
+            if (config->num_strides < 0)
+                suite_usage(argv);
+            for (int i = 0; i < config->num_strides; i++) {
+                if (config->strides[i] % sizeof(uint32_t))
+                    suite_usage(argv);
+            }
+            break;
+
+        default:
+            suite_usage(argv);
+        }
+    }
+}
+
+/* Default working sets are relative to color's share of L2 cache */
+static void set_default_working_sets(suite_config_t *config)
+{
+    cudaDeviceProp prop;
+    size_t share;
+    int num_colors;
+
+    gpuErrAssert(cudaGetDeviceProperties(&prop, FGPU_DEVICE_NUMBER));
+
+    num_colors = fgpu_num_colors();
+    if (num_colors <= 0)
+        num_colors = 1;
+
+    share = prop.l2CacheSize / num_colors;
+    printf("L2 cache:\t%d\nL2 cache share of color:\t%zu\n", prop.l2CacheSize, share);
+
+    if (config->num_working_sets == 0) {
+        config->working_sets[0] = share / 4;
+        config->working_sets[1] = share / 2;
+        config->working_sets[2] = share * 2;
+        config->working_sets[3] = share * 8;
+        config->working_sets[4] = DRAM_WORKING_SET;
+        config->num_working_sets = 5;
+    }
+
+    if (config->num_strides == 0) {
+        for (size_t stride = 2 * sizeof(uint32_t); stride <= PAGE_SIZE; stride *= 2)
+            config->strides[config->num_strides++] = stride;
+    }
+}
+
+/* Prints result of a test (ACCESS lines are CSV for scripts) */
+static void print_access_result(pstats_t *stats, enum pattern pattern, const char *op,
+        size_t stride, size_t working_set, size_t bytes, size_t accesses)
+{
+    double avg = stats->count ? stats->sum / stats->count : 0;
+    char name[128];
+
+    snprintf(name, sizeof(name), "%s_%s_s%zu_w%zu", pattern_names[pattern], op,
+            stride, working_set);
+
+    printf("%s: Op:%s, Stride:%zu, WorkingSet:%zu\n", pattern_names[pattern], op,
+            stride, working_set);
+    pstats_print(stats, name);
+    printf("ACCESS,%s,%s,%zu,%zu,%zu,%f,%f,%f,%f,%f\n", pattern_names[pattern], op,
+            stride, working_set, bytes, avg, pstats_percentile(stats, 50),
+            pstats_percentile(stats, 95), avg > 0 ? bytes / avg / 1000 : 0,
+            accesses ? avg * 1000 / accesses : 0);
+}
+
+static void run_access_test(enum pattern pattern, enum op op, size_t stride,
+        size_t working_set, int num_iterations, uint32_t *d_buf, uint32_t *d_out,
+        pstats_t *kernel_stats)
+{
+    size_t stride_words = stride / sizeof(uint32_t);
+    size_t num_accesses = working_set / stride;
+    size_t num_blocks, bytes;
+    pstats_t stats;
+    int passes;
+    int ret;
+
+    if (num_accesses == 0)
+        return;
+
+    passes = std::max((size_t)1, MIN_ACCESSES / num_accesses);
+    num_blocks = std::min((size_t)MAX_BLOCKS, (num_accesses + NUM_THREADS - 1) / NUM_THREADS);
+    bytes = num_accesses * passes * sizeof(uint32_t) * (op == OP_RMW ? 2 : 1);
+
+    pstats_init(&stats);
+
+    /* First launch is warmup */
+    for (int i = -1; i < num_iterations; i++) {
+        double start = dtime_usec(0);
+
+        ret = FGPU_LAUNCH_KERNEL(access_kernel, dim3(num_blocks), dim3(NUM_THREADS), 0,
+                d_buf, num_accesses, stride_words, passes, op, d_out);
+        if (ret < 0)
+            exit(-1);
+        ret = fgpu_color_stream_synchronize();
+        if (ret < 0)
+            exit(-1);
+
+        if (i >= 0) {
+            double time = dtime_usec(start);
+            pstats_add_observation(&stats, time);
+            pstats_add_observation(kernel_stats, time);
+        }
+    }
+
+    print_access_result(&stats, pattern, op_names[op], stride, working_set, bytes,
+            num_accesses * passes);
+}
+
+/* Chain visits each cacheline of working set once in random order */
+static void setup_chain(uint32_t *d_buf, size_t working_set)
+{
+    size_t line_words = LINE_SIZE / sizeof(uint32_t);
+    size_t num_lines = working_set / LINE_SIZE;
+    std::vector<uint32_t> h_chain(working_set / sizeof(uint32_t), 0);
+    std::vector<size_t> order(num_lines);
+    int ret;
+
+    for (size_t i = 0; i < num_lines; i++)
+        order[i] = i;
+
+    /* Sattolo's algorithm - A single cycle through all lines */
+    for (size_t i = num_lines - 1; i > 0; i--)
+        std::swap(order[i], order[rand() % i]);
+
+    for (size_t i = 0; i < num_lines; i++)
+        h_chain[order[i] * line_words] = order[(i + 1) % num_lines] * line_words;
+
+    ret = fgpu_memory_copy_async(d_buf, h_chain.data(), working_set, FGPU_COPY_CPU_TO_GPU);
+    if (ret < 0)
+        exit(-1);
+    ret = fgpu_color_stream_synchronize();
+    if (ret < 0)
+        exit(-1);
+}
+
+static void run_chase_test(size_t working_set, int num_iterations, uint32_t *d_buf,
+        uint32_t *d_out, pstats_t *kernel_stats)
+{
+    pstats_t stats;
+    int ret;
+
+    if (working_set < 2 * LINE_SIZE)
+        return;
+
+    setup_chain(d_buf, working_set);
+
+    pstats_init(&stats);
+
+    /* First launch is warmup */
+    for (int i = -1; i < num_iterations; i++) {
+        double start = dtime_usec(0);
+
+        ret = FGPU_LAUNCH_KERNEL(chase_kernel, dim3(1), dim3(32), 0, d_buf, CHASE_HOPS, d_out);
+        if (ret < 0)
+            exit(-1);
+        ret = fgpu_color_stream_synchronize();
+        if (ret < 0)
+            exit(-1);
+
+        if (i >= 0) {
+            double time = dtime_usec(start);
+            pstats_add_observation(&stats, time);
+            pstats_add_observation(kernel_stats, time);
+        }
+    }
+
+    print_access_result(&stats, PATTERN_CHASE, op_names[OP_READ], LINE_SIZE, working_set,
+            CHASE_HOPS * sizeof(uint32_t), CHASE_HOPS);
+}
+
+static void run_access_tests(const suite_config_t *config, int num_iterations)
+{
+    uint32_t *d_buf, *d_out;
+    size_t max_working_set = 0;
+    pstats_t kernel_stats;
+    int ret;
+
+    for (int i = 0; i < config->num_working_sets; i++)
+        max_working_set = std::max(max_working_set, config->working_sets[i]);
+
+    ret = fgpu_memory_allocate((void **)&d_buf, max_working_set);
+    if (ret < 0) {
+        fprintf(stderr, "Can't allocate %zu bytes (See -m option)\n", max_working_set);
+        exit(-1);
+    }
+
+    ret = fgpu_memory_allocate((void **)&d_out, sizeof(uint32_t));
+    if (ret < 0)
+        exit(-1);
+
+    ret = fgpu_memory_memset_async(d_buf, 0, max_working_set);
+    if (ret < 0)
+        exit(-1);
+
+    printf("ACCESS,pattern,op,stride,working_set,bytes,avg_usec,median_usec,95p_usec,"
+            "bandwidth_gbps,ns_per_access\n");
+
+    pstats_init(&kernel_stats);
+
+    do {
+        for (int w = 0; w < config->num_working_sets; w++) {
+            size_t working_set = config->working_sets[w];
+
+            for (int o = 0; o < NUM_OPS; o++) {
+                enum op op = (enum op)o;
+
+                if (!(config->ops & (1U << op)))
+                    continue;
+
+                if (config->patterns & (1U << PATTERN_SEQ))
+                    run_access_test(PATTERN_SEQ, op, sizeof(uint32_t), working_set,
+                            num_iterations, d_buf, d_out, &kernel_stats);
+
+                if (config->patterns & (1U << PATTERN_STRIDE)) {
+                    for (int s = 0; s < config->num_strides; s++)
+                        run_access_test(PATTERN_STRIDE, op, config->strides[s],
+                                working_set, num_iterations, d_buf, d_out,
+                                &kernel_stats);
+                }
+            }
+
+            if (config->patterns & (1U << PATTERN_CHASE))
+                run_chase_test(working_set, num_iterations, d_buf, d_out,
+                        &kernel_stats);
+        }
+    } while (test_execute_just_kernel());
+
+    printf("Kernel Stats\n");
+    pstats_print(&kernel_stats, "kernel");
+
+    fgpu_memory_free(d_out);
+    fgpu_memory_free(d_buf);
+}
+
+/*
+ * Benchmark scripts append test options to the command. These can follow the
+ * suite options after another "--", move them ahead of the suite options.
+ */
+static void move_trailing_test_args(int argc, char **argv)
+{
+    int first = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") != 0)
+            continue;
+
+        if (first < 0) {
+            first = i;
+            continue;
+        }
+
+        /* Second "--" ends up last, where it stops suite options parsing */
+        std::rotate(argv + first, argv + i + 1, argv + argc);
+        return;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    suite_config_t config;
+    int num_iterations;
+
+    move_trailing_test_args(argc, argv);
+    test_initialize(argc, argv, &num_iterations);
+    parse_suite_args(argc, argv, &config);
+
+    /* Interference (-k) keeps running the tests */
+    if (num_iterations == DEFAULT_NUM_ITERATION && !test_execute_just_kernel())
+        num_iterations = SUITE_ITERATIONS;
+
+    if ((config.patterns & (1U << PATTERN_COPY)) && !test_execute_just_kernel())
+        run_copy_tests();
+
+    if (config.patterns & ~(1U << PATTERN_COPY)) {
+        set_default_working_sets(&config);
+        run_access_tests(&config, num_iterations);
+    }
 
     test_deinitialize();
 }
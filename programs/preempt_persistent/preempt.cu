@@ -0,0 +1,235 @@
+/*
+ * Measures latency of cooperative preemption of a persistent kernel.
+ * A long running GEMM is launched on the color and a helper thread requests
+ * preemption after a fixed delay. Latency is time from the request till the
+ * launch returns. Kernel is then resumed from where it stopped and result is
+ * verified.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <fractional_gpu.hpp>
+#include <fractional_gpu_cuda.cuh>
+
+#define USE_FGPU
+#include <fractional_gpu_testing.hpp>
+
+#define BLOCK_SIZE          32
+#define MATRIX_DIM          (64 * BLOCK_SIZE)
+#define PREEMPT_DELAY_USEC  2000
+
+typedef struct preempt_args {
+    int color;
+    double request_time;
+} preempt_args_t;
+
+FGPU_DEFINE_KERNEL(matrixMulCUDA, float *C, float *A, float *B, int wA, int wB)
+{
+    fgpu_dev_ctx_t *ctx;
+    dim3 _blockIdx;
+    ctx = FGPU_DEVICE_INIT();
+
+    FGPU_FOR_EACH_DEVICE_BLOCK(_blockIdx) {
+        int bx = _blockIdx.x;
+        int by = _blockIdx.y;
+        int tx = threadIdx.x;
+        int ty = threadIdx.y;
+        int aBegin = wA * BLOCK_SIZE * by;
+        int aEnd   = aBegin + wA - 1;
+        int aStep  = BLOCK_SIZE;
+        int bBegin = BLOCK_SIZE * bx;
+        int bStep  = BLOCK_SIZE * wB;
+        float Csub = 0;
+
+        for (int a = aBegin, b = bBegin; a <= aEnd; a += aStep, b += bStep) {
+            __shared__ float As[BLOCK_SIZE][BLOCK_SIZE];
+            __shared__ float Bs[BLOCK_SIZE][BLOCK_SIZE];
+
+            As[ty][tx] = FGPU_COLOR_LOAD(ctx, &A[a + wA * ty + tx]);
+            Bs[ty][tx] = FGPU_COLOR_LOAD(ctx, &B[b + wB * ty + tx]);
+            __syncthreads();
+
+#pragma unroll
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                Csub += As[ty][k] * Bs[k][tx];
+
+            __syncthreads();
+        }
+
+        int c = wB * BLOCK_SIZE * by + BLOCK_SIZE * bx;
+        FGPU_COLOR_STORE(ctx, &C[c + wB * ty + tx], Csub);
+    } FGPU_FOR_EACH_END;
+}
+
+static void *preempt_thread(void *data)
+{
+    preempt_args_t *args = (preempt_args_t *)data;
+    int ret;
+
+    usleep(PREEMPT_DELAY_USEC);
+
+    args->request_time = dtime_usec(0);
+    ret = fgpu_preempt_color(args->color);
+    if (ret < 0)
+        fprintf(stderr, "fgpu_preempt_color failed\n");
+
+    return NULL;
+}
+
+static void constantInit(float *data, int size, float val)
+{
+    for (int i = 0; i < size; ++i)
+        data[i] = val;
+}
+
+int preemptionLatency(int num_iterations)
+{
+    dim3 threads(BLOCK_SIZE, BLOCK_SIZE);
+    dim3 grid(MATRIX_DIM / BLOCK_SIZE, MATRIX_DIM / BLOCK_SIZE);
+    size_t num_elems = MATRIX_DIM * MATRIX_DIM;
+    size_t mem_size = num_elems * sizeof(float);
+    const float valB = 0.01f;
+    float *h_A, *h_B, *h_C;
+    float *d_A, *d_B, *d_C;
+    pstats_t latency_stats, resume_stats;
+    int num_preempted = 0;
+    int ret;
+
+    h_A = (float *)malloc(mem_size);
+    h_B = (float *)malloc(mem_size);
+    h_C = (float *)malloc(mem_size);
+    if (!h_A || !h_B || !h_C) {
+        fprintf(stderr, "Failed to allocate host matrices\n");
+        exit(EXIT_FAILURE);
+    }
+
+    constantInit(h_A, num_elems, 1.0f);
+    constantInit(h_B, num_elems, valB);
+
+    ret = fgpu_memory_allocate((void **) &d_A, mem_size);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_memory_allocate((void **) &d_B, mem_size);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_memory_allocate((void **) &d_C, mem_size);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_memory_copy_async(d_A, h_A, mem_size, FGPU_COPY_CPU_TO_GPU);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_memory_copy_async(d_B, h_B, mem_size, FGPU_COPY_CPU_TO_GPU);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_color_stream_synchronize();
+    if (ret < 0)
+        return ret;
+
+    pstats_init(&latency_stats);
+    pstats_init(&resume_stats);
+
+    for (int j = 0; j < num_iterations; j++) {
+        fgpu_kernel_state_t state = {0};
+        preempt_args_t args;
+        pthread_t thread;
+        double end, start;
+
+        /* Color is taken from environment (default color of test_initialize) */
+        args.color = fgpu_get_env_color();
+        args.request_time = 0;
+
+        ret = pthread_create(&thread, NULL, preempt_thread, &args);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return -ret;
+        }
+
+        ret = FGPU_LAUNCH_RESUMABLE_KERNEL(&state, matrixMulCUDA, grid, threads,
+                0, d_C, d_A, d_B, MATRIX_DIM, MATRIX_DIM);
+        end = dtime_usec(0);
+
+        pthread_join(thread, NULL);
+
+        if (ret < 0)
+            return ret;
+
+        if (ret == FGPU_KERNEL_PREEMPTED) {
+            num_preempted++;
+            pstats_add_observation(&latency_stats, end - args.request_time);
+        }
+
+        ret = fgpu_resume_color(args.color);
+        if (ret < 0)
+            return ret;
+
+        start = dtime_usec(0);
+        while (state.next_block < (int)(grid.x * grid.y)) {
+            ret = FGPU_LAUNCH_RESUMABLE_KERNEL(&state, matrixMulCUDA, grid,
+                    threads, 0, d_C, d_A, d_B, MATRIX_DIM, MATRIX_DIM);
+            if (ret < 0)
+                return ret;
+        }
+        pstats_add_observation(&resume_stats, dtime_usec(start));
+    }
+
+    printf("Preempted %d of %d launches\n", num_preempted, num_iterations);
+    printf("Preemption latency(usec):\n");
+    pstats_print(&latency_stats, "preemption_latency");
+    printf("Resume time(usec):\n");
+    pstats_print(&resume_stats, "resume");
+
+    ret = fgpu_memory_copy_async(h_C, d_C, mem_size, FGPU_COPY_GPU_TO_CPU);
+    if (ret < 0)
+        return ret;
+
+    ret = fgpu_color_stream_synchronize();
+    if (ret < 0)
+        return ret;
+
+    bool correct = true;
+    double eps = 1.e-6;
+    for (size_t i = 0; i < num_elems; i++) {
+        double abs_err = fabs(h_C[i] - (MATRIX_DIM * valB));
+        double rel_err = abs_err / fabs(h_C[i]) / MATRIX_DIM;
+        if (rel_err > eps) {
+            printf("Error! Matrix[%05zu]=%.8f, ref=%.8f\n", i, h_C[i],
+                    MATRIX_DIM * valB);
+            correct = false;
+            break;
+        }
+    }
+
+    printf("%s\n", correct ? "Result = PASS" : "Result = FAIL");
+
+    free(h_A);
+    free(h_B);
+    free(h_C);
+    fgpu_memory_free(d_A);
+    fgpu_memory_free(d_B);
+    fgpu_memory_free(d_C);
+
+    return correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+    int num_iterations;
+
+    test_initialize(argc, argv, &num_iterations);
+
+    ret = preemptionLatency(num_iterations);
+    if (ret < 0)
+        return ret;
+
+    test_deinitialize();
+
+    return 0;
+}
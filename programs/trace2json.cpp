@@ -0,0 +1,14 @@
+/* Converts trace dumped by fgpu_trace_dump() into Chrome trace JSON */
+#include <stdio.h>
+
+#include <fgpu_internal_trace.hpp>
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <trace file> <output json file>\n", argv[0]);
+        return -1;
+    }
+
+    return fgpu_trace_convert_to_json(argv[1], argv[2]);
+}
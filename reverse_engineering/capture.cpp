@@ -0,0 +1,432 @@
+/*
+ * Records the GPU measurements done while reverse engineering (DRAM pair
+ * access times, cacheline eviction searches and thresholds) into a file, and
+ * serves them back in replay mode.
+ *
+ * File format (native endianness), columnar so that it can be mmap()ed:
+ * capture_header_t                     (Version 2 added the device name.
+ *                                      Version 1 files are still replayed)
+ * uint64_t dram_addr1[num_dram]        Physical addresses of DRAM pairs
+ * uint64_t dram_addr2[num_dram]
+ * double   dram_time[num_dram]         Access time of the pair (cycles)
+ * uint64_t cache_addr1[num_cache]      Physical address to find eviction for
+ * uint64_t cache_start[num_cache]      Physical address search started from
+ * uint64_t cache_offset[num_cache]     Stride of the search
+ * uint64_t cache_result[num_cache]     Physical address found (0 if none)
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <capture.hpp>
+
+#define CAPTURE_MAGIC           "FGPUCAP"
+#define CAPTURE_VERSION         2
+
+typedef struct capture_header {
+    char magic[8];
+    uint32_t version;
+    char device_name[CAPTURE_DEVICE_NAME_LEN];
+    int32_t min_bit;
+    int32_t max_bit;
+    int32_t dram_sample_size;           /* Pairs used for DRAM threshold detection */
+    uint64_t phy_start;
+    uint64_t allocated;
+    uint64_t allocation_overhead;
+    double dram_threshold;              /* Thresholds found while capturing */
+    double cache_avg;
+    double cache_threshold;
+    uint64_t num_dram;
+    uint64_t num_cache;
+} capture_header_t;
+
+/* Version 1 header. Still replayed (device name is left empty). */
+typedef struct capture_header_v1 {
+    char magic[8];
+    uint32_t version;
+    int32_t min_bit;
+    int32_t max_bit;
+    int32_t dram_sample_size;
+    uint64_t phy_start;
+    uint64_t allocated;
+    uint64_t allocation_overhead;
+    double dram_threshold;
+    double cache_avg;
+    double cache_threshold;
+    uint64_t num_dram;
+    uint64_t num_cache;
+} capture_header_v1_t;
+
+typedef std::pair<uint64_t, uint64_t> dram_key_t;
+
+/* All measurements of a pair, in the order they were done */
+typedef struct dram_times {
+    std::vector<double> times;
+    size_t next;
+} dram_times_t;
+
+typedef struct cache_key {
+    uint64_t addr1;
+    uint64_t start;
+    uint64_t offset;
+
+    bool operator<(const struct cache_key &o) const
+    {
+        if (addr1 != o.addr1)
+            return addr1 < o.addr1;
+        if (start != o.start)
+            return start < o.start;
+        return offset < o.offset;
+    }
+} cache_key_t;
+
+static struct {
+    bool enabled;
+    bool replaying;
+    char *file;
+    capture_header_t header;
+
+    /* Recorded in order (when capturing) */
+    std::vector<uint64_t> dram_addr1, dram_addr2;
+    std::vector<double> dram_time;
+    std::vector<uint64_t> cache_addr1, cache_start, cache_offset, cache_result;
+
+    /* Lookup (when replaying) */
+    std::map<dram_key_t, dram_times_t> dram_map;
+    std::map<cache_key_t, uint64_t> cache_map;
+} g_capture;
+
+/* Opens a capture file for recording. Data is written by capture_save() */
+int capture_open(const char *file, const capture_info_t *info)
+{
+    capture_header_t *h = &g_capture.header;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof(h->magic));
+    h->version = CAPTURE_VERSION;
+    memcpy(h->device_name, info->device_name, sizeof(h->device_name));
+    h->device_name[sizeof(h->device_name) - 1] = '\0';
+    h->min_bit = info->min_bit;
+    h->max_bit = info->max_bit;
+    h->phy_start = info->phy_start;
+    h->allocated = info->allocated;
+    h->allocation_overhead = info->allocation_overhead;
+    h->dram_threshold = NAN;
+    h->cache_avg = NAN;
+    h->cache_threshold = NAN;
+
+    g_capture.file = strdup(file);
+    if (!g_capture.file)
+        return -1;
+
+    g_capture.enabled = true;
+    g_capture.replaying = false;
+
+    /* Check early that file can be written */
+    return capture_save();
+}
+
+static int write_column(FILE *fp, const void *data, size_t size, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    return fwrite(data, size, count, fp) == count ? 0 : -1;
+}
+
+static int read_column(FILE *fp, void *data, size_t size, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    return fread(data, size, count, fp) == count ? 0 : -1;
+}
+
+/* Writes all measurements recorded so far. Returns < 0 on error. */
+int capture_save(void)
+{
+    capture_header_t *h = &g_capture.header;
+    FILE *fp;
+    int ret = 0;
+
+    if (!g_capture.enabled || g_capture.replaying)
+        return 0;
+
+    fp = fopen(g_capture.file, "wb");
+    if (!fp) {
+        fprintf(stderr, "Couldn't open capture file %s\n", g_capture.file);
+        return -1;
+    }
+
+    h->num_dram = g_capture.dram_time.size();
+    h->num_cache = g_capture.cache_result.size();
+
+    ret |= write_column(fp, h, sizeof(*h), 1);
+    ret |= write_column(fp, g_capture.dram_addr1.data(), sizeof(uint64_t), h->num_dram);
+    ret |= write_column(fp, g_capture.dram_addr2.data(), sizeof(uint64_t), h->num_dram);
+    ret |= write_column(fp, g_capture.dram_time.data(), sizeof(double), h->num_dram);
+    ret |= write_column(fp, g_capture.cache_addr1.data(), sizeof(uint64_t), h->num_cache);
+    ret |= write_column(fp, g_capture.cache_start.data(), sizeof(uint64_t), h->num_cache);
+    ret |= write_column(fp, g_capture.cache_offset.data(), sizeof(uint64_t), h->num_cache);
+    ret |= write_column(fp, g_capture.cache_result.data(), sizeof(uint64_t), h->num_cache);
+
+    if (fclose(fp) != 0 || ret < 0) {
+        fprintf(stderr, "Couldn't write capture file %s\n", g_capture.file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Reads rest of the header (after magic and version). Returns < 0 on error. */
+static int read_header(FILE *fp, capture_header_t *h)
+{
+    size_t start = offsetof(capture_header_t, device_name);
+    capture_header_v1_t v1;
+
+    if (h->version == CAPTURE_VERSION)
+        return read_column(fp, (char *)h + start, sizeof(*h) - start, 1);
+
+    start = offsetof(capture_header_v1_t, min_bit);
+    if (read_column(fp, (char *)&v1 + start, sizeof(v1) - start, 1) < 0)
+        return -1;
+
+    h->device_name[0] = '\0';
+    h->min_bit = v1.min_bit;
+    h->max_bit = v1.max_bit;
+    h->dram_sample_size = v1.dram_sample_size;
+    h->phy_start = v1.phy_start;
+    h->allocated = v1.allocated;
+    h->allocation_overhead = v1.allocation_overhead;
+    h->dram_threshold = v1.dram_threshold;
+    h->cache_avg = v1.cache_avg;
+    h->cache_threshold = v1.cache_threshold;
+    h->num_dram = v1.num_dram;
+    h->num_cache = v1.num_cache;
+
+    return 0;
+}
+
+/* Loads a capture file for replaying. Returns < 0 on error. */
+int capture_replay_open(const char *file, capture_info_t *info)
+{
+    capture_header_t *h = &g_capture.header;
+    std::vector<uint64_t> addr1, addr2, start, offset, result;
+    std::vector<double> time;
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(file, "rb");
+    if (!fp) {
+        fprintf(stderr, "Couldn't open capture file %s\n", file);
+        return -1;
+    }
+
+    if (read_column(fp, h, offsetof(capture_header_t, device_name), 1) < 0 ||
+            memcmp(h->magic, CAPTURE_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "Invalid capture file %s\n", file);
+        fclose(fp);
+        return -1;
+    }
+
+    if (h->version != CAPTURE_VERSION && h->version != 1) {
+        fprintf(stderr, "Unsupported capture file version %u (Expected upto %u)\n",
+                h->version, CAPTURE_VERSION);
+        fclose(fp);
+        return -1;
+    }
+
+    if (read_header(fp, h) < 0) {
+        fprintf(stderr, "Invalid capture file %s\n", file);
+        fclose(fp);
+        return -1;
+    }
+
+    try {
+        addr1.resize(h->num_dram);
+        addr2.resize(h->num_dram);
+        time.resize(h->num_dram);
+    } catch(...) {
+        fprintf(stderr, "Invalid capture file %s\n", file);
+        fclose(fp);
+        return -1;
+    }
+
+    ret |= read_column(fp, addr1.data(), sizeof(uint64_t), h->num_dram);
+    ret |= read_column(fp, addr2.data(), sizeof(uint64_t), h->num_dram);
+    ret |= read_column(fp, time.data(), sizeof(double), h->num_dram);
+
+    for (size_t i = 0; ret == 0 && i < h->num_dram; i++)
+        g_capture.dram_map[dram_key_t(addr1[i], addr2[i])].times.push_back(time[i]);
+
+    try {
+        addr1.resize(h->num_cache);
+        start.resize(h->num_cache);
+        offset.resize(h->num_cache);
+        result.resize(h->num_cache);
+    } catch(...) {
+        fprintf(stderr, "Invalid capture file %s\n", file);
+        fclose(fp);
+        return -1;
+    }
+
+    ret |= read_column(fp, addr1.data(), sizeof(uint64_t), h->num_cache);
+    ret |= read_column(fp, start.data(), sizeof(uint64_t), h->num_cache);
+    ret |= read_column(fp, offset.data(), sizeof(uint64_t), h->num_cache);
+    ret |= read_column(fp, result.data(), sizeof(uint64_t), h->num_cache);
+
+    for (size_t i = 0; ret == 0 && i < h->num_cache; i++) {
+        cache_key_t key = {addr1[i], start[i], offset[i]};
+        g_capture.cache_map[key] = result[i];
+    }
+
+    fclose(fp);
+
+    if (ret < 0) {
+        fprintf(stderr, "Truncated capture file %s\n", file);
+        return -1;
+    }
+
+    h->device_name[sizeof(h->device_name) - 1] = '\0';
+    memcpy(info->device_name, h->device_name, sizeof(info->device_name));
+    info->min_bit = h->min_bit;
+    info->max_bit = h->max_bit;
+    info->phy_start = h->phy_start;
+    info->allocated = h->allocated;
+    info->allocation_overhead = h->allocation_overhead;
+
+    printf("Replaying %" PRIu64 " DRAM and %" PRIu64 " cache measurements of \"%s\" from %s\n",
+            h->num_dram, h->num_cache, h->device_name, file);
+    printf("Captured thresholds: DRAM:%f, Cache:%f\n", h->dram_threshold,
+            h->cache_threshold);
+
+    g_capture.enabled = true;
+    g_capture.replaying = true;
+
+    return 0;
+}
+
+bool capture_is_enabled(void)
+{
+    return g_capture.enabled;
+}
+
+bool capture_is_replaying(void)
+{
+    return g_capture.replaying;
+}
+
+void capture_close(void)
+{
+    capture_save();
+
+    free(g_capture.file);
+    g_capture.file = NULL;
+    g_capture.enabled = false;
+    g_capture.replaying = false;
+    g_capture.dram_map.clear();
+    g_capture.cache_map.clear();
+}
+
+void capture_add_dram_read_time(uintptr_t phy_addr1, uintptr_t phy_addr2, double time)
+{
+    if (!g_capture.enabled || g_capture.replaying)
+        return;
+
+    g_capture.dram_addr1.push_back(phy_addr1);
+    g_capture.dram_addr2.push_back(phy_addr2);
+    g_capture.dram_time.push_back(time);
+}
+
+/* 
+ * Repeated measurements of a pair are returned in the order they were
+ * captured (the last one once they run out).
+ * Returns < 0 if pair was never measured while capturing.
+ */
+int capture_get_dram_read_time(uintptr_t phy_addr1, uintptr_t phy_addr2, double *time)
+{
+    std::map<dram_key_t, dram_times_t>::iterator it;
+    dram_times_t *t;
+
+    it = g_capture.dram_map.find(dram_key_t(phy_addr1, phy_addr2));
+    if (it == g_capture.dram_map.end())
+        return -1;
+
+    t = &it->second;
+    *time = t->times[std::min(t->next, t->times.size() - 1)];
+    t->next++;
+
+    return 0;
+}
+
+void capture_set_dram_threshold(int sample_size, double threshold)
+{
+    if (!g_capture.enabled || g_capture.replaying)
+        return;
+
+    g_capture.header.dram_sample_size = sample_size;
+    g_capture.header.dram_threshold = threshold;
+}
+
+/* Returns < 0 if DRAM threshold was not captured */
+int capture_get_dram_sample_size(void)
+{
+    if (g_capture.header.dram_sample_size <= 0)
+        return -1;
+
+    return g_capture.header.dram_sample_size;
+}
+
+void capture_set_cache_threshold(double avg, double threshold)
+{
+    if (!g_capture.enabled || g_capture.replaying)
+        return;
+
+    g_capture.header.cache_avg = avg;
+    g_capture.header.cache_threshold = threshold;
+}
+
+/* Returns < 0 if cache threshold was not captured */
+int capture_get_cache_threshold(double *avg)
+{
+    if (isnan(g_capture.header.cache_avg))
+        return -1;
+
+    *avg = g_capture.header.cache_avg;
+    return 0;
+}
+
+void capture_add_cache_eviction_addr(uintptr_t phy_addr1, uintptr_t phy_start_addr,
+        size_t offset, uintptr_t phy_addr2)
+{
+    if (!g_capture.enabled || g_capture.replaying)
+        return;
+
+    g_capture.cache_addr1.push_back(phy_addr1);
+    g_capture.cache_start.push_back(phy_start_addr);
+    g_capture.cache_offset.push_back(offset);
+    g_capture.cache_result.push_back(phy_addr2);
+}
+
+/* Returns < 0 if search was never done while capturing */
+int capture_get_cache_eviction_addr(uintptr_t phy_addr1, uintptr_t phy_start_addr,
+        size_t offset, uintptr_t *phy_addr2)
+{
+    std::map<cache_key_t, uint64_t>::iterator it;
+    cache_key_t key = {phy_addr1, phy_start_addr, offset};
+
+    it = g_capture.cache_map.find(key);
+    if (it == g_capture.cache_map.end())
+        return -1;
+
+    *phy_addr2 = it->second;
+    return 0;
+}
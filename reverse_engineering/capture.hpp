@@ -0,0 +1,42 @@
+#ifndef __CAPTURE_HPP__
+#define __CAPTURE_HPP__
+
+/*
+ * Capture of the measurements done on the GPU, so that threshold detection and
+ * solvers can later be rerun offline (replay) without the GPU.
+ */
+
+/* Same as cudaDeviceProp */
+#define CAPTURE_DEVICE_NAME_LEN     256
+
+/* Details of the device and physically contiguous memory the measurements were done on */
+typedef struct capture_info {
+    char device_name[CAPTURE_DEVICE_NAME_LEN];
+    int min_bit;
+    int max_bit;
+    uintptr_t phy_start;
+    size_t allocated;
+    size_t allocation_overhead;
+} capture_info_t;
+
+int capture_open(const char *file, const capture_info_t *info);
+int capture_replay_open(const char *file, capture_info_t *info);
+bool capture_is_enabled(void);
+bool capture_is_replaying(void);
+int capture_save(void);
+void capture_close(void);
+
+void capture_add_dram_read_time(uintptr_t phy_addr1, uintptr_t phy_addr2, double time);
+int capture_get_dram_read_time(uintptr_t phy_addr1, uintptr_t phy_addr2, double *time);
+
+void capture_set_dram_threshold(int sample_size, double threshold);
+int capture_get_dram_sample_size(void);
+void capture_set_cache_threshold(double avg, double threshold);
+int capture_get_cache_threshold(double *avg);
+
+void capture_add_cache_eviction_addr(uintptr_t phy_addr1, uintptr_t phy_start_addr,
+        size_t offset, uintptr_t phy_addr2);
+int capture_get_cache_eviction_addr(uintptr_t phy_addr1, uintptr_t phy_start_addr,
+        size_t offset, uintptr_t *phy_addr2);
+
+#endif /* __CAPTURE_HPP__ */
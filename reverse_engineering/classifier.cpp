@@ -0,0 +1,133 @@
+/*
+ * Adaptive latency classifier. Instead of a fixed cutoff above the average
+ * latency, samples (after dropping noise spikes) are split into two clusters
+ * with 2-means, which in 1D can be solved exactly by trying every split of
+ * the sorted samples. The threshold is placed between the clusters where the
+ * distance to both is same in terms of their standard deviations.
+ * A latency close to the threshold (compared to the spread of its cluster) is
+ * ambiguous and is worth measuring again.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <reverse_engineering.hpp>
+#include <classifier.hpp>
+
+static double get_sd(double sum, double sum_sq, size_t n)
+{
+    double var;
+
+    if (n == 0)
+        return 0;
+
+    var = sum_sq / n - (sum / n) * (sum / n);
+
+    return sqrt(var > 0 ? var : 0);
+}
+
+/*
+ * Fits the classifier to the samples. Samples above 'outlier_cutoff' are
+ * ignored as noise.
+ * Returns < 0 if samples don't have two clear clusters.
+ */
+int classifier_fit(classifier_t *c, const std::vector<double> &samples,
+        double outlier_cutoff)
+{
+    std::vector<double> sorted;
+    std::vector<double> prefix, prefix_sq;
+    double best_cost = INFINITY;
+    size_t best_split = 0;
+    size_t n;
+    double sd;
+
+    c->is_bimodal = false;
+
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (samples[i] <= outlier_cutoff)
+            sorted.push_back(samples[i]);
+    }
+
+    c->num_outliers = samples.size() - sorted.size();
+
+    n = sorted.size();
+    if (n < 2)
+        return -1;
+
+    std::sort(sorted.begin(), sorted.end());
+
+    prefix.push_back(0);
+    prefix_sq.push_back(0);
+    for (size_t i = 0; i < n; i++) {
+        prefix.push_back(prefix[i] + sorted[i]);
+        prefix_sq.push_back(prefix_sq[i] + sorted[i] * sorted[i]);
+    }
+
+    /* Fast cluster is sorted[0, split), slow is sorted[split, n) */
+    for (size_t split = 1; split < n; split++) {
+        double fast_sum = prefix[split];
+        double slow_sum = prefix[n] - prefix[split];
+        double cost = prefix_sq[n] - fast_sum * fast_sum / split -
+            slow_sum * slow_sum / (n - split);
+
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_split = split;
+        }
+    }
+
+    c->fast_count = best_split;
+    c->slow_count = n - best_split;
+    c->fast_mean = prefix[best_split] / c->fast_count;
+    c->slow_mean = (prefix[n] - prefix[best_split]) / c->slow_count;
+    c->fast_sd = std::max(get_sd(prefix[best_split], prefix_sq[best_split],
+                c->fast_count), CLASSIFIER_MIN_SD);
+    c->slow_sd = std::max(get_sd(prefix[n] - prefix[best_split],
+                prefix_sq[n] - prefix_sq[best_split], c->slow_count), CLASSIFIER_MIN_SD);
+
+    c->threshold = c->fast_mean + (c->slow_mean - c->fast_mean) *
+        c->fast_sd / (c->fast_sd + c->slow_sd);
+
+    /* A single cluster also gets split. Check the split is meaningful. */
+    sd = std::max(c->fast_sd, c->slow_sd);
+    if (c->slow_count < CLASSIFIER_MIN_CLUSTER_SIZE ||
+            c->slow_mean - c->fast_mean < CLASSIFIER_MIN_SEPARATION_SD * sd)
+        return -1;
+
+    c->is_bimodal = true;
+
+    return 0;
+}
+
+bool classifier_is_slow(const classifier_t *c, double latency)
+{
+    return latency >= c->threshold;
+}
+
+/*
+ * Confidence (0 - 1) in the class of a latency, based on how far it is from
+ * the threshold in terms of the standard deviation of its class.
+ */
+double classifier_confidence(const classifier_t *c, double latency)
+{
+    double sd = classifier_is_slow(c, latency) ? c->slow_sd : c->fast_sd;
+    double confidence = fabs(latency - c->threshold) / (CLASSIFIER_CONFIDENCE_SD * sd);
+
+    return std::min(confidence, 1.0);
+}
+
+bool classifier_is_ambiguous(const classifier_t *c, double latency)
+{
+    return c->is_bimodal && classifier_confidence(c, latency) < 1.0;
+}
+
+void classifier_print(const classifier_t *c)
+{
+    printf("Fast: %f (SD: %f, Samples: %zu), Slow: %f (SD: %f, Samples: %zu), "
+            "Outliers: %zu, Threshold: %f\n", c->fast_mean, c->fast_sd,
+            c->fast_count, c->slow_mean, c->slow_sd, c->slow_count,
+            c->num_outliers, c->threshold);
+}
@@ -0,0 +1,27 @@
+#ifndef __CLASSIFIER_HPP__
+#define __CLASSIFIER_HPP__
+
+/*
+ * Classifies measured latencies into fast and slow (e.g. DRAM row buffer
+ * conflict) classes by fitting two clusters to samples.
+ */
+typedef struct classifier {
+    bool is_bimodal;            /* Are there two clear clusters? */
+    double fast_mean;
+    double fast_sd;
+    size_t fast_count;
+    double slow_mean;
+    double slow_sd;
+    size_t slow_count;
+    double threshold;           /* Latencies >= threshold are slow */
+    size_t num_outliers;        /* Samples ignored as noise */
+} classifier_t;
+
+int classifier_fit(classifier_t *c, const std::vector<double> &samples,
+        double outlier_cutoff);
+bool classifier_is_slow(const classifier_t *c, double latency);
+double classifier_confidence(const classifier_t *c, double latency);
+bool classifier_is_ambiguous(const classifier_t *c, double latency);
+void classifier_print(const classifier_t *c);
+
+#endif /* __CLASSIFIER_HPP__ */
@@ -954,3 +954,24 @@ int device_run_interference_exp(void *gpu_start_addr, void *(*cb)(void *addr, vo
 
     return 0;
 }
+
+int device_get_name(char *name, size_t len)
+{
+    cudaDeviceProp deviceProp;
+
+    gpuErrAssert(cudaGetDeviceProperties(&deviceProp, FGPU_DEVICE_NUMBER));
+    snprintf(name, len, "%s", deviceProp.name);
+
+    return 0;
+}
+
+/* Hash functions of a real GPU are not known beforehand */
+int device_get_dram_hash_masks(std::vector<uint64_t> &masks)
+{
+    return -1;
+}
+
+int device_get_cache_hash_masks(std::vector<uint64_t> &masks)
+{
+    return -1;
+}
@@ -6,7 +6,7 @@
  * 1) Generate a pair of addresses to test.
  * 2) Test if pair of address lie on same partition.
  * 3) Collect many such pair of addresses.
- * 4) Using brute force, find all hash functions which fit.
+ * 4) Find all hash functions which fit (null space of key differences over GF(2)).
  * 5) Repeat till all addresses bits are accounted for.
  *
  * XXX: Currently we only support XOR based hash functions (XORing of physical
@@ -19,6 +19,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#if defined(__AVX2__) || defined(__AVX512VPOPCNTDQ__)
+#include <immintrin.h>
+#endif
 
 #include <vector>
 #include <algorithm>
@@ -28,6 +34,18 @@
 /* Maximum physical address bits currently is 64 */
 #define MAX_NUM_INDEX        64
 
+/* Hypotheses checked together in one pass over the keys */
+#define HASH_BATCH_SIZE      256
+
+/* Maximum threads used for brute force search */
+#define HASH_MAX_THREADS     64
+
+/* Brute force search is skipped in benchmark above these many bits */
+#define HASH_BENCHMARK_MAX_BRUTE_FORCE_BITS     24
+
+/* Brute force cross check of the solver is skipped above these many bits */
+#define HASH_CHECK_MAX_BRUTE_FORCE_BITS         16
+
 typedef struct solution {
 
     int indexes[MAX_NUM_INDEX];
@@ -42,8 +60,10 @@ typedef struct hash_context {
     uintptr_t start_addr;               /* Range of permissible addresses */
     uintptr_t end_addr;
 
-    std::vector< std::pair <uintptr_t, uintptr_t> > keys;       /* Keys with same hash */
+    /* XOR of pairs of addresses with same hash */
+    std::vector<uint64_t> keys;
     std::vector<solution_t> solutions;  /* Valid solutions */
+    size_t num_checked_keys;            /* Keys solutions have been checked against */
 
 } hash_context_t;
 
@@ -51,14 +71,19 @@ static void hash_reduce(hash_context_t *ctx);
 
 static void print_solution(const solution_t &s)
 {
+    uint64_t mask = 0;
     int i;
 
     for (i = 0; i < s.depth - 1; i++) {
         printf("Bit(%d) ^ ", s.indexes[i]);
+        mask |= 1ULL << s.indexes[i];
     }
     
-    if (s.depth > 0)
-        printf("Bit(%d)\n", s.indexes[s.depth - 1]);
+    /* Mask is in the format of uvm_color_xor_masks module parameter */
+    if (s.depth > 0) {
+        mask |= 1ULL << s.indexes[s.depth - 1];
+        printf("Bit(%d) (Mask: 0x%" PRIx64 ")\n", s.indexes[s.depth - 1], mask);
+    }
 }
 
 
@@ -96,52 +121,6 @@ static int insert_bit_in_solutions(solution_t &s, int bit)
 
     return 0;
 }
-/* 
- * Create arbitary hash function. Should keep calling this function till
- * it returns negative. In that case, size should be incremented
- */
-static int permute_hypothesis(int *array, int size, int min_val, int max_val, int isfirst)
-{
-    int i, start_index;
-
-    assert(size >= 1);
-
-    if (isfirst) {
-        for (i = 0; i < size; i++) {
-            array[i] = min_val + i;
-        }
-
-        assert(array[size - 1] <= max_val);
-        return 0;
-    }
-
-
-    if (array[size - 1] < max_val) {
-        array[size - 1]++;
-        return 0;
-    }
-
-    for (start_index = size - 2; start_index >= 0; start_index--) {
-        int valid = 1;
-        array[start_index]++;
-        for (int i = start_index + 1; i < size; i++) {
-            array[i] = array[i - 1] + 1;
-            if (array[i] > max_val) {
-                valid = 0;
-                break;
-            }
-        }
-
-        if (valid)
-            break;
-    }
-
-    if (start_index < 0)
-        return -1;
-    
-   return 0;
-}
-
 /* Combine two solutions */
 static void xor_solutions(solution_t &s1, solution_t &s2, solution_t &r)
 {
@@ -255,84 +234,341 @@ static int find_min_bit(std::vector<solution_t> &solutions)
     return ret;
 }
 
-/* Checks if a solution is valid for all the keys */
-static bool is_solution_correct(std::vector< std::pair <uintptr_t, uintptr_t> > &keys, const solution_t &s)
+/* Returns bitmask of address bits in a solution */
+static uint64_t solution_to_mask(const solution_t &s)
 {
-    size_t i;
-    
-    assert(s.depth >= 1);
+    uint64_t mask = 0;
+
+    for (int i = 0; i < s.depth; i++)
+        mask |= 1ULL << s.indexes[i];
 
-    for (i = 0; i < keys.size(); i++) {
+    return mask;
+}
 
-        bool partition1 = get_partition_num(keys[i].first, s);
-        bool partition2 = get_partition_num(keys[i].second, s);
+static void mask_to_solution(uint64_t mask, solution_t &s)
+{
+    s.depth = 0;
+    for (int i = 0; i < MAX_NUM_INDEX; i++) {
+        if (mask & (1ULL << i))
+            s.indexes[s.depth++] = i;
+    }
+}
 
-        if (partition1 != partition2)
+/* 
+ * Checks if a hypothesis (as mask of address bits) is valid for keys starting
+ * from 'first'. Both addresses of a key lie in the same partition if even
+ * number of hypothesis bits differ between them.
+ */
+static bool is_mask_correct(const std::vector<uint64_t> &keys, size_t first, uint64_t mask)
+{
+    for (size_t i = first; i < keys.size(); i++) {
+        if (__builtin_popcountll(keys[i] & mask) & 0x1)
             return false;
     }
 
     return true;
 }
 
+/* Checks if a solution is valid for all the keys */
+static bool is_solution_correct(const std::vector<uint64_t> &keys, const solution_t &s)
+{
+    assert(s.depth >= 1);
+
+    return is_mask_correct(keys, 0, solution_to_mask(s));
+}
+
 /* 
- * Find all the hash functions with which all the keys fit (i.e. lie on same
- * partition).
- * Return the number of solutions found.
+ * Checks a batch of hypotheses against keys starting from 'first'.
+ * Vector instructions (when compiled for them) check multiple hypotheses per key.
  */
-static int find_new_solutions(std::vector< std::pair <uintptr_t, uintptr_t> > &keys, int min_bit, int max_bit, 
-        std::vector<solution_t> &solutions)
+static void check_masks(const std::vector<uint64_t> &keys, size_t first,
+        const uint64_t *masks, int num_masks, bool *correct)
 {
-    int depth;
+    int i = 0;
+
+#if defined(__AVX512VPOPCNTDQ__)
+    for (; i + 8 <= num_masks; i += 8) {
+        __m512i m = _mm512_loadu_si512((const void *)&masks[i]);
+        __m512i bad = _mm512_setzero_si512();
+        uint64_t b[8];
+
+        for (size_t k = first; k < keys.size(); k++) {
+            __m512i x = _mm512_and_si512(m, _mm512_set1_epi64(keys[k]));
+            bad = _mm512_or_si512(bad, _mm512_popcnt_epi64(x));
+        }
+
+        _mm512_storeu_si512((void *)b, bad);
+        for (int j = 0; j < 8; j++)
+            correct[i + j] = !(b[j] & 0x1);
+    }
+#elif defined(__AVX2__)
+    /* No 64-bit popcount in AVX2. Parity is found by folding the bits. */
+    for (; i + 4 <= num_masks; i += 4) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)&masks[i]);
+        __m256i bad = _mm256_setzero_si256();
+        uint64_t b[4];
+
+        for (size_t k = first; k < keys.size(); k++) {
+            __m256i x = _mm256_and_si256(m, _mm256_set1_epi64x(keys[k]));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 16));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 8));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 4));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 2));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 1));
+            bad = _mm256_or_si256(bad, x);
+        }
+
+        _mm256_storeu_si256((__m256i *)b, bad);
+        for (int j = 0; j < 4; j++)
+            correct[i + j] = !(b[j] & 0x1);
+    }
+#endif
+
+    for (; i < num_masks; i++)
+        correct[i] = is_mask_correct(keys, first, masks[i]);
+}
+
+typedef struct brute_force_arg {
+    const std::vector<uint64_t> *keys;
+    int min_bit;
+    uint64_t start;                     /* Range of hypotheses to check */
+    uint64_t end;
+    std::vector<uint64_t> found;        /* Correct hypotheses */
+} brute_force_arg_t;
+
+static void *brute_force_thread(void *arg)
+{
+    brute_force_arg_t *data = (brute_force_arg_t *)arg;
+    uint64_t masks[HASH_BATCH_SIZE];
+    bool correct[HASH_BATCH_SIZE];
+    uint64_t h = data->start;
+
+    while (h < data->end) {
+        int n = 0;
+
+        while (n < HASH_BATCH_SIZE && h < data->end)
+            masks[n++] = (h++) << data->min_bit;
+
+        check_masks(*data->keys, 0, masks, n, correct);
+
+        for (int i = 0; i < n; i++) {
+            if (correct[i])
+                data->found.push_back(masks[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/* Orders solutions as they are generated by increasing depth */
+static bool solution_sort_depth_cb(const solution_t &a, const solution_t &b)
+{
+    if (a.depth != b.depth)
+        return a.depth < b.depth;
+
+    return std::lexicographical_compare(a.indexes, a.indexes + a.depth,
+            b.indexes, b.indexes + b.depth);
+}
+
+/* 
+ * Brute force version of find_new_solutions(). Tries every combination of
+ * bits, so exponential in number of bits. Hypotheses are split among threads.
+ */
+static int find_new_solutions_brute_force(const std::vector<uint64_t> &keys,
+        int min_bit, int max_bit, std::vector<solution_t> &solutions,
+        int num_threads)
+{
+    brute_force_arg_t args[HASH_MAX_THREADS];
+    pthread_t threads[HASH_MAX_THREADS];
+    bool started[HASH_MAX_THREADS];
+    int num_bits = max_bit - min_bit + 1;
+    uint64_t num_hypotheses;
     int solutions_found = 0;
-    bool ret;
+    int i;
 
     assert(solutions.size() == 0);
+    assert(num_bits < 64);
 
-    for (depth = 1; depth <= max_bit - min_bit + 1; depth++) {
-    
-        int isFirst = 1;
+    num_threads = std::max(1, std::min(num_threads, HASH_MAX_THREADS));
 
-        while (1) {
+    /* Every non-zero combination of bits is a hypothesis */
+    num_hypotheses = (1ULL << num_bits) - 1;
+
+    for (i = 0; i < num_threads; i++) {
+        args[i].keys = &keys;
+        args[i].min_bit = min_bit;
+        args[i].start = 1 + (num_hypotheses * i) / num_threads;
+        args[i].end = 1 + (num_hypotheses * (i + 1)) / num_threads;
+
+        started[i] = pthread_create(&threads[i], NULL, brute_force_thread, &args[i]) == 0;
+
+        /* Do it ourselves */
+        if (!started[i])
+            brute_force_thread(&args[i]);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+        for (size_t j = 0; j < args[i].found.size(); j++) {
             solution_t s;
-            s.depth = depth;
+            mask_to_solution(args[i].found[j], s);
+            solutions.push_back(s);
+            solutions_found++;
+        }
+    }
+
+    std::sort(solutions.begin(), solutions.end(), solution_sort_depth_cb);
+
+    return solutions_found;
+}
+
+/* Number of threads to use for brute force search */
+static int get_num_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+/*
+ * A hash function fits a pair of keys if parity(mask & (key1 ^ key2)) is 0.
+ * So the fitting masks are the null space (over GF(2)) of the matrix whose rows
+ * are the key differences. Rows are reduced with Gaussian elimination and each
+ * free bit gives one basis vector of the null space.
+ * Returns the number of basis solutions found (every XOR of them also fits).
+ */
+static int find_new_solutions_gf2(const std::vector<uint64_t> &keys,
+        int min_bit, int max_bit, std::vector<solution_t> &solutions)
+{
+    uint64_t range = (max_bit == 63 ? ~0ULL : ((1ULL << (max_bit + 1)) - 1)) &
+        ~((1ULL << min_bit) - 1);
+    uint64_t rows[MAX_NUM_INDEX] = {0};     /* rows[i] has highest bit i */
+    int solutions_found = 0;
+    int i, j;
 
-            if (permute_hypothesis(s.indexes, s.depth, min_bit, max_bit, isFirst) < 0)
+    /* Row echelon form */
+    for (size_t k = 0; k < keys.size(); k++) {
+        uint64_t diff = keys[k] & range;
+
+        for (i = max_bit; i >= min_bit && diff; i--) {
+            if (!(diff & (1ULL << i)))
+                continue;
+
+            if (!rows[i]) {
+                rows[i] = diff;
                 break;
-            
-            ret = is_solution_correct(keys, s);
-            if (ret) {
-                solutions.push_back(s);
-                solutions_found++;
             }
-            
-            isFirst = 0;
+
+            diff ^= rows[i];
+        }
+    }
+
+    /* Reduced row echelon form: Pivot bit i only present in rows[i] */
+    for (i = min_bit; i <= max_bit; i++) {
+        if (!rows[i])
+            continue;
+
+        for (j = i + 1; j <= max_bit; j++) {
+            if (rows[j] & (1ULL << i))
+                rows[j] ^= rows[i];
+        }
+    }
+
+    /* Free bit f and the pivots of rows containing f fit all the rows */
+    for (i = min_bit; i <= max_bit; i++) {
+        uint64_t mask;
+        solution_t s;
+
+        if (rows[i])
+            continue;
+
+        mask = 1ULL << i;
+        for (j = min_bit; j <= max_bit; j++) {
+            if (rows[j] & (1ULL << i))
+                mask |= 1ULL << j;
         }
+
+        mask_to_solution(mask, s);
+        assert(is_solution_correct(keys, s));
+        solutions.push_back(s);
+        solutions_found++;
     }
 
     return solutions_found;
 }
 
+/* Checks that brute force finds exactly the span of GF(2) solver's solutions */
+static bool check_solutions(const std::vector<uint64_t> &keys,
+        int min_bit, int max_bit, std::vector<solution_t> &solutions)
+{
+    std::vector<solution_t> brute_solutions;
+    uint64_t free_bits = 0;
+    std::vector<uint64_t> basis;
+
+    find_new_solutions_brute_force(keys, min_bit, max_bit, brute_solutions,
+            get_num_threads());
+
+    /* Each basis vector has a free bit no other basis vector has */
+    for (size_t i = 0; i < solutions.size(); i++) {
+        basis.push_back(solution_to_mask(solutions[i]));
+        free_bits |= 1ULL << solutions[i].indexes[0];
+    }
+
+    for (size_t i = 0; i < brute_solutions.size(); i++) {
+        uint64_t mask = solution_to_mask(brute_solutions[i]);
+        uint64_t span = 0;
+
+        for (size_t j = 0; j < basis.size(); j++) {
+            if (mask & free_bits & basis[j])
+                span ^= basis[j];
+        }
+
+        if (span != mask) {
+            fprintf(stderr, "Solver mismatch: 0x%" PRIx64 " not in span\n", mask);
+            return false;
+        }
+    }
+
+    if (brute_solutions.size() != (1ULL << solutions.size()) - 1) {
+        fprintf(stderr, "Solver mismatch: Brute force:%zu, GF(2):%zu\n",
+                brute_solutions.size(), solutions.size());
+        return false;
+    }
+
+    return true;
+}
+
 /* 
- * Checks if all keys fit with all the solutions.
- * Returns the number of solutions removed.
+ * Find all the hash functions with which all the keys fit (i.e. lie on same
+ * partition).
+ * Return the number of solutions found.
  */
-static int remove_incorrect_solutions(hash_context_t *ctx)
+static int find_new_solutions(const std::vector<uint64_t> &keys, int min_bit, int max_bit, 
+        std::vector<solution_t> &solutions)
 {
-	int i;
-    int solutions_removed = 0;
-    std::vector<solution_t>::iterator s;
+    assert(solutions.size() == 0);
 
-    for (s = ctx->solutions.begin(); s != ctx->solutions.end();) {
+    return find_new_solutions_gf2(keys, min_bit, max_bit, solutions);
+}
 
-        if (!is_solution_correct(ctx->keys, *s)) {
-            solutions_removed++;
-            s = ctx->solutions.erase(s);
-        } else {
-            ++s;
-        }
+/* 
+ * Checks if keys added since the last check fit with all the solutions. If
+ * they do, the solutions still span the null space of all the keys.
+ */
+static bool are_solutions_correct(hash_context_t *ctx)
+{
+    for (size_t i = 0; i < ctx->solutions.size(); i++) {
+        if (!is_mask_correct(ctx->keys, ctx->num_checked_keys,
+                    solution_to_mask(ctx->solutions[i])))
+            return false;
     }
 
-    return solutions_removed;
+    ctx->num_checked_keys = ctx->keys.size();
+
+    return true;
 }
 
 /* 
@@ -356,30 +592,23 @@ static bool are_unique_solutions_found(size_t num_solutions, int min_bit, int ma
 static bool try_find_all_solutions(hash_context_t *ctx)
 {
     /* Do we have atleast a pair of keys to compare */
-    if (ctx->keys.size() != 0) {
-
-        /* Some solutions already exist? */
-        if (ctx->solutions.size() > 0) {
-            if (remove_incorrect_solutions(ctx) == 0) {
+    if (ctx->keys.size() == 0)
+        return false;
 
-                hash_reduce(ctx);
+    if (ctx->solutions.size() > 0 && are_solutions_correct(ctx))
+        return are_unique_solutions_found(ctx->solutions.size(), ctx->min_bit,
+                ctx->max_bit);
 
-                /* 
-                 * Max number of solutions can be only be (max_bit - min_bit - 1)
-                 * Since n solutions give 2^n partitions
-                 */
-                if (are_unique_solutions_found(ctx->solutions.size(), ctx->max_bit,
-                            ctx->min_bit))
-                    return 1;
-            }
-        } else {
-
-            find_new_solutions(ctx->keys, ctx->min_bit, ctx->max_bit, 
-                    ctx->solutions);
-        }  
-    }
+    /*
+     * Solutions are only a basis of the null space. A basis vector not fitting
+     * the new keys doesn't rule out its XOR with others (which can be the true
+     * hash function), so solve again over all the keys.
+     */
+    ctx->solutions.clear();
+    find_new_solutions(ctx->keys, ctx->min_bit, ctx->max_bit, ctx->solutions);
+    ctx->num_checked_keys = ctx->keys.size();
 
-    return 0;
+    return false;
 }
  
 /* Find highest bit set in mask <= ceiling bit */
@@ -397,9 +626,7 @@ static int find_highest_bit(uintptr_t mask, int ceiling)
 /* Called when is it confirmed that the pair of address lie in same partition */
 static void hash_confirm_pair(hash_context_t *ctx, uintptr_t phy_addr1, uintptr_t phy_addr2)
 {
-    std::pair <uintptr_t, uintptr_t> key (phy_addr1, phy_addr2);
-
-    ctx->keys.push_back(key);
+    ctx->keys.push_back(phy_addr1 ^ phy_addr2);
 }
 
 static void eliminate_duplicate_solutions(std::vector<solution_t> &solutions)
@@ -604,6 +831,7 @@ static void try_accomodate_new_bit(hash_context_t *ctx, int new_bit, void *arg,
     int ret;
     int num_solutions = ctx->solutions.size();
     uintptr_t base_addr, test_addr;
+    size_t first_key = 0;
 
     assert(num_solutions < 8 * sizeof(uint64_t));
 
@@ -635,19 +863,29 @@ static void try_accomodate_new_bit(hash_context_t *ctx, int new_bit, void *arg,
         if (addr) {
             
             std::vector< std::vector<solution_t> >::iterator s;
+            std::vector<uint64_t> masks;
+            size_t k;
 
             test_addr = (uintptr_t)addr;
             hash_confirm_pair(ctx, base_addr, test_addr);
+
+            /* Check all hypotheses in one go, against the keys not yet checked */
+            for (s = all_new_solutions.begin(); s != all_new_solutions.end(); s++) {
+                for (size_t i = 0; i < s->size(); i++)
+                    masks.push_back(solution_to_mask((*s)[i]));
+            }
+
+            bool *correct = new bool[masks.size()];
+            check_masks(ctx->keys, first_key, masks.data(), masks.size(), correct);
+            first_key = ctx->keys.size();
        
-            for (s = all_new_solutions.begin(); s != all_new_solutions.end();) {
+            for (s = all_new_solutions.begin(), k = 0; s != all_new_solutions.end();) {
                 
                 bool is_correct = true;
 
-                for (int i = 0; i < s->size(); i++) {
-                    if (!is_solution_correct(ctx->keys, (*s)[i])) {
+                for (size_t i = 0; i < s->size(); i++, k++) {
+                    if (!correct[k])
                         is_correct = false;
-                        break;
-                    }
                 }
 
                 if (!is_correct) {
@@ -656,6 +894,8 @@ static void try_accomodate_new_bit(hash_context_t *ctx, int new_bit, void *arg,
                     s++;
                 }
             }
+
+            delete [] correct;
         } else {
             break;
         }
@@ -670,6 +910,7 @@ static void try_accomodate_new_bit(hash_context_t *ctx, int new_bit, void *arg,
     }
 
     ctx->solutions = all_new_solutions[0];
+    ctx->num_checked_keys = first_key;
 }
 
 /* 
@@ -689,12 +930,13 @@ int hash_find_solutions(hash_context_t *ctx, void *arg,
     /* 
      * Works in two steps:
      * 1) Find a base solution - 
-     *   This is done via brute force. (XXX: Any faster method)
+     *   This is done by solving for the null space of key differences.
      *   To make it fast, only consider half of the total bits to consider.
      * 2) Using base solution, find out the role of each leftover bit seperately
      * Using only half of the bits in finding base solution exponentially
-     * speeds up the process since each extra bit makes the brute force solution
-     * 2x slower whereas second step is O(1) for each leftover bit.
+     * speeds up the process since each extra bit doubles the address range
+     * whose pairs need to be measured, whereas second step is O(1) for each
+     * leftover bit.
      */
     int end_bit = ((ctx->max_bit + ctx->min_bit) + 1) / 2;
     int highest_bit = find_highest_bit(ctx->start_addr, ctx->max_bit);
@@ -742,6 +984,7 @@ int hash_find_solutions(hash_context_t *ctx, void *arg,
         fprintf(stderr, "Base solution couldn't be found\n");
         return -1;
     }
+    ctx->num_checked_keys = ctx->keys.size();
 
     hash_reduce(ctx);
 
@@ -991,11 +1234,296 @@ bool hash_is_same_partition(hash_context_t *ctx, void *addr1, void *addr2)
         get_full_partitions_num((uintptr_t)addr1, ctx->solutions);
 }
 
+/* Rank of a set of masks over GF(2) */
+static int get_rank(const std::vector<uint64_t> &masks)
+{
+    uint64_t rows[MAX_NUM_INDEX] = {0};     /* rows[i] has highest bit i */
+    int rank = 0;
+
+    for (size_t k = 0; k < masks.size(); k++) {
+        uint64_t mask = masks[k];
+
+        for (int i = MAX_NUM_INDEX - 1; i >= 0 && mask; i--) {
+            if (!(mask & (1ULL << i)))
+                continue;
+
+            if (!rows[i]) {
+                rows[i] = mask;
+                rank++;
+                break;
+            }
+
+            mask ^= rows[i];
+        }
+    }
+
+    return rank;
+}
+
+/* 
+ * Checks if solutions are equivalent to a known hash function (XOR masks, one
+ * per index bit), i.e. both span the same space over GF(2). Bits of masks
+ * outside [min_bit, max_bit] can't be found and are ignored.
+ */
+bool hash_is_same_function(hash_context_t *ctx, const std::vector<uint64_t> &masks)
+{
+    uint64_t range = (ctx->max_bit == 63 ? ~0ULL : ((1ULL << (ctx->max_bit + 1)) - 1)) &
+        ~((1ULL << ctx->min_bit) - 1);
+    std::vector<uint64_t> found, known, all;
+
+    for (size_t i = 0; i < ctx->solutions.size(); i++)
+        found.push_back(solution_to_mask(ctx->solutions[i]));
+
+    for (size_t i = 0; i < masks.size(); i++)
+        known.push_back(masks[i] & range);
+
+    all = found;
+    all.insert(all.end(), known.begin(), known.end());
+
+    return get_rank(found) == get_rank(known) && get_rank(all) == get_rank(known);
+}
+
+/* Solutions as XOR masks of physical address bits */
+void hash_get_masks(hash_context_t *ctx, std::vector<uint64_t> &masks)
+{
+    masks.clear();
+    for (size_t i = 0; i < ctx->solutions.size(); i++)
+        masks.push_back(solution_to_mask(ctx->solutions[i]));
+}
+
 void hash_del(hash_context_t *ctx)
 {
     delete ctx;
 }
 
+#define HASH_KEYS_FILE_HEADER   "# FGPU hash keys v1"
+
+/* 
+ * Saves the keys collected so far so that solvers can be rerun offline.
+ * Returns < 0 on error.
+ */
+int hash_save_keys(hash_context_t *ctx, const char *file)
+{
+    FILE *fp;
+
+    fp = fopen(file, "w");
+    if (!fp) {
+        fprintf(stderr, "Couldn't open file %s\n", file);
+        return -1;
+    }
+
+    fprintf(fp, "%s\n", HASH_KEYS_FILE_HEADER);
+    fprintf(fp, "%d %d 0x%" PRIxPTR " 0x%" PRIxPTR "\n", ctx->min_bit,
+            ctx->max_bit, ctx->start_addr, ctx->end_addr);
+
+    for (size_t i = 0; i < ctx->keys.size(); i++)
+        fprintf(fp, "0x%" PRIx64 "\n", ctx->keys[i]);
+
+    fclose(fp);
+
+    return 0;
+}
+
+/* Loads keys saved by hash_save_keys(). Returns NULL on error. */
+hash_context_t *hash_load_keys(const char *file)
+{
+    char line[256];
+    int min_bit, max_bit;
+    uintptr_t start_addr, end_addr;
+    uint64_t key;
+    hash_context_t *ctx;
+    FILE *fp;
+
+    fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "Couldn't open file %s\n", file);
+        return NULL;
+    }
+
+    if (!fgets(line, sizeof(line), fp) ||
+            strncmp(line, HASH_KEYS_FILE_HEADER, strlen(HASH_KEYS_FILE_HEADER)) != 0 ||
+            fscanf(fp, "%d %d %" SCNxPTR " %" SCNxPTR, &min_bit, &max_bit,
+                &start_addr, &end_addr) != 4) {
+        fprintf(stderr, "Invalid keys file %s\n", file);
+        fclose(fp);
+        return NULL;
+    }
+
+    ctx = hash_init(min_bit, max_bit, (void *)start_addr, (void *)end_addr);
+    if (!ctx) {
+        fprintf(stderr, "Invalid parameters in keys file %s\n", file);
+        fclose(fp);
+        return NULL;
+    }
+
+    while (fscanf(fp, "%" SCNx64, &key) == 1)
+        ctx->keys.push_back(key);
+
+    fclose(fp);
+
+    return ctx;
+}
+
+static double get_time_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* 
+ * Times the solvers on the keys in the context (e.g. loaded with
+ * hash_load_keys()). Brute force is skipped if there are too many bits.
+ */
+void hash_benchmark_solvers(hash_context_t *ctx)
+{
+    std::vector<solution_t> solutions;
+    int num_bits = ctx->max_bit - ctx->min_bit + 1;
+    int num_threads = get_num_threads();
+    double start;
+    int ret;
+
+    printf("Keys:%zu, Bits:%d-%d\n", ctx->keys.size(), ctx->min_bit, ctx->max_bit);
+
+    start = get_time_usec();
+    ret = find_new_solutions_gf2(ctx->keys, ctx->min_bit, ctx->max_bit, solutions);
+    printf("GF(2) solver: Basis solutions:%d, Time:%.1f usec\n", ret,
+            get_time_usec() - start);
+
+    if (num_bits > HASH_BENCHMARK_MAX_BRUTE_FORCE_BITS) {
+        printf("Skipping brute force as too many bits (%d)\n", num_bits);
+        return;
+    }
+
+    solutions.clear();
+    start = get_time_usec();
+    ret = find_new_solutions_brute_force(ctx->keys, ctx->min_bit, ctx->max_bit,
+            solutions, 1);
+    printf("Brute force (1 thread): Solutions:%d, Time:%.1f usec\n", ret,
+            get_time_usec() - start);
+
+    if (num_threads == 1)
+        return;
+
+    solutions.clear();
+    start = get_time_usec();
+    ret = find_new_solutions_brute_force(ctx->keys, ctx->min_bit, ctx->max_bit,
+            solutions, num_threads);
+    printf("Brute force (%d threads): Solutions:%d, Time:%.1f usec\n",
+            num_threads, ret, get_time_usec() - start);
+}
+
+/* Known hash function (XOR masks of a device) to generate keys from */
+typedef struct hash_check_function {
+    const char *name;
+    int min_bit;
+    int max_bit;
+    std::vector<uint64_t> masks;
+} hash_check_function_t;
+
+/* Deterministic, so that failures can be reproduced */
+static uint64_t hash_check_rand(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+/* Random key of bits in [min_bit, max_bit] fitting all the masks */
+static uint64_t hash_check_get_key(const hash_check_function_t *f, uint64_t *state)
+{
+    uint64_t range = ((1ULL << (f->max_bit + 1)) - 1) & ~((1ULL << f->min_bit) - 1);
+
+    while (true) {
+        uint64_t key = hash_check_rand(state) & range;
+        bool fits = key != 0;
+
+        for (size_t i = 0; i < f->masks.size(); i++) {
+            if (__builtin_popcountll(key & f->masks[i]) & 0x1)
+                fits = false;
+        }
+
+        if (fits)
+            return key;
+    }
+}
+
+/*
+ * Solves for a known hash function from synthetic keys: in one go, and as
+ * keys trickle in (as while measuring), where solutions found from too few
+ * keys must be refined without losing the true function.
+ */
+static bool hash_check_function(const hash_check_function_t *f, uint64_t *state)
+{
+    int num_bits = f->max_bit - f->min_bit + 1;
+    hash_context_t ctx;
+    bool correct = true;
+    bool found = false;
+
+    ctx.min_bit = f->min_bit;
+    ctx.max_bit = f->max_bit;
+    ctx.num_checked_keys = 0;
+
+    for (int i = 0; i < 4 * num_bits; i++) {
+        ctx.keys.push_back(hash_check_get_key(f, state));
+
+        /* Few keys at a time, as when measuring */
+        if (i % 4 == 3)
+            found = try_find_all_solutions(&ctx);
+    }
+
+    if (!found)
+        found = try_find_all_solutions(&ctx);
+
+    if (!found || !hash_is_same_function(&ctx, f->masks)) {
+        fprintf(stderr, "%s: Incremental solutions don't match\n", f->name);
+        correct = false;
+    }
+
+    ctx.solutions.clear();
+    if (find_new_solutions(ctx.keys, ctx.min_bit, ctx.max_bit, ctx.solutions) !=
+            (int)f->masks.size() || !hash_is_same_function(&ctx, f->masks)) {
+        fprintf(stderr, "%s: Solutions don't match\n", f->name);
+        correct = false;
+    }
+
+    if (num_bits <= HASH_CHECK_MAX_BRUTE_FORCE_BITS &&
+            !check_solutions(ctx.keys, ctx.min_bit, ctx.max_bit, ctx.solutions))
+        correct = false;
+
+    return correct;
+}
+
+/* 
+ * Checks the solvers on keys generated from known hash functions (no GPU
+ * needed). Returns true if all the functions are found.
+ */
+bool hash_check_solvers(void)
+{
+    hash_check_function_t functions[] = {
+        {"Small", 6, 17, {0x11280, 0x2900, 0x2c400}},
+        {"GTX 1070 DRAM", 13, 33, {0x12510a000, 0x36e18000, 0x48890000,
+            0xb9d20000}},
+        {"V100 L2 cache", 7, 33, {0x113a08080, 0xb3a88300, 0x3cf688200,
+            0x3fb184000, 0x156690000}},
+    };
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    bool correct = true;
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        bool ret = hash_check_function(&functions[i], &state);
+
+        printf("%s: %s\n", functions[i].name, ret ? "PASS" : "FAIL");
+        correct = ret && correct;
+    }
+
+    return correct;
+}
+
 /* TODO: Below code is just to make testing faster. Remove. For GTX 1070*/
 #if 0
 hash_context_t *hash_get_dram(void)
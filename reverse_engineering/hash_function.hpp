@@ -26,6 +26,10 @@ void *hash_get_next_addr(std::vector<hash_context_t *> ctx,
 
 bool hash_is_same_partition(hash_context_t *ctx, void *addr1, void *addr2);
 
+bool hash_is_same_function(hash_context_t *ctx, const std::vector<uint64_t> &masks);
+
+void hash_get_masks(hash_context_t *ctx, std::vector<uint64_t> &masks);
+
 #if 0 /* TODO: Below code is just for testing. Remove */
 hash_context_t *hash_get_dram(void);
 hash_context_t *hash_get_cache(void);
@@ -34,4 +38,12 @@ hash_context_t *hash_get_common(void);
 
 void hash_del(hash_context *ctx);
 
+int hash_save_keys(hash_context_t *ctx, const char *file);
+
+hash_context_t *hash_load_keys(const char *file);
+
+void hash_benchmark_solvers(hash_context_t *ctx);
+
+bool hash_check_solvers(void);
+
 #endif /* __HASH_FUNCTION_HPP__ */
@@ -16,6 +16,8 @@
 #include <sys/ioctl.h>
 #include <math.h>
 #include <stdarg.h>
+#include <getopt.h>
+#include <sys/time.h>
 
 #include <algorithm>
 #include <vector>
@@ -23,6 +25,10 @@
 #include <reverse_engineering.hpp>
 
 #include <hash_function.hpp>
+#include <capture.hpp>
+#include <classifier.hpp>
+
+#include <fgpu_internal_profile.hpp>
 
 /* TODO:
  * 1) On GTX 1070, DRAM Bank reverse engineering function get stuck sometime.
@@ -39,6 +45,8 @@ typedef struct cb_arg {
     double nearest_nonoutlier;
     double threshold;
     double running_threshold;
+    classifier_t classifier;
+    size_t num_remeasured;          /* Extra measurements of ambiguous pairs */
 } cb_arg_t;
 
 typedef struct pchase_cb_arg {
@@ -63,6 +71,26 @@ char *g_dram_histogram_file;
 char *g_dram_trendline_file;
 char *g_interference_file;
 
+/* Parameters for recording/benchmarking hash function keys */
+char *g_keys_prefix;
+char *g_benchmark_keys_file;
+bool g_check_solvers;
+
+/* Parameters for capturing measurements and replaying them */
+char *g_capture_file;
+char *g_replay_file;
+
+/* Parameters for exporting device profile */
+char *g_profile_file;
+static fgpu_device_profile_t g_profile;
+
+/* Set from device, or from capture file while replaying */
+static size_t g_allocation_overhead;
+
+/* Number of measurements done */
+static size_t g_num_dram_reads;
+static size_t g_num_cache_searches;
+
 /* Prints and hightlights string */
 static void print_highlighted(const char *fmt, ...)
 {
@@ -91,6 +119,12 @@ void print_usage(char **argv)
     fprintf(stderr, "Usage: %s [OPTIONS]\n"
             "-H Filename for outputting DRAM access time histogram\n"
             "-I Filename for outputting DRAM Banks/Cachelines inteference results\n"
+            "-K Prefix of filenames for saving DRAM/Cacheline hash keys\n"
+            "-P Filename for exporting device profile (for FGPU runtime)\n"
+            "-B Filename of saved hash keys to benchmark solvers on (no GPU needed)\n"
+            "-S, --check-solvers Check hash function solvers on synthetic keys (no GPU needed)\n"
+            "-C Filename for capturing GPU measurements (for --replay)\n"
+            "-R, --replay Filename of captured GPU measurements to rerun offline (no GPU needed)\n"
             "-T Filename for outputting DRAM access times\n"
             "-n Number of samples of DRAM. Default :%d\n"
             "-s Spacing for dram histogram. Default: %d\n", argv[0],
@@ -101,8 +135,14 @@ void print_usage(char **argv)
 void parse_args(int argc, char **argv) 
 {
     int opt;
-
-    while ((opt = getopt(argc, argv, "H:I:T:n:s:h")) != -1) {
+    static struct option long_options[] = {
+        {"replay", required_argument, NULL, 'R'},
+        {"check-solvers", no_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "B:C:H:I:K:P:R:ST:n:s:h", long_options,
+                    NULL)) != -1) {
         
         switch (opt) {
         
@@ -141,6 +181,30 @@ void parse_args(int argc, char **argv)
             }
             break;
 
+        case 'K':
+            g_keys_prefix = optarg;
+            break;
+
+        case 'P':
+            g_profile_file = optarg;
+            break;
+
+        case 'B':
+            g_benchmark_keys_file = optarg;
+            break;
+
+        case 'C':
+            g_capture_file = optarg;
+            break;
+
+        case 'R':
+            g_replay_file = optarg;
+            break;
+
+        case 'S':
+            g_check_solvers = true;
+            break;
+
         case 'T':
             g_dram_trendline_enabled = true;
             g_dram_trendline_file = optarg;
@@ -166,19 +230,58 @@ bool is_power_of_2(size_t x)
     return !(x & (x - 1));
 }
 
-bool check_dram_partition_pair(void *phy_addr1, void *phy_addr2, void *arg)
+/* 
+ * Measures access time of a pair of physical addresses (or gets it from the
+ * capture file while replaying).
+ */
+static double find_dram_read_time(uintptr_t phy_addr1, uintptr_t phy_addr2,
+        uintptr_t phy_start, uintptr_t virt_start, double threshold)
 {
-    cb_arg_t *data = (cb_arg_t *)arg;
     uintptr_t a, b;
+    double time;
+
+    g_num_dram_reads++;
+
+    if (capture_is_replaying()) {
+        if (capture_get_dram_read_time(phy_addr1, phy_addr2, &time) < 0) {
+            fprintf(stderr, "Access time of (0x%lx, 0x%lx) not in capture file\n",
+                    phy_addr1, phy_addr2);
+            exit(EXIT_FAILURE);
+        }
+        return time;
+    }
+
+    a = phy_addr1 - phy_start + virt_start;
+    b = phy_addr2 - phy_start + virt_start;
+
+    dprintf("VirtAddr1: 0x%lx,\t VirtAddr2: 0x%lx\n", a, b);
 
-    a = (uintptr_t)phy_addr1 - data->phy_start + data->virt_start;
-    b = (uintptr_t)phy_addr2 - data->phy_start + data->virt_start;
+    time = device_find_dram_read_time((void *)a, (void *)b, threshold);
+    capture_add_dram_read_time(phy_addr1, phy_addr2, time);
+
+    return time;
+}
+
+bool check_dram_partition_pair(void *phy_addr1, void *phy_addr2, void *arg)
+{
+    cb_arg_t *data = (cb_arg_t *)arg;
+    double sum;
+    int n;
 
     dprintf("Reading Time: PhyAddr1: %p,\t PhyAddr2:0x%p\n",
                 phy_addr1, phy_addr2);
-    dprintf("VirtAddr1: 0x%lx,\t VirtAddr2: 0x%lx\n", a, b);
 
-    data->time = device_find_dram_read_time((void *)a, (void *)b, data->threshold);
+    data->time = find_dram_read_time((uintptr_t)phy_addr1, (uintptr_t)phy_addr2,
+            data->phy_start, data->virt_start, data->threshold);
+
+    /* Measure again (and average) only if not sure */
+    for (n = 1, sum = data->time; n <= CLASSIFIER_MAX_REMEASUREMENTS &&
+            classifier_is_ambiguous(&data->classifier, sum / n); n++) {
+        sum += find_dram_read_time((uintptr_t)phy_addr1, (uintptr_t)phy_addr2,
+                data->phy_start, data->virt_start, data->threshold);
+        data->num_remeasured++;
+    }
+    data->time = sum / n;
     dprintf("Time:%f, Threshold:%f\n", data->time, data->running_threshold);
     
     data->min = data->time < data->min ? data->time : data->min;
@@ -199,7 +302,6 @@ bool check_dram_partition_pair(void *phy_addr1, void *phy_addr2, void *arg)
 void *find_next_dram_partition_pair(void *phy_addr1, void *phy_start_addr, 
         void *phy_end_addr, size_t offset, void *arg)
 {
-    uintptr_t a, b;
     uintptr_t ustart_addr = (uintptr_t)phy_start_addr;
     uintptr_t uend_addr = (uintptr_t)phy_end_addr;
 
@@ -214,6 +316,43 @@ void *find_next_dram_partition_pair(void *phy_addr1, void *phy_start_addr,
     return NULL;
 }
 
+static double get_time_sec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000;
+}
+
+/* 
+ * Compares the hash function found with the known one (only known for
+ * simulated device).
+ */
+static void check_hash_function(const char *name, hash_context_t *hctx,
+        int (*get_masks)(std::vector<uint64_t> &masks))
+{
+    std::vector<uint64_t> masks;
+
+    if (get_masks(masks) < 0)
+        return;
+
+    if (hash_is_same_function(hctx, masks))
+        print_highlighted("%s hash function matches the known function", name);
+    else
+        print_highlighted("%s hash function DOESN'T match the known function", name);
+}
+
+/* Reorders samples in place (order of samples doesn't matter) */
+static double get_median(std::vector<double> &samples)
+{
+    size_t mid = samples.size() / 2;
+
+    std::nth_element(samples.begin(), samples.begin() + mid, samples.end());
+
+    return samples[mid];
+}
+
 static double get_histogram_bin(double time, double min_time, int spacing)
 {
     int min_rounded = ((int)(min_time) / spacing) * spacing;
@@ -241,7 +380,7 @@ static hash_context_t *run_dram_exp(void *virt_start, void *phy_start,
     void *phy_end;
     size_t min_row_size;
     void *row_start, *row_end;
-    uintptr_t a, b, b_phy;
+    uintptr_t b_phy;
     double threshold = LONG_MAX;
     double time, sum, running_threshold, nearest_nonoutlier;
     double min, max;
@@ -252,9 +391,22 @@ static hash_context_t *run_dram_exp(void *virt_start, void *phy_start,
     size_t max_entries = allocated / offset;
     int count = std::min(max_entries, (size_t)THRESHOLD_SAMPLE_SIZE);
     std::vector<std::pair<void *, double>> times;
+    std::vector<double> samples;
     std::vector<int> dram_histogram;
+    classifier_t classifier;
+    bool is_adaptive = !(g_dram_histogram_enabled || g_dram_trendline_enabled);
+    size_t num_ambiguous = 0;
+
+    if (capture_is_replaying()) {
+
+        /* Redo threshold detection on the same pairs as captured */
+        count = capture_get_dram_sample_size();
+        if (count < 0) {
+            fprintf(stderr, "DRAM measurements not in capture file\n");
+            return NULL;
+        }
 
-    if (g_dram_histogram_enabled || g_dram_trendline_enabled) {
+    } else if (g_dram_histogram_enabled || g_dram_trendline_enabled) {
         
         count = std::min(max_entries, (size_t)g_dram_sample_size);
         if (count != g_dram_sample_size) {
@@ -269,24 +421,57 @@ static hash_context_t *run_dram_exp(void *virt_start, void *phy_start,
     sum = 0;
     printf("Finding threshold\n", count);
     for (int i = 0; i < count; i++) {
-        a = (uintptr_t)virt_start;
-        b = a + offset * i;
         b_phy = (uintptr_t)phy_start +  offset * i;
 
-        time = device_find_dram_read_time((void *)a, (void *)b, threshold);
+        time = find_dram_read_time((uintptr_t)phy_start, b_phy,
+                (uintptr_t)phy_start, (uintptr_t)virt_start, threshold);
         sum += time;
         min = time < min ? time : min;
         max = time > max ? time : max;
         times.push_back(std::pair<void *, double>((void *)b_phy, time));
+        samples.push_back(time);
 
         /* Print progress */
         printf("Done:%.1f%%\r", (float)(i * 100)/(float)(count));
+
+        /* Stop once there are enough samples of both fast and slow accesses */
+        if (is_adaptive && i + 1 >= THRESHOLD_MIN_SAMPLE_SIZE &&
+                (i + 1) % THRESHOLD_CHECK_INTERVAL == 0 &&
+                classifier_fit(&classifier, samples,
+                    get_median(samples) * THRESHOLD_MULTIPLIER) == 0) {
+            count = i + 1;
+            break;
+        }
     }
     printf("\n");
     
     double avg = sum / count;
-    threshold = avg * THRESHOLD_MULTIPLIER;
-    running_threshold = (avg * (100.0 + OUTLIER_DRAM_PERCENTAGE)) / 100.0;
+    threshold = get_median(samples) * THRESHOLD_MULTIPLIER;
+
+    ret = classifier_fit(&classifier, samples, threshold);
+    if (ret == 0) {
+        running_threshold = classifier.threshold;
+
+        for (size_t i = 0; i < samples.size(); i++) {
+            if (classifier_is_ambiguous(&classifier, samples[i]))
+                num_ambiguous++;
+        }
+
+        printf("Access time classes (%d samples): ", count);
+        classifier_print(&classifier);
+        printf("Samples with ambiguous access time: %zu\n", num_ambiguous);
+
+        g_profile.dram_fast_latency = classifier.fast_mean;
+        g_profile.dram_slow_latency = classifier.slow_mean;
+    } else {
+        /* Might not have seen enough bank conflicts */
+        running_threshold = (avg * (100.0 + OUTLIER_DRAM_PERCENTAGE)) / 100.0;
+        fprintf(stderr, "WARNING: Access times are not bimodal. Using %d%% above "
+                "average as threshold\n", OUTLIER_DRAM_PERCENTAGE);
+    }
+
+    capture_set_dram_threshold(count, running_threshold);
+    g_profile.dram_threshold = running_threshold;
 
     if (g_dram_histogram_enabled || g_dram_trendline_fp) {
 
@@ -339,13 +524,15 @@ static hash_context_t *run_dram_exp(void *virt_start, void *phy_start,
             threshold, running_threshold, max, min);
     }
 
-    phy_end = (void *)((uintptr_t)phy_start + allocated - device_allocation_overhead());
+    phy_end = (void *)((uintptr_t)phy_start + allocated - g_allocation_overhead);
 
     data.min = LONG_MAX;
     data.max = 0;
     data.nearest_nonoutlier = 0;
     data.threshold = threshold;
     data.running_threshold = running_threshold;
+    data.classifier = classifier;
+    data.num_remeasured = 0;
     data.phy_start = (uintptr_t)phy_start;
     data.virt_start = (uintptr_t)virt_start;
 
@@ -414,6 +601,8 @@ static hash_context_t *run_dram_exp(void *virt_start, void *phy_start,
                 data.min, data.max, (data.max - data.min) / (data.min));
     dprintf("Nearest Nonoutlier: %f, Threshold: %f\n",
                 data.nearest_nonoutlier, data.running_threshold);
+    printf("Extra measurements of pairs with ambiguous access time: %zu\n",
+            data.num_remeasured);
 
     if (ret < 0) {
         fprintf(stderr, "No solutions found\n");
@@ -429,23 +618,51 @@ static hash_context_t *run_dram_exp(void *virt_start, void *phy_start,
     return hctx;
 }
 
+/* 
+ * Finds physical address (0 if none) starting from phy_start_addr that evicts
+ * phy_addr1 from cache (or gets it from the capture file while replaying).
+ */
+static uintptr_t find_cache_eviction_addr(uintptr_t phy_addr1,
+        uintptr_t phy_start_addr, size_t offset, cb_arg_t *data)
+{
+    uintptr_t a, b;
+    uintptr_t ret_addr, phy_addr2;
+
+    g_num_cache_searches++;
+
+    if (capture_is_replaying()) {
+        if (capture_get_cache_eviction_addr(phy_addr1, phy_start_addr, offset,
+                    &phy_addr2) < 0) {
+            fprintf(stderr, "Cache eviction search for 0x%lx from 0x%lx not in capture file\n",
+                    phy_addr1, phy_start_addr);
+            exit(EXIT_FAILURE);
+        }
+        return phy_addr2;
+    }
+
+    a = phy_addr1 - data->phy_start + data->virt_start;
+    b = phy_start_addr - data->phy_start + data->virt_start;
+
+    ret_addr = (uintptr_t)device_find_cache_eviction_addr((void * )a, (void *)b, offset, data->running_threshold);
+    phy_addr2 = ret_addr ? ret_addr - data->virt_start + data->phy_start : 0;
+
+    capture_add_cache_eviction_addr(phy_addr1, phy_start_addr, offset, phy_addr2);
+
+    return phy_addr2;
+}
+
 void *find_next_cache_partition_pair(void *phy_addr1, void *phy_start_addr, 
         void *phy_end_addr, size_t offset, void *arg)
 {
     void *phy_addr2;
-    uintptr_t a, b;
-    uintptr_t ret_addr;
     cb_arg_t *data = (cb_arg_t *)arg;
 
-    a = (uintptr_t)phy_addr1 - data->phy_start + data->virt_start;
-    b = (uintptr_t)phy_start_addr - data->phy_start + data->virt_start;
-
     dprintf("Trying to find pair for %p in the range [%p, %p)\n", phy_addr1, phy_start_addr, phy_end_addr);
-    ret_addr = (uintptr_t)device_find_cache_eviction_addr((void * )a, (void *)b, offset, data->running_threshold);
-    if (!ret_addr)
+    phy_addr2 = (void *)find_cache_eviction_addr((uintptr_t)phy_addr1,
+            (uintptr_t)phy_start_addr, offset, data);
+    if (!phy_addr2)
         return NULL;
 
-    phy_addr2 = (void *)((uintptr_t)ret_addr - data->virt_start + data->phy_start);
     dprintf("Found valid pair: (%p, %p)\n", phy_addr1, phy_addr2);
 
     if ((uintptr_t)phy_addr2 > (uintptr_t)phy_end_addr)
@@ -490,26 +707,37 @@ static hash_context_t *run_cache_exp(void *virt_start, void *phy_start, size_t a
     size_t num_words;
     pchase_cb_arg_t pchase_cb_arg;
 
-    printf("Doing initialization\n");
-    ret = device_cacheline_test_init(virt_start, allocated);
-    if (ret < 0) {
-        fprintf(stderr, "Couldn't initialize\n");
-        return NULL;
-    }
+    if (capture_is_replaying()) {
+        ret = capture_get_cache_threshold(&avg);
+        if (ret < 0) {
+            fprintf(stderr, "Cache measurements not in capture file\n");
+            return NULL;
+        }
+    } else {
+        printf("Doing initialization\n");
+        ret = device_cacheline_test_init(virt_start, allocated);
+        if (ret < 0) {
+            fprintf(stderr, "Couldn't initialize\n");
+            return NULL;
+        }
 
-    // Find running threshold
-    printf("Finding threshold\n");
-    
-    ret = device_cacheline_test_find_threshold(THRESHOLD_SAMPLE_SIZE, &avg);
-    if (ret < 0) {
-        fprintf(stderr, "Couldn't find the threshold\n");
-        return NULL;
+        // Find running threshold
+        printf("Finding threshold\n");
+        
+        ret = device_cacheline_test_find_threshold(THRESHOLD_SAMPLE_SIZE, &avg);
+        if (ret < 0) {
+            fprintf(stderr, "Couldn't find the threshold\n");
+            return NULL;
+        }
     }
     running_threshold = (avg * (100.0 + OUTLIER_CACHE_PERCENTAGE)) / 100.0;
+    capture_set_cache_threshold(avg, running_threshold);
+    g_profile.cache_hit_latency = avg;
+    g_profile.cache_threshold = running_threshold;
 
     dprintf("Running threshold is: %f\n", running_threshold);
 
-    phy_end = (void *)((uintptr_t)phy_start + allocated - device_allocation_overhead());
+    phy_end = (void *)((uintptr_t)phy_start + allocated - g_allocation_overhead);
 
     data.running_threshold = running_threshold;
     data.phy_start = (uintptr_t)phy_start;
@@ -530,6 +758,10 @@ static hash_context_t *run_cache_exp(void *virt_start, void *phy_start, size_t a
         hash_print_solutions(hctx);
     }
 
+    /* Needs the GPU */
+    if (capture_is_replaying())
+        return hctx;
+
     /* Find the number of words in a cacheline */
     pchase_cb_arg.virt_start = (uintptr_t)virt_start;
     pchase_cb_arg.phy_start = (uintptr_t)phy_start;
@@ -541,6 +773,8 @@ static hash_context_t *run_cache_exp(void *virt_start, void *phy_start, size_t a
             get_next_word, &pchase_cb_arg, &num_words);
     if (ret < 0) {
         fprintf(stderr, "Couldn't find number of words in a cachline\n");
+    } else {
+        g_profile.l2_cache_line_words = num_words;
     }
     print_highlighted("Number of words in a cachline:%zd", num_words);
     
@@ -695,6 +929,49 @@ static int run_interference_exp(void *virt_start, void *phy_start,
     return 0;
 }
 
+static void set_profile_masks(hash_context_t *hctx, uint64_t *masks, int *num_masks)
+{
+    std::vector<uint64_t> solutions;
+
+    hash_get_masks(hctx, solutions);
+
+    *num_masks = std::min(solutions.size(), (size_t)FGPU_PROFILE_MAX_MASKS);
+    std::copy(solutions.begin(), solutions.begin() + *num_masks, masks);
+}
+
+/* Exports what was found, so that FGPU can be used on device without code changes */
+static int save_profile(const char *file, hash_context_t *common_hctx)
+{
+    std::vector<uint64_t> common;
+    char masks[FGPU_PROFILE_MAX_COLOR_MASKS * 20];
+    int ret;
+
+    if (common_hctx)
+        hash_get_masks(common_hctx, common);
+
+    ret = fgpu_profile_derive_color_masks(&g_profile, common.data(), common.size());
+    if (ret == 0)
+        fprintf(stderr, "WARNING: No color function found. Memory coloring can't be used\n");
+
+    g_profile.l2_cache_line_size = GPU_L2_CACHE_LINE_SIZE;
+    g_profile.l2_cache_word_size = GPU_L2_CACHE_WORD_SIZE;
+
+    ret = fgpu_profile_write(file, &g_profile);
+    if (ret < 0)
+        return ret;
+
+    print_highlighted("Saved device profile to %s", file);
+
+    if (g_profile.num_color_masks > 0) {
+        fgpu_profile_format_masks(masks, sizeof(masks), g_profile.color_masks,
+                g_profile.num_color_masks);
+        printf("Driver can be loaded with (Fewer masks for fewer colors):\n");
+        printf("sudo modprobe nvidia-uvm uvm_color_xor_masks=%s\n", masks);
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     void *virt_start;
@@ -703,9 +980,58 @@ int main(int argc, char *argv[])
     int ret;
     int max_bit, min_bit;
     hash_context_t *dram_hctx, *cache_hctx, *common_hctx;
+    capture_info_t capture_info;
+    double start_time;
 
     parse_args(argc, argv);
 
+    fgpu_profile_init(&g_profile);
+
+    if (g_check_solvers) {
+        bool correct = hash_check_solvers();
+
+        printf("%s\n", correct ? "Result = PASS" : "Result = FAIL");
+        return correct ? 0 : -1;
+    }
+
+    if (g_benchmark_keys_file) {
+        hash_context_t *hctx = hash_load_keys(g_benchmark_keys_file);
+        if (hctx == NULL)
+            return -1;
+
+        hash_benchmark_solvers(hctx);
+        hash_del(hctx);
+        return 0;
+    }
+
+    if (g_replay_file) {
+        ret = capture_replay_open(g_replay_file, &capture_info);
+        if (ret < 0)
+            return -1;
+
+        /* No GPU. Physical addresses are used as virtual addresses. */
+        min_bit = capture_info.min_bit;
+        max_bit = capture_info.max_bit;
+        phy_start = virt_start = (void *)capture_info.phy_start;
+        allocated = capture_info.allocated;
+        g_allocation_overhead = capture_info.allocation_overhead;
+        snprintf(g_profile.device, sizeof(g_profile.device), "%s",
+                capture_info.device_name);
+
+        /* Version 1 captures don't have it */
+        if (g_profile_file && g_profile.device[0] == '\0') {
+            fprintf(stderr, "WARNING: Capture has no device name. Set \"device\" "
+                    "in the exported profile before using it.\n");
+        }
+
+        if (g_interference_enabled) {
+            fprintf(stderr, "WARNING: Interference tests need the GPU. Skipping them.\n");
+            g_interference_enabled = false;
+        }
+
+        goto find_hash_functions;
+    }
+
     max_bit = device_max_physical_bit();
     if (max_bit < 0) {
         fprintf(stderr, "Couldn't find the maximum bit\n");
@@ -732,19 +1058,69 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    g_allocation_overhead = device_allocation_overhead();
+    device_get_name(g_profile.device, sizeof(g_profile.device));
+
+    if (g_capture_file) {
+        snprintf(capture_info.device_name, sizeof(capture_info.device_name), "%s",
+                g_profile.device);
+        capture_info.min_bit = min_bit;
+        capture_info.max_bit = max_bit;
+        capture_info.phy_start = (uintptr_t)phy_start;
+        capture_info.allocated = allocated;
+        capture_info.allocation_overhead = g_allocation_overhead;
+
+        ret = capture_open(g_capture_file, &capture_info);
+        if (ret < 0) {
+            fprintf(stderr, "Couldn't open capture file\n");
+            return -1;
+        }
+    }
+
+find_hash_functions:
+    g_profile.min_bit = min_bit;
+    g_profile.max_bit = max_bit;
+
     printf("Finding DRAM Banks hash function\n");
+    start_time = get_time_sec();
     dram_hctx = run_dram_exp(virt_start, phy_start, allocated, min_bit, max_bit);
+    capture_save();
     if (dram_hctx == NULL) {
         fprintf(stderr, "Couldn't find DRAM Banks hash function\n");
         return -1;
     }
+    printf("DRAM Banks: Time:%.1f sec, Pair reads:%zu\n",
+            get_time_sec() - start_time, g_num_dram_reads);
+    check_hash_function("DRAM Banks", dram_hctx, device_get_dram_hash_masks);
+    set_profile_masks(dram_hctx, g_profile.dram_masks, &g_profile.num_dram_masks);
 
     printf("Finding Cacheline hash function\n");
+    start_time = get_time_sec();
     cache_hctx = run_cache_exp(virt_start, phy_start, allocated, min_bit, max_bit);
+    capture_save();
     if (cache_hctx == NULL) {
         fprintf(stderr, "Couldn't find Cacheline hash function\n");
         return -1;
     }
+    printf("Cacheline: Time:%.1f sec, Eviction searches:%zu\n",
+            get_time_sec() - start_time, g_num_cache_searches);
+    check_hash_function("Cacheline", cache_hctx, device_get_cache_hash_masks);
+    set_profile_masks(cache_hctx, g_profile.cache_masks, &g_profile.num_cache_masks);
+
+    if (g_capture_file)
+        print_highlighted("Captured GPU measurements to %s", g_capture_file);
+
+    if (g_keys_prefix) {
+        char dram_file[PATH_MAX], cache_file[PATH_MAX];
+
+        snprintf(dram_file, sizeof(dram_file), "%s.dram", g_keys_prefix);
+        snprintf(cache_file, sizeof(cache_file), "%s.cache", g_keys_prefix);
+
+        print_highlighted("Saving hash keys to %s and %s", dram_file, cache_file);
+        if (hash_save_keys(dram_hctx, dram_file) < 0 ||
+                hash_save_keys(cache_hctx, cache_file) < 0)
+            fprintf(stderr, "Couldn't save hash keys\n");
+    }
 
     print_highlighted("Finding common solutions between DRAM and Cache");
     common_hctx = hash_get_common_solutions(dram_hctx, cache_hctx);
@@ -755,6 +1131,12 @@ int main(int argc, char *argv[])
     print_highlighted("Unique Cache solutions");
     hash_print_solutions(cache_hctx);
 
+    if (g_profile_file) {
+        ret = save_profile(g_profile_file, common_hctx);
+        if (ret < 0)
+            fprintf(stderr, "Couldn't save device profile\n");
+    }
+
     if (g_interference_enabled) {
         print_highlighted("Running Interference Tests");
         ret = run_interference_exp(virt_start, phy_start, cache_hctx, dram_hctx, 
@@ -769,6 +1151,8 @@ int main(int argc, char *argv[])
     hash_del(cache_hctx);
     hash_del(common_hctx);
 
+    capture_close();
+
     if (g_dram_histogram_fp)
         fclose(g_dram_histogram_fp);
 
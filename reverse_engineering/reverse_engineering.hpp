@@ -32,7 +32,8 @@
 
 /* 
  * By what percentage do the bank conflict cause delay as compared to avg read time 
- * Used as cutoff
+ * Used as cutoff only if the latencies measured don't have two clear clusters
+ * (See classifier.cpp)
  */
 #define GPU_DRAM_OUTLIER_PERCENTAGE              10
 
@@ -48,16 +49,39 @@
 #define OUTLIER_CACHE_PERCENTAGE                 GPU_CACHE_OUTLIER_PERCENTAGE
 
 /* 
- * For CPU, any values above THRESHOLD_MULTIPLIER * avg is ignored (as might have
- * noise). This is because we are using wall clock time and interrupts might
- * cause huge jumps
+ * Any values above THRESHOLD_MULTIPLIER * median are ignored (as might have
+ * noise). On CPU this is because we are using wall clock time and interrupts
+ * might cause huge jumps
  */
 #define THRESHOLD_MULTIPLIER                5
 
 /* Sample size to find out the threshold */
 #define THRESHOLD_SAMPLE_SIZE               1000
 
+/* 
+ * Threshold sampling stops early once the classifier finds two clear clusters
+ * (checked every THRESHOLD_CHECK_INTERVAL samples after THRESHOLD_MIN_SAMPLE_SIZE)
+ */
+#define THRESHOLD_MIN_SAMPLE_SIZE           200
+#define THRESHOLD_CHECK_INTERVAL            50
+
+/* Minimum number of samples in a cluster (e.g. of bank conflicts) */
+#define CLASSIFIER_MIN_CLUSTER_SIZE         5
+
+/* Clusters closer than these many standard deviations are considered one */
+#define CLASSIFIER_MIN_SEPARATION_SD        3
+
+/* Latency is confidently classified if these many SDs away from threshold */
+#define CLASSIFIER_CONFIDENCE_SD            1
+
+/* Floor for standard deviation of a cluster (cycles) */
+#define CLASSIFIER_MIN_SD                   1.0
+
+/* Maximum times a pair with ambiguous access time is measured again */
+#define CLASSIFIER_MAX_REMEASUREMENTS       4
+
 /***************************** FUNCTION DECLARATIONS **************************/
+int device_get_name(char *name, size_t len);
 size_t device_allocation_overhead(void);
 int device_max_physical_bit(void);
 int device_min_physical_bit(void);
@@ -75,6 +99,10 @@ int device_run_interference_exp(void *gpu_start_addr, void *(*cb)(void *addr, vo
         void *primary_arg, void *secondary_arg, int max_blocks, int loop_count, 
         std::vector<double> &time);
 
+/* Known hash functions (as XOR masks). Returns < 0 if not known (real GPU). */
+int device_get_dram_hash_masks(std::vector<uint64_t> &masks);
+int device_get_cache_hash_masks(std::vector<uint64_t> &masks);
+
 inline int ilog2(unsigned int x)
 {
     return sizeof(unsigned int) * 8 - __builtin_clz(x) - 1;
@@ -0,0 +1,448 @@
+/*
+ * Simulated GPU memory hierarchy for reverse engineering without a GPU.
+ * Implements the device_* interface of reverse_engineering.hpp on the host.
+ *
+ * Physical addresses are mapped to DRAM banks and L2 cache sets with XOR hash
+ * functions (one mask per index bit), so results of the reverse engineering
+ * can be checked against the known (ground truth) functions:
+ * - Reading two addresses in the same bank but different rows (row conflict)
+ *   takes longer.
+ * - An address is evicted from L2 once as many other lines of its set as
+ *   there are ways are read after it.
+ * Measured latencies have gaussian noise and occasional large spikes.
+ *
+ * The simulated device can be configured with environment variables (See
+ * SIM_*_ENV_NAME below). Defaults are the functions found for GTX 1070
+ * (See doc/REVERSE.md).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <reverse_engineering.hpp>
+
+/* Comma separated XOR masks of physical address bits, one per index bit */
+#define SIM_DRAM_MASKS_ENV_NAME         "FGPU_SIM_DRAM_MASKS"
+#define SIM_CACHE_MASKS_ENV_NAME        "FGPU_SIM_CACHE_MASKS"
+/* Highest physical address bit (Memory size is less than 2^(bit + 1)) */
+#define SIM_MAX_BIT_ENV_NAME            "FGPU_SIM_MAX_BIT"
+/* Standard deviation of latency noise (cycles) */
+#define SIM_NOISE_ENV_NAME              "FGPU_SIM_NOISE"
+/* Probability of a latency spike in a measurement */
+#define SIM_SPIKE_RATE_ENV_NAME         "FGPU_SIM_SPIKE_RATE"
+/* Probability that an eviction search returns a wrong line */
+#define SIM_CACHE_ERROR_RATE_ENV_NAME   "FGPU_SIM_CACHE_ERROR_RATE"
+/* Associativity of L2 cache */
+#define SIM_L2_NUM_WAYS_ENV_NAME        "FGPU_SIM_L2_NUM_WAYS"
+#define SIM_SEED_ENV_NAME               "FGPU_SIM_SEED"
+
+#define SIM_DEFAULT_DRAM_MASKS          "0x64911400,0x46b2b800,0xce4c3000,0x12510a000," \
+                                        "0x36e18000,0x48890000,0xb9d20000"
+#define SIM_DEFAULT_CACHE_MASKS         "0x64911400,0x46b2b800,0xce4c3000,0x84830180," \
+                                        "0xf231500,0xe2040600,0x70906000,0x91b2c000," \
+                                        "0x177998000,0x5aef0000"
+#define SIM_DEFAULT_MAX_BIT             32
+#define SIM_DEVICE_NAME                 "FGPU Simulated GPU"
+#define SIM_DEFAULT_NOISE               5.0
+#define SIM_DEFAULT_SPIKE_RATE          0.01
+#define SIM_DEFAULT_CACHE_ERROR_RATE    0.0
+#define SIM_DEFAULT_L2_NUM_WAYS         8
+#define SIM_DEFAULT_SEED                1
+
+/* Bits of address within a DRAM row (Same bank, different row conflicts) */
+#define SIM_DRAM_ROW_BITS               14
+#define SIM_DRAM_LATENCY                400.0
+#define SIM_DRAM_CONFLICT_LATENCY       100.0
+#define SIM_CACHE_LATENCY               200.0
+#define SIM_SPIKE_LATENCY               5000.0
+
+/* Start of simulated virtual address space (Never dereferenced) */
+#define SIM_VIRT_START                  (1ULL << 40)
+
+static struct {
+    std::vector<uint64_t> dram_masks;
+    std::vector<uint64_t> cache_masks;
+    int max_bit;
+    double noise;
+    double spike_rate;
+    double cache_error_rate;
+    int l2_num_ways;
+    std::mt19937_64 rng;
+
+    uintptr_t phy_start;
+    uintptr_t virt_start;
+    size_t size;
+
+    /* Statistics */
+    size_t num_dram_reads;
+    size_t num_cache_searches;
+} g_sim;
+
+static int parse_masks(const char *str, std::vector<uint64_t> &masks)
+{
+    char *end;
+
+    masks.clear();
+
+    while (*str) {
+        uint64_t mask = strtoull(str, &end, 0);
+        if (end == str || mask == 0)
+            return -1;
+
+        masks.push_back(mask);
+
+        str = end;
+        if (*str == ',')
+            str++;
+        else if (*str)
+            return -1;
+    }
+
+    return masks.size() > 0 ? 0 : -1;
+}
+
+static const char *get_env(const char *name, const char *def)
+{
+    const char *tmp = getenv(name);
+
+    return tmp ? tmp : def;
+}
+
+static void print_masks(const char *name, const std::vector<uint64_t> &masks)
+{
+    printf("%s:", name);
+    for (size_t i = 0; i < masks.size(); i++)
+        printf(" 0x%" PRIx64, masks[i]);
+    printf("\n");
+}
+
+static uint64_t get_index(uintptr_t phy_addr, const std::vector<uint64_t> &masks)
+{
+    uint64_t index = 0;
+
+    for (size_t i = 0; i < masks.size(); i++)
+        index |= (uint64_t)__builtin_parityll(phy_addr & masks[i]) << i;
+
+    return index;
+}
+
+/* Adds noise to a latency */
+static double add_noise(double latency)
+{
+    std::normal_distribution<double> noise(0, g_sim.noise);
+    std::uniform_real_distribution<double> spike(0, 1);
+
+    latency += noise(g_sim.rng);
+    if (spike(g_sim.rng) < g_sim.spike_rate)
+        latency += SIM_SPIKE_LATENCY;
+
+    return latency > 1 ? latency : 1;
+}
+
+static uintptr_t virt_to_phy(void *addr)
+{
+    return (uintptr_t)addr - g_sim.virt_start + g_sim.phy_start;
+}
+
+static void *phy_to_virt(uintptr_t addr)
+{
+    return (void *)(addr - g_sim.phy_start + g_sim.virt_start);
+}
+
+static void print_stats(void)
+{
+    printf("Simulated device: DRAM pair reads:%zu, Cache eviction searches:%zu\n",
+            g_sim.num_dram_reads, g_sim.num_cache_searches);
+}
+
+/* Reads configuration. Called before anything else. */
+static int sim_config(void)
+{
+    static bool configured = false;
+    const char *tmp;
+
+    if (configured)
+        return 0;
+
+    if (parse_masks(get_env(SIM_DRAM_MASKS_ENV_NAME, SIM_DEFAULT_DRAM_MASKS),
+                g_sim.dram_masks) < 0) {
+        fprintf(stderr, "Invalid %s\n", SIM_DRAM_MASKS_ENV_NAME);
+        return -1;
+    }
+
+    if (parse_masks(get_env(SIM_CACHE_MASKS_ENV_NAME, SIM_DEFAULT_CACHE_MASKS),
+                g_sim.cache_masks) < 0) {
+        fprintf(stderr, "Invalid %s\n", SIM_CACHE_MASKS_ENV_NAME);
+        return -1;
+    }
+
+    tmp = getenv(SIM_MAX_BIT_ENV_NAME);
+    g_sim.max_bit = tmp ? atoi(tmp) : SIM_DEFAULT_MAX_BIT;
+    if (g_sim.max_bit <= device_min_physical_bit() || g_sim.max_bit >= 48) {
+        fprintf(stderr, "Invalid %s\n", SIM_MAX_BIT_ENV_NAME);
+        return -1;
+    }
+
+    tmp = getenv(SIM_NOISE_ENV_NAME);
+    g_sim.noise = tmp ? atof(tmp) : SIM_DEFAULT_NOISE;
+
+    tmp = getenv(SIM_SPIKE_RATE_ENV_NAME);
+    g_sim.spike_rate = tmp ? atof(tmp) : SIM_DEFAULT_SPIKE_RATE;
+
+    tmp = getenv(SIM_CACHE_ERROR_RATE_ENV_NAME);
+    g_sim.cache_error_rate = tmp ? atof(tmp) : SIM_DEFAULT_CACHE_ERROR_RATE;
+
+    tmp = getenv(SIM_L2_NUM_WAYS_ENV_NAME);
+    g_sim.l2_num_ways = tmp ? atoi(tmp) : SIM_DEFAULT_L2_NUM_WAYS;
+    if (g_sim.l2_num_ways <= 0) {
+        fprintf(stderr, "Invalid %s\n", SIM_L2_NUM_WAYS_ENV_NAME);
+        return -1;
+    }
+
+    tmp = getenv(SIM_SEED_ENV_NAME);
+    g_sim.rng.seed(tmp ? strtoull(tmp, NULL, 0) : SIM_DEFAULT_SEED);
+
+    configured = true;
+
+    return 0;
+}
+
+size_t device_allocation_overhead(void)
+{
+    return 2 * GPU_L2_CACHE_LINE_SIZE;
+}
+
+int device_max_physical_bit(void)
+{
+    if (sim_config() < 0)
+        return -1;
+
+    return g_sim.max_bit;
+}
+
+int device_min_physical_bit(void)
+{
+    return ilog2((unsigned long long)GPU_L2_CACHE_LINE_SIZE);
+}
+
+int device_init(size_t req_reserved_size, size_t *reserved_size)
+{
+    size_t total, overheads = 1024 * 1024;
+
+    if (sim_config() < 0)
+        return -1;
+
+    /* Like a real GPU, memory is a bit less than the next power of 2 */
+    total = (1ULL << (g_sim.max_bit + 1)) - (1ULL << (g_sim.max_bit - 2));
+
+    g_sim.size = std::min(req_reserved_size, total);
+    if (reserved_size)
+        *reserved_size = g_sim.size - overheads;
+
+    printf("Simulated device: Max Bit:%d, L2 ways:%d, Noise:%f cycles, "
+            "Spike rate:%f, Cache error rate:%f\n", g_sim.max_bit,
+            g_sim.l2_num_ways, g_sim.noise, g_sim.spike_rate,
+            g_sim.cache_error_rate);
+    print_masks("Simulated DRAM Bank masks", g_sim.dram_masks);
+    print_masks("Simulated Cacheline masks", g_sim.cache_masks);
+
+    atexit(print_stats);
+
+    return 0;
+}
+
+void *device_allocate_contigous(size_t contiguous_size, void **phy_start_p)
+{
+    if (contiguous_size > g_sim.size)
+        return NULL;
+
+    g_sim.phy_start = 0;
+    g_sim.virt_start = SIM_VIRT_START;
+
+    *phy_start_p = (void *)g_sim.phy_start;
+    return (void *)g_sim.virt_start;
+}
+
+/* Same as on GPU, minimum of GPU_MAX_OUTER_LOOP noisy measurements */
+double device_find_dram_read_time(void *_a, void *_b, double threshold)
+{
+    uintptr_t a = virt_to_phy(_a);
+    uintptr_t b = virt_to_phy(_b);
+    double latency = SIM_DRAM_LATENCY;
+    double min_ticks = LONG_MAX;
+
+    (void)threshold;
+
+    g_sim.num_dram_reads++;
+
+    if (get_index(a, g_sim.dram_masks) == get_index(b, g_sim.dram_masks) &&
+            (a >> SIM_DRAM_ROW_BITS) != (b >> SIM_DRAM_ROW_BITS))
+        latency += SIM_DRAM_CONFLICT_LATENCY;
+
+    for (int i = 0; i < GPU_MAX_OUTER_LOOP; i++) {
+        double tick = add_noise(latency);
+        min_ticks = tick < min_ticks ? tick : min_ticks;
+    }
+
+    return min_ticks;
+}
+
+int device_cacheline_test_init(void *gpu_start_addr, size_t size)
+{
+    (void)gpu_start_addr;
+    (void)size;
+
+    return 0;
+}
+
+int device_cacheline_test_find_threshold(size_t sample_size, double *avg)
+{
+    double total_sum_ticks = 0;
+
+    for (size_t i = 0; i < sample_size; i++) {
+        double min_ticks = LONG_MAX;
+
+        for (int j = 0; j < GPU_MAX_OUTER_LOOP; j++) {
+            double tick = add_noise(SIM_CACHE_LATENCY);
+            min_ticks = tick < min_ticks ? tick : min_ticks;
+        }
+
+        total_sum_ticks += min_ticks;
+    }
+
+    *avg = total_sum_ticks / sample_size;
+    return 0;
+}
+
+/*
+ * Lines from '_b' (at 'offset') are read after '_a'. Returns the line whose
+ * read evicts '_a', i.e. the (number of ways)th line in same set as '_a'.
+ * Like on GPU, the line found is skipped next time. So if search continues
+ * from the line found, the other lines of the set are still read and next
+ * line of the set causes eviction.
+ */
+void *device_find_cache_eviction_addr(void *_a, void *_b, size_t offset, double threshold)
+{
+    static uintptr_t last_a, last_found;
+    static size_t last_offset;
+    uintptr_t a = virt_to_phy(_a);
+    uintptr_t b = virt_to_phy(_b);
+    uintptr_t end = g_sim.phy_start + g_sim.size;
+    uint64_t set = get_index(a, g_sim.cache_masks);
+    std::uniform_real_distribution<double> error(0, 1);
+    int count = 0;
+
+    (void)threshold;
+
+    g_sim.num_cache_searches++;
+
+    /* Continuing search */
+    if (last_found && a == last_a && offset == last_offset &&
+            (b == last_found || b == last_found + offset)) {
+        count = g_sim.l2_num_ways - 1;
+        b = last_found + offset;
+    }
+
+    last_a = a;
+    last_offset = offset;
+    last_found = 0;
+
+    for (; b < end; b += offset) {
+        if (b == a || get_index(b, g_sim.cache_masks) != set)
+            continue;
+
+        if (++count < g_sim.l2_num_ways)
+            continue;
+
+        last_found = b;
+
+        /* Noise: Eviction noticed a line too late */
+        if (error(g_sim.rng) < g_sim.cache_error_rate && b + offset < end)
+            b += offset;
+
+        return phy_to_virt(b);
+    }
+
+    return NULL;
+}
+
+/* Number of words read (following 'cb') before first word gets evicted */
+int device_find_cacheline_words_count(void *gpu_start_addr, double threshold,
+        void *(*cb)(void *addr, void *arg), void *arg, size_t *words)
+{
+    uintptr_t a = virt_to_phy(gpu_start_addr);
+    uint64_t set = get_index(a, g_sim.cache_masks);
+    uintptr_t last_line = a / GPU_L2_CACHE_LINE_SIZE;
+    void *addr = gpu_start_addr;
+    size_t count = 0;
+    int lines = 0;
+
+    (void)threshold;
+
+    while (lines < g_sim.l2_num_ways) {
+        uintptr_t phy;
+
+        addr = cb(addr, arg);
+        if (!addr)
+            return -1;
+
+        count++;
+        phy = virt_to_phy(addr);
+
+        if (phy / GPU_L2_CACHE_LINE_SIZE != last_line &&
+                get_index(phy, g_sim.cache_masks) == set)
+            lines++;
+
+        last_line = phy / GPU_L2_CACHE_LINE_SIZE;
+    }
+
+    *words = count;
+    return 0;
+}
+
+int device_run_interference_exp(void *gpu_start_addr, void *(*cb)(void *addr, void *arg),
+        void *primary_arg, void *secondary_arg, int max_blocks, int loop_count,
+        std::vector<double> &time)
+{
+    (void)gpu_start_addr;
+    (void)cb;
+    (void)primary_arg;
+    (void)secondary_arg;
+    (void)max_blocks;
+    (void)loop_count;
+    (void)time;
+
+    fprintf(stderr, "Interference experiments are not supported on simulated device\n");
+    return -1;
+}
+
+int device_get_name(char *name, size_t len)
+{
+    snprintf(name, len, "%s", SIM_DEVICE_NAME);
+    return 0;
+}
+
+int device_get_dram_hash_masks(std::vector<uint64_t> &masks)
+{
+    if (sim_config() < 0)
+        return -1;
+
+    masks = g_sim.dram_masks;
+    return 0;
+}
+
+int device_get_cache_hash_masks(std::vector<uint64_t> &masks)
+{
+    if (sim_config() < 0)
+        return -1;
+
+    masks = g_sim.cache_masks;
+    return 0;
+}
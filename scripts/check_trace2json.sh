@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Checks fgpu_trace2json against a sample trace dump (no GPU needed). The trace
+# has two launches, pblocks on SMs of the other color, a partially written
+# record and a ring that wrapped around. Output must match the expected JSON
+# and must be valid JSON.
+# Usage: ./check_trace2json.sh
+
+COMMON_SCRIPT=../scripts/common.sh
+
+if [ ! -f $COMMON_SCRIPT ]; then
+    echo "Run this script from \$PROJ_DIR/scripts folder"
+fi
+
+source $COMMON_SCRIPT
+
+TRACE2JSON=$BIN_PATH/fgpu_trace2json
+TRACE_FILE=$SCRIPTS_PATH/traces/sample.trace
+EXPECTED_FILE=$SCRIPTS_PATH/traces/sample.json
+
+check_file_exists $TRACE2JSON
+check_file_exists $TRACE_FILE
+check_file_exists $EXPECTED_FILE
+
+OUTPUT_FILE=`mktemp --suffix=.json`
+
+$TRACE2JSON $TRACE_FILE $OUTPUT_FILE
+if [ $? -ne 0 ]; then
+    do_error_exit "Couldn't convert $TRACE_FILE"
+fi
+
+diff -u $EXPECTED_FILE $OUTPUT_FILE
+if [ $? -ne 0 ]; then
+    do_error_exit "Output doesn't match $EXPECTED_FILE"
+fi
+
+# Chrome/Perfetto only load valid JSON
+if which python3 &> /dev/null; then
+    python3 -m json.tool $OUTPUT_FILE > /dev/null
+    if [ $? -ne 0 ]; then
+        do_error_exit "Output is not valid JSON"
+    fi
+fi
+
+rm -f $OUTPUT_FILE
+echo "Result = PASS"
@@ -0,0 +1,85 @@
+#!/bin/bash
+
+# Compares bandwidth of 128MB host to device (and back) copies of
+# membench_persistent with and without the driver's cached colored page masks
+# (uvm_colored_page_mask_cache module parameter of nvidia-uvm). Needs FGPU
+# installed with memory coloring. Uses the currently installed FGPU (doesn't
+# rebuild). Prints average bandwidth (GB/s) of each copy kind in both cases.
+# Usage: ./colored_copy_bench.sh [number of runs]
+# (Default number of runs: 5)
+
+COMMON_SCRIPT=../scripts/common.sh
+
+if [ ! -f $COMMON_SCRIPT ]; then
+    echo "Run this script from \$PROJ_DIR/scripts folder"
+fi
+
+source $COMMON_SCRIPT
+
+# Shouldn't be running as root
+check_if_not_sudo
+
+MEMBENCH=$BIN_PATH/membench_persistent
+MEMORY=1000000000                   # Amount of memory (About 1GB)
+CACHE_PARAM=/sys/module/nvidia_uvm/parameters/uvm_colored_page_mask_cache
+
+num_runs=5
+if [ $# -gt 0 ]; then
+    check_arg_between "$1" 1 100
+    num_runs=$1
+fi
+
+check_file_exists $MEMBENCH
+check_file_exists $CACHE_PARAM
+
+# Refresh state of machine
+echo "INFO:Cleaning up any previous FGPU related state"
+init_fgpu
+
+old_cache=`cat $CACHE_PARAM`
+
+# If can of error, cleanup
+function do_for_sigint() {
+    echo $old_cache | sudo tee $CACHE_PARAM > /dev/null
+    deinit_fgpu
+    exit 1
+}
+
+trap 'do_for_sigint' EXIT
+
+LOG_FILE=`mktemp`
+
+# Runs the copy tests with cache enabled/disabled (First argument is 1/0)
+# and appends "<cache> <copy kind> <bandwidth>" lines to log file
+run_copies() {
+    echo $1 | sudo tee $CACHE_PARAM > /dev/null
+
+    for ((run = 0; run < num_runs; run++))
+    do
+        log=`mktemp`
+
+        $MEMBENCH -c 0 -m $MEMORY -- -p copy > $log
+        if [ $? -ne 0 ]; then
+            do_error_exit "Couldn't run $MEMBENCH. See $log"
+        fi
+
+        grep -Po '^[A-Za-z]+: Bandwidth:[0-9.]+' $log | \
+            sed "s/^\([A-Za-z]*\): Bandwidth:/$1 \1 /" >> $LOG_FILE
+        rm $log
+    done
+}
+
+echo "Running copies without cached colored page masks"
+run_copies 0
+
+echo "Running copies with cached colored page masks"
+run_copies 1
+
+echo -e "Copy\tUncached (GB/s)\tCached (GB/s)"
+awk '{ sum[$2, $1] += $3; count[$2, $1]++; kinds[$2] = 1 }
+    END {
+        for (k in kinds)
+            printf("%s\t%f\t%f\n", k, sum[k, 0] / count[k, 0], sum[k, 1] / count[k, 1]);
+    }' $LOG_FILE | sort
+
+echo "Raw values are in $LOG_FILE"
@@ -37,6 +37,17 @@ declare -A default_aliases=(
 ["__none__"]="<NONE>"
 )
 
+# Different modes of FGPU
+FGPU_DISABLED=1                  # No compute/memory partitioning
+FGPU_COMPUTE_ONLY=2              # Compute partitioning only
+FGPU_COMPUTE_AND_MEMORY=3        # Compute and memory partitioning
+FGPU_VOLTA_COMPUTE_ONLY=4        # For only volta GPU, we have Volta MPS based compute partitoning
+FGPU_REVERSE_ENGINEERING=5       # Reverse engineering
+
+# Tracks the current FGPU mode
+FGPU_MODE=''
+FGPU_MODE_NAME=''
+
 # Get any input from user to continue
 pause_for_user_input() {
     read -p "Press enter to continue"
@@ -307,3 +318,68 @@ check_if_installed() {
     fi
     return 0
 }
+
+# Prints out current FGPU mode
+print_fgpu_mode() {
+    echo    "*****************************************"
+    echo    "Running in FGPU MODE: $FGPU_MODE_NAME"
+    echo    "*****************************************"
+    
+    return 0
+}
+
+# Configures FGPU in a specific mode
+# First argument is the FGPU mode number
+configure_fgpu() {
+    # If FGPU is already set to the desired mode, skip configuring
+    if [ "$FGPU_MODE" = "$1" ]; then
+        return 0
+    fi
+
+    case $1 in
+    1)
+        echo "*********************************"
+        echo "Configuring FGPU in disabled mode"
+        echo "*********************************"
+        FGPU_MODE=$FGPU_DISABLED
+        FGPU_MODE_NAME="FGPU DISABLED"
+        build_and_install_fgpu "FGPU_COMP_COLORING_ENABLE=OFF" "FGPU_MEM_COLORING_ENABLED=OFF" "FGPU_TEST_MEM_COLORING_ENABLED=OFF"
+        ;;
+
+    2)
+        echo "**************************************************"
+        echo "Configuring FGPU in compute partitioning only mode"
+        echo "**************************************************"
+        FGPU_MODE=$FGPU_COMPUTE_ONLY
+        FGPU_MODE_NAME="FGPU COMPUTE ONLY PARTITIONING MODE (CP)"
+        build_and_install_fgpu "FGPU_COMP_COLORING_ENABLE=ON" "FGPU_MEM_COLORING_ENABLED=OFF" "FGPU_TEST_MEM_COLORING_ENABLED=OFF"
+        ;;
+    3)
+        echo "********************************************************"
+        echo "Configuring FGPU in compute and memory partitioning mode"
+        echo "********************************************************"
+        FGPU_MODE=$FGPU_COMPUTE_AND_MEMORY 
+        FGPU_MODE_NAME="FGPU COMPUTE AND MEMORY PARTITIONING MODE (CMP)"
+        build_and_install_fgpu "FGPU_COMP_COLORING_ENABLE=ON" "FGPU_MEM_COLORING_ENABLED=ON" "FGPU_TEST_MEM_COLORING_ENABLED=OFF"
+        ;;
+    4)
+        echo "************************************************************************************************"
+        echo "Configuring FGPU in disabled mode (Volta MPS will do the compute partitioning, FGPU is bypassed)"
+        echo "************************************************************************************************"
+        FGPU_MODE=$FGPU_VOLTA_COMPUTE_ONLY
+        FGPU_MODE_NAME="FGPU VOLTA COMPUTE ONLY PARTITIONING MODE (MPS)"
+        build_and_install_fgpu "FGPU_COMP_COLORING_ENABLE=OFF" "FGPU_MEM_COLORING_ENABLED=OFF" "FGPU_TEST_MEM_COLORING_ENABLED=OFF"
+        ;;
+
+    5)
+        echo "********************************************"
+        echo "Configuring FGPU in reverse engineering mode"
+        echo "********************************************"
+        FGPU_MODE=$FGPU_REVERSE_ENGINEERING 
+        FGPU_MODE_NAME="FGPU REVERSE ENGINEERING MODE"
+        build_and_install_fgpu "FGPU_COMP_COLORING_ENABLE=ON" "FGPU_MEM_COLORING_ENABLED=ON" "FGPU_TEST_MEM_COLORING_ENABLED=ON"
+        ;;
+    esac
+
+    return 0
+}
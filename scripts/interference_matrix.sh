@@ -0,0 +1,315 @@
+#!/bin/bash
+
+# Runs every pair of workloads of the config file (application of interest on
+# first color, copies of interfering application on rest of the colors) in each
+# FGPU mode of the config file and prints slowdown matrices. Slowdown is the
+# runtime of a kernel with interference over the runtime without interference
+# (in the same mode).
+# Usage: ./interference_matrix.sh [config file]
+# (Default config file: interference_matrix.conf)
+
+COMMON_SCRIPT=../scripts/common.sh
+CONFIG_BENCHMARK_SCRIPT=../benchmarks/config_benchmark.sh
+
+if [ ! -f $COMMON_SCRIPT ]; then
+    echo "Run this script from \$PROJ_DIR/scripts folder"
+fi
+
+source $COMMON_SCRIPT
+
+# For list of default benchmarks/interferences of run_benchmark.sh
+source $CONFIG_BENCHMARK_SCRIPT
+
+# Shouldn't be running as root
+check_if_not_sudo
+
+CONFIG_FILE=${1:-$SCRIPTPATH/interference_matrix.conf}
+
+# Maximum number of colors (Same as FGPU_MAX_NUM_COLORS)
+FGPU_MAX_NUM_COLORS=8
+
+check_file_exists $CONFIG_FILE
+
+# Values read from the config file
+modes=()
+workload_aliases=()
+workload_apps=()
+num_colors=$NUM_COLORS
+num_iterations=$NUM_ITERATION
+uses_caffe=0
+
+# Parses the config file (Lines are "key = value" or "workload <alias> = <app>")
+parse_config() {
+    while IFS= read -r line || [ -n "$line" ]
+    do
+        line="${line%%#*}"
+        if [[ "$line" =~ ^[[:space:]]*$ ]]; then
+            continue
+        fi
+
+        if [[ "$line" =~ ^[[:space:]]*workload[[:space:]]+([A-Za-z0-9_]+)[[:space:]]*=[[:space:]]*(.*[^[:space:]])[[:space:]]*$ ]]; then
+            app="${BASH_REMATCH[2]}"
+            if [[ "$app" = *'$CAFFE_PATH'* ]]; then
+                uses_caffe=1
+            fi
+            app="${app//\$BIN_PATH/$BIN_PATH}"
+            app="${app//\$CAFFE_PATH/$CAFFE_PATH}"
+            workload_aliases+=("${BASH_REMATCH[1]}")
+            workload_apps+=("$app")
+        elif [[ "$line" =~ ^[[:space:]]*([a-z_]+)[[:space:]]*=[[:space:]]*([^[:space:]]+)[[:space:]]*$ ]]; then
+            value="${BASH_REMATCH[2]}"
+            case "${BASH_REMATCH[1]}" in
+            mode)
+                modes+=("$value")
+                ;;
+            colors)
+                check_arg_between "$value" 2 $FGPU_MAX_NUM_COLORS
+                num_colors=$value
+                ;;
+            iterations)
+                check_arg_is_number "$value" || do_error_exit "Invalid iterations in $CONFIG_FILE"
+                num_iterations=$value
+                ;;
+            *)
+                do_error_exit "Unknown key '${BASH_REMATCH[1]}' in $CONFIG_FILE"
+                ;;
+            esac
+        else
+            do_error_exit "Invalid line in $CONFIG_FILE: $line"
+        fi
+    done < $CONFIG_FILE
+
+    if [ ${#modes[@]} -eq 0 ] || [ ${#workload_apps[@]} -eq 0 ]; then
+        do_error_exit "Config file $CONFIG_FILE needs atleast one mode and one workload"
+    fi
+}
+
+parse_config
+
+# Converts mode name to FGPU mode number (Sets MODE_NUMBER)
+# First argument is the mode name
+get_mode_number() {
+    case $1 in
+    disabled)
+        MODE_NUMBER=$FGPU_DISABLED
+        ;;
+    compute)
+        MODE_NUMBER=$FGPU_COMPUTE_ONLY
+        ;;
+    compute_memory)
+        MODE_NUMBER=$FGPU_COMPUTE_AND_MEMORY
+        ;;
+    volta_mps)
+        if [ $IS_VOLTA -eq 0 ]; then
+            do_error_exit "Mode volta_mps is only supported on Volta GPU"
+        fi
+        MODE_NUMBER=$FGPU_VOLTA_COMPUTE_ONLY
+        ;;
+    *)
+        do_error_exit "Unknown mode '$1' in $CONFIG_FILE"
+        ;;
+    esac
+}
+
+# Checks if an element is in an array
+# First argument is the element, rest are the array
+is_in_list() {
+    elem="$1"
+    shift
+    for i in "$@"
+    do
+        if [ "$i" = "$elem" ]; then
+            return 0
+        fi
+    done
+    return 1
+}
+
+# Returns the command for a workload (Sets WORKLOAD_CMD)
+# First argument is the app from config file
+get_workload_cmd() {
+    # A plain name is a binary in build directory
+    if [[ "$1" =~ ^[A-Za-z0-9_.-]+$ ]]; then
+        WORKLOAD_CMD="$BIN_PATH/$1"
+    else
+        WORKLOAD_CMD="$1"
+    fi
+}
+
+# Refresh state of machine
+echo "INFO:Cleaning up any previous FGPU related state"
+deinit_fgpu
+
+check_is_volta_gpu
+IS_VOLTA=$?
+
+# Validate all modes before spending time on any of them
+for mode in "${modes[@]}"
+do
+    get_mode_number $mode
+done
+
+# If can of error, cleanup
+function do_for_sigint() {
+    deinit_fgpu
+    exit 1
+}
+
+trap 'do_for_sigint' EXIT
+
+# Runs a workload with an interfering workload via run_benchmark.sh
+# First argument is the app of interest, second is the interfering app (or
+# __none__ for no interference)
+# Sets PAIR_AVG, PAIR_MEDIAN, PAIR_P95 (in usec)
+run_pair() {
+    args=("-c=$num_colors" "-n=$num_iterations")
+
+    if is_in_list "$1" "${default_benchmarks[@]}"; then
+        args+=("-b=$1")
+    else
+        get_workload_cmd "$1"
+        args+=("-e=$WORKLOAD_CMD")
+    fi
+
+    if is_in_list "$2" "${default_interferences[@]}"; then
+        args+=("-i=$2")
+    else
+        get_workload_cmd "$2"
+        args+=("-E=$WORKLOAD_CMD")
+    fi
+
+    # Enable volta mps based compute partitioning
+    if [ "$FGPU_MODE" = "$FGPU_VOLTA_COMPUTE_ONLY" ]; then
+        args+=("-v")
+    fi
+
+    cur_dir=`pwd`
+    cd $BENCHMARK_PATH
+    log=`mktemp`
+
+    echo ""
+    ./$BENCHMARK_SCRIPT "${args[@]}" | tee $log
+    status=${PIPESTATUS[0]}
+    echo ""
+
+    cd $cur_dir
+
+    if [ $status -ne 0 ]; then
+        do_error_exit "Couldn't run benchmark. See $log"
+    fi
+
+    PAIR_AVG=`grep -oP '(?<=AVG_RUNTIME: )[0-9.]+' $log`
+    PAIR_MEDIAN=`grep -oP '(?<=MEDIAN_RUNTIME: )[0-9.]+' $log`
+    PAIR_P95=`grep -oP '(?<=P95_RUNTIME: )[0-9.]+' $log`
+    if [ -z "$PAIR_AVG" ] || [ -z "$PAIR_MEDIAN" ] || [ -z "$PAIR_P95" ]; then
+        do_error_exit "Couldn't find the runtime of benchmark. See $log"
+    fi
+}
+
+# Ratio of two runtimes (with 2 decimal places)
+# First argument is runtime with interference, second without
+get_slowdown() {
+    if [ "$(echo "$2 > 0" | bc -l)" -ne 1 ]; then
+        echo "NA"
+        return
+    fi
+    printf "%.2f" `echo "$1 / $2" | bc -l`
+}
+
+# Prints percentile of list of values (NA values are skipped)
+# First argument is the percentile, rest are the values
+get_percentile() {
+    p=$1
+    shift
+    printf "%s\n" "$@" | grep -v NA | sort -g | \
+        awk -v p=$p '{ v[NR] = $1 } END { if (NR == 0) print "NA"; else print v[int((NR - 1) * p / 100) + 1] }'
+}
+
+# Prints a slowdown matrix (rows are applications of interest, columns are
+# interfering applications)
+# First argument is the title, second is name of associative array of slowdowns
+print_matrix() {
+    declare -n slowdowns=$2
+
+    echo "$1"
+    printf "%-10s" "App\\Int"
+    for a in "${workload_aliases[@]}"
+    do
+        printf "%10s" "$a"
+    done
+    printf "\n"
+
+    for v in "${workload_aliases[@]}"
+    do
+        printf "%-10s" "$v"
+        for a in "${workload_aliases[@]}"
+        do
+            printf "%10s" "${slowdowns[$v,$a]}"
+        done
+        printf "\n"
+    done
+    echo ""
+}
+
+RESULT_DIR=`mktemp -d`
+SUMMARY_FILE=$RESULT_DIR/summary.txt
+
+for mode in "${modes[@]}"
+do
+    get_mode_number $mode
+    configure_fgpu $MODE_NUMBER
+    if [ $uses_caffe -eq 1 ]; then
+        compile_caffe
+    fi
+    print_fgpu_mode
+
+    declare -A alone_avg=() alone_median=() alone_p95=()
+    declare -A slowdown_avg=() slowdown_median=() slowdown_p95=()
+
+    # Baseline of each workload is without interference in the same mode
+    for ((i = 0; i < ${#workload_apps[@]}; i++))
+    do
+        v=${workload_aliases[$i]}
+        echo "Running $v without interference"
+        run_pair "${workload_apps[$i]}" "$NO_INTERFERENCE_DUMMY_APP"
+        alone_avg[$v]=$PAIR_AVG
+        alone_median[$v]=$PAIR_MEDIAN
+        alone_p95[$v]=$PAIR_P95
+    done
+
+    result_file=$RESULT_DIR/$mode.tsv
+    printf "App\tInterference\tAvg(us)\tMedian(us)\tP95(us)\tAvg Slowdown\tMedian Slowdown\tP95 Slowdown\n" > $result_file
+
+    for ((i = 0; i < ${#workload_apps[@]}; i++))
+    do
+        for ((j = 0; j < ${#workload_apps[@]}; j++))
+        do
+            v=${workload_aliases[$i]}
+            a=${workload_aliases[$j]}
+            echo "Running $v with interference $a"
+            run_pair "${workload_apps[$i]}" "${workload_apps[$j]}"
+            slowdown_avg[$v,$a]=`get_slowdown $PAIR_AVG ${alone_avg[$v]}`
+            slowdown_median[$v,$a]=`get_slowdown $PAIR_MEDIAN ${alone_median[$v]}`
+            slowdown_p95[$v,$a]=`get_slowdown $PAIR_P95 ${alone_p95[$v]}`
+            printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" $v $a $PAIR_AVG $PAIR_MEDIAN $PAIR_P95 \
+                ${slowdown_avg[$v,$a]} ${slowdown_median[$v,$a]} ${slowdown_p95[$v,$a]} >> $result_file
+        done
+    done
+
+    {
+        echo "*****************************************"
+        echo "$FGPU_MODE_NAME ($num_colors colors)"
+        echo "*****************************************"
+        print_matrix "Average runtime slowdown:" slowdown_avg
+        print_matrix "Median runtime slowdown:" slowdown_median
+        print_matrix "95 percentile runtime slowdown:" slowdown_p95
+        echo "Slowdown of average runtime across all pairs: Median:`get_percentile 50 ${slowdown_avg[@]}`," \
+            "95 percentile:`get_percentile 95 ${slowdown_avg[@]}`, Max:`get_percentile 100 ${slowdown_avg[@]}`"
+        echo "Slowdown of 95 percentile runtime across all pairs: Median:`get_percentile 50 ${slowdown_p95[@]}`," \
+            "95 percentile:`get_percentile 95 ${slowdown_p95[@]}`, Max:`get_percentile 100 ${slowdown_p95[@]}`"
+        echo ""
+    } | tee -a $SUMMARY_FILE
+done
+
+echo "Results are in $RESULT_DIR (Summary in $SUMMARY_FILE, raw values in <mode>.tsv)"
+cat $SUMMARY_FILE
@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# Runs the access pattern suite of membench_persistent on each color, first
+# alone and then with a co-runner (another membench_persistent streaming
+# read-modify-write through DRAM) on the next color. Uses the currently
+# installed FGPU (doesn't rebuild). ACCESS lines of all the runs are collected
+# in a CSV file with the color and co-runner as first columns.
+# Usage: ./membench_colors.sh [number of colors] [-- suite options]
+# (Default number of colors: 2)
+
+COMMON_SCRIPT=../scripts/common.sh
+
+if [ ! -f $COMMON_SCRIPT ]; then
+    echo "Run this script from \$PROJ_DIR/scripts folder"
+fi
+
+source $COMMON_SCRIPT
+
+# Shouldn't be running as root
+check_if_not_sudo
+
+# Maximum number of colors (Same as FGPU_MAX_NUM_COLORS)
+FGPU_MAX_NUM_COLORS=8
+
+MEMBENCH=$BIN_PATH/membench_persistent
+MEMORY=1000000000                   # Amount of memory for each instance (About 1GB)
+CORUNNER_ARGS="-p seq -a rmw -w 64M"
+
+num_colors=2
+if [ $# -gt 0 ] && [ "$1" != "--" ]; then
+    check_arg_between "$1" 2 $FGPU_MAX_NUM_COLORS
+    num_colors=$1
+    shift
+fi
+
+if [ "$1" = "--" ]; then
+    shift
+fi
+suite_args=("$@")
+
+check_file_exists $MEMBENCH
+
+# Refresh state of machine
+echo "INFO:Cleaning up any previous FGPU related state"
+init_fgpu
+
+corunner_pid=''
+
+# If can of error, cleanup
+function do_for_sigint() {
+    if [ ! -z "$corunner_pid" ]; then
+        kill $corunner_pid &> /dev/null
+    fi
+    deinit_fgpu
+    exit 1
+}
+
+trap 'do_for_sigint' EXIT
+
+RESULT_FILE=`mktemp --suffix=.csv`
+echo "color,corunner,pattern,op,stride,working_set,bytes,avg_usec,median_usec,95p_usec,bandwidth_gbps,ns_per_access" > $RESULT_FILE
+
+# Runs the suite on a color and appends the results to result file
+# First argument is the color, second is the co-runner color (or "none")
+run_suite() {
+    log=`mktemp`
+
+    $MEMBENCH -c $1 -m $MEMORY -- "${suite_args[@]}" | tee $log
+    if [ ${PIPESTATUS[0]} -ne 0 ]; then
+        do_error_exit "Couldn't run $MEMBENCH. See $log"
+    fi
+
+    grep "^ACCESS," $log | grep -v "^ACCESS,pattern" | sed "s/^ACCESS,/$1,$2,/" >> $RESULT_FILE
+}
+
+for ((color = 0; color < num_colors; color++))
+do
+    echo "Running on color $color without co-runner"
+    run_suite $color none
+
+    corunner=$(((color + 1) % num_colors))
+    echo "Running on color $color with co-runner on color $corunner"
+    $MEMBENCH -c $corunner -m $MEMORY -k -- $CORUNNER_ARGS &> /dev/null &
+    corunner_pid=$!
+
+    # Let the co-runner start its kernels
+    sleep 5
+    run_suite $color $corunner
+
+    kill $corunner_pid &> /dev/null
+    wait $corunner_pid &> /dev/null
+    corunner_pid=''
+done
+
+echo "Results are in $RESULT_FILE"